@@ -0,0 +1,17 @@
+TEMPLATE = lib
+TARGET = mpegaudioparse
+VERSION = 1.0.0
+CONFIG += shared c++17 hide_symbols
+CONFIG -= qt
+
+QMAKE_CXXFLAGS += -std=c++17
+DEFINES += MY_MPEG_C_BUILD MY_MPEG_NO_ABORT
+
+SOURCES += \
+    my_mpeg_c.cpp
+
+HEADERS += \
+    include/my_mpeg_c.h \
+    include/my_mpeg.hpp
+
+LIBS += -lpthread
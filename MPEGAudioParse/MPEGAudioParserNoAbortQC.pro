@@ -0,0 +1,5 @@
+# The test driver again, built as batch users build the library: with
+# MY_MPEG_NO_ABORT, bad input must come back as errors (test_bad_input).
+include(MPEGAudioParserQC.pro)
+TARGET = MPEGAudioParserNoAbortQC
+DEFINES += MY_MPEG_NO_ABORT
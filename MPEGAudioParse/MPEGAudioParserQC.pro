@@ -1,12 +1,13 @@
 TEMPLATE = app
-CONFIG += console c++17
+CONFIG += console c++2a
 CONFIG -= app_bundle
 CONFIG -= qt
 
 
-QMAKE_CXXFLAGS += -std=c++17
+QMAKE_CXXFLAGS += -std=c++2a
 SOURCES += \
-    mpeg_audio_test.cpp
+    mpeg_audio_test.cpp \
+    my_mpeg_c.cpp
 
 HEADERS += \
     include/fast_string.h \
@@ -15,6 +16,23 @@ HEADERS += \
     include/my_macros.hpp \
     include/my_mpeg.hpp \
     include/my_sbo_buffer.hpp \
-    include/my_string_view.hpp
+    include/my_string_view.hpp \
+    include/my_scan_cache.hpp \
+    include/my_library_watcher.hpp \
+    include/my_hash.hpp \
+    include/my_dedupe.hpp \
+    include/my_layer3_tables.hpp \
+    include/my_layer3.hpp \
+    include/my_mpeg_c.h \
+    include/my_frame_columns.hpp \
+    include/my_dir_walker.hpp \
+    include/my_icy.hpp \
+    include/my_sparse.hpp \
+    include/my_mpeg_async.hpp \
+    include/my_memory_budget.hpp \
+    include/my_follow.hpp \
+    include/my_frame_index.hpp \
+    include/my_level.hpp \
+    include/my_id3v2.hpp
 
-LIBS += -lstdc++fs
+LIBS += -lstdc++fs -lpthread
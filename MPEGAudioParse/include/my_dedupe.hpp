@@ -0,0 +1,147 @@
+#pragma once
+// my_dedupe.hpp
+// Finds files holding the same audio under different tags, by the audio-only
+// fingerprint the parser computes (parser::fingerprint(),
+// parse_summary::audio_hash).
+//
+// Every file costs one small record. With a bloom filter (expected_files >
+// 0), only fingerprints the filter has (maybe) seen before are put in a hash
+// set: in a library that is mostly unique, that set stays tiny, and the
+// grouping at the end only looks at those suspects.
+#include "my_mpeg.hpp"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <vector>
+
+namespace my {
+namespace mpeg {
+
+    class bloom_filter {
+        std::vector<uint64_t> m_bits;
+        uint64_t m_nbits = 0;
+        int m_nhashes = 0;
+
+        public:
+        // ~10 bits and 7 probes per item: about 1% false positives
+        explicit bloom_filter(size_t expected_items, int bits_per_item = 10)
+            : m_nhashes(7) {
+            m_nbits = (CAST(uint64_t, expected_items) * CAST(uint64_t, bits_per_item)) | 64;
+            m_bits.resize(CAST(size_t, (m_nbits + 63) / 64));
+        }
+
+        // Adds key (already a good 64 bit hash). Returns true if it may have
+        // been there already, false if it definitely was not.
+        bool test_and_set(uint64_t key) noexcept {
+            // double hashing: probe i is h1 + i * h2
+            const uint64_t h1 = key;
+            const uint64_t h2 = (key >> 32 | key << 32) | 1;
+            bool seen = true;
+            for (int i = 0; i < m_nhashes; ++i) {
+                const uint64_t bit = (h1 + CAST(uint64_t, i) * h2) % m_nbits;
+                uint64_t& word = m_bits[CAST(size_t, bit / 64)];
+                const uint64_t mask = 1ULL << (bit % 64);
+                if ((word & mask) == 0) {
+                    seen = false;
+                    word |= mask;
+                }
+            }
+            return seen;
+        }
+    };
+
+    class duplicate_index {
+        public:
+        // expected_files: size the bloom prefilter for this many files. 0
+        // means no prefilter: every fingerprint goes into the hash set.
+        explicit duplicate_index(size_t expected_files = 0) {
+            if (expected_files > 0) {
+                m_bloom.reset(new bloom_filter(expected_files));
+            }
+        }
+
+        // Records path's fingerprint. Returns true if it (probably) has been
+        // seen before: duplicates are only certain after groups().
+        // Files with no fingerprint (not parsed, or no audio) are ignored.
+        bool add(const std::string& path, const parse_summary& s) {
+            if (s.audio_hash == 0 || s.nframes == 0) {
+                return false;
+            }
+            const key k{s.audio_hash, s.nframes};
+            m_files.push_back(file{k, path});
+            const uint64_t mixed = k.hash ^ (CAST(uint64_t, k.nframes) * 0x9E3779B97F4A7C15ULL);
+            bool seen = false;
+            if (m_bloom) {
+                seen = m_bloom->test_and_set(mixed);
+            } else {
+                seen = !m_seen.insert(mixed).second;
+            }
+            if (seen) {
+                m_suspects.insert(mixed);
+            }
+            return seen;
+        }
+
+        // Calls cb(const std::vector<std::string>& paths) once for each set
+        // of 2 or more files with the same audio. Returns the number of sets.
+        template <typename CB> size_t groups(CB&& cb) const {
+            std::unordered_map<uint64_t, std::vector<const file*>> by_key;
+            for (const auto& f : m_files) {
+                const uint64_t mixed
+                    = f.k.hash ^ (CAST(uint64_t, f.k.nframes) * 0x9E3779B97F4A7C15ULL);
+                if (m_suspects.count(mixed) != 0) {
+                    by_key[mixed].push_back(&f);
+                }
+            }
+            size_t ngroups = 0;
+            std::vector<std::string> paths;
+            for (const auto& kv : by_key) {
+                // a bloom false positive (or a 64 bit collision) still has
+                // to agree on the exact key
+                const auto& v = kv.second;
+                std::vector<bool> done(v.size(), false);
+                for (size_t i = 0; i < v.size(); ++i) {
+                    if (done[i]) {
+                        continue;
+                    }
+                    paths.clear();
+                    paths.push_back(v[i]->path);
+                    for (size_t j = i + 1; j < v.size(); ++j) {
+                        if (!done[j] && v[j]->k == v[i]->k) {
+                            done[j] = true;
+                            paths.push_back(v[j]->path);
+                        }
+                    }
+                    if (paths.size() > 1) {
+                        ++ngroups;
+                        cb(static_cast<const std::vector<std::string>&>(paths));
+                    }
+                }
+            }
+            return ngroups;
+        }
+
+        size_t size() const noexcept { return m_files.size(); }
+        size_t suspects() const noexcept { return m_suspects.size(); }
+
+        private:
+        struct key {
+            uint64_t hash = 0;
+            int64_t nframes = 0;
+            bool operator==(const key& rhs) const noexcept {
+                return hash == rhs.hash && nframes == rhs.nframes;
+            }
+        };
+        struct file {
+            key k;
+            std::string path;
+        };
+        std::vector<file> m_files;
+        std::unordered_set<uint64_t> m_seen; // when there's no bloom filter
+        std::unordered_set<uint64_t> m_suspects;
+        std::unique_ptr<bloom_filter> m_bloom;
+    };
+
+} // namespace mpeg
+} // namespace my
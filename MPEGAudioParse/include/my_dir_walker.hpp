@@ -0,0 +1,323 @@
+#pragma once
+// my_dir_walker.hpp
+// A parallel directory walker, for trees too big (or too far away: a NAS) to
+// walk with files_finder. Directories go on a work stack that nthreads
+// threads take from: depth first, so that what waits is the siblings along
+// one path down the tree, not a whole level of it. Each reads its directory
+// with getdents64 and takes d_type from the entries, so a file costs no stat.
+// The extension is checked on the entry's name where it lies, so only the
+// files that match cost an allocation: their path. Paths come out in batches:
+// full ones as they fill, and a thread's part filled one whenever it finds
+// nothing more queued, so no path waits on a slow directory elsewhere.
+//
+// Symlinks to files are followed (one stat each), whether d_type says DT_LNK
+// or the filesystem leaves it DT_UNKNOWN and lstat says so. Symlinks to
+// directories are not, as with recursive_directory_iterator.
+//
+// Given a memory_budget, the directories waiting are charged to it, and the
+// walk pauses (between directories) while the rest of the scan has spent it.
+//
+// Linux only: everywhere else, use files_finder.
+#ifdef __linux__
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "my_macros.hpp"
+#include "my_memory_budget.hpp"
+
+namespace my {
+class dir_walker {
+
+    // what getdents64 fills its buffer with
+    struct linux_dirent64 {
+        ino64_t d_ino;
+        off64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+    static constexpr size_t DIRENT_BUFFER = 64 * 1024;
+
+    std::string m_root;
+    std::string m_extn; // lower case
+    int m_nthreads = 1;
+    size_t m_batch_size = 256;
+
+    std::mutex m_mx;
+    std::condition_variable m_cv;
+    std::deque<std::string> m_dirs; // still to read: the back is next
+    int m_busy = 0; // threads reading a directory (and maybe adding more)
+    std::atomic<bool> m_stop{false};
+    std::mutex m_out_mx; // one batch out at a time
+    std::atomic<int64_t> m_nfiles{0};
+    std::atomic<int64_t> m_ndirs{0};
+    std::atomic<int64_t> m_nerrors{0};
+    memory_budget* m_budget = nullptr;
+    std::atomic<int64_t> m_dir_bytes{0}; // what m_dirs has charged to m_budget
+
+    // name ends in m_extn, whatever its case
+    bool wanted(const char* name, size_t len) const noexcept {
+        const size_t n = m_extn.size();
+        if (len < n) {
+            return false;
+        }
+        const char* p = name + len - n;
+        for (size_t i = 0; i < n; ++i) {
+            char c = p[i];
+            if (c >= 'A' && c <= 'Z') {
+                c = CAST(char, c - 'A' + 'a');
+            }
+            if (c != m_extn[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void charge(const std::string& dir, int sign) {
+        if (m_budget != nullptr) {
+            const int64_t n = memory_budget::cost(dir);
+            m_dir_bytes += sign * n;
+            if (sign > 0) {
+                m_budget->charge(n);
+            } else {
+                m_budget->refund(n);
+            }
+        }
+    }
+
+    bool next_dir(std::string& dir) {
+        if (m_budget != nullptr) {
+            // what this walk holds itself doesn't count: it is only given
+            // back by walking on
+            m_budget->wait_for_room(m_dir_bytes, m_stop);
+        }
+        std::unique_lock<std::mutex> lock(m_mx);
+        m_cv.wait(lock, [this] { return m_stop || !m_dirs.empty() || m_busy == 0; });
+        if (m_stop || m_dirs.empty()) {
+            return false; // stopped, or nothing queued and nobody to queue more
+        }
+        dir = std::move(m_dirs.back());
+        m_dirs.pop_back();
+        ++m_busy;
+        return true;
+    }
+
+    // Returns true if that left nothing queued.
+    bool dir_done(const std::string& dir, std::vector<std::string>& subdirs) {
+        for (const auto& d : subdirs) {
+            charge(d, 1);
+        }
+        charge(dir, -1);
+        bool dry = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mx);
+            for (auto& d : subdirs) {
+                m_dirs.push_back(std::move(d));
+            }
+            --m_busy;
+            dry = m_dirs.empty();
+        }
+        subdirs.clear();
+        m_cv.notify_all();
+        return dry;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mx);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        if (m_budget != nullptr) {
+            m_budget->wake();
+        }
+    }
+
+    template <typename CB> void flush(std::vector<std::string>& batch, CB& cb) {
+        if (batch.empty()) {
+            return;
+        }
+        int stop_now = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_out_mx);
+            if (!m_stop) {
+                m_nfiles += CAST(int64_t, batch.size());
+                stop_now = cb(batch);
+            }
+        }
+        batch.clear();
+        if (stop_now) {
+            stop();
+        }
+    }
+
+    // Reads one directory: files into batch, directories into subdirs.
+    template <typename CB>
+    void read_dir(const std::string& dir, std::vector<char>& buf,
+        std::vector<std::string>& batch, std::vector<std::string>& subdirs, CB& cb) {
+        const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            ++m_nerrors;
+            return;
+        }
+        ++m_ndirs;
+        const bool slash = !dir.empty() && dir.back() == '/';
+        while (!m_stop) {
+            const long got = ::syscall(SYS_getdents64, fd, buf.data(), buf.size());
+            if (got <= 0) {
+                if (got < 0) {
+                    ++m_nerrors;
+                }
+                break;
+            }
+            for (long off = 0; off < got;) {
+                const auto* d = reinterpret_cast<const linux_dirent64*>(buf.data() + off);
+                off += d->d_reclen;
+                const char* name = d->d_name;
+                if (name[0] == '.'
+                    && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                    continue;
+                }
+                unsigned char type = d->d_type;
+                const size_t len = strlen(name);
+                if (type == DT_REG && !wanted(name, len)) {
+                    continue; // the common case: no stat, no string
+                }
+                if (type == DT_UNKNOWN || type == DT_LNK) {
+                    // some filesystems don't fill d_type in: lstat says what
+                    // it is. Links are followed, however we found them.
+                    struct stat st;
+                    bool link = type == DT_LNK;
+                    if (!link) {
+                        if (::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                            continue; // gone already
+                        }
+                        link = S_ISLNK(st.st_mode);
+                    }
+                    if (link && ::fstatat(fd, name, &st, 0) != 0) {
+                        continue; // a dangling link, or gone already
+                    }
+                    if (S_ISREG(st.st_mode)) {
+                        type = DT_REG;
+                    } else if (S_ISDIR(st.st_mode) && !link) {
+                        type = DT_DIR;
+                    } else {
+                        continue;
+                    }
+                    if (type == DT_REG && !wanted(name, len)) {
+                        continue;
+                    }
+                }
+                if (type == DT_REG) {
+                    batch.emplace_back(dir);
+                    if (!slash) {
+                        batch.back() += '/';
+                    }
+                    batch.back().append(name, len);
+                    if (batch.size() >= m_batch_size) {
+                        flush(batch, cb);
+                    }
+                } else if (type == DT_DIR) {
+                    subdirs.emplace_back(dir);
+                    if (!slash) {
+                        subdirs.back() += '/';
+                    }
+                    subdirs.back().append(name, len);
+                }
+            }
+        }
+        ::close(fd);
+    }
+
+    public:
+    using batch_type = std::vector<std::string>;
+
+    // extn ("" for every file) is matched without regard to case. nthreads 0
+    // is one per core.
+    dir_walker(std::string root, std::string extn, int nthreads = 0,
+        size_t batch_size = 256)
+        : m_root(std::move(root)), m_extn(std::move(extn)), m_batch_size(batch_size) {
+        for (auto& c : m_extn) {
+            if (c >= 'A' && c <= 'Z') {
+                c = CAST(char, c - 'A' + 'a');
+            }
+        }
+        if (nthreads <= 0) {
+            nthreads = CAST(int, std::thread::hardware_concurrency());
+        }
+        m_nthreads = nthreads > 0 ? nthreads : 1;
+        if (m_batch_size == 0) {
+            m_batch_size = 1;
+        }
+    }
+    dir_walker(const dir_walker&) = delete;
+    dir_walker& operator=(const dir_walker&) = delete;
+
+    // Charge the directories waiting to b, and pause while it is spent. b
+    // must outlast start().
+    void budget(memory_budget* b) noexcept { m_budget = b; }
+
+    // Walks the tree, calling cb(const batch_type&) with each batch of file
+    // paths, in no particular order. cb is never called from two threads at
+    // once; it returns nonzero to stop the walk. Returns how many files went
+    // to cb.
+    template <typename CB> int64_t start(CB&& cb) {
+        m_dirs.assign(1, m_root);
+        m_dir_bytes = 0;
+        charge(m_dirs.back(), 1);
+        m_busy = 0;
+        m_stop = false;
+        m_nfiles = 0;
+        m_ndirs = 0;
+        m_nerrors = 0;
+
+        auto work = [&]() {
+            std::vector<char> buf(DIRENT_BUFFER);
+            std::vector<std::string> batch;
+            std::vector<std::string> subdirs;
+            batch.reserve(m_batch_size);
+            std::string dir;
+            while (next_dir(dir)) {
+                read_dir(dir, buf, batch, subdirs, cb);
+                if (dir_done(dir, subdirs)) {
+                    // we may wait a while for more: what we have goes now
+                    flush(batch, cb);
+                }
+            }
+            flush(batch, cb);
+        };
+        std::vector<std::thread> threads;
+        for (int i = 1; i < m_nthreads; ++i) {
+            threads.emplace_back(work);
+        }
+        work();
+        for (auto& t : threads) {
+            t.join();
+        }
+        for (const auto& d : m_dirs) {
+            charge(d, -1); // left when it was stopped
+        }
+        m_dirs.clear();
+        return m_nfiles;
+    }
+
+    const std::string& path() const noexcept { return m_root; }
+    int64_t count() const noexcept { return m_nfiles; }
+    int64_t dirs() const noexcept { return m_ndirs; }
+    // directories that could not be read (permissions, or gone mid walk)
+    int64_t errors() const noexcept { return m_nerrors; }
+};
+} // namespace my
+#endif // __linux__
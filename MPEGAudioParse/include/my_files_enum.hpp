@@ -28,7 +28,9 @@ class files_finder {
 
                 auto& path = p.path();
                 m_u8path = path.generic_string();
-                m_u8extn = path.extension().u8string();
+                // a std::u8string from C++20 on
+                const auto extn = path.extension().u8string();
+                m_u8extn.assign(extn.begin(), extn.end());
                 stop_now = cb(p, m_u8path, m_u8extn);
                 ++n;
                 if (stop_now) {
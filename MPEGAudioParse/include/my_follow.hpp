@@ -0,0 +1,267 @@
+#pragma once
+// my_follow.hpp
+// Following a file that is still being written (a logger's current hour):
+// file_follower reads only what was added since it last looked, and keeps a
+// running parse_summary and frame index up to date as it goes. Between reads
+// it holds what a stream_framer holds: where the last whole frame ended, and
+// whatever of the next frame has come in. Nothing is read twice; the tags at
+// the end, if the writer adds any, are seen on the way past.
+//
+// It waits for the file to grow with inotify (IN_MODIFY) on Linux, and by
+// looking at its size once a timeout elsewhere. POSIX only.
+#ifndef _WIN32
+#include "my_icy.hpp"
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace my {
+namespace mpeg {
+
+    class file_follower {
+        static constexpr int TAIL_KEEP = 128 + detail::APE_FOOTER_SIZE; // ID3v1, APE
+
+        std::string m_path;
+        int m_fd = -1;
+        int m_ifd = -1; // inotify, or -1 to poll the size
+        int m_read_block;
+        bool m_index_frames = true;
+        bool m_started = false; // the ID3v2 header (or its absence) has been seen
+        bool m_writer_closed = false;
+        int64_t m_pos = 0; // read up to here
+        int64_t m_reads = 0;
+        stream_framer m_framer;
+        frame_tally m_tally{0};
+        parse_summary m_summary;
+        std::vector<frame_entry> m_index;
+        std::vector<char> m_block;
+        std::vector<char> m_tail; // the last TAIL_KEEP bytes read
+
+        void count(const frame& f) {
+            const bool info = m_summary.nframes == 0 && detail::is_info_frame(f);
+            m_tally.add(f, m_summary);
+            if (m_index_frames && !info) {
+                m_index.push_back(detail::make_entry(f));
+            }
+        }
+
+        void keep_tail(const char* p, size_t n) {
+            if (n >= TAIL_KEEP) {
+                m_tail.assign(p + n - TAIL_KEEP, p + n);
+                return;
+            }
+            m_tail.insert(m_tail.end(), p, p + n);
+            if (m_tail.size() > TAIL_KEEP) {
+                m_tail.erase(m_tail.begin(), m_tail.end() - CAST(ptrdiff_t, TAIL_KEEP));
+            }
+        }
+
+        void drain_events() {
+#ifdef __linux__
+            alignas(inotify_event) char buf[4096];
+            for (;;) {
+                const ssize_t n = ::read(m_ifd, buf, sizeof(buf));
+                if (n <= 0) {
+                    return;
+                }
+                for (const char* p = buf; p < buf + n;) {
+                    const auto* ev = reinterpret_cast<const inotify_event*>(p);
+                    if ((ev->mask & IN_CLOSE_WRITE) != 0) {
+                        m_writer_closed = true;
+                    }
+                    p += sizeof(inotify_event) + ev->len;
+                }
+            }
+#endif
+        }
+
+        // Reads whatever the file has past m_pos, and feeds it on. Returns
+        // 0, or -errno: -ESTALE if the file got shorter (truncated, rotated).
+        int read_new() {
+            struct stat st;
+            if (::fstat(m_fd, &st) != 0) {
+                return -errno;
+            }
+            const int64_t size = CAST(int64_t, st.st_size);
+            if (size < m_pos) {
+                return -ESTALE;
+            }
+            m_summary.file_size = size;
+            if (!m_started && size < detail::ID3V2_HEADER_SIZE) {
+                return 0; // can't tell where the audio starts yet
+            }
+            while (m_pos < size) {
+                const int n
+                    = CAST(int, (std::min)(CAST(int64_t, m_block.size()), size - m_pos));
+                const ssize_t got = ::pread(m_fd, m_block.data(), CAST(size_t, n), m_pos);
+                if (got < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return -errno;
+                }
+                if (got == 0) {
+                    break;
+                }
+                ++m_reads;
+                const char* p = m_block.data();
+                if (!m_started) {
+                    // the first read: the ID3v2 tag is skipped, not parsed
+                    if (got >= detail::ID3V2_HEADER_SIZE && memcmp(p, "ID3", 3) == 0) {
+                        detail::id3v2Header h;
+                        memcpy(static_cast<void*>(&h), p, detail::ID3V2_HEADER_SIZE);
+                        m_summary.id3v2_size = detail::id3v2_tag_size(h);
+                    }
+                    m_framer.reset(m_summary.id3v2_size);
+                    m_tally = frame_tally(m_summary.id3v2_size);
+                    m_started = true;
+                }
+                const int64_t from
+                    = (std::max)(m_pos, CAST(int64_t, m_summary.id3v2_size));
+                const int64_t to = m_pos + got;
+                if (to > from) {
+                    m_framer.feed(
+                        byte_span(p + (from - m_pos), CAST(size_t, to - from)),
+                        [this](const frame& f) { count(f); });
+                }
+                keep_tail(p, CAST(size_t, got));
+                m_pos = to;
+            }
+            return 0;
+        }
+
+        template <typename CB>
+        int64_t publish(int64_t before, size_t first_new, CB& on_update) {
+            const int64_t added = m_summary.nframes - before;
+            if (added > 0) {
+                on_update(CAST(const file_follower&, *this), first_new);
+            }
+            return added;
+        }
+
+        public:
+        explicit file_follower(
+            std::string path, int read_block = detail::DEFAULT_READ_BLOCK)
+            : m_path(std::move(path)), m_read_block(read_block) {}
+        file_follower(const file_follower&) = delete;
+        file_follower& operator=(const file_follower&) = delete;
+        ~file_follower() { close(); }
+
+        // Off to keep no index (24 bytes a frame); on by default.
+        void index_frames(bool on) noexcept { m_index_frames = on; }
+
+        // Opens the file, which must be there (it may still be empty).
+        // Returns 0, or an errno.
+        int open() {
+            close();
+            m_fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (m_fd < 0) {
+                return errno;
+            }
+#ifdef __linux__
+            m_ifd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            const uint32_t events = IN_MODIFY | IN_CLOSE_WRITE;
+            if (m_ifd >= 0 && ::inotify_add_watch(m_ifd, m_path.c_str(), events) < 0) {
+                ::close(m_ifd);
+                m_ifd = -1; // poll the size instead
+            }
+#endif
+            m_block.resize(CAST(size_t, (std::max)(m_read_block, 4096)));
+            m_started = m_writer_closed = false;
+            m_pos = m_reads = 0;
+            m_framer.reset();
+            m_tally = frame_tally(0);
+            m_summary = parse_summary();
+            m_summary.file_size = 0;
+            m_index.clear();
+            m_tail.clear();
+            return 0;
+        }
+
+        void close() noexcept {
+            if (m_ifd >= 0) {
+                ::close(m_ifd);
+                m_ifd = -1;
+            }
+            if (m_fd >= 0) {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+        }
+
+        // Reads what was added since the last call; if there was nothing,
+        // waits up to timeout_ms for more, and reads that. If that found new
+        // frames, calls on_update(const file_follower&, size_t first_new):
+        // index()[first_new, index().size()) are the new ones. Returns how
+        // many frames were found, or -errno (-ESTALE: the file got shorter).
+        template <typename CB> int64_t poll(int timeout_ms, CB&& on_update) {
+            const int64_t before = m_summary.nframes;
+            const size_t first_new = m_index.size();
+            const int64_t was = m_pos;
+            int e = read_new();
+            if (e == 0 && m_pos == was && timeout_ms != 0) {
+                if (m_ifd >= 0) {
+                    pollfd pfd{m_ifd, POLLIN, 0};
+                    if (::poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+                        return -errno;
+                    }
+                    drain_events();
+                } else {
+                    ::poll(nullptr, 0, timeout_ms);
+                }
+                e = read_new();
+            }
+            if (e != 0) {
+                return e;
+            }
+            return publish(before, first_new, on_update);
+        }
+
+        // The writer is done. Reads what is left, counts a last frame that
+        // was cut short (as the file walk does), and takes an ID3v1 tag or an
+        // APE tag at the end for what it is. The summary is then what
+        // parse_file() would say, junk and all, since the framer confirms a
+        // sync as the walk does; the one exception is a run of frames at the
+        // end that runs into an APE tag with no header. Returns as poll() does.
+        template <typename CB> int64_t finish(CB&& on_update) {
+            const int64_t before = m_summary.nframes;
+            const size_t first_new = m_index.size();
+            const int e = read_new();
+            if (e != 0) {
+                return e;
+            }
+            m_framer.finish([this](const frame& f) { count(f); });
+            const int tn = CAST(int, m_tail.size());
+            int64_t audio_end = m_pos;
+            m_summary.id3v1 = tn >= 128 && memcmp(m_tail.data() + tn - 128, "TAG", 3) == 0;
+            audio_end -= m_summary.id3v1 ? 128 : 0;
+            const int foot = tn - (m_summary.id3v1 ? 128 : 0) - detail::APE_FOOTER_SIZE;
+            if (foot >= 0) {
+                m_summary.ape_size = detail::ape_tag_size(m_tail.data() + foot, audio_end);
+                audio_end -= m_summary.ape_size;
+            }
+            m_tally.end(audio_end, m_summary);
+            return publish(before, first_new, on_update);
+        }
+
+        const std::string& path() const noexcept { return m_path; }
+        const parse_summary& summary() const noexcept { return m_summary; }
+        const std::vector<frame_entry>& index() const noexcept { return m_index; }
+        // bytes read so far: each once, so never more than the file's size
+        int64_t bytes_read() const noexcept { return m_pos; }
+        int64_t reads() const noexcept { return m_reads; }
+        // the writer closed the file since open() (inotify only)
+        bool writer_closed() const noexcept { return m_writer_closed; }
+    };
+
+} // namespace mpeg
+} // namespace my
+#endif // _WIN32
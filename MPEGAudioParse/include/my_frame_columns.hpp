@@ -0,0 +1,326 @@
+#pragma once
+// my_frame_columns.hpp
+// Per frame data (where, how big, bitrate, padding, channel mode, CRC) for
+// whole corpora, written column-wise straight off the parser's frame stream
+// (parser::on_frame()), and read back in place: no parsing, no copying.
+//
+// The file: a frame_columns_file_header, then blocks. A block is all or part
+// of one source file's frames (at most COLUMN_BLOCK_FRAMES of them):
+//      frame_columns_block_header
+//      path                    path_len bytes, zero padded to 8
+//      gap[n]      uint32      offset - end of the frame before (the first
+//                              counts from base_offset): almost always 0
+//      size[n]     uint16      frame length, header included
+//      bitrate[n]  uint8       index into the block's bitrate_kbps[]
+//      flags[n]    uint8       bits 0-1 channel mode, 2 padding,
+//                              3-4 column_crc (none, ok, bad, unchecked)
+//      zero padding to 8
+// so a frame costs 8 bytes. Every column starts 8 byte aligned: mmap the
+// file and frame_columns_reader hands out pointers into it. Offsets come back
+// by summing gap + size as you go (block_view::offsets()). All of it is little
+// endian, as the parser is.
+#include "my_mpeg.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace my {
+namespace mpeg {
+
+    enum class column_crc : uint8_t { none, ok, bad, unchecked };
+
+    namespace detail {
+        static constexpr char FRAME_COLUMNS_MAGIC[8]
+            = {'M', 'P', 'F', 'R', 'C', 'O', 'L', 'S'};
+        static constexpr uint32_t FRAME_COLUMNS_VERSION = 1;
+        static constexpr uint32_t FRAME_COLUMNS_BLOCK_MAGIC = 0x4B4C4246; // "FBLK"
+        static constexpr uint32_t COLUMN_BLOCK_FRAMES = 65536;
+        static constexpr int COLUMN_DICT_SIZE = 16; // distinct bitrates a block
+
+        struct frame_columns_file_header {
+            char magic[8];
+            uint32_t version;
+            uint32_t block_header_size;
+        };
+
+        struct frame_columns_block_header {
+            uint32_t magic;
+            uint32_t nframes;
+            uint64_t block_bytes; // all of it, header included: the next block is here
+            int64_t base_offset; // the first frame's gap counts from here
+            int64_t first_frame; // index of the first frame in its source file
+            uint32_t path_len;
+            uint32_t ndict;
+            uint16_t bitrate_kbps[COLUMN_DICT_SIZE];
+        };
+        static_assert(sizeof(frame_columns_file_header) % 8 == 0, "keep blocks aligned");
+        static_assert(sizeof(frame_columns_block_header) % 8 == 0, "keep blocks aligned");
+
+        inline size_t column_pad8(size_t n) noexcept { return (n + 7) & ~CAST(size_t, 7); }
+
+        // CRC-16 (0x8005, starting at 0xFFFF), as the protection word uses
+        inline uint16_t mpeg_crc16(const unsigned char* p, int n, uint16_t crc) noexcept {
+            for (int i = 0; i < n; ++i) {
+                crc = CAST(uint16_t, crc ^ (p[i] << 8));
+                for (int b = 0; b < 8; ++b) {
+                    crc = CAST(uint16_t, (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1);
+                }
+            }
+            return crc;
+        }
+
+        // Layer III only: its side info has a fixed size, so the CRC (header
+        // bytes 2 and 3, then the side info) can be checked without decoding.
+        // Layers I and II protect a variable number of bits: unchecked.
+        inline column_crc check_frame_crc(const frame_base& f) noexcept {
+            const auto& p = f.props_const();
+            if (!p.crc) {
+                return column_crc::none;
+            }
+            if (p.layer != 3) {
+                return column_crc::unchecked;
+            }
+            const bool mono = p.channelmode == CHANNELS_SINGLE_CHANNEL;
+            const int side = p.version == 1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+            const auto* b = f.bytes();
+            if (f.bytes_size() < 6 + side) {
+                return column_crc::unchecked;
+            }
+            uint16_t crc = mpeg_crc16(b + 2, 2, 0xFFFF);
+            crc = mpeg_crc16(b + 6, side, crc);
+            const uint16_t stored = CAST(uint16_t, (b[4] << 8) | b[5]);
+            return crc == stored ? column_crc::ok : column_crc::bad;
+        }
+    } // namespace detail
+
+    // Encodes frames into blocks, in memory. add() the frames of one file
+    // between begin_file() and end_file(), and take() the bytes whenever it
+    // suits (after each file, say): memory is one block, plus what hasn't
+    // been taken. The file header is not included: see file_header().
+    class frame_columns_writer {
+        public:
+        static std::string file_header() {
+            detail::frame_columns_file_header fh;
+            memcpy(fh.magic, detail::FRAME_COLUMNS_MAGIC, sizeof(fh.magic));
+            fh.version = detail::FRAME_COLUMNS_VERSION;
+            fh.block_header_size = sizeof(detail::frame_columns_block_header);
+            return std::string(reinterpret_cast<const char*>(&fh), sizeof(fh));
+        }
+
+        void begin_file(const std::string& path) {
+            end_file();
+            m_path = path;
+            m_frame_in_file = 0;
+            m_in_file = true;
+        }
+
+        // f must have at least its header and side info loaded (on_frame()
+        // frames have all of it).
+        void add(const frame_base& f) {
+            if (!m_gap.empty() && f.file_position - m_end > CAST(int64_t, UINT32_MAX)) {
+                flush_block(); // a gap column can't span it: the next block rebases
+            }
+            const auto& p = f.props_const();
+            const int kbps = p.bitrate / 1000;
+            int code = 0;
+            while (code < m_ndict && m_dict[code] != kbps) {
+                ++code;
+            }
+            if (code == m_ndict && m_ndict == detail::COLUMN_DICT_SIZE) {
+                flush_block(); // free format, or garbage: start a new dictionary
+                code = 0;
+            }
+            if (code == m_ndict) {
+                m_dict[m_ndict++] = CAST(uint16_t, kbps);
+            }
+            if (m_gap.empty()) {
+                m_base = f.file_position;
+                m_block_first = m_frame_in_file;
+                m_end = f.file_position;
+            }
+            m_gap.push_back(CAST(uint32_t, f.file_position - m_end));
+            const int len = f.length_in_bytes();
+            m_size.push_back(CAST(uint16_t, len));
+            m_end = f.file_position + len;
+            m_code.push_back(CAST(uint8_t, code));
+            const auto crc = detail::check_frame_crc(f);
+            m_flags.push_back(CAST(uint8_t, (p.channelmode & 3) | (p.padding ? 4 : 0)
+                    | (CAST(int, crc) << 3)));
+            ++m_frame_in_file;
+            ++m_nframes;
+            if (m_gap.size() == detail::COLUMN_BLOCK_FRAMES) {
+                flush_block();
+            }
+        }
+
+        void end_file() {
+            if (m_in_file) {
+                flush_block();
+                m_in_file = false;
+            }
+        }
+
+        // the encoded blocks so far; the writer forgets them
+        std::string take() {
+            std::string s;
+            s.swap(m_out);
+            return s;
+        }
+        size_t pending_bytes() const noexcept { return m_out.size(); }
+        uint64_t frames() const noexcept { return m_nframes; }
+
+        private:
+        std::string m_out;
+        std::string m_path;
+        bool m_in_file = false;
+        int64_t m_frame_in_file = 0;
+        int64_t m_block_first = 0;
+        int64_t m_base = 0;
+        int64_t m_end = 0;
+        uint64_t m_nframes = 0;
+        uint16_t m_dict[detail::COLUMN_DICT_SIZE] = {0};
+        int m_ndict = 0;
+        std::vector<uint32_t> m_gap;
+        std::vector<uint16_t> m_size;
+        std::vector<uint8_t> m_code;
+        std::vector<uint8_t> m_flags;
+
+        template <typename T> void put(const std::vector<T>& col) {
+            const size_t n = col.size() * sizeof(T);
+            m_out.append(reinterpret_cast<const char*>(col.data()), n);
+            m_out.append(detail::column_pad8(n) - n, '\0');
+        }
+
+        void flush_block() {
+            const size_t n = m_gap.size();
+            if (n == 0) {
+                m_ndict = 0;
+                return;
+            }
+            detail::frame_columns_block_header bh;
+            memset(&bh, 0, sizeof(bh));
+            bh.magic = detail::FRAME_COLUMNS_BLOCK_MAGIC;
+            bh.nframes = CAST(uint32_t, n);
+            bh.base_offset = m_base;
+            bh.first_frame = m_block_first;
+            bh.path_len = CAST(uint32_t, m_path.size());
+            bh.ndict = CAST(uint32_t, m_ndict);
+            memcpy(bh.bitrate_kbps, m_dict, sizeof(m_dict));
+            bh.block_bytes = sizeof(bh) + detail::column_pad8(m_path.size())
+                + detail::column_pad8(n * 4) + detail::column_pad8(n * 2)
+                + 2 * detail::column_pad8(n);
+            m_out.reserve(m_out.size() + CAST(size_t, bh.block_bytes));
+            m_out.append(reinterpret_cast<const char*>(&bh), sizeof(bh));
+            m_out.append(m_path);
+            m_out.append(detail::column_pad8(m_path.size()) - m_path.size(), '\0');
+            put(m_gap);
+            put(m_size);
+            put(m_code);
+            put(m_flags);
+            m_gap.clear();
+            m_size.clear();
+            m_code.clear();
+            m_flags.clear();
+            m_ndict = 0;
+        }
+    };
+
+    // Walks the blocks of a frame columns file that is all in memory (mmap'd,
+    // typically). Nothing is copied: the columns point into data.
+    class frame_columns_reader {
+        public:
+        struct block_view {
+            const detail::frame_columns_block_header* hdr = nullptr;
+            const char* path = nullptr;
+            const uint32_t* gap = nullptr;
+            const uint16_t* size = nullptr;
+            const uint8_t* bitrate = nullptr;
+            const uint8_t* flags = nullptr;
+
+            uint32_t nframes() const noexcept { return hdr->nframes; }
+            std::string source() const { return std::string(path, hdr->path_len); }
+            int kbps(uint32_t i) const noexcept {
+                return hdr->bitrate_kbps[bitrate[i] & 15];
+            }
+            int channelmode(uint32_t i) const noexcept { return flags[i] & 3; }
+            bool padded(uint32_t i) const noexcept { return (flags[i] & 4) != 0; }
+            column_crc crc(uint32_t i) const noexcept {
+                return CAST(column_crc, (flags[i] >> 3) & 3);
+            }
+            // fills out[0, nframes()) with the file offset of each frame
+            void offsets(int64_t* out) const noexcept {
+                int64_t end = hdr->base_offset;
+                for (uint32_t i = 0; i < hdr->nframes; ++i) {
+                    out[i] = end + gap[i];
+                    end = out[i] + size[i];
+                }
+            }
+        };
+
+        frame_columns_reader(const void* data, size_t size) noexcept
+            : m_p(static_cast<const char*>(data)), m_size(size) {
+            using fh_t = detail::frame_columns_file_header;
+            const auto* fh = reinterpret_cast<const fh_t*>(m_p);
+            m_ok = size >= sizeof(*fh)
+                && memcmp(fh->magic, detail::FRAME_COLUMNS_MAGIC, sizeof(fh->magic)) == 0
+                && fh->version == detail::FRAME_COLUMNS_VERSION
+                && fh->block_header_size == sizeof(detail::frame_columns_block_header);
+            m_pos = sizeof(*fh);
+        }
+
+        // is it a frame columns file we understand?
+        bool ok() const noexcept { return m_ok; }
+
+        // the next block, or false at the end (or at a truncated block)
+        bool next(block_view& b) noexcept {
+            using bh_t = detail::frame_columns_block_header;
+            if (!m_ok || m_pos + sizeof(bh_t) > m_size) {
+                return false;
+            }
+            const auto* h = reinterpret_cast<const bh_t*>(m_p + m_pos);
+            if (h->magic != detail::FRAME_COLUMNS_BLOCK_MAGIC
+                || h->block_bytes > m_size - m_pos
+                || h->ndict > CAST(uint32_t, detail::COLUMN_DICT_SIZE)) {
+                return false;
+            }
+            const size_t n = h->nframes;
+            const char* p = m_p + m_pos + sizeof(bh_t);
+            b.hdr = h;
+            b.path = p;
+            p += detail::column_pad8(h->path_len);
+            b.gap = reinterpret_cast<const uint32_t*>(p);
+            p += detail::column_pad8(n * 4);
+            b.size = reinterpret_cast<const uint16_t*>(p);
+            p += detail::column_pad8(n * 2);
+            b.bitrate = reinterpret_cast<const uint8_t*>(p);
+            p += detail::column_pad8(n);
+            b.flags = reinterpret_cast<const uint8_t*>(p);
+            p += detail::column_pad8(n);
+            if (CAST(size_t, p - (m_p + m_pos)) != h->block_bytes) {
+                return false;
+            }
+            m_pos += CAST(size_t, h->block_bytes);
+            return true;
+        }
+
+        private:
+        const char* m_p;
+        size_t m_size;
+        size_t m_pos = 0;
+        bool m_ok = false;
+    };
+
+    // Parses path, adding its frames to w. summary, fingerprint and
+    // read_block as parse_file().
+    inline error export_frame_columns(const std::string& path, frame_columns_writer& w,
+        parse_summary& summary, bool fingerprint = false,
+        int read_block = detail::DEFAULT_READ_BLOCK) {
+        w.begin_file(path);
+        const error e = parse_file(path, summary, fingerprint,
+            [&w](const frame& f) { w.add(f); }, nullptr, read_block);
+        w.end_file();
+        return e;
+    }
+
+} // namespace mpeg
+} // namespace my
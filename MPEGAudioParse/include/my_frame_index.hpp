@@ -0,0 +1,294 @@
+#pragma once
+// my_frame_index.hpp
+// A frame index kept with an archived file, so that when the file is added to
+// (a recorder that concatenates its takes) only what was added gets walked.
+// saved_index holds the parse_summary and the index as they were, and an
+// xxh64 of the bytes of the last few frames indexed. index_file() reads those
+// frames again: if they hash the same, and the file has not got shorter, the
+// rest of the prefix is taken as it was, and the walk picks up where the last
+// frame ended, with a stream_framer and a frame_tally (my_icy.hpp) set up as
+// the walk left them. If not, it walks the whole file. Either way the summary
+// and index come out as parse_file() with parser::index_frames() gives them,
+// damaged audio and all: the framer believes a sync only as the walk does
+// (short of a run of frames at the end that runs into an APE tag with no
+// header, which the walk takes and the framer does not).
+//
+// On disk it is
+//      saved_index_header | parse_summary | frame_entry[nframes]
+// as they are in memory; a different layout of either is a different file.
+#include "my_icy.hpp"
+#include "my_hash.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace my {
+namespace mpeg {
+
+    struct saved_index {
+        parse_summary summary;
+        std::vector<frame_entry> frames; // parser::frame_index()
+        uint64_t tail_hash = {0}; // of the last INDEX_TAIL_FRAMES frames' bytes
+
+        // where the last frame indexed ends, or -1
+        int64_t end() const noexcept {
+            return frames.empty() ? -1 : frames.back().offset + frames.back().length;
+        }
+    };
+
+    namespace detail {
+        static constexpr char SAVED_INDEX_MAGIC[8]
+            = {'M', 'P', 'F', 'R', 'M', 'I', 'D', 'X'};
+        static constexpr uint32_t SAVED_INDEX_VERSION = 1;
+        // how many frames, from the end of the index, the tail hash covers
+        static constexpr int INDEX_TAIL_FRAMES = 4;
+
+        struct saved_index_header {
+            char magic[8];
+            uint32_t version;
+            uint32_t summary_size;
+            uint32_t entry_size;
+            uint32_t spare;
+            int64_t nframes;
+            uint64_t tail_hash;
+        };
+        static_assert(sizeof(saved_index_header) % 8 == 0, "keep what follows aligned");
+
+        inline int64_t file_size_of(FILE* f) noexcept {
+#ifdef _WIN32
+            if (_fseeki64(f, 0, SEEK_END) == 0) {
+                return _ftelli64(f);
+            }
+#else
+            if (fseeko(f, 0, SEEK_END) == 0) {
+                return CAST(int64_t, ftello(f));
+            }
+#endif
+            return -1;
+        }
+
+        // Reads n bytes at pos. Returns 0, my::io::NO_MORE_DATA if the file
+        // ends first, or -errno.
+        inline int read_exactly(FILE* f, int64_t pos, char* into, int n) noexcept {
+            int got = n;
+            const int e = read_stdio(f, into, got,
+                my::io::seek_type(pos, my::io::seek_value_type::seek_from_begin));
+            if (e != 0) {
+                return e;
+            }
+            return got == n ? 0 : my::io::NO_MORE_DATA;
+        }
+
+        // xxh64 of the bytes of the last INDEX_TAIL_FRAMES frames in frames,
+        // as they are in f now. Returns 0, or as read_exactly().
+        inline int index_tail_hash(
+            FILE* f, const std::vector<frame_entry>& frames, uint64_t& hash) {
+            my::hash::xxh64 h;
+            std::vector<char> buf;
+            const size_t from = frames.size() > INDEX_TAIL_FRAMES
+                ? frames.size() - INDEX_TAIL_FRAMES
+                : 0;
+            for (size_t i = from; i < frames.size(); ++i) {
+                buf.resize(CAST(size_t, frames[i].length));
+                const int e
+                    = read_exactly(f, frames[i].offset, buf.data(), frames[i].length);
+                if (e != 0) {
+                    return e;
+                }
+                h.update(buf.data(), buf.size());
+            }
+            hash = h.digest();
+            return 0;
+        }
+
+        // What of what was saved still holds, now that the file is file_size
+        // bytes: false if the walk must start over.
+        inline bool can_resume(FILE* f, const saved_index& was, int64_t file_size) {
+            const parse_summary& s = was.summary;
+            const int64_t end = was.end();
+            // the audio the saved walk had; past it were only the tags
+            const int64_t audio_end
+                = s.file_size - (s.id3v1 ? 128 : 0) - CAST(int64_t, s.ape_size);
+            if (end < 0 || s.error != 0 || s.audio_hash != 0 || file_size < s.file_size
+                || end > audio_end) { // the last frame was cut short
+                return false;
+            }
+            uint64_t hash = 0;
+            return index_tail_hash(f, was.frames, hash) == 0 && hash == was.tail_hash;
+        }
+    } // namespace detail
+
+    // Writes idx to path, by way of path.tmp. Returns 0, or an errno.
+    inline int save_index(const std::string& path, const saved_index& idx) {
+        detail::saved_index_header h = {};
+        memcpy(h.magic, detail::SAVED_INDEX_MAGIC, sizeof(h.magic));
+        h.version = detail::SAVED_INDEX_VERSION;
+        h.summary_size = sizeof(parse_summary);
+        h.entry_size = sizeof(frame_entry);
+        h.nframes = CAST(int64_t, idx.frames.size());
+        h.tail_hash = idx.tail_hash;
+
+        const std::string tmp = path + ".tmp";
+        FILE* f = ::fopen(tmp.c_str(), "wb");
+        if (f == nullptr) {
+            return errno;
+        }
+        int e = 0;
+        if (fwrite(&h, sizeof(h), 1, f) != 1
+            || fwrite(&idx.summary, sizeof(parse_summary), 1, f) != 1
+            || fwrite(idx.frames.data(), sizeof(frame_entry), idx.frames.size(), f)
+                != idx.frames.size()) {
+            e = errno != 0 ? errno : EIO;
+        }
+        if (fclose(f) != 0 && e == 0) {
+            e = errno;
+        }
+        if (e != 0) {
+            ::remove(tmp.c_str());
+            return e;
+        }
+#ifdef _WIN32
+        ::remove(path.c_str());
+#endif
+        return ::rename(tmp.c_str(), path.c_str()) == 0 ? 0 : errno;
+    }
+
+    // Reads what save_index() wrote. Returns 0, or an errno: EINVAL if it is
+    // not a saved index, or one laid out by a different build.
+    inline int load_index(const std::string& path, saved_index& idx) {
+        idx = saved_index();
+        FILE* f = ::fopen(path.c_str(), "rb");
+        if (f == nullptr) {
+            return errno;
+        }
+        // the size must be what the header says, before nframes is trusted
+        const int64_t size = detail::file_size_of(f);
+        rewind(f);
+        detail::saved_index_header h;
+        int e = 0;
+        if (fread(&h, sizeof(h), 1, f) != 1
+            || memcmp(h.magic, detail::SAVED_INDEX_MAGIC, sizeof(h.magic)) != 0
+            || h.version != detail::SAVED_INDEX_VERSION
+            || h.summary_size != sizeof(parse_summary)
+            || h.entry_size != sizeof(frame_entry) || h.nframes < 0
+            || h.nframes > size / CAST(int64_t, sizeof(frame_entry))
+            || size
+                != CAST(int64_t, sizeof(h) + sizeof(parse_summary))
+                    + h.nframes * CAST(int64_t, sizeof(frame_entry))
+            || fread(&idx.summary, sizeof(parse_summary), 1, f) != 1) {
+            e = EINVAL;
+        } else {
+            idx.frames.resize(CAST(size_t, h.nframes));
+            if (fread(idx.frames.data(), sizeof(frame_entry), idx.frames.size(), f)
+                != idx.frames.size()) {
+                e = EINVAL;
+            }
+            idx.tail_hash = h.tail_hash;
+        }
+        fclose(f);
+        if (e != 0) {
+            idx = saved_index();
+        }
+        return e;
+    }
+
+    // Brings idx up to date with the file at path: from where idx left off
+    // if the file was only added to since, else from the start (pass an
+    // empty saved_index to index a file for the first time). walked_from, if
+    // given, gets the offset the walk started at. Reads read_block bytes at a
+    // time. On an error idx is left empty.
+    inline error index_file(const std::string& path, saved_index& idx,
+        int64_t* walked_from = nullptr, int read_block = detail::DEFAULT_READ_BLOCK) {
+        FILE* f = ::fopen(path.c_str(), "rb");
+        if (f == nullptr) {
+            idx = saved_index();
+            return error(CAST(error::error_code, -errno)).at(-1, MPEG_WHERE);
+        }
+        setvbuf(f, nullptr, _IONBF, 0);
+        const int64_t file_size = detail::file_size_of(f);
+        std::vector<char> block(CAST(size_t, (std::max)(read_block, 4096)));
+
+        parse_summary& s = idx.summary;
+        int64_t from = 0;
+        stream_framer framer;
+        frame_tally tally(0);
+        if (detail::can_resume(f, idx, file_size)) {
+            // What the saved walk said about its end no longer holds: its
+            // tags are now in the middle, and the trailing gap is the start
+            // of one the walk from here will find.
+            from = idx.end();
+            const int64_t audio_end
+                = s.file_size - (s.id3v1 ? 128 : 0) - CAST(int64_t, s.ape_size);
+            if (audio_end - from >= MPEG_HEADER_SIZE) {
+                --s.ngaps;
+                s.gap_bytes -= audio_end - from;
+            }
+            s.id3v1 = 0;
+            s.ape_size = 0;
+            tally = frame_tally(from, idx.frames.back().bitrate);
+        } else {
+            idx = saved_index();
+            s.file_size = file_size;
+            char head[detail::ID3V2_HEADER_SIZE];
+            if (detail::read_exactly(f, 0, head, sizeof(head)) == 0
+                && memcmp(head, "ID3", 3) == 0) {
+                detail::id3v2Header h;
+                memcpy(static_cast<void*>(&h), head, detail::ID3V2_HEADER_SIZE);
+                s.id3v2_size = detail::id3v2_tag_size(h);
+            }
+            from = s.id3v2_size;
+            tally = frame_tally(from);
+        }
+        if (walked_from != nullptr) {
+            *walked_from = from;
+        }
+        s.file_size = file_size;
+        framer.reset(from);
+
+        auto count = [&](const frame& f) {
+            const bool info = s.nframes == 0 && detail::is_info_frame(f);
+            tally.add(f, s);
+            if (!info) {
+                idx.frames.push_back(detail::make_entry(f));
+            }
+        };
+        int e = 0;
+        for (int64_t pos = from; pos < file_size && e == 0;) {
+            int n = CAST(int, (std::min)(CAST(int64_t, block.size()), file_size - pos));
+            e = detail::read_stdio(f, block.data(), n,
+                my::io::seek_type(pos, my::io::seek_value_type::seek_from_begin));
+            if (e == 0 || e == my::io::NO_MORE_DATA) {
+                framer.feed(byte_span(block.data(), CAST(size_t, n)), count);
+                pos += n;
+                e = n == 0 ? my::io::NO_MORE_DATA : e;
+            }
+        }
+        if (e < 0) {
+            fclose(f);
+            idx = saved_index();
+            return error(CAST(error::error_code, e)).at(-1, MPEG_WHERE);
+        }
+        framer.finish(count);
+
+        // the tags at the end, as the walk takes them
+        char tail[128 + detail::APE_FOOTER_SIZE];
+        const int tn = CAST(int, (std::min)(CAST(int64_t, sizeof(tail)), file_size));
+        int64_t audio_end = file_size;
+        if (detail::read_exactly(f, file_size - tn, tail, tn) == 0) {
+            s.id3v1 = tn >= 128 && memcmp(tail + tn - 128, "TAG", 3) == 0;
+            audio_end -= s.id3v1 ? 128 : 0;
+            const int foot = tn - (s.id3v1 ? 128 : 0) - detail::APE_FOOTER_SIZE;
+            if (foot >= 0) {
+                s.ape_size = detail::ape_tag_size(tail + foot, audio_end);
+                audio_end -= s.ape_size;
+            }
+        }
+        tally.end(audio_end, s);
+        detail::index_tail_hash(f, idx.frames, idx.tail_hash);
+        fclose(f);
+        return error();
+    }
+
+} // namespace mpeg
+} // namespace my
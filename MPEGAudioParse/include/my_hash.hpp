@@ -0,0 +1,146 @@
+#pragma once
+// my_hash.hpp
+// A streaming XXH64 (https://github.com/Cyan4973/xxHash, BSD 2-clause
+// algorithm), written out here so we need no library. Its 4 independent
+// lanes keep a modern core busy on 32 bytes at a time, so it runs at close to
+// memory speed, and we can feed it a frame at a time.
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include "my_macros.hpp"
+
+namespace my {
+namespace hash {
+
+    class xxh64 {
+        static constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL;
+        static constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+        static constexpr uint64_t P3 = 0x165667B19E3779F9ULL;
+        static constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+        static constexpr uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+        uint64_t m_v[4];
+        uint64_t m_total = 0;
+        uint64_t m_seed = 0;
+        unsigned char m_buf[32];
+        size_t m_buffered = 0;
+
+        static uint64_t rotl(uint64_t x, int r) noexcept {
+            return (x << r) | (x >> (64 - r));
+        }
+        static uint64_t read64(const unsigned char* p) noexcept {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v)); // little endian hosts only, as is the parser
+            return v;
+        }
+        static uint32_t read32(const unsigned char* p) noexcept {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        static uint64_t round(uint64_t acc, uint64_t input) noexcept {
+            acc += input * P2;
+            acc = rotl(acc, 31);
+            return acc * P1;
+        }
+        static uint64_t merge(uint64_t acc, uint64_t v) noexcept {
+            acc ^= round(0, v);
+            return acc * P1 + P4;
+        }
+        void stripes(const unsigned char* p, size_t n) noexcept {
+            const unsigned char* const e = p + n;
+            uint64_t v0 = m_v[0], v1 = m_v[1], v2 = m_v[2], v3 = m_v[3];
+            for (; p + 32 <= e; p += 32) {
+                v0 = round(v0, read64(p));
+                v1 = round(v1, read64(p + 8));
+                v2 = round(v2, read64(p + 16));
+                v3 = round(v3, read64(p + 24));
+            }
+            m_v[0] = v0;
+            m_v[1] = v1;
+            m_v[2] = v2;
+            m_v[3] = v3;
+        }
+
+        public:
+        explicit xxh64(uint64_t seed = 0) noexcept { reset(seed); }
+
+        void reset(uint64_t seed = 0) noexcept {
+            m_seed = seed;
+            m_v[0] = seed + P1 + P2;
+            m_v[1] = seed + P2;
+            m_v[2] = seed;
+            m_v[3] = seed - P1;
+            m_total = 0;
+            m_buffered = 0;
+        }
+
+        void update(const void* data, size_t len) noexcept {
+            const auto* p = static_cast<const unsigned char*>(data);
+            m_total += len;
+            if (m_buffered + len < 32) {
+                memcpy(m_buf + m_buffered, p, len);
+                m_buffered += len;
+                return;
+            }
+            if (m_buffered != 0) {
+                const size_t fill = 32 - m_buffered;
+                memcpy(m_buf + m_buffered, p, fill);
+                stripes(m_buf, 32);
+                p += fill;
+                len -= fill;
+                m_buffered = 0;
+            }
+            const size_t whole = len & ~CAST(size_t, 31);
+            stripes(p, whole);
+            memcpy(m_buf, p + whole, len - whole);
+            m_buffered = len - whole;
+        }
+
+        uint64_t digest() const noexcept {
+            uint64_t h;
+            if (m_total >= 32) {
+                h = rotl(m_v[0], 1) + rotl(m_v[1], 7) + rotl(m_v[2], 12) + rotl(m_v[3], 18);
+                h = merge(h, m_v[0]);
+                h = merge(h, m_v[1]);
+                h = merge(h, m_v[2]);
+                h = merge(h, m_v[3]);
+            } else {
+                h = m_seed + P5;
+            }
+            h += m_total;
+
+            const unsigned char* p = m_buf;
+            const unsigned char* const e = m_buf + m_buffered;
+            for (; p + 8 <= e; p += 8) {
+                h ^= round(0, read64(p));
+                h = rotl(h, 27) * P1 + P4;
+            }
+            if (p + 4 <= e) {
+                h ^= static_cast<uint64_t>(read32(p)) * P1;
+                h = rotl(h, 23) * P2 + P3;
+                p += 4;
+            }
+            for (; p < e; ++p) {
+                h ^= (*p) * P5;
+                h = rotl(h, 11) * P1;
+            }
+            h ^= h >> 33;
+            h *= P2;
+            h ^= h >> 29;
+            h *= P3;
+            h ^= h >> 32;
+            return h;
+        }
+
+        uint64_t bytes_hashed() const noexcept { return m_total; }
+
+        static uint64_t of(const void* data, size_t len, uint64_t seed = 0) noexcept {
+            xxh64 h(seed);
+            h.update(data, len);
+            return h.digest();
+        }
+    };
+
+} // namespace hash
+} // namespace my
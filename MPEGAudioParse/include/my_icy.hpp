@@ -0,0 +1,524 @@
+#pragma once
+// my_icy.hpp
+// Shoutcast/Icecast (ICY) streams. A server that was asked for metadata
+// (Icy-MetaData: 1) puts a metadata block after every icy-metaint bytes of
+// audio: one length byte (times 16), then that many bytes of
+// "StreamTitle='...';StreamUrl='...';", NUL padded. Fed to the frame walk as
+// they are, those blocks look like damage, and cost a resync each.
+//
+// icy_demux takes the stream as it arrives (from a non-blocking socket, say)
+// and splits it: audio goes out as views into the caller's buffer, and a
+// metadata block that differs from the last one goes out as an icy_metadata.
+// stream_framer takes that audio and finds its MPEG frames, as the file walk
+// does, without ever having the whole stream: a frame is a view into the
+// caller's buffer, unless it straddles two reads (then it is copied, once).
+// frame_tally sums those frames into a parse_summary, as the file walk would.
+#include "my_mpeg.hpp"
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace my {
+namespace mpeg {
+
+    // what the server said before the audio started
+    struct icy_headers {
+        int status = 0; // 200, hopefully
+        int metaint = 0; // 0: no metadata in this stream
+        int bitrate = 0; // icy-br, kbps
+        std::string name; // icy-name
+        std::string genre; // icy-genre
+        std::string content_type;
+    };
+
+    // A metadata block that differs from the one before it.
+    struct icy_metadata {
+        int64_t audio_offset = 0; // audio bytes that came before it
+        std::string raw; // as sent, without the NUL padding
+        std::string title; // StreamTitle
+        std::string url; // StreamUrl
+    };
+
+    namespace detail {
+        inline bool icy_name_is(const std::string& line, size_t colon, const char* name) {
+            const size_t n = strlen(name);
+            if (colon != n) {
+                return false;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                char c = line[i];
+                if (c >= 'A' && c <= 'Z') {
+                    c = CAST(char, c - 'A' + 'a');
+                }
+                if (c != name[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // One "ICY 200 OK" (or "HTTP/1.x 200 OK") response header line, no CRLF.
+        inline void icy_header_line(const std::string& line, icy_headers& h) {
+            if (h.status == 0) {
+                const size_t sp = line.find(' ');
+                h.status = sp == std::string::npos ? -1 : atoi(line.c_str() + sp + 1);
+                return;
+            }
+            const size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                return;
+            }
+            size_t v = colon + 1;
+            while (v < line.size() && line[v] == ' ') {
+                ++v;
+            }
+            const std::string value = line.substr(v);
+            if (icy_name_is(line, colon, "icy-metaint")) {
+                h.metaint = atoi(value.c_str());
+            } else if (icy_name_is(line, colon, "icy-br")) {
+                h.bitrate = atoi(value.c_str());
+            } else if (icy_name_is(line, colon, "icy-name")) {
+                h.name = value;
+            } else if (icy_name_is(line, colon, "icy-genre")) {
+                h.genre = value;
+            } else if (icy_name_is(line, colon, "content-type")) {
+                h.content_type = value;
+            }
+        }
+
+        // the value of key='...'; in an ICY metadata block
+        inline std::string icy_field(const std::string& meta, const char* key) {
+            const std::string k = std::string(key) + "='";
+            const size_t at = meta.find(k);
+            if (at == std::string::npos) {
+                return std::string();
+            }
+            const size_t from = at + k.size();
+            // titles have apostrophes in them: only "';" ends one
+            size_t to = meta.find("';", from);
+            if (to == std::string::npos) {
+                to = meta.rfind('\'');
+                if (to == std::string::npos || to < from) {
+                    to = meta.size();
+                }
+            }
+            return meta.substr(from, to - from);
+        }
+    } // namespace detail
+
+    class icy_demux {
+        enum class state { headers, audio, meta_length, meta };
+        state m_state = state::headers;
+        icy_headers m_headers;
+        std::string m_line; // a header line, so far
+        int m_left = 0; // audio bytes before the next metadata block
+        size_t m_meta_len = 0;
+        std::string m_meta; // a metadata block, so far
+        std::string m_last_meta;
+        int64_t m_audio_bytes = 0;
+        int64_t m_meta_bytes = 0;
+
+        void start_audio() noexcept {
+            m_state = state::audio;
+            m_left = m_headers.metaint;
+        }
+
+        public:
+        // The stream starts with the server's response headers, which say
+        // where the metadata is.
+        icy_demux() = default;
+        // The response headers were read elsewhere: the stream is the body.
+        explicit icy_demux(int metaint) {
+            m_headers.status = 200;
+            m_headers.metaint = metaint;
+            start_audio();
+        }
+
+        // Takes the next n bytes of the stream. on_audio(byte_span) is called
+        // with every run of audio in them, pointing into data; on_meta(const
+        // icy_metadata&) with each metadata change. Fails (-EPROTO) on a
+        // response that isn't a 200.
+        template <typename AUDIO, typename META>
+        error feed(const char* data, size_t n, AUDIO&& on_audio, META&& on_meta) {
+            const char* p = data;
+            const char* const end = data + n;
+            while (p < end) {
+                switch (m_state) {
+                    case state::headers: {
+                        const char c = *p++;
+                        if (c == '\r') {
+                            break;
+                        }
+                        if (c != '\n') {
+                            if (m_line.size() < 8192) {
+                                m_line += c;
+                            }
+                            break;
+                        }
+                        if (!m_line.empty()) {
+                            detail::icy_header_line(m_line, m_headers);
+                            m_line.clear();
+                            break;
+                        }
+                        // the blank line: audio from here on
+                        if (m_headers.status != 200) {
+                            return error(CAST(error::error_code, -EPROTO));
+                        }
+                        start_audio();
+                        break;
+                    }
+                    case state::audio: {
+                        size_t run = CAST(size_t, end - p);
+                        if (m_headers.metaint > 0) {
+                            run = (std::min)(run, CAST(size_t, m_left));
+                            m_left -= CAST(int, run);
+                        }
+                        on_audio(byte_span(p, run));
+                        m_audio_bytes += CAST(int64_t, run);
+                        p += run;
+                        if (m_headers.metaint > 0 && m_left == 0) {
+                            m_state = state::meta_length;
+                        }
+                        break;
+                    }
+                    case state::meta_length: {
+                        m_meta_len = CAST(size_t, CAST(unsigned char, *p++)) * 16;
+                        ++m_meta_bytes;
+                        m_meta.clear();
+                        if (m_meta_len == 0) {
+                            start_audio(); // nothing new
+                        } else {
+                            m_state = state::meta;
+                        }
+                        break;
+                    }
+                    case state::meta: {
+                        const size_t take
+                            = (std::min)(CAST(size_t, end - p), m_meta_len - m_meta.size());
+                        m_meta.append(p, take);
+                        m_meta_bytes += CAST(int64_t, take);
+                        p += take;
+                        if (m_meta.size() < m_meta_len) {
+                            break;
+                        }
+                        const size_t nul = m_meta.find('\0');
+                        if (nul != std::string::npos) {
+                            m_meta.resize(nul);
+                        }
+                        if (m_meta != m_last_meta) {
+                            m_last_meta = m_meta;
+                            icy_metadata md;
+                            md.audio_offset = m_audio_bytes;
+                            md.raw = m_meta;
+                            md.title = detail::icy_field(m_meta, "StreamTitle");
+                            md.url = detail::icy_field(m_meta, "StreamUrl");
+                            on_meta(md);
+                        }
+                        start_audio();
+                        break;
+                    }
+                }
+            }
+            return error::error_code::noerror;
+        }
+
+#ifndef _WIN32
+        // Reads what fd has (it may well be non-blocking) into buf, and feeds
+        // it through. Returns how much was read, 0 at the end of the stream,
+        // or -errno: -EAGAIN means nothing yet (poll, and come back).
+        template <typename AUDIO, typename META>
+        int64_t read_some(int fd, char* buf, size_t cap, AUDIO&& on_audio, META&& on_meta) {
+            ssize_t got = 0;
+            do {
+                got = ::read(fd, buf, cap);
+            } while (got < 0 && errno == EINTR);
+            if (got < 0) {
+                return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+            }
+            const error e = feed(buf, CAST(size_t, got), on_audio, on_meta);
+            return e ? e.to_int() : CAST(int64_t, got);
+        }
+#endif
+
+        const icy_headers& headers() const noexcept { return m_headers; }
+        bool in_headers() const noexcept { return m_state == state::headers; }
+        int64_t audio_bytes() const noexcept { return m_audio_bytes; }
+        int64_t meta_bytes() const noexcept { return m_meta_bytes; }
+    };
+
+    // Finds MPEG frames in audio that arrives a piece at a time. A sync
+    // candidate has to chain to RESYNC_CONFIRM_FRAMES - 1 more frames with
+    // the same stream signature before it is believed; after that, each frame
+    // only has to have that signature (checked by detail::known_signature),
+    // as in the file walk.
+    class stream_framer {
+        std::vector<unsigned char> m_carry; // the start of what wasn't done
+        frame m_frame;
+        frame m_next; // scratch for confirming a candidate
+        uint32_t m_sig = 0;
+        detail::known_signature_fn m_known = nullptr; // set when in sync
+        int64_t m_pos = 0; // stream offset of the next byte to look at
+        int64_t m_frames = 0;
+        int64_t m_junk = 0;
+        int64_t m_copied = 0;
+        bool m_ending = false; // finish(): nothing more is coming
+
+        // Is the candidate at p (len bytes long) a real frame? As in the file
+        // walk, the next RESYNC_CONFIRM_FRAMES - 1 frames it chains to must
+        // parse and have its stream signature, but a chain of at least two
+        // frames will do if the audio ends where the next would be: the end
+        // of the stream when finishing, an ID3v1 tag (128 bytes, then the
+        // end), or an APE tag's header. need is non-zero if it needs need
+        // bytes at p to say.
+        bool confirm(const unsigned char* p, size_t avail, size_t len, size_t& need) {
+            const uint32_t sig = detail::stream_signature(p);
+            const auto fn = detail::known_signature_for(sig);
+            bool ok = fn != nullptr;
+            size_t at = len;
+            for (int i = 1; ok && i < detail::RESYNC_CONFIRM_FRAMES; ++i) {
+                if (avail < at + MPEG_HEADER_SIZE) {
+                    if (!m_ending) {
+                        need = at + MPEG_HEADER_SIZE;
+                        return false;
+                    }
+                    ok = i >= 2;
+                    break;
+                }
+                if (detail::stream_signature(p + at) == sig) {
+                    m_next.clear();
+                    m_next.set_view(p + at, MPEG_HEADER_SIZE);
+                    const error e = m_next.parse_header(m_pos + CAST(int64_t, at));
+                    if (!e || e == error::error_code::data_incomplete) {
+                        at += CAST(size_t, m_next.length_in_bytes());
+                        continue;
+                    }
+                }
+                ok = false;
+                if (i >= 2 && memcmp(p + at, "TAG", 3) == 0) {
+                    if (!m_ending && avail <= at + 128) {
+                        need = at + 129; // is that the end?
+                        return false;
+                    }
+                    ok = avail == at + 128;
+                } else if (i >= 2 && memcmp(p + at, "APET", 4) == 0) {
+                    if (!m_ending && avail < at + 8) {
+                        need = at + 8;
+                        return false;
+                    }
+                    ok = avail >= at + 8 && memcmp(p + at, "APETAGEX", 8) == 0;
+                }
+                break;
+            }
+            if (ok) {
+                m_sig = sig;
+                m_known = fn;
+            }
+            return ok;
+        }
+
+        // Looks at the avail bytes at p (stream offset m_pos). Returns how
+        // many it consumed, or 0 if it needs need bytes there to say.
+        template <typename CB>
+        size_t step(const unsigned char* p, size_t avail, size_t& need, CB& on_frame) {
+            need = 0;
+            if (avail < MPEG_HEADER_SIZE) {
+                need = MPEG_HEADER_SIZE;
+                return 0;
+            }
+            if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0) {
+                const auto* sync = reinterpret_cast<const unsigned char*>(detail::find_sync(
+                    reinterpret_cast<const char*>(p), 0, CAST(int, avail)));
+                size_t skip = sync != nullptr ? CAST(size_t, sync - p) : avail;
+                if (sync == nullptr && p[avail - 1] == 0xFF) {
+                    --skip; // it may start a sync with the next byte in
+                }
+                m_known = nullptr; // lost it, if it had it
+                m_junk += CAST(int64_t, skip);
+                if (skip == 0) {
+                    need = avail + 1;
+                }
+                return skip;
+            }
+
+            m_frame.clear();
+            m_frame.set_view(p, CAST(int, (std::min)(avail, CAST(size_t, INT32_MAX))));
+            bool ok = m_known != nullptr && m_known(m_frame, m_pos);
+            if (!ok && m_known != nullptr) {
+                m_known = nullptr; // lost it
+            }
+            if (!ok) {
+                error e = m_frame.parse_header(m_pos);
+                ok = !e || e == error::error_code::data_incomplete;
+            }
+            const size_t len = ok ? CAST(size_t, m_frame.length_in_bytes()) : 0;
+            if (ok && m_known == nullptr) {
+                // a candidate: the frames it chains to must agree with it
+                ok = confirm(p, avail, len, need);
+                if (need != 0) {
+                    return 0;
+                }
+            }
+            if (!ok) {
+                ++m_junk;
+                return 1;
+            }
+            if (avail < len) {
+                need = len;
+                return 0;
+            }
+            m_frame.set_view(p, CAST(int, len));
+            ++m_frames;
+            on_frame(CAST(const frame&, m_frame));
+            return len;
+        }
+
+        public:
+        // offset: where the stream starts in the file, if it is in one, so
+        // that frames come out with their file positions
+        explicit stream_framer(int64_t offset = 0) noexcept : m_pos(offset) {}
+
+        // Starts over, with a new stream at offset.
+        void reset(int64_t offset = 0) noexcept {
+            m_carry.clear();
+            m_sig = 0;
+            m_known = nullptr;
+            m_ending = false;
+            m_pos = offset;
+            m_frames = m_junk = m_copied = 0;
+        }
+
+        // Takes the next piece of audio. on_frame(const frame&) is called
+        // with each whole frame in it (and in what was left over from
+        // earlier pieces).
+        template <typename CB> void feed(byte_span audio, CB&& on_frame) {
+            const unsigned char* p = audio.data();
+            size_t left = audio.size();
+            size_t need = 0;
+            // finish what the last piece started, topping it up from this one
+            while (!m_carry.empty()) {
+                const size_t used = step(m_carry.data(), m_carry.size(), need, on_frame);
+                if (used != 0) {
+                    m_carry.erase(m_carry.begin(), m_carry.begin() + CAST(ptrdiff_t, used));
+                    m_pos += CAST(int64_t, used);
+                    continue;
+                }
+                if (left == 0) {
+                    return;
+                }
+                // only take what it needs: the rest can be looked at in place
+                const size_t take = (std::min)(left, need - m_carry.size());
+                m_carry.insert(m_carry.end(), p, p + take);
+                m_copied += CAST(int64_t, take);
+                p += take;
+                left -= take;
+            }
+            while (left != 0) {
+                const size_t used = step(p, left, need, on_frame);
+                if (used == 0) {
+                    m_carry.assign(p, p + left);
+                    m_copied += CAST(int64_t, left);
+                    return;
+                }
+                p += used;
+                left -= used;
+                m_pos += CAST(int64_t, used);
+            }
+        }
+
+        // The end of the stream. What is left is looked at knowing that, so
+        // a short run of frames at the very end can be believed. A last frame
+        // cut short still counts, as it does in the file walk, if its header
+        // is there and agrees.
+        template <typename CB> void finish(CB&& on_frame) {
+            m_ending = true;
+            size_t need = 0;
+            while (!m_carry.empty()) {
+                const size_t used = step(m_carry.data(), m_carry.size(), need, on_frame);
+                if (used == 0) {
+                    break;
+                }
+                m_carry.erase(m_carry.begin(), m_carry.begin() + CAST(ptrdiff_t, used));
+                m_pos += CAST(int64_t, used);
+            }
+            m_ending = false;
+            if (m_known != nullptr && m_carry.size() >= MPEG_HEADER_SIZE) {
+                m_frame.clear();
+                m_frame.set_view(m_carry.data(), CAST(int, m_carry.size()));
+                if (m_known(m_frame, m_pos)) {
+                    ++m_frames;
+                    on_frame(CAST(const frame&, m_frame));
+                }
+            }
+            m_pos += CAST(int64_t, m_carry.size());
+            m_carry.clear();
+        }
+
+        bool in_sync() const noexcept { return m_known != nullptr; }
+        uint32_t signature() const noexcept { return m_sig; }
+        int64_t frames() const noexcept { return m_frames; }
+        // bytes skipped looking for sync
+        int64_t junk_bytes() const noexcept { return m_junk; }
+        // bytes that had to be copied, because a frame straddled two pieces
+        int64_t copied_bytes() const noexcept { return m_copied; }
+    };
+
+    // Sums frames into a parse_summary the way the file walk does, as a
+    // stream_framer finds them: the gaps between them, whether the bitrate
+    // changes, and the first frame's properties.
+    class frame_tally {
+        int64_t m_expect; // where the next frame is, if in step
+        int m_prev_bitrate = 0;
+
+        public:
+        // audio_from: where the audio starts (after any ID3v2 tag). To pick
+        // up a walk part way, where the last frame counted ended, and that
+        // frame's bitrate.
+        explicit frame_tally(int64_t audio_from, int prev_bitrate = 0) noexcept
+            : m_expect(audio_from), m_prev_bitrate(prev_bitrate) {}
+
+        void add(const frame& f, parse_summary& out) noexcept {
+            const auto& p = f.props_const();
+            const int64_t pos = f.file_position;
+            if (pos > m_expect) {
+                ++out.ngaps;
+                out.gap_bytes += pos - m_expect;
+                m_prev_bitrate = 0; // a new run: its bitrate is no change
+            }
+            if (m_prev_bitrate != 0 && p.bitrate != m_prev_bitrate) {
+                out.vbr = 1;
+            }
+            m_prev_bitrate = p.bitrate;
+            m_expect = pos + f.length_in_bytes();
+            if (out.nframes == 0) {
+                out.first_frame = pos;
+                out.samplerate = p.samplerate;
+                out.bitrate = p.bitrate;
+                out.version = CAST(uint8_t, p.version);
+                out.layer = CAST(uint8_t, p.layer);
+                out.channelmode = CAST(uint8_t, p.channelmode);
+                out.emphasis = CAST(uint8_t, p.emphasis);
+            }
+            ++out.nframes;
+            out.total_samples += f.samples();
+            out.duration_ms += 1000.0 * f.samples() / p.samplerate;
+        }
+
+        // The audio ends at audio_end: what is left after the last frame (a
+        // header's worth, or more) is a gap, as the walk gives up on it.
+        void end(int64_t audio_end, parse_summary& out) noexcept {
+            if (audio_end - m_expect >= MPEG_HEADER_SIZE) {
+                ++out.ngaps;
+                out.gap_bytes += audio_end - m_expect;
+            }
+        }
+
+        // where the last frame ended
+        int64_t expect() const noexcept { return m_expect; }
+    };
+
+} // namespace mpeg
+} // namespace my
@@ -0,0 +1,644 @@
+#pragma once
+// my_id3v2.hpp
+// The frames of the ID3v2 tag at the start of a file, and writing them back
+// without rewriting the file. read_id3v2_frames() takes the tag apart (v2.2,
+// v2.3 and v2.4; unsynchronisation undone); write_id3v2_tag() puts a v2.4 tag
+// together and writes it over the old one. If it fits in what the old one
+// took, header, frames and padding, that is all it writes, and the audio
+// stays where it is. If it doesn't, the audio is moved up to make room, and
+// room for another ID3V2_GROW_PADDING bytes of edits:
+//  - with fallocate(FALLOC_FL_INSERT_RANGE) where the filesystem has it (ext4,
+//    XFS), which shifts the blocks rather than the bytes; the room is then a
+//    whole number of blocks, and the tag pads out to it.
+//  - else by copying the file from the end down, with copy_file_range() on
+//    Linux, pread() and pwrite() elsewhere.
+// So an edit costs what the tag costs, bar the odd one that grows it.
+//
+// Nothing is renamed: a crash part way through a move leaves the file as it
+// was only if it was INSERT_RANGE.
+//
+// find_id3v2_pictures() says where the embedded pictures (APIC, v2.2 PIC)
+// are in the file, for a thumbnailer to sendfile() or mmap; it reads frame
+// headers and the first bytes of each picture frame, not the pictures. A
+// picture stored unsynchronised is not the image as it is on disk, and
+// read_id3v2_picture() gives it back as it was. POSIX only.
+#ifndef _WIN32
+#include "my_mpeg.hpp"
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace my {
+namespace mpeg {
+
+    // One frame: its id and its body, as the spec lays it out (a text frame
+    // is an encoding byte, then the text). flags are the v2.4 format flags
+    // (the second byte); grouping, compression and encryption are kept as
+    // they were, the body with them.
+    struct id3v2_frame {
+        std::string id;
+        std::string data;
+        uint8_t flags = {0};
+    };
+
+    // A v2.4 text frame (TIT2, TPE1, ...), in UTF-8.
+    inline id3v2_frame id3v2_text_frame(const std::string& id, const std::string& text) {
+        return id3v2_frame{id, std::string(1, '\x03') + text, 0};
+    }
+
+    // An embedded picture: the image is length bytes at offset in the file.
+    struct id3v2_picture {
+        std::string mime; // "image/jpeg"; a v2.2 "JPG" or "PNG" as a MIME type
+        int type = {0}; // 3 is the front cover, 0 other: see the spec for the rest
+        int64_t offset = {0};
+        int64_t length = {0};
+        bool unsynchronised = {false}; // only read_id3v2_picture() gives the image
+    };
+
+    struct id3v2_write_result {
+        enum class how { in_place, inserted, shifted };
+        how done = {how::in_place};
+        uint32_t old_size = {0}; // the tag's, header included: 0 if there was none
+        uint32_t new_size = {0};
+        int64_t bytes_moved = {0}; // by a shift: the audio and what follows it
+    };
+
+    namespace detail {
+        // padding a tag that has to grow gets, for the next edits
+        static constexpr uint32_t ID3V2_GROW_PADDING = 4096;
+
+        inline void encode_syncsafe(uint32_t v, unsigned char* into) noexcept {
+            for (int i = 0; i < 4; ++i) {
+                into[i] = CAST(unsigned char, (v >> ((3 - i) * 7)) & 127);
+            }
+        }
+
+        inline uint32_t read_be(const unsigned char* p, int n) noexcept {
+            uint32_t v = 0;
+            for (int i = 0; i < n; ++i) {
+                v = (v << 8) | p[i];
+            }
+            return v;
+        }
+
+        // Undoes unsynchronisation in place (every FF 00 back to FF).
+        // Returns the new length. dropped, if given, gets where each 00 went
+        // from, as an offset into what is left: the byte that is now at d was
+        // at d plus how many of them are <= d.
+        inline size_t remove_unsync(
+            unsigned char* p, size_t n, std::vector<uint32_t>* dropped = nullptr) {
+            size_t out = 0;
+            for (size_t i = 0; i < n; ++i) {
+                p[out++] = p[i];
+                if (p[i] == 0xFF && i + 1 < n && p[i + 1] == 0) {
+                    ++i;
+                    if (dropped != nullptr) {
+                        dropped->push_back(CAST(uint32_t, out));
+                    }
+                }
+            }
+            return out;
+        }
+
+        // where what is at d after remove_unsync() was before it
+        inline size_t unsync_offset(const std::vector<uint32_t>& dropped, size_t d) {
+            return d
+                + CAST(size_t,
+                    std::upper_bound(dropped.begin(), dropped.end(), CAST(uint32_t, d))
+                        - dropped.begin());
+        }
+
+        // Where a frame is in the tag, as id3v2_frames() finds it.
+        struct id3v2_frame_pos {
+            char id[5] = {0};
+            uint32_t header = {0}; // offset of its header, from the tag's start
+            uint32_t body = {0}; // of its body
+            uint32_t size = {0}; // of its body, as stored
+            uint8_t flags = {0}; // the format flags, as stored
+        };
+
+        inline int id3v2_frame_header_size(int version) noexcept {
+            return version == 2 ? 6 : 10;
+        }
+
+        // Reads the frame header at h, of a version tag, into f (all but
+        // where it is).
+        inline void read_frame_header(
+            const unsigned char* h, int version, id3v2_frame_pos& f) noexcept {
+            memcpy(f.id, h, version == 2 ? 3 : 4);
+            if (version == 2) {
+                f.size = read_be(h + 3, 3);
+                f.flags = 0;
+            } else if (version == 3) {
+                f.size = read_be(h + 4, 4);
+                // v2.3 compression, encryption, grouping to v2.4's
+                const uint8_t fl = h[9];
+                f.flags = CAST(uint8_t,
+                    ((fl & 0x80) ? 0x09 : 0) | ((fl & 0x40) ? 0x04 : 0)
+                        | ((fl & 0x20) ? 0x40 : 0));
+            } else {
+                f.size = DecodeSyncSafe(reinterpret_cast<const char*>(h + 4));
+                f.flags = h[9];
+            }
+        }
+
+        // Where the frames of a tag start, from its first 14 bytes (the
+        // header, and the size of an extended header).
+        inline uint32_t id3v2_first_frame(const unsigned char* h) noexcept {
+            if (h[3] == 2 || (h[5] & 0x40) == 0) {
+                return ID3V2_HEADER_SIZE;
+            }
+            const unsigned char* ext = h + ID3V2_HEADER_SIZE;
+            return ID3V2_HEADER_SIZE
+                + (h[3] == 4 ? DecodeSyncSafe(reinterpret_cast<const char*>(ext))
+                             : 4 + read_be(ext, 4));
+        }
+
+        // Calls cb(const id3v2_frame_pos&) for each frame in tag (n bytes,
+        // header included) until the frames or the tag run out, or cb
+        // returns false. tag must already have had v2.2 or v2.3 whole-tag
+        // unsynchronisation undone. Returns false if it is not a tag it can
+        // read (v2.2 to v2.4).
+        template <typename CB>
+        bool id3v2_frames(const unsigned char* tag, size_t n, CB&& cb) {
+            if (n < ID3V2_HEADER_SIZE || memcmp(tag, "ID3", 3) != 0 || tag[3] < 2
+                || tag[3] > 4) {
+                return false;
+            }
+            const int v = tag[3];
+            const int hsize = id3v2_frame_header_size(v);
+            size_t pos = n >= ID3V2_HEADER_SIZE + 4 ? id3v2_first_frame(tag)
+                                                      : ID3V2_HEADER_SIZE;
+            while (pos + hsize <= n && tag[pos] != 0) { // then it's padding
+                id3v2_frame_pos f;
+                read_frame_header(tag + pos, v, f);
+                f.header = CAST(uint32_t, pos);
+                f.body = CAST(uint32_t, pos + hsize);
+                if (f.size > n - f.body) {
+                    break;
+                }
+                if (!cb(CAST(const id3v2_frame_pos&, f))) {
+                    break;
+                }
+                pos = f.body + f.size;
+            }
+            return true;
+        }
+
+        // Reads the fields ahead of the image in a picture frame's data (p,
+        // n bytes) into pic. Returns how many bytes they take, or -1 if n is
+        // too few to tell.
+        inline int read_picture_header(
+            const unsigned char* p, size_t n, bool pic_v22, id3v2_picture& pic) {
+            if (n < 2) {
+                return -1;
+            }
+            const int encoding = p[0];
+            size_t i = 1;
+            if (pic_v22) {
+                if (n < 5) {
+                    return -1;
+                }
+                const std::string format(reinterpret_cast<const char*>(p + 1), 3);
+                pic.mime = format == "JPG" ? "image/jpeg"
+                    : format == "PNG"      ? "image/png"
+                                           : format;
+                i = 4;
+            } else {
+                const auto* z = static_cast<const unsigned char*>(memchr(p + i, 0, n - i));
+                if (z == nullptr) {
+                    return -1;
+                }
+                const size_t len = CAST(size_t, z - p) - i;
+                pic.mime.assign(reinterpret_cast<const char*>(p + i), len);
+                i += len + 1;
+            }
+            if (i >= n) {
+                return -1;
+            }
+            pic.type = p[i++];
+            // the description, ended by a 0 of its encoding's width
+            const size_t width = encoding == 1 || encoding == 2 ? 2 : 1;
+            for (; i + width <= n; i += width) {
+                if (p[i] == 0 && (width == 1 || p[i + 1] == 0)) {
+                    return CAST(int, i + width);
+                }
+            }
+            return -1;
+        }
+
+        inline int pread_all(int fd, void* into, size_t n, int64_t at) noexcept {
+            auto* p = static_cast<char*>(into);
+            while (n > 0) {
+                const ssize_t got = ::pread(fd, p, n, CAST(off_t, at));
+                if (got < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (got <= 0) {
+                    return got == 0 ? my::io::NO_MORE_DATA : -errno;
+                }
+                p += got;
+                at += got;
+                n -= CAST(size_t, got);
+            }
+            return 0;
+        }
+
+        inline int pwrite_all(int fd, const void* from, size_t n, int64_t at) noexcept {
+            const auto* p = static_cast<const char*>(from);
+            while (n > 0) {
+                const ssize_t put = ::pwrite(fd, p, n, CAST(off_t, at));
+                if (put < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (put < 0) {
+                    return -errno;
+                }
+                p += put;
+                at += put;
+                n -= CAST(size_t, put);
+            }
+            return 0;
+        }
+
+        // The tag at the start of fd, header included, as it is on disk; empty
+        // if there isn't one. Returns 0 or -errno.
+        inline int read_id3v2_raw(int fd, std::vector<unsigned char>& tag) {
+            tag.assign(ID3V2_HEADER_SIZE, 0);
+            int e = pread_all(fd, tag.data(), tag.size(), 0);
+            if (e == my::io::NO_MORE_DATA
+                || (e == 0 && memcmp(tag.data(), "ID3", 3) != 0)) {
+                tag.clear();
+                return 0;
+            }
+            if (e != 0) {
+                return e;
+            }
+            id3v2Header h;
+            memcpy(static_cast<void*>(&h), tag.data(), ID3V2_HEADER_SIZE);
+            uint32_t size = id3v2_tag_size(h);
+            if (size == 0) {
+                size = ID3V2_HEADER_SIZE; // an empty tag: all header
+            }
+            if (h.version[0] == 4 && (h.flags[0] & 0x10) != 0) {
+                size += ID3V2_HEADER_SIZE; // the footer
+            }
+            tag.resize(size);
+            e = pread_all(fd, tag.data() + ID3V2_HEADER_SIZE, size - ID3V2_HEADER_SIZE,
+                ID3V2_HEADER_SIZE);
+            return e == my::io::NO_MORE_DATA ? -EINVAL : e;
+        }
+
+        // Moves what is at [from, size) of fd up by `by` bytes, from the end
+        // down, so that nothing is overwritten before it is copied.
+        inline int shift_up(int fd, int64_t from, int64_t by, int64_t size) {
+            if (::ftruncate(fd, CAST(off_t, size + by)) != 0) {
+                return -errno;
+            }
+#ifdef __linux__
+            // copy_file_range won't copy a range onto itself: chunks of `by`
+            // bytes don't overlap where they go
+            bool kernel = true;
+            for (int64_t end = size; end > from && kernel;) {
+                const int64_t n = (std::min)(by, end - from);
+                loff_t in = CAST(loff_t, end - n), out = CAST(loff_t, end - n + by);
+                int64_t left = n;
+                while (left > 0) {
+                    const ssize_t c
+                        = ::copy_file_range(fd, &in, fd, &out, CAST(size_t, left), 0);
+                    if (c < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (c <= 0) {
+                        if (left == n
+                            && (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+                                || errno == EOPNOTSUPP)) {
+                            kernel = false; // the rest through user space
+                            break;
+                        }
+                        return c == 0 ? -EIO : -errno;
+                    }
+                    left -= c;
+                }
+                if (kernel) {
+                    end -= n;
+                } else {
+                    size = end;
+                }
+            }
+            if (kernel) {
+                return 0;
+            }
+#endif
+            // A whole block is read before any of it is written, so the
+            // block may overlap where it goes.
+            std::vector<char> buf(CAST(size_t, 1) << 20);
+            for (int64_t end = size; end > from;) {
+                const int64_t n = (std::min)(CAST(int64_t, buf.size()), end - from);
+                int e = pread_all(fd, buf.data(), CAST(size_t, n), end - n);
+                if (e == 0) {
+                    e = pwrite_all(fd, buf.data(), CAST(size_t, n), end - n + by);
+                }
+                if (e != 0) {
+                    return e == my::io::NO_MORE_DATA ? -EIO : e;
+                }
+                end -= n;
+            }
+            return 0;
+        }
+    } // namespace detail
+
+    // The frames of the ID3v2 tag of the file at path, in order; none if it
+    // has no tag. Bodies come with unsynchronisation undone, and a v2.4 data
+    // length indicator taken off unless the frame is compressed or encrypted.
+    // v2.3 compressed and encrypted frames are left out: they have no v2.4
+    // form without being unpacked. v2.2 frames keep their 3 character ids,
+    // and must be renamed before they can be written. Returns 0, or an
+    // errno: EINVAL if the tag is not one it can read.
+    inline int read_id3v2_frames(
+        const std::string& path, std::vector<id3v2_frame>& frames) {
+        frames.clear();
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return errno;
+        }
+        std::vector<unsigned char> tag;
+        const int e = detail::read_id3v2_raw(fd, tag);
+        ::close(fd);
+        if (e != 0 || tag.empty()) {
+            return -e;
+        }
+        if (tag[3] < 4 && (tag[5] & 0x80) != 0) {
+            tag.resize(detail::ID3V2_HEADER_SIZE
+                + detail::remove_unsync(tag.data() + detail::ID3V2_HEADER_SIZE,
+                    tag.size() - detail::ID3V2_HEADER_SIZE));
+        }
+        const bool v23 = tag[3] == 3;
+        const bool ok = detail::id3v2_frames(
+            tag.data(), tag.size(), [&](const detail::id3v2_frame_pos& f) {
+                if (v23 && (f.flags & 0x0C) != 0) {
+                    return true;
+                }
+                // the group byte stays, with its flag; the data length goes
+                const size_t group = (f.flags & 0x40) != 0 ? 1 : 0;
+                const size_t length = (f.flags & 0x0D) == 0x01 ? 4 : 0;
+                if (f.size < group + length) {
+                    return true;
+                }
+                const char* const p = reinterpret_cast<const char*>(tag.data() + f.body);
+                std::string data(p, group);
+                std::string rest(p + group + length, p + f.size);
+                if ((f.flags & 0x02) != 0 && !rest.empty()) {
+                    rest.resize(detail::remove_unsync(
+                        reinterpret_cast<unsigned char*>(&rest[0]), rest.size()));
+                }
+                frames.push_back(id3v2_frame{
+                    f.id, data + rest, CAST(uint8_t, f.flags & ~(length ? 0x03 : 0x02))});
+                return true;
+            });
+        return ok ? 0 : EINVAL;
+    }
+
+    // frames as a v2.4 tag, header included, padded with zeros out to size
+    // bytes if that is more than it needs. Empty if a frame's id is not 4
+    // characters.
+    inline std::string build_id3v2_tag(
+        const std::vector<id3v2_frame>& frames, uint32_t size = 0) {
+        std::string tag(detail::ID3V2_HEADER_SIZE, '\0');
+        for (const auto& f : frames) {
+            if (f.id.size() != 4) {
+                return std::string();
+            }
+            unsigned char h[10] = {0};
+            memcpy(h, f.id.data(), 4);
+            detail::encode_syncsafe(CAST(uint32_t, f.data.size()), h + 4);
+            h[9] = f.flags;
+            tag.append(reinterpret_cast<const char*>(h), sizeof(h));
+            tag += f.data;
+        }
+        if (tag.size() < size) {
+            tag.resize(size, '\0');
+        }
+        memcpy(&tag[0], "ID3\x04\x00\x00", 6);
+        detail::encode_syncsafe(
+            CAST(uint32_t, tag.size() - detail::ID3V2_HEADER_SIZE),
+            reinterpret_cast<unsigned char*>(&tag[6]));
+        return tag;
+    }
+
+    // Writes frames as the ID3v2 tag of the file at path, over the one it
+    // has (see above). result, if given, says how. Returns 0, or an errno:
+    // EINVAL if a frame id is not 4 characters, EFBIG if the tag would be
+    // more than the parser reads (ID3V2_MAX_SIZE).
+    inline int write_id3v2_tag(const std::string& path,
+        const std::vector<id3v2_frame>& frames, id3v2_write_result* result = nullptr,
+        uint32_t grow_padding = detail::ID3V2_GROW_PADDING) {
+        id3v2_write_result r;
+        const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            return errno;
+        }
+        struct stat st;
+        std::vector<unsigned char> old;
+        int e = ::fstat(fd, &st) != 0 ? -errno : detail::read_id3v2_raw(fd, old);
+        std::string tag;
+        if (e == 0) {
+            r.old_size = CAST(uint32_t, old.size());
+            tag = build_id3v2_tag(frames, r.old_size);
+            e = tag.empty() ? -EINVAL : 0;
+        }
+        if (e == 0 && tag.size() > r.old_size) {
+            // a whole number of blocks, for INSERT_RANGE
+            const int64_t block = st.st_blksize > 0 ? CAST(int64_t, st.st_blksize) : 4096;
+            const int64_t by = (CAST(int64_t, tag.size()) + grow_padding - r.old_size
+                                   + block - 1) / block * block;
+            if (r.old_size + by >= detail::ID3V2_MAX_SIZE) {
+                e = -EFBIG;
+            } else {
+                tag = build_id3v2_tag(frames, CAST(uint32_t, r.old_size + by));
+                r.done = id3v2_write_result::how::shifted;
+#ifdef FALLOC_FL_INSERT_RANGE
+                if (st.st_size > 0
+                    && ::fallocate(fd, FALLOC_FL_INSERT_RANGE, 0, CAST(off_t, by)) == 0) {
+                    r.done = id3v2_write_result::how::inserted;
+                }
+#endif
+                if (r.done == id3v2_write_result::how::shifted) {
+                    r.bytes_moved = CAST(int64_t, st.st_size) - r.old_size;
+                    e = detail::shift_up(fd, r.old_size, by, CAST(int64_t, st.st_size));
+                }
+            }
+        }
+        if (e == 0) {
+            r.new_size = CAST(uint32_t, tag.size());
+            e = detail::pwrite_all(fd, tag.data(), tag.size(), 0);
+        }
+        if (::close(fd) != 0 && e == 0) {
+            e = -errno;
+        }
+        if (result != nullptr) {
+            *result = r;
+        }
+        return -e;
+    }
+
+    // The pictures in the ID3v2 tag of the file at path, in the order they
+    // come; none if it has no tag. Pictures that are compressed, encrypted,
+    // or a link ("-->") are left out. A tag unsynchronised as a whole (v2.2,
+    // v2.3) is read whole, to find its frames; any other is read a frame
+    // header at a time. Returns 0, or an errno: EINVAL if the tag is not one
+    // it can read.
+    inline int find_id3v2_pictures(
+        const std::string& path, std::vector<id3v2_picture>& pictures) {
+        pictures.clear();
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return errno;
+        }
+        unsigned char h[detail::ID3V2_HEADER_SIZE + 4] = {0};
+        int e = detail::pread_all(fd, h, sizeof(h), 0);
+        if (e == my::io::NO_MORE_DATA || (e == 0 && memcmp(h, "ID3", 3) != 0)) {
+            ::close(fd);
+            return 0;
+        }
+        const int v = h[3];
+        if (e != 0 || v < 2 || v > 4) {
+            ::close(fd);
+            return e != 0 ? -e : EINVAL;
+        }
+        auto is_picture = [v](const detail::id3v2_frame_pos& f) {
+            return (f.flags & 0x0C) == 0
+                && memcmp(f.id, v == 2 ? "PIC" : "APIC", v == 2 ? 3 : 4) == 0;
+        };
+        // the group byte and the data length, ahead of the frame's data
+        auto prefix = [](const detail::id3v2_frame_pos& f) {
+            return CAST(uint32_t, ((f.flags & 0x40) ? 1 : 0) + ((f.flags & 0x01) ? 4 : 0));
+        };
+        id3v2_picture pic;
+
+        if (v < 4 && (h[5] & 0x80) != 0) {
+            // The frame headers are unsynchronised too: undo it all, and
+            // work out where each picture was from what was dropped.
+            std::vector<unsigned char> tag;
+            e = detail::read_id3v2_raw(fd, tag);
+            ::close(fd);
+            if (e != 0) {
+                return -e;
+            }
+            std::vector<uint32_t> dropped;
+            tag.resize(detail::ID3V2_HEADER_SIZE
+                + detail::remove_unsync(tag.data() + detail::ID3V2_HEADER_SIZE,
+                    tag.size() - detail::ID3V2_HEADER_SIZE, &dropped));
+            for (auto& d : dropped) {
+                d += detail::ID3V2_HEADER_SIZE;
+            }
+            detail::id3v2_frames(
+                tag.data(), tag.size(), [&](const detail::id3v2_frame_pos& f) {
+                    const uint32_t data = f.body + prefix(f), end = f.body + f.size;
+                    const int skip = is_picture(f) && data <= end
+                        ? detail::read_picture_header(
+                            tag.data() + data, end - data, v == 2, pic)
+                        : -1;
+                    if (skip >= 0 && pic.mime != "-->") {
+                        const size_t at = data + CAST(size_t, skip);
+                        pic.offset = CAST(int64_t, detail::unsync_offset(dropped, at));
+                        pic.length = CAST(int64_t, detail::unsync_offset(dropped, end))
+                            - pic.offset;
+                        pic.unsynchronised = true;
+                        pictures.push_back(pic);
+                    }
+                    return true;
+                });
+            return 0;
+        }
+
+        // A frame header at a time. Of a picture frame, enough of the start
+        // to get past the fields ahead of the image.
+        detail::id3v2Header hdr;
+        memcpy(static_cast<void*>(&hdr), h, detail::ID3V2_HEADER_SIZE);
+        const int64_t tag_end = (std::max)(detail::id3v2_tag_size(hdr),
+            CAST(uint32_t, detail::ID3V2_HEADER_SIZE));
+        const int hsize = detail::id3v2_frame_header_size(v);
+        const bool all_unsync = v == 4 && (h[5] & 0x80) != 0;
+        std::vector<unsigned char> buf;
+        std::vector<uint32_t> dropped;
+        for (int64_t pos = detail::id3v2_first_frame(h); pos + hsize <= tag_end;) {
+            unsigned char fh[10];
+            e = detail::pread_all(fd, fh, CAST(size_t, hsize), pos);
+            if (e != 0 || fh[0] == 0) { // the padding
+                break;
+            }
+            detail::id3v2_frame_pos f;
+            detail::read_frame_header(fh, v, f);
+            f.body = CAST(uint32_t, pos + hsize);
+            const int64_t end = CAST(int64_t, f.body) + f.size;
+            if (end > tag_end) {
+                break;
+            }
+            const int64_t data = f.body + prefix(f);
+            if (is_picture(f) && data <= end) {
+                const bool unsync = all_unsync || (f.flags & 0x02) != 0;
+                int skip = -1;
+                for (size_t want = 256; skip < 0; want *= 4) {
+                    const size_t n
+                        = CAST(size_t, (std::min)(CAST(int64_t, want), end - data));
+                    buf.resize(n);
+                    e = detail::pread_all(fd, buf.data(), n, data);
+                    if (e != 0) {
+                        break;
+                    }
+                    dropped.clear();
+                    const size_t m
+                        = unsync ? detail::remove_unsync(buf.data(), n, &dropped) : n;
+                    skip = detail::read_picture_header(buf.data(), m, v == 2, pic);
+                    if (CAST(int64_t, n) == end - data) {
+                        break;
+                    }
+                }
+                if (skip >= 0 && pic.mime != "-->") {
+                    pic.offset = data
+                        + CAST(int64_t,
+                            unsync ? detail::unsync_offset(dropped, CAST(size_t, skip))
+                                   : CAST(size_t, skip));
+                    pic.length = end - pic.offset;
+                    pic.unsynchronised = unsync;
+                    pictures.push_back(pic);
+                }
+            }
+            pos = end;
+        }
+        ::close(fd);
+        return e == my::io::NO_MORE_DATA ? 0 : -e;
+    }
+
+    // The image of pic, a picture find_id3v2_pictures() found in the file at
+    // path, with unsynchronisation undone. Returns 0, or an errno.
+    inline int read_id3v2_picture(
+        const std::string& path, const id3v2_picture& pic, std::string& image) {
+        image.clear();
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return errno;
+        }
+        image.resize(CAST(size_t, pic.length));
+        int e = detail::pread_all(fd, &image[0], image.size(), pic.offset);
+        ::close(fd);
+        if (e != 0) {
+            image.clear();
+            return e == my::io::NO_MORE_DATA ? EINVAL : -e;
+        }
+        if (pic.unsynchronised) {
+            image.resize(detail::remove_unsync(
+                reinterpret_cast<unsigned char*>(&image[0]), image.size()));
+        }
+        return 0;
+    }
+
+} // namespace mpeg
+} // namespace my
+#endif // _WIN32
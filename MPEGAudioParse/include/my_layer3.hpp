@@ -0,0 +1,1182 @@
+#pragma once
+// my_layer3.hpp
+// An MPEG 1, 2 and 2.5 Layer III decoder that works on the frames the parser
+// has already read. Hook a layer3_decoder to parser::on_frame() (or use
+// decode_file()) and each file is parsed and decoded in the one pass, with
+// no second read.
+//
+// Nearly all the time goes on the two filterbanks, the IMDCT and the
+// polyphase synthesis. Both are written as small matrix kernels
+// (l3::detail::mac_columns, synth_window): AVX when the compiler targets it
+// (-mavx, /arch:AVX), SSE on any x86-64, plain C++ anywhere else (or with
+// MY_L3_NO_SIMD defined, to compare).
+#include "my_mpeg.hpp"
+#include "my_layer3_tables.hpp"
+#include <cmath>
+#include <memory>
+#include <vector>
+#if defined(__AVX__) && !defined(MY_L3_NO_SIMD)
+#include <immintrin.h>
+#define MY_L3_AVX 1
+#endif
+#if (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)) \
+    && !defined(MY_L3_NO_SIMD)
+#include <xmmintrin.h>
+#define MY_L3_SSE 1
+#endif
+
+namespace my {
+namespace mpeg {
+    namespace l3 {
+
+        static constexpr int SBLIMIT = 32;
+        static constexpr int SSLIMIT = 18;
+        static constexpr int GRANULE_SAMPLES = SBLIMIT * SSLIMIT; // 576
+        static constexpr int MAX_MAIN_DATA_BEGIN = 511;
+
+        static constexpr uint8_t SLEN[2][16]
+            = {{0, 0, 0, 0, 3, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4},
+                {0, 1, 2, 3, 0, 1, 2, 3, 1, 2, 3, 1, 2, 3, 2, 3}};
+        static constexpr uint8_t PRETAB[22]
+            = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 3, 3, 3, 2, 0};
+        // MPEG 2 scalefactor partitions: [table][long, short, mixed][partition]
+        static constexpr uint8_t NR_OF_SFB[6][3][4] = {
+            {{6, 5, 5, 5}, {9, 9, 9, 9}, {6, 9, 9, 9}},
+            {{6, 5, 7, 3}, {9, 9, 12, 6}, {6, 9, 12, 6}},
+            {{11, 10, 0, 0}, {18, 18, 0, 0}, {15, 18, 0, 0}},
+            {{7, 7, 7, 0}, {12, 12, 12, 0}, {6, 15, 12, 0}},
+            {{6, 6, 6, 3}, {12, 9, 9, 6}, {6, 12, 9, 6}},
+            {{8, 8, 5, 0}, {15, 12, 9, 0}, {6, 18, 9, 0}}};
+        static constexpr float ANTIALIAS_C[8]
+            = {-0.6f, -0.535f, -0.33f, -0.185f, -0.095f, -0.041f, -0.0142f, -0.0037f};
+
+        struct huff_table_info {
+            const huff_code* codes;
+            int dim;
+            int linbits;
+        };
+        static constexpr huff_table_info HUFF_TABLES[32] = {{nullptr, 0, 0},
+            {HUFF1, 2, 0}, {HUFF2, 3, 0}, {HUFF3, 3, 0}, {nullptr, 0, 0}, {HUFF5, 4, 0},
+            {HUFF6, 4, 0}, {HUFF7, 6, 0}, {HUFF8, 6, 0}, {HUFF9, 6, 0}, {HUFF10, 8, 0},
+            {HUFF11, 8, 0}, {HUFF12, 8, 0}, {HUFF13, 16, 0}, {nullptr, 0, 0},
+            {HUFF15, 16, 0}, {HUFF16, 16, 1}, {HUFF16, 16, 2}, {HUFF16, 16, 3},
+            {HUFF16, 16, 4}, {HUFF16, 16, 6}, {HUFF16, 16, 8}, {HUFF16, 16, 10},
+            {HUFF16, 16, 13}, {HUFF24, 16, 4}, {HUFF24, 16, 5}, {HUFF24, 16, 6},
+            {HUFF24, 16, 7}, {HUFF24, 16, 8}, {HUFF24, 16, 9}, {HUFF24, 16, 11},
+            {HUFF24, 16, 13}};
+
+        namespace detail {
+
+            // y[j] = sum over k of x[k] * m[k * nout + j], for j < nout
+            inline void mac_columns(
+                const float* m, const float* x, int nin, int nout, float* y) noexcept {
+                int j = 0;
+#ifdef MY_L3_AVX
+                for (; j + 8 <= nout; j += 8) {
+                    __m256 acc = _mm256_setzero_ps();
+                    for (int k = 0; k < nin; ++k) {
+                        acc = _mm256_add_ps(acc,
+                            _mm256_mul_ps(
+                                _mm256_set1_ps(x[k]), _mm256_loadu_ps(m + k * nout + j)));
+                    }
+                    _mm256_storeu_ps(y + j, acc);
+                }
+#endif
+#ifdef MY_L3_SSE
+                for (; j + 4 <= nout; j += 4) {
+                    __m128 acc = _mm_setzero_ps();
+                    for (int k = 0; k < nin; ++k) {
+                        acc = _mm_add_ps(acc,
+                            _mm_mul_ps(_mm_set1_ps(x[k]), _mm_loadu_ps(m + k * nout + j)));
+                    }
+                    _mm_storeu_ps(y + j, acc);
+                }
+#endif
+                for (; j < nout; ++j) {
+                    float acc = 0;
+                    for (int k = 0; k < nin; ++k) {
+                        acc += x[k] * m[k * nout + j];
+                    }
+                    y[j] = acc;
+                }
+            }
+
+            // The windowing half of the synthesis filterbank: 32 samples out of
+            // the last 16 V vectors (v[k] is the one from k slots ago).
+            // out[j] = sum over i < 8 of d[64i + j] * v[2i][j]
+            //                          + d[64i + 32 + j] * v[2i + 1][32 + j]
+            inline void synth_window(
+                const float* d, const float* const* v, float* out) noexcept {
+                int j = 0;
+#ifdef MY_L3_AVX
+                for (; j + 8 <= 32; j += 8) {
+                    __m256 acc = _mm256_setzero_ps();
+                    for (int i = 0; i < 8; ++i) {
+                        acc = _mm256_add_ps(acc,
+                            _mm256_mul_ps(_mm256_loadu_ps(d + 64 * i + j),
+                                _mm256_loadu_ps(v[2 * i] + j)));
+                        acc = _mm256_add_ps(acc,
+                            _mm256_mul_ps(_mm256_loadu_ps(d + 64 * i + 32 + j),
+                                _mm256_loadu_ps(v[2 * i + 1] + 32 + j)));
+                    }
+                    _mm256_storeu_ps(out + j, acc);
+                }
+#endif
+#ifdef MY_L3_SSE
+                for (; j + 4 <= 32; j += 4) {
+                    __m128 acc = _mm_setzero_ps();
+                    for (int i = 0; i < 8; ++i) {
+                        acc = _mm_add_ps(acc,
+                            _mm_mul_ps(
+                                _mm_loadu_ps(d + 64 * i + j), _mm_loadu_ps(v[2 * i] + j)));
+                        acc = _mm_add_ps(acc,
+                            _mm_mul_ps(_mm_loadu_ps(d + 64 * i + 32 + j),
+                                _mm_loadu_ps(v[2 * i + 1] + 32 + j)));
+                    }
+                    _mm_storeu_ps(out + j, acc);
+                }
+#endif
+                for (; j < 32; ++j) {
+                    float acc = 0;
+                    for (int i = 0; i < 8; ++i) {
+                        acc += d[64 * i + j] * v[2 * i][j];
+                        acc += d[64 * i + 32 + j] * v[2 * i + 1][32 + j];
+                    }
+                    out[j] = acc;
+                }
+            }
+
+            // A Huffman code as a tree of lookup tables, 8 bits a level at most.
+            struct huff_lut {
+                struct entry {
+                    uint16_t value; // leaf: the symbol. Else: the subtable
+                    uint8_t bits; // leaf: code bits left to use. Else: subtable bits
+                    uint8_t leaf;
+                };
+                std::vector<entry> t;
+                int bits = 0;
+
+                struct sym {
+                    uint32_t code;
+                    int len;
+                    uint16_t value;
+                };
+
+                void build(const std::vector<sym>& syms) {
+                    t.clear();
+                    int maxlen = 0;
+                    for (const auto& s : syms) {
+                        maxlen = (std::max)(maxlen, s.len);
+                    }
+                    bits = (std::min)(maxlen, 8);
+                    level(syms, 0, bits);
+                }
+
+                private:
+                int level(const std::vector<sym>& syms, int used, int nbits) {
+                    const int base = CAST(int, t.size());
+                    t.resize(t.size() + (size_t(1) << nbits), entry{0, 0, 1});
+                    std::vector<sym> below[256];
+                    for (const auto& s : syms) {
+                        const int left = s.len - used;
+                        const uint32_t code = s.code & ((1u << left) - 1);
+                        if (left <= nbits) {
+                            const int spread = nbits - left;
+                            for (int j = 0; j < (1 << spread); ++j) {
+                                t[CAST(size_t, base + (CAST(int, code) << spread) + j)]
+                                    = entry{s.value, CAST(uint8_t, left), 1};
+                            }
+                        } else {
+                            below[code >> (left - nbits)].push_back(s);
+                        }
+                    }
+                    for (int i = 0; i < (1 << nbits); ++i) {
+                        if (below[i].empty()) {
+                            continue;
+                        }
+                        int maxleft = 0;
+                        for (const auto& s : below[i]) {
+                            maxleft = (std::max)(maxleft, s.len - used - nbits);
+                        }
+                        const int subbits = (std::min)(maxleft, 8);
+                        const int sub = level(below[i], used + nbits, subbits);
+                        t[CAST(size_t, base + i)]
+                            = entry{CAST(uint16_t, sub), CAST(uint8_t, subbits), 0};
+                    }
+                    return base;
+                }
+            };
+
+            // Everything worked out once, and shared by all decoders.
+            struct l3_tables {
+                float pow43[8207]; // |sample| ^ (4/3), for |sample| up to 15 + 8191
+                float imdct_long[4][18 * 36]; // by block type, window folded in
+                float imdct_short[6 * 12];
+                float dct32[32 * 32];
+                float window[512]; // D[]
+                float cs[8], ca[8];
+                float is_ratio[7][2]; // MPEG 1 intensity stereo
+                float lsf_is[2][32]; // MPEG 2: io ^ n, by intensity_scale
+                huff_lut huff[32];
+                huff_lut count1[2];
+
+                l3_tables() {
+                    const double pi = 3.14159265358979323846;
+                    for (int i = 0; i < 8207; ++i) {
+                        pow43[i] = CAST(float, std::pow(CAST(double, i), 4.0 / 3.0));
+                    }
+
+                    double win[4][36];
+                    for (int i = 0; i < 36; ++i) {
+                        win[0][i] = std::sin(pi / 36 * (i + 0.5));
+                    }
+                    // start (1) and stop (3) windows: half long, half short
+                    for (int i = 0; i < 36; ++i) {
+                        win[1][i] = win[3][35 - i] = 0.0;
+                        if (i < 18) {
+                            win[1][i] = win[3][35 - i] = win[0][i];
+                        } else if (i < 24) {
+                            win[1][i] = win[3][35 - i] = 1.0;
+                        } else if (i < 30) {
+                            win[1][i] = win[3][35 - i] = std::sin(pi / 12 * (i - 18 + 0.5));
+                        }
+                        win[2][i] = 0; // short blocks have their own
+                    }
+                    for (int bt = 0; bt < 4; ++bt) {
+                        for (int k = 0; k < 18; ++k) {
+                            for (int i = 0; i < 36; ++i) {
+                                const double c
+                                    = std::cos(pi / 72 * (2 * i + 1 + 18) * (2 * k + 1));
+                                imdct_long[bt][k * 36 + i] = CAST(float, win[bt][i] * c);
+                            }
+                        }
+                    }
+                    for (int k = 0; k < 6; ++k) {
+                        for (int i = 0; i < 12; ++i) {
+                            imdct_short[k * 12 + i] = CAST(float,
+                                std::sin(pi / 12 * (i + 0.5))
+                                    * std::cos(pi / 24 * (2 * i + 1 + 6) * (2 * k + 1)));
+                        }
+                    }
+                    for (int k = 0; k < 32; ++k) {
+                        for (int j = 0; j < 32; ++j) {
+                            dct32[k * 32 + j]
+                                = CAST(float, std::cos(pi / 64 * j * (2 * k + 1)));
+                        }
+                    }
+                    for (int i = 0; i <= 256; ++i) {
+                        const float v = CAST(float, SYNTH_WINDOW[i] / 65536.0);
+                        window[i] = v;
+                        if (i != 0) {
+                            window[512 - i] = (i & 63) != 0 ? -v : v;
+                        }
+                    }
+                    for (int i = 0; i < 8; ++i) {
+                        const double c = ANTIALIAS_C[i];
+                        const double sq = std::sqrt(1.0 + c * c);
+                        cs[i] = CAST(float, 1.0 / sq);
+                        ca[i] = CAST(float, c / sq);
+                    }
+                    for (int i = 0; i < 7; ++i) {
+                        const double s = std::sin(pi / 12 * i);
+                        const double c = std::cos(pi / 12 * i);
+                        is_ratio[i][0] = CAST(float, s / (s + c));
+                        is_ratio[i][1] = CAST(float, c / (s + c));
+                    }
+                    for (int sc = 0; sc < 2; ++sc) {
+                        for (int n = 0; n < 32; ++n) {
+                            lsf_is[sc][n]
+                                = CAST(float, std::pow(2.0, -0.25 * (sc + 1) * n));
+                        }
+                    }
+
+                    std::vector<huff_lut::sym> syms;
+                    for (int i = 1; i < 32; ++i) {
+                        const auto& ht = HUFF_TABLES[i];
+                        if (ht.codes == nullptr) {
+                            continue;
+                        }
+                        if (i > 1 && ht.codes == HUFF_TABLES[i - 1].codes) {
+                            huff[i] = huff[i - 1];
+                            continue;
+                        }
+                        syms.clear();
+                        for (int x = 0; x < ht.dim; ++x) {
+                            for (int y = 0; y < ht.dim; ++y) {
+                                const auto& hc = ht.codes[x * ht.dim + y];
+                                const auto v = CAST(uint16_t, x * 16 + y);
+                                syms.push_back(huff_lut::sym{hc.code, hc.len, v});
+                            }
+                        }
+                        huff[i].build(syms);
+                    }
+                    const huff_code* quads[2] = {HUFFA, HUFFB};
+                    for (int q = 0; q < 2; ++q) {
+                        syms.clear();
+                        for (int v = 0; v < 16; ++v) {
+                            syms.push_back(huff_lut::sym{
+                                quads[q][v].code, quads[q][v].len, CAST(uint16_t, v)});
+                        }
+                        count1[q].build(syms);
+                    }
+                }
+            };
+
+            inline const l3_tables& tables() {
+                static const l3_tables t;
+                return t;
+            }
+
+            // Big-endian bit reader over a buffer with at least 8 readable
+            // bytes past its end.
+            class bit_reader {
+                const unsigned char* m_p = nullptr;
+                int m_pos = 0;
+
+                public:
+                bit_reader(const unsigned char* p, int bitpos = 0) noexcept
+                    : m_p(p), m_pos(bitpos) {}
+                uint32_t peek(int n) const noexcept {
+                    const unsigned char* q = m_p + (m_pos >> 3);
+                    const uint32_t w = (uint32_t(q[0]) << 24) | (uint32_t(q[1]) << 16)
+                        | (uint32_t(q[2]) << 8) | uint32_t(q[3]);
+                    return n == 0 ? 0 : (w << (m_pos & 7)) >> (32 - n); // n <= 24
+                }
+                void skip(int n) noexcept { m_pos += n; }
+                uint32_t get(int n) noexcept {
+                    const uint32_t v = peek(n);
+                    m_pos += n;
+                    return v;
+                }
+                int pos() const noexcept { return m_pos; }
+                void seek(int bitpos) noexcept { m_pos = bitpos; }
+
+                int decode(const huff_lut& lut) noexcept {
+                    const huff_lut::entry* t = lut.t.data();
+                    int base = 0;
+                    int bits = lut.bits;
+                    while (true) {
+                        const auto& e = t[base + CAST(int, peek(bits))];
+                        if (e.leaf) {
+                            m_pos += e.bits;
+                            return e.value;
+                        }
+                        m_pos += bits;
+                        base = e.value;
+                        bits = e.bits;
+                    }
+                }
+            };
+
+            struct granule_info {
+                int part2_3_length = 0;
+                int big_values = 0;
+                int global_gain = 0;
+                int scalefac_compress = 0;
+                int window_switching = 0;
+                int block_type = 0;
+                int mixed = 0;
+                int table_select[3] = {0};
+                int subblock_gain[3] = {0};
+                int region0_count = 0;
+                int region1_count = 0;
+                int preflag = 0;
+                int scalefac_scale = 0;
+                int count1table = 0;
+                bool short_blocks() const noexcept {
+                    return window_switching && block_type == 2;
+                }
+            };
+
+            struct side_info {
+                int main_data_begin = 0;
+                int scfsi[2][4] = {{0}};
+                granule_info gr[2][2];
+            };
+
+            // bytes of side info in a frame with nch channels
+            inline int side_info_size(bool lsf, int nch) noexcept {
+                return lsf ? (nch == 1 ? 9 : 17) : (nch == 1 ? 17 : 32);
+            }
+
+            // The side info (after the header, and the CRC if any) of a frame
+            // with nch channels, MPEG 2 or 2.5 if lsf.
+            inline void read_side_info(
+                const unsigned char* side, bool lsf, int nch, side_info& si) noexcept {
+                bit_reader br(side);
+                if (lsf) {
+                    si.main_data_begin = CAST(int, br.get(8));
+                    br.skip(nch == 1 ? 1 : 2);
+                } else {
+                    si.main_data_begin = CAST(int, br.get(9));
+                    br.skip(nch == 1 ? 5 : 3);
+                    for (int ch = 0; ch < nch; ++ch) {
+                        for (int i = 0; i < 4; ++i) {
+                            si.scfsi[ch][i] = CAST(int, br.get(1));
+                        }
+                    }
+                }
+                const int ngr = lsf ? 1 : 2;
+                for (int gr = 0; gr < ngr; ++gr) {
+                    for (int ch = 0; ch < nch; ++ch) {
+                        auto& gi = si.gr[gr][ch];
+                        gi.part2_3_length = CAST(int, br.get(12));
+                        gi.big_values = (std::min)(CAST(int, br.get(9)), 288);
+                        gi.global_gain = CAST(int, br.get(8));
+                        gi.scalefac_compress = CAST(int, br.get(lsf ? 9 : 4));
+                        gi.window_switching = CAST(int, br.get(1));
+                        if (gi.window_switching) {
+                            gi.block_type = CAST(int, br.get(2));
+                            gi.mixed = CAST(int, br.get(1));
+                            gi.table_select[0] = CAST(int, br.get(5));
+                            gi.table_select[1] = CAST(int, br.get(5));
+                            gi.table_select[2] = 0;
+                            for (int w = 0; w < 3; ++w) {
+                                gi.subblock_gain[w] = CAST(int, br.get(3));
+                            }
+                            gi.region0_count = gi.block_type == 2 && !gi.mixed ? 8 : 7;
+                            gi.region1_count = 36;
+                        } else {
+                            gi.block_type = 0;
+                            gi.mixed = 0;
+                            for (int r = 0; r < 3; ++r) {
+                                gi.table_select[r] = CAST(int, br.get(5));
+                            }
+                            gi.subblock_gain[0] = 0;
+                            gi.subblock_gain[1] = gi.subblock_gain[2] = 0;
+                            gi.region0_count = CAST(int, br.get(4));
+                            gi.region1_count = CAST(int, br.get(3));
+                        }
+                        gi.preflag = lsf ? 0 : CAST(int, br.get(1));
+                        gi.scalefac_scale = CAST(int, br.get(1));
+                        gi.count1table = CAST(int, br.get(1));
+                    }
+                }
+            }
+
+        } // namespace detail
+    } // namespace l3
+
+    class layer3_decoder {
+        public:
+        static constexpr int MAX_CHANNELS = 2;
+        static constexpr int MAX_SAMPLES = 1152;
+        using pcm_type = float[MAX_CHANNELS][MAX_SAMPLES];
+
+        layer3_decoder() { reset(); }
+
+        // Forget everything: the next frame starts a new stream.
+        void reset() noexcept {
+            memset(m_overlap, 0, sizeof(m_overlap));
+            memset(m_v, 0, sizeof(m_v));
+            m_slot[0] = m_slot[1] = 0;
+            m_res_len = 0;
+            m_next_pos = -1;
+            m_channels = 0;
+            m_samplerate = 0;
+        }
+
+        // Decodes one whole frame, header and all, to planar float PCM in
+        // [-1, 1]. file_position is used to notice skipped data (a resync gap),
+        // after which the bit reservoir can't be trusted.
+        // Returns the samples per channel (1152, or 576 for MPEG 2 and 2.5), or
+        // -1 if this is not a Layer III frame we can decode. A frame whose
+        // main data starts before what we have seen (the first frame after a
+        // seek or gap) comes out as silence, to keep the timing.
+        int decode(const unsigned char* data, int len, int64_t file_position,
+            pcm_type& pcm) noexcept {
+            using namespace l3;
+            if (len < 4 || data[0] != 0xFF || (data[1] & 0xE0) != 0xE0
+                || ((data[1] >> 1) & 3) != 1) {
+                return -1;
+            }
+            const int version_bits = (data[1] >> 3) & 3; // 3: 1, 2: 2, 0: 2.5
+            const int sr_index = (data[2] >> 2) & 3;
+            if (version_bits == 1 || sr_index == 3) {
+                return -1;
+            }
+            m_lsf = version_bits != 3;
+            const int sfb_set
+                = (version_bits == 3 ? 0 : version_bits == 2 ? 3 : 6) + sr_index;
+            m_sfb = &SFB_BANDS[sfb_set];
+            static constexpr int RATES[9]
+                = {44100, 48000, 32000, 22050, 24000, 16000, 11025, 12000, 8000};
+            m_samplerate = RATES[sfb_set];
+            const int mode = data[3] >> 6;
+            m_mode_ext = (data[3] >> 4) & 3;
+            m_joint = mode == mpeg::detail::CHANNELS_JOINT_STEREO;
+            m_channels = mode == mpeg::detail::CHANNELS_SINGLE_CHANNEL ? 1 : 2;
+            const int ngr = m_lsf ? 1 : 2;
+            const int nsamples = ngr * GRANULE_SAMPLES;
+
+            const int side_start = (data[1] & 1) ? 4 : 6; // CRC
+            const int side_len = l3::detail::side_info_size(m_lsf, m_channels);
+            const int main_len = len - side_start - side_len;
+            if (main_len < 0) {
+                return -1;
+            }
+            if (file_position >= 0 && file_position != m_next_pos) {
+                m_res_len = 0;
+            }
+            m_next_pos = file_position >= 0 ? file_position + len : -1;
+
+            unsigned char side[40] = {0};
+            memcpy(side, data + side_start, CAST(size_t, side_len));
+            l3::detail::read_side_info(side, m_lsf, m_channels, m_si);
+
+            const unsigned char* main_data = data + side_start + side_len;
+            const int mdb = m_si.main_data_begin;
+            const bool have_all = mdb <= m_res_len;
+            int main_total = 0;
+            if (have_all) {
+                memcpy(m_main, m_res + m_res_len - mdb, CAST(size_t, mdb));
+                memcpy(m_main + mdb, main_data, CAST(size_t, main_len));
+                main_total = mdb + main_len;
+                memset(m_main + main_total, 0, MAIN_SLACK);
+            }
+            keep_reservoir(main_data, main_len);
+
+            if (!have_all) {
+                for (int ch = 0; ch < m_channels; ++ch) {
+                    memset(pcm[ch], 0, sizeof(float) * CAST(size_t, nsamples));
+                }
+                return nsamples;
+            }
+
+            const int main_bits = main_total * 8;
+            int bitpos = 0;
+            for (int gr = 0; gr < ngr; ++gr) {
+                for (int ch = 0; ch < m_channels; ++ch) {
+                    const auto& gi = m_si.gr[gr][ch];
+                    const int part_end = (std::min)(bitpos + gi.part2_3_length, main_bits);
+                    l3::detail::bit_reader br(m_main, bitpos);
+                    if (m_lsf) {
+                        read_scalefactors_lsf(br, gi, ch);
+                    } else {
+                        read_scalefactors(br, gi, gr, ch);
+                    }
+                    read_huffman(br, gi, ch, part_end);
+                    requantize(gi, ch);
+                    bitpos += gi.part2_3_length;
+                }
+                if (m_channels == 2 && m_joint && m_mode_ext != 0) {
+                    stereo(m_si.gr[gr][1]);
+                    // either channel may now have lines the other had
+                    m_nonzero[0] = m_nonzero[1] = (std::max)(m_nonzero[0], m_nonzero[1]);
+                }
+                for (int ch = 0; ch < m_channels; ++ch) {
+                    const auto& gi = m_si.gr[gr][ch];
+                    reorder(gi, ch);
+                    antialias(gi, ch);
+                    imdct(gi, ch);
+                    synthesis(ch, pcm[ch] + gr * GRANULE_SAMPLES);
+                }
+            }
+            return nsamples;
+        }
+
+        int decode(const frame_base& f, pcm_type& pcm) noexcept {
+            const int len = (std::min)(f.length_in_bytes(), f.bytes_size());
+            return decode(f.bytes(), len, f.file_position, pcm);
+        }
+
+        // of the last frame decoded
+        int channels() const noexcept { return m_channels; }
+        int samplerate() const noexcept { return m_samplerate; }
+
+        private:
+        static constexpr int MAIN_SLACK = 64;
+        static constexpr int MAX_FRAME = 2881; // 320k, 32kHz (+ padding)
+
+        l3::detail::side_info m_si;
+        const l3::sfb_bands* m_sfb = nullptr;
+        bool m_lsf = false;
+        bool m_joint = false;
+        int m_mode_ext = 0;
+        int m_channels = 0;
+        int m_samplerate = 0;
+        int64_t m_next_pos = -1;
+
+        unsigned char m_res[l3::MAX_MAIN_DATA_BEGIN + 8];
+        int m_res_len = 0;
+        unsigned char m_main[l3::MAX_MAIN_DATA_BEGIN + MAX_FRAME + MAIN_SLACK];
+
+        int m_sfl[2][22];
+        int m_sfs[2][13][3];
+        // MPEG 2 intensity stereo: the scalefactor value that means "illegal
+        // position" in each band of the right channel
+        int m_ismax_l[22];
+        int m_ismax_s[13];
+        int m_lsf_preflag[2];
+
+        int m_is[576];
+        float m_xr[2][576];
+        int m_nonzero[2];
+        float m_overlap[2][l3::SBLIMIT][l3::SSLIMIT];
+        float m_time[2][l3::SSLIMIT][l3::SBLIMIT];
+        float m_v[2][16][64]; // the last 16 V vectors: a ring, newest at m_slot
+        int m_slot[2];
+
+        void keep_reservoir(const unsigned char* p, int n) noexcept {
+            static constexpr int RES = l3::MAX_MAIN_DATA_BEGIN;
+            if (n >= RES) {
+                memcpy(m_res, p + n - RES, RES);
+                m_res_len = RES;
+                return;
+            }
+            const int keep = (std::min)(m_res_len, RES - n);
+            memmove(m_res, m_res + m_res_len - keep, CAST(size_t, keep));
+            memcpy(m_res + keep, p, CAST(size_t, n));
+            m_res_len = keep + n;
+        }
+
+        void read_scalefactors(l3::detail::bit_reader& br,
+            const l3::detail::granule_info& gi, int gr, int ch) {
+            using namespace l3;
+            const int slen1 = SLEN[0][gi.scalefac_compress];
+            const int slen2 = SLEN[1][gi.scalefac_compress];
+            auto& sfl = m_sfl[ch];
+            auto& sfs = m_sfs[ch];
+            if (gi.short_blocks()) {
+                int sfb = 0;
+                if (gi.mixed) {
+                    for (; sfb < 8; ++sfb) {
+                        sfl[sfb] = CAST(int, br.get(slen1));
+                    }
+                    sfb = 3;
+                }
+                for (; sfb < 12; ++sfb) {
+                    const int n = sfb < 6 ? slen1 : slen2;
+                    for (int w = 0; w < 3; ++w) {
+                        sfs[sfb][w] = CAST(int, br.get(n));
+                    }
+                }
+                sfs[12][0] = sfs[12][1] = sfs[12][2] = 0;
+                return;
+            }
+            static constexpr int GROUPS[5] = {0, 6, 11, 16, 21};
+            for (int g = 0; g < 4; ++g) {
+                if (gr == 1 && m_si.scfsi[ch][g]) {
+                    continue; // same as granule 0
+                }
+                const int n = g < 2 ? slen1 : slen2;
+                for (int sfb = GROUPS[g]; sfb < GROUPS[g + 1]; ++sfb) {
+                    sfl[sfb] = CAST(int, br.get(n));
+                }
+            }
+            sfl[21] = 0;
+        }
+
+        void read_scalefactors_lsf(
+            l3::detail::bit_reader& br, const l3::detail::granule_info& gi, int ch) {
+            using namespace l3;
+            int sfc = gi.scalefac_compress;
+            int slen[4] = {0};
+            int tab = 0;
+            int preflag = 0;
+            const bool is_right = ch == 1 && m_joint && (m_mode_ext & 1);
+            if (!is_right) {
+                if (sfc < 400) {
+                    slen[0] = (sfc >> 4) / 5;
+                    slen[1] = (sfc >> 4) % 5;
+                    slen[2] = (sfc & 15) >> 2;
+                    slen[3] = sfc & 3;
+                } else if (sfc < 500) {
+                    sfc -= 400;
+                    slen[0] = (sfc >> 2) / 5;
+                    slen[1] = (sfc >> 2) % 5;
+                    slen[2] = sfc & 3;
+                    tab = 1;
+                } else {
+                    sfc -= 500;
+                    slen[0] = sfc / 3;
+                    slen[1] = sfc % 3;
+                    tab = 2;
+                    preflag = 1;
+                }
+            } else {
+                sfc >>= 1;
+                if (sfc < 180) {
+                    slen[0] = sfc / 36;
+                    slen[1] = (sfc % 36) / 6;
+                    slen[2] = (sfc % 36) % 6;
+                    tab = 3;
+                } else if (sfc < 244) {
+                    sfc -= 180;
+                    slen[0] = (sfc & 63) >> 4;
+                    slen[1] = (sfc & 15) >> 2;
+                    slen[2] = sfc & 3;
+                    tab = 4;
+                } else {
+                    sfc -= 244;
+                    slen[0] = sfc / 3;
+                    slen[1] = sfc % 3;
+                    tab = 5;
+                }
+            }
+            m_lsf_preflag[ch] = preflag;
+
+            const int blocks = gi.short_blocks() ? (gi.mixed ? 2 : 1) : 0;
+            int values[40];
+            int maxes[40];
+            int n = 0;
+            for (int part = 0; part < 4; ++part) {
+                for (int i = 0; i < NR_OF_SFB[tab][blocks][part]; ++i) {
+                    values[n] = CAST(int, br.get(slen[part]));
+                    maxes[n++] = (1 << slen[part]) - 1;
+                }
+            }
+            for (int i = n; i < 40; ++i) {
+                values[i] = 0;
+                maxes[i] = 0;
+            }
+
+            auto& sfl = m_sfl[ch];
+            auto& sfs = m_sfs[ch];
+            int k = 0;
+            if (blocks == 0) {
+                for (int sfb = 0; sfb < 21; ++sfb, ++k) {
+                    sfl[sfb] = values[k];
+                    m_ismax_l[sfb] = maxes[k];
+                }
+                sfl[21] = 0;
+                m_ismax_l[21] = m_ismax_l[20];
+                return;
+            }
+            int sfb = 0;
+            if (blocks == 2) {
+                for (; sfb < 6; ++sfb, ++k) {
+                    sfl[sfb] = values[k];
+                    m_ismax_l[sfb] = maxes[k];
+                }
+                sfb = 3;
+            }
+            for (; sfb < 12; ++sfb) {
+                for (int w = 0; w < 3; ++w, ++k) {
+                    sfs[sfb][w] = values[k];
+                }
+                m_ismax_s[sfb] = maxes[k - 1];
+            }
+            sfs[12][0] = sfs[12][1] = sfs[12][2] = 0;
+            m_ismax_s[12] = m_ismax_s[11];
+        }
+
+        void read_huffman(l3::detail::bit_reader& br, const l3::detail::granule_info& gi,
+            int ch, int part_end) noexcept {
+            using namespace l3;
+            const auto& t = l3::detail::tables();
+            int* is = m_is;
+            const int big_end = gi.big_values * 2;
+            int region1, region2;
+            if (gi.window_switching) {
+                region1 = gi.block_type == 2 ? m_sfb->s[3] * 3 : m_sfb->l[8];
+                region2 = GRANULE_SAMPLES;
+            } else {
+                region1 = m_sfb->l[(std::min)(gi.region0_count + 1, 22)];
+                region2 = m_sfb->l[(std::min)(gi.region0_count + gi.region1_count + 2, 22)];
+            }
+            const int ends[3] = {(std::min)(region1, big_end), (std::min)(region2, big_end),
+                big_end};
+
+            int i = 0;
+            for (int r = 0; r < 3; ++r) {
+                const int tab = gi.table_select[r];
+                const int end = (std::max)(ends[r], i);
+                const auto& info = HUFF_TABLES[tab];
+                if (info.codes == nullptr) {
+                    for (; i < end; ++i) {
+                        is[i] = 0;
+                    }
+                    continue;
+                }
+                const auto& lut = t.huff[tab];
+                const int linbits = info.linbits;
+                for (; i < end; i += 2) {
+                    const int v = br.decode(lut);
+                    int x = v >> 4;
+                    int y = v & 15;
+                    if (x != 0) {
+                        if (x == 15 && linbits) {
+                            x += CAST(int, br.get(linbits));
+                        }
+                        if (br.get(1)) {
+                            x = -x;
+                        }
+                    }
+                    if (y != 0) {
+                        if (y == 15 && linbits) {
+                            y += CAST(int, br.get(linbits));
+                        }
+                        if (br.get(1)) {
+                            y = -y;
+                        }
+                    }
+                    is[i] = x;
+                    is[i + 1] = y;
+                    if (br.pos() > part_end) {
+                        i += 2;
+                        break; // damaged: don't wander off into the next granule
+                    }
+                }
+            }
+
+            const auto& quad = t.count1[gi.count1table];
+            while (i + 4 <= GRANULE_SAMPLES && br.pos() < part_end) {
+                const int v = br.decode(quad);
+                int q[4] = {(v >> 3) & 1, (v >> 2) & 1, (v >> 1) & 1, v & 1};
+                for (int j = 0; j < 4; ++j) {
+                    if (q[j] && br.get(1)) {
+                        q[j] = -1;
+                    }
+                }
+                if (br.pos() > part_end) {
+                    break; // the last one ran over: it was padding
+                }
+                is[i] = q[0];
+                is[i + 1] = q[1];
+                is[i + 2] = q[2];
+                is[i + 3] = q[3];
+                i += 4;
+            }
+            m_nonzero[ch] = i;
+            for (; i < GRANULE_SAMPLES; ++i) {
+                is[i] = 0;
+            }
+        }
+
+        static float gain(int quarter_steps) noexcept {
+            static constexpr float POW2Q[4] = {1.0f, 1.18920712f, 1.41421356f, 1.68179283f};
+            return std::ldexp(POW2Q[quarter_steps & 3], quarter_steps >> 2);
+        }
+
+        static float dequant(int v, float g, const float* pow43) noexcept {
+            return v >= 0 ? pow43[v] * g : -pow43[-v] * g;
+        }
+
+        void requantize(const l3::detail::granule_info& gi, int ch) noexcept {
+            const auto& t = l3::detail::tables();
+            float* xr = m_xr[ch];
+            const int n = m_nonzero[ch];
+            const int base = gi.global_gain - 210;
+            const int shift = gi.scalefac_scale ? 4 : 2;
+            const int preflag = m_lsf ? m_lsf_preflag[ch] : gi.preflag;
+            const auto& sfb_l = m_sfb->l;
+            const auto& sfb_s = m_sfb->s;
+
+            int i = 0;
+            int long_end = GRANULE_END;
+            int short_sfb = 0;
+            if (gi.short_blocks()) {
+                long_end = gi.mixed ? sfb_l[m_lsf ? 6 : 8] : 0;
+                short_sfb = gi.mixed ? 3 : 0;
+            }
+            for (int sfb = 0; i < long_end && i < n; ++sfb) {
+                const int sf = m_sfl[ch][sfb] + (preflag ? l3::PRETAB[sfb] : 0);
+                const float g = gain(base - sf * shift);
+                const int end = (std::min)(CAST(int, sfb_l[sfb + 1]), long_end);
+                for (; i < end; ++i) {
+                    xr[i] = dequant(m_is[i], g, t.pow43);
+                }
+            }
+            if (long_end < GRANULE_END) {
+                i = long_end;
+                for (int sfb = short_sfb; sfb < 13 && i < n; ++sfb) {
+                    const int width = sfb_s[sfb + 1] - sfb_s[sfb];
+                    for (int w = 0; w < 3; ++w) {
+                        const float g = gain(
+                            base - 8 * gi.subblock_gain[w] - m_sfs[ch][sfb][w] * shift);
+                        for (int j = 0; j < width; ++j, ++i) {
+                            xr[i] = dequant(m_is[i], g, t.pow43);
+                        }
+                    }
+                }
+            }
+            for (i = (std::min)(i, n); i < GRANULE_END; ++i) {
+                xr[i] = 0;
+            }
+        }
+
+        static constexpr int GRANULE_END = l3::GRANULE_SAMPLES;
+
+        // mid/side on [from, to)
+        void ms(int from, int to) noexcept {
+            static constexpr float R = 0.70710678f;
+            float* l = m_xr[0];
+            float* r = m_xr[1];
+            for (int i = from; i < to; ++i) {
+                const float m = l[i];
+                const float s = r[i];
+                l[i] = (m + s) * R;
+                r[i] = (m - s) * R;
+            }
+        }
+
+        // intensity stereo on [from, to), position pos, or mid/side if pos
+        // is illegal: illegal and up, as a 4 bit MPEG 1 scalefactor can say
+        // up to 15 where only 0 to 6 are positions
+        void intensity(int from, int to, int pos, int illegal, bool is_ms,
+            int intensity_scale) noexcept {
+            const auto& t = l3::detail::tables();
+            if (pos >= illegal) {
+                if (is_ms) {
+                    ms(from, to);
+                }
+                return;
+            }
+            float kl, kr;
+            if (!m_lsf) {
+                kl = t.is_ratio[pos][0];
+                kr = t.is_ratio[pos][1];
+            } else if (pos == 0) {
+                kl = kr = 1.0f;
+            } else if (pos & 1) {
+                kl = t.lsf_is[intensity_scale][(pos + 1) >> 1];
+                kr = 1.0f;
+            } else {
+                kl = 1.0f;
+                kr = t.lsf_is[intensity_scale][pos >> 1];
+            }
+            float* l = m_xr[0];
+            float* r = m_xr[1];
+            for (int i = from; i < to; ++i) {
+                const float v = l[i];
+                l[i] = v * kl;
+                r[i] = v * kr;
+            }
+        }
+
+        void stereo(const l3::detail::granule_info& gi) noexcept {
+            const bool is_ms = (m_mode_ext & 2) != 0;
+            const int nz = (std::max)(m_nonzero[0], m_nonzero[1]);
+            if (!(m_mode_ext & 1)) {
+                ms(0, nz);
+                return;
+            }
+            const float* r = m_xr[1];
+            const int iscale = gi.scalefac_compress & 1;
+            const auto& sfb_l = m_sfb->l;
+            const auto& sfb_s = m_sfb->s;
+            auto illegal_l = [&](int sfb) { return m_lsf ? m_ismax_l[sfb] : 7; };
+            auto illegal_s = [&](int sfb) { return m_lsf ? m_ismax_s[sfb] : 7; };
+
+            int long_end = GRANULE_END;
+            if (gi.short_blocks()) {
+                long_end = gi.mixed ? sfb_l[m_lsf ? 6 : 8] : 0;
+                const int first = gi.mixed ? 3 : 0;
+                bool right_in_short = false;
+                for (int w = 0; w < 3; ++w) {
+                    // the right channel is coded up to the last band it has a
+                    // non zero line in: intensity above that
+                    int is_from = first;
+                    for (int sfb = 12; sfb >= first; --sfb) {
+                        const int width = sfb_s[sfb + 1] - sfb_s[sfb];
+                        const int start = sfb_s[sfb] * 3 + w * width;
+                        bool any = false;
+                        for (int j = 0; j < width && !any; ++j) {
+                            any = r[start + j] != 0.0f;
+                        }
+                        if (any) {
+                            is_from = sfb + 1;
+                            right_in_short = true;
+                            break;
+                        }
+                    }
+                    for (int sfb = first; sfb < 13; ++sfb) {
+                        const int width = sfb_s[sfb + 1] - sfb_s[sfb];
+                        const int start = sfb_s[sfb] * 3 + w * width;
+                        if (sfb < is_from) {
+                            if (is_ms) {
+                                ms(start, start + width);
+                            }
+                        } else {
+                            const int src = sfb < 12 ? sfb : 11;
+                            intensity(start, start + width, m_sfs[1][src][w],
+                                illegal_s(src), is_ms, iscale);
+                        }
+                    }
+                }
+                if (long_end == 0) {
+                    return;
+                }
+                if (right_in_short) {
+                    if (is_ms) {
+                        ms(0, long_end);
+                    }
+                    return;
+                }
+            }
+
+            int last = -1;
+            for (int i = long_end - 1; i >= 0; --i) {
+                if (r[i] != 0.0f) {
+                    last = i;
+                    break;
+                }
+            }
+            const int nbands = long_end == GRANULE_END ? 22 : (m_lsf ? 6 : 8);
+            for (int sfb = 0; sfb < nbands; ++sfb) {
+                const int start = sfb_l[sfb];
+                const int end = sfb_l[sfb + 1];
+                if (start <= last) {
+                    if (is_ms) {
+                        ms(start, end);
+                    }
+                } else {
+                    const int src = sfb < 21 ? sfb : 20;
+                    intensity(start, end, m_sfl[1][src], illegal_l(src), is_ms, iscale);
+                }
+            }
+        }
+
+        // short block lines come window by window in each band: the IMDCT
+        // wants them interleaved
+        void reorder(const l3::detail::granule_info& gi, int ch) noexcept {
+            if (!gi.short_blocks()) {
+                return;
+            }
+            float* xr = m_xr[ch];
+            float tmp[GRANULE_END];
+            const auto& sfb_s = m_sfb->s;
+            const int first = gi.mixed ? 3 : 0;
+            const int from = sfb_s[first] * 3;
+            for (int sfb = first; sfb < 13; ++sfb) {
+                const int start = sfb_s[sfb] * 3;
+                const int width = sfb_s[sfb + 1] - sfb_s[sfb];
+                for (int w = 0; w < 3; ++w) {
+                    for (int j = 0; j < width; ++j) {
+                        tmp[start + 3 * j + w] = xr[start + w * width + j];
+                    }
+                }
+            }
+            memcpy(xr + from, tmp + from, sizeof(float) * CAST(size_t, GRANULE_END - from));
+            // lines have moved up, to anywhere in their band
+            int& nz = m_nonzero[ch];
+            for (int sfb = first; sfb < 13; ++sfb) {
+                if (sfb_s[sfb] * 3 < nz) {
+                    nz = (std::max)(nz, sfb_s[sfb + 1] * 3);
+                }
+            }
+        }
+
+        void antialias(const l3::detail::granule_info& gi, int ch) noexcept {
+            int sblimit = l3::SBLIMIT;
+            if (gi.short_blocks()) {
+                if (!gi.mixed) {
+                    return;
+                }
+                sblimit = 2;
+            } else {
+                // nothing to do above the last non zero line
+                sblimit = (std::min)(l3::SBLIMIT, (m_nonzero[ch] + 7) / l3::SSLIMIT + 1);
+            }
+            const auto& t = l3::detail::tables();
+            float* xr = m_xr[ch];
+            for (int sb = 1; sb < sblimit; ++sb) {
+                float* lo = xr + sb * l3::SSLIMIT;
+                for (int i = 0; i < 8; ++i) {
+                    const float a = lo[-1 - i];
+                    const float b = lo[i];
+                    lo[-1 - i] = a * t.cs[i] - b * t.ca[i];
+                    lo[i] = b * t.cs[i] + a * t.ca[i];
+                }
+            }
+        }
+
+        void imdct(const l3::detail::granule_info& gi, int ch) noexcept {
+            using namespace l3;
+            const auto& t = l3::detail::tables();
+            const float* xr = m_xr[ch];
+            // past the last non zero line (give or take the antialias
+            // butterflies) all that's left is the overlap
+            const int active = (std::min)(SBLIMIT, (m_nonzero[ch] + 7) / SSLIMIT + 1);
+            alignas(32) float y[36];
+            for (int sb = 0; sb < SBLIMIT; ++sb) {
+                float* ov = m_overlap[ch][sb];
+                if (sb >= active) {
+                    for (int i = 0; i < SSLIMIT; ++i) {
+                        m_time[ch][i][sb] = ov[i];
+                        ov[i] = 0;
+                    }
+                    continue;
+                }
+                const float* x = xr + sb * SSLIMIT;
+                const int bt
+                    = gi.window_switching && !(gi.mixed && sb < 2) ? gi.block_type : 0;
+                if (bt == 2) {
+                    float xw[6];
+                    float yw[12];
+                    for (int i = 0; i < 36; ++i) {
+                        y[i] = 0;
+                    }
+                    for (int w = 0; w < 3; ++w) {
+                        for (int k = 0; k < 6; ++k) {
+                            xw[k] = x[3 * k + w];
+                        }
+                        l3::detail::mac_columns(t.imdct_short, xw, 6, 12, yw);
+                        for (int i = 0; i < 12; ++i) {
+                            y[6 + 6 * w + i] += yw[i];
+                        }
+                    }
+                } else {
+                    l3::detail::mac_columns(t.imdct_long[bt], x, 18, 36, y);
+                }
+                for (int i = 0; i < SSLIMIT; ++i) {
+                    m_time[ch][i][sb] = y[i] + ov[i];
+                    ov[i] = y[i + SSLIMIT];
+                }
+            }
+            // frequency inversion: odd subbands, odd time slots
+            for (int i = 1; i < SSLIMIT; i += 2) {
+                for (int sb = 1; sb < SBLIMIT; sb += 2) {
+                    m_time[ch][i][sb] = -m_time[ch][i][sb];
+                }
+            }
+        }
+
+        void synthesis(int ch, float* out) noexcept {
+            const auto& t = l3::detail::tables();
+            alignas(32) float x[32];
+            for (int s = 0; s < l3::SSLIMIT; ++s) {
+                // matrixing: a 32 point DCT, unfolded into the 64 V values
+                l3::detail::mac_columns(t.dct32, m_time[ch][s], 32, 32, x);
+                int& slot = m_slot[ch];
+                slot = (slot - 1) & 15;
+                float* v = m_v[ch][slot];
+                for (int i = 0; i < 16; ++i) {
+                    v[i] = x[i + 16];
+                }
+                v[16] = 0;
+                for (int i = 17; i < 48; ++i) {
+                    v[i] = -x[48 - i];
+                }
+                for (int i = 48; i < 64; ++i) {
+                    v[i] = -x[i - 48];
+                }
+                const float* vs[16];
+                for (int k = 0; k < 16; ++k) {
+                    vs[k] = m_v[ch][(slot + k) & 15];
+                }
+                l3::detail::synth_window(t.window, vs, out + s * 32);
+            }
+        }
+    };
+
+    // Parses and decodes the file at path in one pass. sink is called for
+    // each frame as sink(const layer3_decoder::pcm_type& pcm, int nsamples,
+    // int nchannels, int samplerate). Frames that aren't Layer III are
+    // skipped.
+    template <typename SINK>
+    error decode_file(const std::string& path, SINK&& sink, parse_summary& summary) {
+        layer3_decoder dec;
+        std::unique_ptr<layer3_decoder::pcm_type[]> pcm(new layer3_decoder::pcm_type[1]);
+        return parse_file(path, summary, false, [&](const frame& f) {
+            const int n = dec.decode(f, pcm[0]);
+            if (n > 0) {
+                sink(static_cast<const layer3_decoder::pcm_type&>(pcm[0]), n,
+                    dec.channels(), dec.samplerate());
+            }
+        });
+    }
+
+} // namespace mpeg
+} // namespace my
@@ -0,0 +1,262 @@
+#pragma once
+// my_level.hpp
+// Finding dead air without decoding. Each MPEG frame says how loud it is
+// before any of its samples: Layer I and II give a scale factor for every
+// subband that has bits at all, and Layer III gives each granule a global
+// gain (the requantizer's step) and the bits its spectrum took. level_db()
+// turns that into the level of the louder channel, in dB from full scale,
+// from the first couple of hundred bytes of the frame; a frame with nothing
+// coded in it is LEVEL_SILENT.
+//
+// It is an estimate. For Layer III it is fitted against layer3_decoder, and
+// is off by about 7 dB a frame on average over the test clip (test_level
+// allows 8): enough to tell programme from a feed that has gone quiet, not
+// a loudness meter.
+//
+// level_meter takes the frames in order (from parser::on_frame()) and keeps
+// the runs at or under a threshold, as (start sample, end sample, level).
+#include "my_layer3.hpp"
+#include <cmath>
+#include <vector>
+
+namespace my {
+namespace mpeg {
+
+    // what level_db() says of a frame with no audio coded in it
+    static constexpr float LEVEL_SILENT = -144.0f;
+
+    namespace detail {
+        // Layer II bits of allocation per subband: ISO 11172-3 tables B.2a
+        // to d, then 13818-3 B.1 (MPEG 2 and 2.5)
+        struct l2_alloc_table {
+            int sblimit;
+            uint8_t nbal[30];
+        };
+        static constexpr l2_alloc_table L2_ALLOC[5] = {
+            {27, {4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 2,
+                     2, 2, 2}},
+            {30, {4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 2,
+                     2, 2, 2, 2, 2, 2}},
+            {8, {4, 4, 3, 3, 3, 3, 3, 3}},
+            {12, {4, 4, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3}},
+            {30, {4, 4, 4, 4, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+                     2, 2, 2, 2, 2, 2}}};
+
+        // Which of L2_ALLOC a frame uses: it goes by the bitrate per channel.
+        inline int l2_alloc_index(const mpeg_properties& p, int nch) noexcept {
+            if (p.version != 1) {
+                return 4;
+            }
+            const int kbps = p.bitrate / 1000 / nch;
+            if (kbps <= 48) {
+                return p.samplerate == 32000 ? 3 : 2;
+            }
+            return kbps <= 80 || p.samplerate == 48000 ? 0 : 1;
+        }
+
+        // The power of a sine whose peak is scale factor i (2 * 2^(-i/3)).
+        inline float scalefactor_power(int i) noexcept {
+            static const struct table {
+                float p[64];
+                table() noexcept {
+                    for (int k = 0; k < 64; ++k) {
+                        const double a = 2.0 * std::exp2(-k / 3.0);
+                        p[k] = CAST(float, a * a / 2);
+                    }
+                }
+            } t;
+            return t.p[i & 63];
+        }
+
+        inline float power_db(double power) noexcept {
+            return power > 0 ? (std::max)(CAST(float, 10 * std::log10(power)), LEVEL_SILENT)
+                             : LEVEL_SILENT;
+        }
+
+        // Layer I and II: the power of each channel is the sum of its
+        // subbands', each taken from its scale factor(s).
+        inline float level_db_l12(const unsigned char* data, const mpeg_properties& p) {
+            const int nch = p.channelmode == CHANNELS_SINGLE_CHANNEL ? 1 : 2;
+            const bool layer1 = p.layer == 1;
+            const l2_alloc_table* t = layer1 ? nullptr : &L2_ALLOC[l2_alloc_index(p, nch)];
+            const int sblimit = layer1 ? 32 : t->sblimit;
+            const int mode_ext = (data[3] >> 4) & 3;
+            const int bound = p.channelmode == CHANNELS_JOINT_STEREO
+                ? (std::min)(4 + 4 * mode_ext, sblimit)
+                : sblimit;
+            l3::detail::bit_reader br(data, p.crc ? 48 : 32);
+            uint8_t alloc[2][32] = {{0}};
+            for (int sb = 0; sb < sblimit; ++sb) {
+                const int bits = layer1 ? 4 : t->nbal[sb];
+                for (int ch = 0; ch < nch; ++ch) {
+                    alloc[ch][sb] = sb < bound || ch == 0 ? CAST(uint8_t, br.get(bits))
+                                                          : alloc[0][sb];
+                }
+            }
+            uint8_t scfsi[2][32] = {{0}};
+            if (!layer1) {
+                for (int sb = 0; sb < sblimit; ++sb) {
+                    for (int ch = 0; ch < nch; ++ch) {
+                        scfsi[ch][sb] = alloc[ch][sb] ? CAST(uint8_t, br.get(2)) : 0;
+                    }
+                }
+            }
+            double power[2] = {0, 0};
+            bool coded = false;
+            for (int sb = 0; sb < sblimit; ++sb) {
+                for (int ch = 0; ch < nch; ++ch) {
+                    if (alloc[ch][sb] == 0) {
+                        continue;
+                    }
+                    coded = true;
+                    if (layer1) {
+                        power[ch] += scalefactor_power(CAST(int, br.get(6)));
+                        continue;
+                    }
+                    // scfsi: which of the 3 parts share a scale factor
+                    static constexpr int NSF[4] = {3, 2, 1, 2};
+                    static constexpr int WEIGHT[4][3] = {{1, 1, 1}, {2, 1, 0}, {3, 0, 0},
+                        {1, 2, 0}};
+                    for (int k = 0; k < NSF[scfsi[ch][sb]]; ++k) {
+                        power[ch] += scalefactor_power(CAST(int, br.get(6)))
+                            * WEIGHT[scfsi[ch][sb]][k] / 3;
+                    }
+                }
+            }
+            return coded ? power_db((std::max)(power[0], power[1])) : LEVEL_SILENT;
+        }
+
+        // Layer III: the requantizer scales by 2^((global_gain - 210) / 4),
+        // 1.5 dB a step. How big the quantized values are shows in how many
+        // bits each line of the big values region took: about 18 dB each
+        // time that doubles (fitted against the decoder). A granule with no
+        // bits at all decodes to silence.
+        inline float level_db_l3(const unsigned char* data, const mpeg_properties& p) {
+            const bool lsf = p.version != 1;
+            const int nch = p.channelmode == CHANNELS_SINGLE_CHANNEL ? 1 : 2;
+            unsigned char side[40] = {0};
+            memcpy(side, data + (p.crc ? 6 : 4),
+                CAST(size_t, l3::detail::side_info_size(lsf, nch)));
+            l3::detail::side_info si;
+            l3::detail::read_side_info(side, lsf, nch, si);
+            const int ngr = lsf ? 1 : 2;
+            double power = 0;
+            bool coded = false;
+            for (int gr = 0; gr < ngr; ++gr) {
+                float loudest = LEVEL_SILENT;
+                for (int ch = 0; ch < nch; ++ch) {
+                    const auto& gi = si.gr[gr][ch];
+                    if (gi.part2_3_length == 0) {
+                        continue;
+                    }
+                    coded = true;
+                    float db = 1.5f * CAST(float, gi.global_gain - 210);
+                    if (gi.big_values > 0) {
+                        const double doublings = (std::max)(0.0,
+                            (std::min)(3.0,
+                                std::log2(CAST(double, gi.part2_3_length)
+                                    / (2 * gi.big_values))));
+                        db += 18.0f * CAST(float, doublings);
+                    }
+                    loudest = (std::max)(loudest, db);
+                }
+                power += loudest > LEVEL_SILENT ? std::pow(10.0, loudest / 10.0) : 0;
+            }
+            return coded ? power_db(power / ngr) : LEVEL_SILENT;
+        }
+    } // namespace detail
+
+    // The level of frame f (see above). NAN if it can't say: too little of
+    // the frame was read.
+    inline float level_db(const frame_base& f) {
+        static constexpr int NEED = 256; // enough for any Layer I or II header
+        const auto& p = f.props_const();
+        const int have = (std::min)(f.length_in_bytes(), f.bytes_size());
+        if (p.layer < 1 || p.layer > 3 || have < 4) {
+            return NAN;
+        }
+        // bit_reader reads 4 bytes at a time: give it slack, and zeros past
+        // the end of a short frame
+        unsigned char buf[NEED + 8] = {0};
+        memcpy(buf, f.bytes(), CAST(size_t, (std::min)(have, NEED)));
+        if (p.layer == 3) {
+            const int side = (p.crc ? 6 : 4)
+                + l3::detail::side_info_size(p.version != 1,
+                    p.channelmode == detail::CHANNELS_SINGLE_CHANNEL ? 1 : 2);
+            return have < side ? NAN : detail::level_db_l3(buf, p);
+        }
+        return detail::level_db_l12(buf, p);
+    }
+
+    struct level_run {
+        int64_t start_sample = {0}; // per channel, from the first frame
+        int64_t end_sample = {0}; // one past the last
+        float level_db = {LEVEL_SILENT}; // of the loudest frame in it
+        bool silent() const noexcept { return level_db <= LEVEL_SILENT; }
+    };
+
+    class level_meter {
+        float m_threshold_db;
+        int m_min_ms;
+        int m_samplerate = 0;
+        int64_t m_samples = 0;
+        bool m_in_run = false;
+        level_run m_run;
+        std::vector<level_run> m_runs;
+
+        void close_run() {
+            if (m_in_run && m_samplerate > 0
+                && (m_run.end_sample - m_run.start_sample) * 1000
+                    >= CAST(int64_t, m_min_ms) * m_samplerate) {
+                m_runs.push_back(m_run);
+            }
+            m_in_run = false;
+        }
+
+        public:
+        // Runs at or under threshold_db, and at least min_ms long.
+        explicit level_meter(float threshold_db = -60.0f, int min_ms = 500) noexcept
+            : m_threshold_db(threshold_db), m_min_ms(min_ms) {}
+
+        // The next frame. Returns its level_db(). One it can't tell (NAN)
+        // ends a run.
+        float add(const frame_base& f) {
+            const float db = level_db(f);
+            const int64_t n = f.samples();
+            m_samplerate = f.props_const().samplerate;
+            if (db <= m_threshold_db) { // false for NAN
+                if (!m_in_run) {
+                    m_run = level_run();
+                    m_run.start_sample = m_samples;
+                    m_in_run = true;
+                }
+                m_run.end_sample = m_samples + n;
+                m_run.level_db = (std::max)(m_run.level_db, db);
+            } else {
+                close_run();
+            }
+            m_samples += n;
+            return db;
+        }
+
+        // No more frames: keeps a run still open.
+        void finish() { close_run(); }
+
+        const std::vector<level_run>& runs() const noexcept { return m_runs; }
+        int64_t samples() const noexcept { return m_samples; }
+    };
+
+    // Parses the file at path and gives its quiet runs (see level_meter), in
+    // the one pass.
+    inline error find_quiet_runs(const std::string& path, std::vector<level_run>& runs,
+        parse_summary& summary, float threshold_db = -60.0f, int min_ms = 500) {
+        level_meter meter(threshold_db, min_ms);
+        const error e
+            = parse_file(path, summary, false, [&](const frame& f) { meter.add(f); });
+        meter.finish();
+        runs = meter.runs();
+        return e;
+    }
+
+} // namespace mpeg
+} // namespace my
@@ -0,0 +1,380 @@
+#pragma once
+// my_library_watcher.hpp
+// Incremental library scanning: rather than walking the whole tree again
+// (files_finder), watch it with inotify and re-parse only the mp3s that were
+// created or changed, reporting each as a library_delta.
+//
+// Files being copied in are not parsed half-written: a file is only parsed
+// once its writer closes it (IN_CLOSE_WRITE), it is renamed into place
+// (IN_MOVED_TO), or it has been quiet for quiet_ms. Bursts of events for one
+// file (a copy is thousands of IN_MODIFYs) coalesce into one parse.
+//
+// A directory moved out of the tree takes its files with it: each is reported
+// removed. If inotify's queue overflows, the tree is walked again and every
+// file is re-parsed; those no longer there are reported removed.
+//
+// Linux only: everywhere else, use files_finder.
+#ifdef __linux__
+#include "my_mpeg.hpp"
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace my {
+namespace mpeg {
+
+    struct library_delta {
+        enum class kind { updated, removed };
+        kind what = kind::updated;
+        std::string path;
+        parse_summary summary; // when updated
+        error err; // what parse_file() said, when updated
+    };
+
+    class library_watcher {
+        using clock = std::chrono::steady_clock;
+
+        public:
+        library_watcher(std::string root, std::string extn = ".mp3", int quiet_ms = 2000)
+            : m_root(std::move(root)), m_extn(std::move(extn)), m_quiet_ms(quiet_ms) {
+            while (m_root.size() > 1 && m_root.back() == '/') {
+                m_root.pop_back();
+            }
+        }
+        library_watcher(const library_watcher&) = delete;
+        library_watcher& operator=(const library_watcher&) = delete;
+        ~library_watcher() { stop(); }
+
+        // Starts watching every directory under the root. Files already there
+        // are not reported (that's what a full scan is for).
+        // Returns 0, or an errno.
+        int start() {
+            stop();
+            m_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (m_fd < 0) {
+                return errno;
+            }
+            return add_tree(m_root, false);
+        }
+
+        void stop() noexcept {
+            if (m_fd >= 0) {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+            m_dirs.clear();
+            m_files.clear();
+            m_pending.clear();
+        }
+
+        // pollable (POLLIN), if you'd rather drive poll() from your own loop
+        int fd() const noexcept { return m_fd; }
+        // files seen changing, but not settled yet
+        size_t pending() const noexcept { return m_pending.size(); }
+        size_t directories() const noexcept { return m_dirs.size(); }
+        // files in the tree, as far as we know
+        size_t files() const noexcept { return m_files.size(); }
+
+        // Waits up to timeout_ms for events, then parses whatever has settled,
+        // calling on_delta(const library_delta&) for each file parsed or
+        // removed. Returns how many deltas there were, or -errno.
+        template <typename DELTA> int poll(int timeout_ms, DELTA&& on_delta) {
+            if (m_fd < 0) {
+                return -EBADF;
+            }
+            // don't sleep past the moment the next pending file goes quiet
+            const int until_quiet = next_quiet_ms();
+            if (until_quiet >= 0 && (timeout_ms < 0 || until_quiet < timeout_ms)) {
+                timeout_ms = until_quiet;
+            }
+            pollfd pfd{m_fd, POLLIN, 0};
+            const int r = ::poll(&pfd, 1, timeout_ms);
+            if (r < 0 && errno != EINTR) {
+                return -errno;
+            }
+            int ndeltas = 0;
+            if (r > 0) {
+                const int e = read_events(on_delta, ndeltas);
+                if (e != 0) {
+                    return -e;
+                }
+            }
+            return ndeltas + flush_settled(on_delta);
+        }
+
+        // poll()s until keep_going() returns false, or there is an error.
+        template <typename DELTA, typename PRED>
+        int run(DELTA&& on_delta, PRED&& keep_going, int tick_ms = 500) {
+            while (keep_going()) {
+                const int r = poll(tick_ms, on_delta);
+                if (r < 0) {
+                    return -r;
+                }
+            }
+            return 0;
+        }
+
+        private:
+        struct pending_file {
+            clock::time_point last;
+            bool closed = false;
+        };
+
+        static constexpr uint32_t DIR_EVENTS = IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE
+            | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF
+            | IN_ONLYDIR;
+
+        std::string m_root;
+        std::string m_extn;
+        int m_quiet_ms = 2000;
+        int m_fd = -1;
+        std::unordered_map<int, std::string> m_dirs; // watch descriptor -> dir
+        std::unordered_set<std::string> m_files; // wanted, and in the tree
+        std::unordered_map<std::string, pending_file> m_pending;
+
+        bool wanted(const char* name, size_t len) const noexcept {
+            const size_t n = m_extn.size();
+            if (len < n) {
+                return false;
+            }
+            const char* p = name + len - n;
+            for (size_t i = 0; i < n; ++i) {
+                char c = p[i];
+                if (c >= 'A' && c <= 'Z') {
+                    c = CAST(char, c - 'A' + 'a');
+                }
+                if (c != m_extn[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void touch(const std::string& path, bool closed) {
+            auto& pf = m_pending[path];
+            pf.last = clock::now();
+            pf.closed = closed;
+            m_files.insert(path);
+        }
+
+        template <typename DELTA> void removed(std::string path, DELTA& on_delta) {
+            m_pending.erase(path);
+            m_files.erase(path);
+            library_delta d;
+            d.what = library_delta::kind::removed;
+            d.path = std::move(path);
+            on_delta(static_cast<const library_delta&>(d));
+        }
+
+        // dir has left the tree: stop watching it and everything under it,
+        // and report its files removed. (Moved within the tree, IN_MOVED_TO
+        // adds it back.) Returns how many files were removed.
+        template <typename DELTA> int drop_tree(const std::string& dir, DELTA& on_delta) {
+            const std::string under = dir + "/";
+            auto inside = [&](const std::string& p) {
+                return p == dir || p.compare(0, under.size(), under) == 0;
+            };
+            for (auto it = m_dirs.begin(); it != m_dirs.end();) {
+                if (inside(it->second)) {
+                    ::inotify_rm_watch(m_fd, it->first);
+                    it = m_dirs.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            std::vector<std::string> gone;
+            for (const auto& f : m_files) {
+                if (inside(f)) {
+                    gone.push_back(f);
+                }
+            }
+            for (auto& f : gone) {
+                removed(std::move(f), on_delta);
+            }
+            return CAST(int, gone.size());
+        }
+
+        // We lost events: watch and re-parse everything, and report removed
+        // whatever we knew of that isn't there now. Returns how many removed.
+        template <typename DELTA> int rescan(DELTA& on_delta) {
+            std::unordered_map<int, std::string> dirs;
+            std::unordered_set<std::string> files;
+            dirs.swap(m_dirs);
+            files.swap(m_files);
+            // a directory still there gets its old watch descriptor back
+            add_tree(m_root, true);
+            for (const auto& kv : dirs) {
+                if (m_dirs.find(kv.first) == m_dirs.end()) {
+                    ::inotify_rm_watch(m_fd, kv.first);
+                }
+            }
+            int n = 0;
+            for (const auto& f : files) {
+                if (m_files.find(f) == m_files.end()) {
+                    removed(f, on_delta);
+                    ++n;
+                }
+            }
+            return n;
+        }
+
+        // Watches dir and everything under it. enqueue: also treat every
+        // file found as new (a directory moved in, or we lost events).
+        int add_tree(const std::string& dir, bool enqueue) {
+            const int wd = ::inotify_add_watch(m_fd, dir.c_str(), DIR_EVENTS);
+            if (wd < 0) {
+                return errno;
+            }
+            m_dirs[wd] = dir;
+            DIR* d = ::opendir(dir.c_str());
+            if (d == nullptr) {
+                return 0; // gone already: we'll get told
+            }
+            int e = 0;
+            while (const dirent* de = ::readdir(d)) {
+                const char* name = de->d_name;
+                if (name[0] == '.'
+                    && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                    continue;
+                }
+                std::string path = dir + "/" + name;
+                unsigned char type = de->d_type;
+                if (type == DT_UNKNOWN) {
+                    struct stat st;
+                    if (::lstat(path.c_str(), &st) != 0) {
+                        continue;
+                    }
+                    type = S_ISDIR(st.st_mode) ? DT_DIR
+                                               : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+                }
+                if (type == DT_DIR) {
+                    e = add_tree(path, enqueue);
+                    if (e == ENOSPC) {
+                        break; // out of watches: no point carrying on
+                    }
+                } else if (type == DT_REG && wanted(name, strlen(name))) {
+                    if (enqueue) {
+                        touch(path, true);
+                    } else {
+                        m_files.insert(std::move(path));
+                    }
+                }
+            }
+            ::closedir(d);
+            return e == ENOSPC ? e : 0;
+        }
+
+        template <typename DELTA> int read_events(DELTA& on_delta, int& ndeltas) {
+            alignas(inotify_event) char buf[64 * 1024];
+            while (true) {
+                const ssize_t got = ::read(m_fd, buf, sizeof(buf));
+                if (got < 0) {
+                    if (errno == EAGAIN || errno == EINTR) {
+                        return 0;
+                    }
+                    return errno;
+                }
+                if (got == 0) {
+                    return 0;
+                }
+                for (const char* p = buf; p < buf + got;) {
+                    const auto* ev = reinterpret_cast<const inotify_event*>(p);
+                    p += sizeof(inotify_event) + ev->len;
+                    if (ev->mask & IN_Q_OVERFLOW) {
+                        ndeltas += rescan(on_delta);
+                        continue;
+                    }
+                    const auto it = m_dirs.find(ev->wd);
+                    if (it == m_dirs.end()) {
+                        continue;
+                    }
+                    if (ev->mask & IN_IGNORED) {
+                        m_dirs.erase(it);
+                        continue;
+                    }
+                    if (ev->mask & IN_MOVE_SELF) {
+                        // its parent's IN_MOVED_FROM has usually seen to it;
+                        // not if it is the root
+                        ndeltas += drop_tree(std::string(it->second), on_delta);
+                        continue;
+                    }
+                    if (ev->len == 0) {
+                        continue;
+                    }
+                    std::string path = it->second + "/" + ev->name;
+                    if (ev->mask & IN_ISDIR) {
+                        if (ev->mask & IN_MOVED_FROM) {
+                            ndeltas += drop_tree(path, on_delta);
+                        } else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                            add_tree(path, true);
+                        }
+                        continue;
+                    }
+                    if (!wanted(ev->name, strlen(ev->name))) {
+                        continue;
+                    }
+                    if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                        removed(std::move(path), on_delta);
+                        ++ndeltas;
+                    } else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                        touch(path, true);
+                    } else if (ev->mask & (IN_CREATE | IN_MODIFY)) {
+                        touch(path, false);
+                    }
+                }
+            }
+        }
+
+        int next_quiet_ms() const noexcept {
+            if (m_pending.empty()) {
+                return -1;
+            }
+            const auto now = clock::now();
+            long long best = m_quiet_ms;
+            for (const auto& kv : m_pending) {
+                if (kv.second.closed) {
+                    return 0;
+                }
+                const auto age = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    now - kv.second.last)
+                                     .count();
+                const long long left = m_quiet_ms - age;
+                if (left < best) {
+                    best = left;
+                }
+            }
+            return best < 0 ? 0 : CAST(int, best);
+        }
+
+        template <typename DELTA> int flush_settled(DELTA& on_delta) {
+            const auto now = clock::now();
+            const auto quiet = std::chrono::milliseconds(m_quiet_ms);
+            std::vector<std::string> ready;
+            for (const auto& kv : m_pending) {
+                if (kv.second.closed || now - kv.second.last >= quiet) {
+                    ready.push_back(kv.first);
+                }
+            }
+            for (auto& path : ready) {
+                m_pending.erase(path);
+                library_delta d;
+                d.path = std::move(path);
+                d.err = parse_file(d.path, d.summary);
+                on_delta(static_cast<const library_delta&>(d));
+            }
+            return CAST(int, ready.size());
+        }
+    };
+
+} // namespace mpeg
+} // namespace my
+#endif // __linux__
@@ -0,0 +1,101 @@
+#pragma once
+// my_memory_budget.hpp
+// One memory limit for everything a batch scan holds: queued paths, the
+// directories still to walk, and the buffers of the files being parsed.
+// Producers acquire() what they hand on (a path for the queue) and wait for
+// room; the consumer that takes it release()s it. What can't wait (the walk's
+// own directories, a file being parsed) is charge()d and refund()ed instead,
+// even over the limit. acquire() only waits while something acquired is still
+// held, since only that is sure to come back; so nothing deadlocks on memory
+// that is itself waiting. What is held stays under the limit plus what was
+// charged: a fixed amount, however big the tree.
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "my_macros.hpp"
+
+namespace my {
+class memory_budget {
+    const int64_t m_limit;
+    std::mutex m_mx;
+    std::condition_variable m_cv;
+    std::atomic<int64_t> m_used{0};
+    std::atomic<int64_t> m_acquired{0}; // the part of m_used a release() gives back
+    std::atomic<int64_t> m_peak{0};
+    std::atomic<int64_t> m_waits{0};
+
+    void add(int64_t n) noexcept {
+        const int64_t now = m_used += n;
+        int64_t peak = m_peak.load();
+        while (now > peak && !m_peak.compare_exchange_weak(peak, now)) {
+        }
+    }
+
+    public:
+    // limit <= 0: no limit (it still counts)
+    explicit memory_budget(int64_t limit) noexcept : m_limit(limit) {}
+    memory_budget(const memory_budget&) = delete;
+    memory_budget& operator=(const memory_budget&) = delete;
+
+    // What a string in a container costs.
+    static int64_t cost(const std::string& s) noexcept {
+        return CAST(int64_t, sizeof(std::string) + s.capacity());
+    }
+
+    // For producers: waits until n fits (or nothing acquired is left to
+    // come back, so that it can't wait forever), then takes it.
+    void acquire(int64_t n) {
+        if (m_limit > 0) {
+            std::unique_lock<std::mutex> lk(m_mx);
+            if (m_used + n > m_limit && m_acquired > 0) {
+                ++m_waits;
+                m_cv.wait(lk, [&] { return m_used + n <= m_limit || m_acquired == 0; });
+            }
+        }
+        m_acquired += n;
+        add(n);
+    }
+    void release(int64_t n) {
+        m_acquired -= n;
+        refund(n);
+    }
+
+    // Takes n without waiting, whatever is left.
+    void charge(int64_t n) noexcept { add(n); }
+    void refund(int64_t n) {
+        m_used -= n;
+        if (m_limit > 0) {
+            // through the mutex, or a waiter could miss it between its
+            // check and its wait
+            std::lock_guard<std::mutex> lk(m_mx);
+        }
+        m_cv.notify_all();
+    }
+
+    // Waits while, leaving out the own bytes the caller holds, the budget is
+    // spent, or until stop is set (then call wake()).
+    void wait_for_room(const std::atomic<int64_t>& own, const std::atomic<bool>& stop) {
+        if (m_limit <= 0) {
+            return;
+        }
+        std::unique_lock<std::mutex> lk(m_mx);
+        if (m_used - own >= m_limit && !stop) {
+            ++m_waits;
+            m_cv.wait(lk, [&] { return m_used - own < m_limit || stop; });
+        }
+    }
+    void wake() {
+        { std::lock_guard<std::mutex> lk(m_mx); }
+        m_cv.notify_all();
+    }
+
+    int64_t limit() const noexcept { return m_limit; }
+    int64_t used() const noexcept { return m_used; }
+    // the most ever held at once
+    int64_t peak() const noexcept { return m_peak; }
+    // how often a producer had to wait
+    int64_t waits() const noexcept { return m_waits; }
+};
+} // namespace my
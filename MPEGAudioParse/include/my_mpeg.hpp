@@ -13,14 +13,36 @@
 #include <limits>
 #include <functional>
 #include <array>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include <atomic>
+#include <utility>
 #ifdef _WIN32
 #include <io.h> // access
 #else
+#include <fcntl.h> // posix_fadvise
 #include <unistd.h>
 #endif
 #include "my_string_view.hpp"
+#include "my_hash.hpp"
 #include <iostream>
 
+// Define MY_MPEG_NO_ABORT for batch/production use: bad input (and anything
+// else that would otherwise assert) never aborts the process, debug build or
+// not. Every failure comes back out of parser::parse() as an error, stamped
+// with the source location and file offset it happened at.
+#ifdef MY_MPEG_NO_ABORT
+#define MPEG_ASSERT(expr) CAST(void, sizeof(expr))
+#else
+#define MPEG_ASSERT(expr) assert(expr)
+#endif
+#define MPEG_STRINGIZE_(x) #x
+#define MPEG_STRINGIZE(x) MPEG_STRINGIZE_(x)
+#define MPEG_WHERE __FILE__ ":" MPEG_STRINGIZE(__LINE__)
+
 namespace my {
 namespace mpeg {
 
@@ -28,7 +50,7 @@ namespace mpeg {
 
         enum class loglevel_t {
 
-            reserved,
+            quiet, // nothing on stdout: errors still go to stderr
             all,
             error_only,
             critical_only,
@@ -36,7 +58,9 @@ namespace mpeg {
             everything,
 
         };
-        static constexpr loglevel_t loglevel = loglevel_t::all;
+        // Process wide, and read by every parse: set it (set_loglevel()) before
+        // any start. Anything that owns stdout (mpegscan) wants quiet.
+        inline std::atomic<loglevel_t> loglevel{loglevel_t::all};
 
         static constexpr int ID3V2_HEADER_SIZE = 10;
         static constexpr uint32_t ID3V2_MAX_SIZE = 1024U * 1024U; // 1 meg
@@ -56,7 +80,7 @@ namespace mpeg {
 
                 case CHANNELS_SINGLE_CHANNEL: return 1;
                 default: {
-                    assert("Bad Channel Enumeration value" == nullptr);
+                    MPEG_ASSERT("Bad Channel Enumeration value" == nullptr);
                     return 0;
                 }
             }
@@ -65,7 +89,7 @@ namespace mpeg {
         [[maybe_unused]] static inline const char* Channel_String(
             ChannelEnum ce) noexcept {
             switch (ce) {
-                assert(ce >= CHANNELS_STEREO && ce <= CHANNELS_SINGLE_CHANNEL);
+                MPEG_ASSERT(ce >= CHANNELS_STEREO && ce <= CHANNELS_SINGLE_CHANNEL);
                 case CHANNELS_STEREO: return "Stereo";
                 case CHANNELS_JOINT_STEREO: return "Double Mono";
                 case CHANNELS_DUAL_CHANNEL: return "Joint Stereo";
@@ -82,7 +106,7 @@ namespace mpeg {
 
         [[maybe_unused]] static inline const char* Emphasis_String(
             EmphasisEnum ce) noexcept {
-            assert(ce >= EMPHASIS_NONE && ce <= EMPHASIS_CCIT_J17);
+            MPEG_ASSERT(ce >= EMPHASIS_NONE && ce <= EMPHASIS_CCIT_J17);
             switch (ce) {
                 case EMPHASIS_NONE: return "No Emphasis";
                 case EMPHASIS_FIFTY_FIFTEEN_MS: return "15 Millisecond Emphasis";
@@ -95,6 +119,9 @@ namespace mpeg {
         static constexpr int MIN_MPEG_PAYLOAD = 512;
     } // namespace detail
 
+    using loglevel_t = detail::loglevel_t;
+    inline void set_loglevel(loglevel_t ll) noexcept { detail::loglevel = ll; }
+
     enum class frame_mismatch {
         none = 0,
         samplerate = 1,
@@ -116,7 +143,7 @@ namespace mpeg {
             case frame_mismatch::version: return "Versions differ";
             default:
 
-                assert("unhandled frame mismatch" == nullptr);
+                MPEG_ASSERT("unhandled frame mismatch" == nullptr);
                 return "unknown mismatch";
         }
     }
@@ -138,7 +165,8 @@ namespace mpeg {
             bad_mpeg_emphasis = 12,
             tiny_file = 13,
             prev_frame_bad = 14,
-            data_incomplete = 15
+            data_incomplete = 15,
+            no_frames = 16 // parsed, but there was no audio in it
 
         };
 
@@ -172,6 +200,33 @@ namespace mpeg {
         bool is_errno() const noexcept { return to_int() < 0; }
         bool is_frame_mismatch() const noexcept { return m_bis_frame_mismatch; }
 
+        // Where it went wrong: source location (MPEG_WHERE) and file offset.
+        // Both are only set on the way out of the parser, and the first one
+        // set (the innermost) sticks.
+        error& at(int64_t file_offset, const char* source_location) noexcept {
+            if (value != error_code::noerror && where == nullptr) {
+                where = source_location;
+                offset = file_offset;
+            }
+            return *this;
+        }
+        const char* where = nullptr;
+        int64_t offset = -1;
+
+        // to_string(), with the location, if we know it.
+        std::string describe() {
+            std::string s = to_string();
+            if (offset >= 0) {
+                s += " @ file offset " + std::to_string(offset);
+            }
+            if (where != nullptr) {
+                s += " (";
+                s += where;
+                s += ")";
+            }
+            return s;
+        }
+
 #ifdef _MSC_VER
 #pragma warning(disable : 26446)
 #endif
@@ -187,7 +242,7 @@ namespace mpeg {
                 "bad mpeg bitrate", "bad samplerate", "lost sync", "need_more_data",
                 "bad mpeg channels", "bad mpeg emphasis",
                 "file payload too small to contain any meaningful audio",
-                "previous frame bad", "data incomplete"};
+                "previous frame bad", "data incomplete", "no mpeg frames found"};
 
             if (is_errno()) {
                 return strerror(-to_int());
@@ -255,11 +310,14 @@ namespace mpeg {
         using base::size;
 
         // return 0 on success, <0 for an errno, >0 for a custom error.
+        // how_much is one read's worth (a frame, a tag, or a read block: at
+        // most MAX_READ_BLOCK), so an int will do; where it is read from,
+        // sk.position, is 64 bit, like every offset and count after it.
         error get(int& how_much, const seek_type& sk, char* const buf_into,
             bool /*peek*/ = false) {
 
             const char* bi = buf_into;
-            assert(bi);
+            MPEG_ASSERT(bi);
             const int avail_space = how_much;
             char* ptr = nullptr;
             if (buf_into == nullptr) {
@@ -278,7 +336,7 @@ namespace mpeg {
 
             how_much = (std::min)(how_much, avail_space);
 
-            assert(how_much > 0);
+            MPEG_ASSERT(how_much > 0);
             error ret;
             const int rv = m_cb(ptr, how_much, sk);
             if (rv == my::io::NO_MORE_DATA) {
@@ -355,6 +413,9 @@ namespace mpeg {
         // header
         int size_in_bytes() const noexcept { return frame_get_length(); }
 
+        // number of (per channel) samples this frame decodes to
+        int samples() const noexcept { return samples_per_frame(); }
+
         int frame_dur_in_ms() const noexcept {
             if (!valid) {
                 return 0;
@@ -386,18 +447,45 @@ namespace mpeg {
             m_vbr = false;
             props = mpeg_properties{0};
             m_frame_len = 0;
+            m_view = nullptr;
+            m_view_size = 0;
         }
         bool vbr() const noexcept { return m_vbr; }
+        // the sbo may have moved its data (grown): point back into it
+        void set_header_ptr() noexcept { header_bytes = bytes(); }
         void set_file_position(int64_t file_pos = -1) noexcept {
             valid = false;
+            m_frame_len = 0;
             file_position = file_pos;
-            header_bytes = reinterpret_cast<const unsigned char*>(m_sbo.cbegin());
+            header_bytes = bytes();
+        }
+
+        // The frame's bytes, header first: what was loaded into m_sbo, or,
+        // after parser::parse(byte_span), a view into the caller's memory.
+        const unsigned char* bytes() const noexcept {
+            return m_view != nullptr ? m_view : m_sbo.cbeginc();
+        }
+        int bytes_size() const noexcept {
+            return m_view != nullptr ? m_view_size : m_sbo.size_i();
+        }
+        bool is_view() const noexcept { return m_view != nullptr; }
+        void set_view(const unsigned char* p, int size) noexcept {
+            m_view = p;
+            m_view_size = size;
+            header_bytes = bytes();
+        }
+        // for detail::known_signature, which has the length already
+        void set_known_length(int len) noexcept {
+            valid = true;
+            m_frame_len = len;
         }
 
         protected:
         bool m_vbr = {false};
         char b[2];
         mutable int m_frame_len = 0;
+        const unsigned char* m_view = nullptr;
+        int m_view_size = 0;
 
         int frame_get_length() const noexcept {
             int sz = 0;
@@ -424,7 +512,7 @@ namespace mpeg {
                     }
                 }
             }
-            assert(sz);
+            MPEG_ASSERT(sz);
             return sz;
         }
         char pad[6];
@@ -447,7 +535,7 @@ namespace mpeg {
                 }
                 return 1152;
             }
-            if (p.version >= 2 && p.version < 3) {
+            if (p.version >= 2) {
                 if (p.layer == 1) {
                     return 384;
                 }
@@ -458,7 +546,7 @@ namespace mpeg {
                     return 576;
                 }
             }
-            assert(0); // what have I missed?
+            MPEG_ASSERT(0); // what have I missed?
             return 0;
         }
         char padd[4];
@@ -488,13 +576,13 @@ namespace mpeg {
         frame() = default;
 
         error parse_header(int64_t file_position) {
-            assert(file_position >= 0);
+            MPEG_ASSERT(file_position >= 0);
             if (my::mpeg::detail::loglevel >= my::mpeg::detail::loglevel_t::all) {
-                printf("Parsing MPEG header @ file position %lu ...\n",
-                    static_cast<unsigned long>(file_position));
+                printf("Parsing MPEG header @ file position %lld ...\n",
+                    static_cast<long long>(file_position));
             }
 
-            if (m_sbo.size() < MPEG_HEADER_SIZE) {
+            if (bytes_size() < MPEG_HEADER_SIZE) {
                 return error::error_code::need_more_data;
             }
             set_file_position(file_position);
@@ -520,7 +608,7 @@ namespace mpeg {
             }
 
             const auto lib = length_in_bytes();
-            const auto bsz = m_sbo.size_i();
+            const auto bsz = bytes_size();
             if (bsz < lib) {
                 e = mpeg::error::error_code::data_incomplete;
             }
@@ -601,7 +689,7 @@ namespace mpeg {
                 return e;
             }
             frame.props.layer = CAST(uint8_t, MPEGLayers[layer_index]);
-            assert(frame.props.layer);
+            MPEG_ASSERT(frame.props.layer);
             if (frame.props.layer == 0u) {
                 e = error::error_code::bad_mpeg_layer;
             }
@@ -631,11 +719,14 @@ namespace mpeg {
                     >= MAX_MPEG_BITRATES - 1 // -1 coz all values @ 16 -1 are OK for
                 // us, 16 itself is -1, which is not.
                 || bitrate_index == BAD_BITRATE_INDEX) {
+                // junk met while resyncing lands here all the time: bail before
+                // the table lookups below, which would assert on it.
                 e = error::error_code::bad_mpeg_bitrate;
+                return e;
             }
 
-            assert(frame.props.version);
-            assert(frame.props.layer);
+            MPEG_ASSERT(frame.props.version);
+            MPEG_ASSERT(frame.props.layer);
             if (frame.props.version == 1) {
                 switch (frame.props.layer) {
                     case 3: {
@@ -672,7 +763,7 @@ namespace mpeg {
                         frame.props.bitrate = V2L2L3BitRates[bitrate_index] * 1000;
                 };
             }
-            assert(frame.props.bitrate > 0 && "bitrate <= 0");
+            MPEG_ASSERT(frame.props.bitrate > 0 && "bitrate <= 0");
             return e;
         }
 
@@ -702,7 +793,7 @@ namespace mpeg {
                 frame.props.samplerate = MPEG2Point5SampleRates[samplerate_index];
             }
 
-            assert(frame.props.samplerate && "no samplerate");
+            MPEG_ASSERT(frame.props.samplerate && "no samplerate");
             return e;
         }
 
@@ -715,7 +806,7 @@ namespace mpeg {
             static constexpr int ChannelMode[MAX_MPEG_CHANNEL_MODE] = {CHANNELS_STEREO,
                 CHANNELS_JOINT_STEREO, CHANNELS_DUAL_CHANNEL, CHANNELS_SINGLE_CHANNEL};
 
-            assert(cmodeindex < MAX_MPEG_CHANNEL_MODE);
+            MPEG_ASSERT(cmodeindex < MAX_MPEG_CHANNEL_MODE);
 
             if (cmodeindex >= MAX_MPEG_CHANNEL_MODE) {
                 e = error::error_code::bad_mpeg_channels;
@@ -770,7 +861,7 @@ namespace mpeg {
             return h.tagsize_inc_header > 10 && (h.tagsize_inc_header < ID3V2_MAX_SIZE);
         }
 
-        uint32_t DecodeSyncSafe(const char* pb) noexcept {
+        inline uint32_t DecodeSyncSafe(const char* pb) noexcept {
             /// For i As Integer = 0 To UBound(arBytes)
             // usum = usum Or (arBytes(i) And 127) << ((3 - i) * 7)
             // Next
@@ -802,7 +893,7 @@ namespace mpeg {
             if (!p) return nullptr;
 
             const auto sz = e - p;
-            assert(sz);
+            MPEG_ASSERT(sz);
             p += buf_position;
             while (e - p >= 4) {
                 if (*p == 255 && *(p + 1) >= 224) {
@@ -814,7 +905,7 @@ namespace mpeg {
         }
         /*/
         using byte = my::io::byte_type;
-        const byte* find_sync(const byte* buf, int /*offset*/, int bufsize) {
+        inline const byte* find_sync(const byte* buf, int /*offset*/, int bufsize) {
 
             auto my_buf = reinterpret_cast<const uint8_t*>(buf);
             auto p = my_buf;
@@ -836,26 +927,155 @@ namespace mpeg {
 
             return nullptr;
         }
+
+        // The header bits that must not change from one frame to the next in
+        // a single stream: sync, version, layer and samplerate. Bitrate,
+        // padding, crc, channel mode and emphasis are all allowed to vary.
+        static constexpr uint32_t STREAM_SIGNATURE_MASK = 0xFFFE0C00;
+        // How many back-to-back frames with the same signature we need to see
+        // before we believe a sync candidate is real and not junk.
+        static constexpr int RESYNC_CONFIRM_FRAMES = 4;
+        // How much we read at a time when scanning (junk) for a sync
+        static constexpr int RESYNC_WINDOW = 8192;
+
+        inline uint32_t header_word(const unsigned char* p) noexcept {
+            return (CAST(uint32_t, p[0]) << 24) | (CAST(uint32_t, p[1]) << 16)
+                | (CAST(uint32_t, p[2]) << 8) | CAST(uint32_t, p[3]);
+        }
+        inline uint32_t stream_signature(const unsigned char* p) noexcept {
+            return header_word(p) & STREAM_SIGNATURE_MASK;
+        }
+
+        // One stream signature, fixed at compile time. Once a run of frames is
+        // confirmed, every header after it has the same version, layer and
+        // samplerate, so the walk checks those with one masked compare and looks
+        // the length up by bitrate index and padding, instead of going through
+        // frame::parse_header(). parse() says no (and the walk takes the general
+        // path) on anything else, including free format and bitrate index 15.
+        template <int VERSION, int LAYER, int SR_INDEX> struct known_signature {
+            static_assert(VERSION >= 1 && VERSION <= 3, "1, 2, or 3 for MPEG 2.5");
+            static_assert(LAYER >= 1 && LAYER <= 3, "bad layer");
+            static_assert(SR_INDEX >= 0 && SR_INDEX <= 2, "bad samplerate index");
+
+            static constexpr uint32_t VERSION_BITS
+                = VERSION == 1 ? 3u : (VERSION == 2 ? 2u : 0u);
+            static constexpr uint32_t SIGNATURE = 0xFFE00000u | (VERSION_BITS << 19)
+                | (CAST(uint32_t, 4 - LAYER) << 17) | (CAST(uint32_t, SR_INDEX) << 10);
+
+            static constexpr int samplerate() noexcept {
+                constexpr int rates[3][3] = {
+                    {44100, 48000, 32000}, {22050, 24000, 16000}, {11025, 12000, 8000}};
+                return rates[VERSION - 1][SR_INDEX];
+            }
+            static constexpr int kbps(unsigned int bitrate_index) noexcept {
+                constexpr int v1[3][16] = {
+                    {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+                    {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+                    {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0}};
+                constexpr int v2[2][16]
+                    = {{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+                        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0}};
+                return VERSION == 1 ? v1[LAYER - 1][bitrate_index]
+                                    : v2[LAYER == 1 ? 0 : 1][bitrate_index];
+            }
+            // as frame_base::frame_get_length()
+            static constexpr int length(unsigned int bitrate_index, int padding) noexcept {
+                const int br = kbps(bitrate_index) * 1000;
+                if (br == 0) {
+                    return 0;
+                }
+                if (LAYER == 1) {
+                    return (12 * br / samplerate() + padding) * 4;
+                }
+                const int slots = (LAYER == 3 && VERSION != 1) ? 72 : 144;
+                return slots * br / samplerate() + padding;
+            }
+            using length_table = std::array<uint16_t, 32>;
+            static constexpr length_table make_lengths() noexcept {
+                length_table t{};
+                for (unsigned int i = 0; i < 16; ++i) {
+                    t[i * 2] = CAST(uint16_t, length(i, 0));
+                    t[i * 2 + 1] = CAST(uint16_t, length(i, 1));
+                }
+                return t;
+            }
+            // [bitrate index * 2 + padding], 0 where there's no fixed length
+            static constexpr length_table LENGTHS = make_lengths();
+
+            static bool parse(frame& f, int64_t file_position) noexcept {
+                if (f.bytes_size() < MPEG_HEADER_SIZE) {
+                    return false;
+                }
+                f.set_file_position(file_position);
+                const uint32_t w = header_word(f.header_bytes);
+                const unsigned int i = ((w >> 12) & 0x0F) * 2 + ((w >> 9) & 0x01);
+                if ((w & STREAM_SIGNATURE_MASK) != SIGNATURE || LENGTHS[i] == 0) {
+                    return false;
+                }
+                auto& p = f.props;
+                p.version = CAST(uint8_t, VERSION);
+                p.layer = CAST(uint8_t, LAYER);
+                p.samplerate = samplerate();
+                p.bitrate = kbps(i / 2) * 1000;
+                p.padding = CAST(int, i & 1);
+                p.crc = (w & 0x00010000) == 0;
+                p.copyright = (w & 0x08) != 0;
+                // both lookups in frame_emph_copyright_etc() are the identity
+                p.channelmode = CAST(uint8_t, (w >> 6) & 0x03);
+                p.emphasis = CAST(uint8_t, w & 0x03);
+                f.set_known_length(LENGTHS[i]);
+                return true;
+            }
+        };
+
+        using known_signature_fn = bool (*)(frame&, int64_t);
+
+        template <size_t... I>
+        constexpr std::array<known_signature_fn, sizeof...(I)> make_known_signatures(
+            std::index_sequence<I...>) noexcept {
+            return {{&known_signature<CAST(int, I / 9 + 1), CAST(int, I / 3 % 3 + 1),
+                CAST(int, I % 3)>::parse...}};
+        }
+
+        // The known_signature parse for a stream signature, or nullptr if the
+        // signature is one no frame can have.
+        inline known_signature_fn known_signature_for(uint32_t signature) noexcept {
+            static constexpr auto fns = make_known_signatures(std::make_index_sequence<27>());
+            static constexpr int versions[4] = {3, 0, 2, 1}; // by the header's bits
+            const int version = versions[(signature >> 19) & 0x03];
+            const int layer = 4 - CAST(int, (signature >> 17) & 0x03);
+            const int sr_index = CAST(int, (signature >> 10) & 0x03);
+            if (version == 0 || layer == 4 || sr_index == 3) {
+                return nullptr;
+            }
+            return fns[CAST(size_t, (version - 1) * 9 + (layer - 1) * 3 + sr_index)];
+        }
+
         template <typename IO>
         [[maybe_unused]] static error read_io(IO&& io, int& how_much,
             char* const your_buf, my::io::seek_type sk = my::io::seek_type(),
             bool peek = false) {
 
-            assert(your_buf);
+            MPEG_ASSERT(your_buf);
 
             auto& myio = std::forward<IO&>(io);
             error e = myio.get(
                 how_much, std::forward<const my::io::seek_type&>(sk), your_buf, peek);
             if (e) {
-                fprintf(stderr, "%s %s %s %s %i\n\n",
-                    "Error reading io device:", e.to_string().c_str(),
-                    "\n For:", io.uri().c_str(), e.to_int());
+                const bool from_begin
+                    = sk.seek == my::io::seek_value_type::seek_from_begin;
+                e.at(from_begin ? sk.position : -1, MPEG_WHERE);
+                // running out of data is how every parse ends: not worth a
+                // shout
                 if (e != error::error_code::no_more_data) {
-                    assert("Error reading iodevice" == nullptr);
+                    fprintf(stderr, "%s %s %s %s %i\n\n",
+                        "Error reading io device:", e.describe().c_str(),
+                        "\n For:", io.uri().c_str(), e.to_int());
+                    MPEG_ASSERT("Error reading iodevice" == nullptr);
                 }
             }
             if (your_buf == nullptr) {
-                assert("always assumed you wanted to use your own buffer" == nullptr);
+                MPEG_ASSERT("always assumed you wanted to use your own buffer" == nullptr);
                 myio.size_set(how_much);
             }
 
@@ -863,6 +1083,21 @@ namespace mpeg {
         }
 
         template <typename CB> using _buffer_type = buffer_type<CB>;
+
+        // The whole tag, header included, from a header that starts "ID3".
+        inline uint32_t id3v2_tag_size(const id3v2Header& id3) noexcept {
+            uint32_t usize
+                = detail::DecodeSyncSafe(reinterpret_cast<const char*>(id3.size));
+            if (usize != 0u) {
+                usize += ID3V2_HEADER_SIZE;
+            }
+            if (usize > detail::ID3V2_MAX_SIZE) {
+                MPEG_ASSERT("MAX ID3 SIZE EXCEEDED!" == nullptr);
+                return 0;
+            }
+            return usize;
+        }
+
         template <typename IO> inline error get_id3v2_tag(IO&& io, id3v2Header& id3) {
 
             const seek_type sk(0, io::seek_value_type::seek_from_begin);
@@ -891,17 +1126,7 @@ namespace mpeg {
             //   d:	Footer present.
             /*/
 
-                uint32_t usize
-                    = detail::DecodeSyncSafe(reinterpret_cast<char*>((&id3)->size));
-                if (usize != 0u) {
-                    usize += ID3V2_HEADER_SIZE;
-                }
-                if (usize > detail::ID3V2_MAX_SIZE) {
-                    assert("MAX ID3 SIZE EXCEEDED!" == nullptr);
-                    id3.tagsize_inc_header = 0;
-                } else {
-                    id3.tagsize_inc_header = usize;
-                }
+                id3.tagsize_inc_header = id3v2_tag_size(id3);
 
                 return error::error_code::noerror;
             }
@@ -942,7 +1167,7 @@ namespace mpeg {
                     m_file = nullptr;
                     m_spath.clear();
                 } else {
-                    assert("Unexpected error closing file." == nullptr);
+                    MPEG_ASSERT("Unexpected error closing file." == nullptr);
                 }
             }
         }
@@ -1006,65 +1231,605 @@ namespace mpeg {
     };
     /*/
     using seek_t = my::io::seek_type;
+
+    // A run of bytes we had to skip to (re)gain sync: junk before the first
+    // frame, or damage/splices between two confirmed frames.
+    struct sync_gap {
+        int64_t offset = {0};
+        int64_t length = {0};
+    };
+
+    // Some bytes of a file, to be fetched (see my_sparse.hpp).
+    struct byte_range {
+        int64_t offset = {0};
+        int64_t length = {0};
+        int64_t end() const noexcept { return offset + length; }
+    };
+
     struct io_base : public my::io::buffer_guts_type<io_base> {};
 
+    // What parse() found out about a file, flattened so it is cheap to copy,
+    // reduce and store (see my_scan_cache.hpp). Trivially copyable on purpose:
+    // keep it that way.
+    struct parse_summary {
+        int64_t file_size = {-1};
+        int64_t first_frame = {-1}; // file offset of the first audio frame
+        int64_t nframes = {0};
+        int64_t total_samples = {0};
+        double duration_ms = {0};
+        int64_t gap_bytes = {0}; // total junk skipped (see parser::gaps())
+        int64_t error_offset = {-1};
+        uint32_t id3v2_size = {0}; // at offset 0, including its header
+        uint32_t ngaps = {0};
+        int32_t error = {0}; // error::error_code, as an int
+        int32_t samplerate = {0};
+        int32_t bitrate = {0}; // of the first frame
+        uint8_t version = {0};
+        uint8_t layer = {0};
+        uint8_t channelmode = {0};
+        uint8_t emphasis = {0};
+        uint8_t vbr = {0};
+        uint8_t id3v1 = {0}; // 128 bytes, at the very end
+        uint8_t spare[2] = {0};
+        uint32_t ape_size = {0}; // APEv2 tag, just before any ID3V1 tag
+        // xxh64 of the audio frames only (no tags, no Xing/Info/VBRI frame):
+        // the same audio under different tags hashes the same. 0 unless
+        // parser::fingerprint() was switched on.
+        uint64_t audio_hash = {0};
+
+        int64_t id3v1_offset() const noexcept { return id3v1 ? file_size - 128 : -1; }
+        int64_t ape_offset() const noexcept {
+            return ape_size ? file_size - (id3v1 ? 128 : 0) - ape_size : -1;
+        }
+    };
+    static_assert(std::is_trivially_copyable_v<parse_summary>,
+        "parse_summary gets memcpy'd to and from disk");
+
+    // Per frame QC numbers, gathered as the walk finds each frame: fixed size,
+    // no allocation, and merge()able, so a batch scan can sum a whole library.
+    struct frame_stats {
+        // every bitrate in every table is a multiple of 8 kbps, up to 448
+        static constexpr int BITRATE_STEP_KBPS = 8;
+        static constexpr int BITRATE_BUCKETS = 448 / BITRATE_STEP_KBPS + 1;
+
+        int64_t nframes = {0};
+        int64_t padded_frames = {0};
+        int64_t audio_bytes = {0}; // sum of frame lengths
+        double duration_ms = {0};
+        int64_t bitrate_sum_kbps = {0}; // over frames: / nframes for the mean
+        int32_t min_kbps = {0};
+        int32_t max_kbps = {0};
+        int64_t mode_changes = {0}; // channel mode differs from the frame before
+        int64_t bitrate_hist[BITRATE_BUCKETS] = {0}; // frames at i * 8 kbps
+        int64_t by_channelmode[4] = {0}; // detail::ChannelEnum
+        int64_t by_version_layer[3][3] = {{0}}; // [version 1, 2, 2.5][layer - 1]
+        int32_t last_channelmode = {-1};
+        uint32_t files = {0}; // how many merged in, 1 for one file with frames
+
+        void add(const frame_base& f) noexcept {
+            const auto& p = f.props_const();
+            const int kbps = p.bitrate / 1000;
+            if (nframes == 0) {
+                min_kbps = max_kbps = kbps;
+                files = 1;
+            } else {
+                min_kbps = (std::min)(min_kbps, kbps);
+                max_kbps = (std::max)(max_kbps, kbps);
+                if (p.channelmode != last_channelmode) {
+                    ++mode_changes;
+                }
+            }
+            ++nframes;
+            padded_frames += p.padding ? 1 : 0;
+            audio_bytes += f.length_in_bytes();
+            duration_ms += 1000.0 * f.samples() / p.samplerate;
+            bitrate_sum_kbps += kbps;
+            const int bucket = kbps / BITRATE_STEP_KBPS;
+            if (bucket >= 0 && bucket < BITRATE_BUCKETS) {
+                ++bitrate_hist[bucket];
+            }
+            by_channelmode[p.channelmode & 3]++;
+            if (p.version >= 1 && p.version <= 3 && p.layer >= 1 && p.layer <= 3) {
+                by_version_layer[p.version - 1][p.layer - 1]++;
+            }
+            last_channelmode = p.channelmode;
+        }
+
+        // Sums in another file's (or another library's) numbers.
+        void merge(const frame_stats& o) noexcept {
+            if (o.nframes == 0) {
+                return;
+            }
+            min_kbps = nframes == 0 ? o.min_kbps : (std::min)(min_kbps, o.min_kbps);
+            max_kbps = nframes == 0 ? o.max_kbps : (std::max)(max_kbps, o.max_kbps);
+            nframes += o.nframes;
+            padded_frames += o.padded_frames;
+            audio_bytes += o.audio_bytes;
+            duration_ms += o.duration_ms;
+            bitrate_sum_kbps += o.bitrate_sum_kbps;
+            mode_changes += o.mode_changes;
+            for (int i = 0; i < BITRATE_BUCKETS; ++i) {
+                bitrate_hist[i] += o.bitrate_hist[i];
+            }
+            for (int i = 0; i < 4; ++i) {
+                by_channelmode[i] += o.by_channelmode[i];
+            }
+            for (int v = 0; v < 3; ++v) {
+                for (int l = 0; l < 3; ++l) {
+                    by_version_layer[v][l] += o.by_version_layer[v][l];
+                }
+            }
+            files += o.files;
+        }
+
+        // per frame
+        double mean_kbps() const noexcept {
+            return nframes ? double(bitrate_sum_kbps) / double(nframes) : 0;
+        }
+        // by what it actually took up: what a VBR file "is"
+        double average_kbps() const noexcept {
+            return duration_ms > 0 ? double(audio_bytes) * 8.0 / duration_ms : 0;
+        }
+        double padding_ratio() const noexcept {
+            return nframes ? double(padded_frames) / double(nframes) : 0;
+        }
+    };
+    static_assert(std::is_trivially_copyable_v<frame_stats>,
+        "frame_stats is meant to be copied, summed and stored flat");
+
+    // One audio frame, as parser::index_frames() records it: enough to seek
+    // to any frame, or cut the file at one, without parsing again.
+    struct frame_entry {
+        int64_t offset = {-1};
+        int32_t length = {0}; // including the header
+        int32_t bitrate = {0};
+        int32_t samplerate = {0};
+        uint16_t samples = {0};
+        uint8_t version = {0};
+        uint8_t layer = {0};
+        uint8_t channelmode = {0};
+        uint8_t padding = {0};
+        uint8_t spare[2] = {0};
+    };
+    static_assert(std::is_trivially_copyable_v<frame_entry>, "frame_entry is stored flat");
+
+    // Some consecutive frames of a bitrate_timeline: their bitrates and sizes
+    // (least, most, and the sums for the mean), and the junk skipped after
+    // them.
+    struct timeline_bucket {
+        int64_t first_frame = {0}; // as the walk counts them
+        int64_t start_sample = {0};
+        int64_t kbps_sum = {0};
+        int64_t bytes = {0};
+        int64_t gap_bytes = {0};
+        int32_t frames = {0};
+        int32_t min_kbps = {0};
+        int32_t max_kbps = {0};
+        int32_t min_bytes = {0};
+        int32_t max_bytes = {0};
+        int32_t gaps = {0}; // lost sync: each is a parser::gaps() entry
+
+        double mean_kbps() const noexcept {
+            return frames ? double(kbps_sum) / double(frames) : 0;
+        }
+        double mean_bytes() const noexcept {
+            return frames ? double(bytes) / double(frames) : 0;
+        }
+
+        // o follows on from this one
+        void merge(const timeline_bucket& o) noexcept {
+            min_kbps = frames == 0 ? o.min_kbps : (std::min)(min_kbps, o.min_kbps);
+            max_kbps = frames == 0 ? o.max_kbps : (std::max)(max_kbps, o.max_kbps);
+            min_bytes = frames == 0 ? o.min_bytes : (std::min)(min_bytes, o.min_bytes);
+            max_bytes = frames == 0 ? o.max_bytes : (std::max)(max_bytes, o.max_bytes);
+            frames += o.frames;
+            kbps_sum += o.kbps_sum;
+            bytes += o.bytes;
+            gaps += o.gaps;
+            gap_bytes += o.gap_bytes;
+        }
+    };
+
+    // A bitrate strip to draw, built as the walk goes (parser::timeline()),
+    // in a fixed amount of memory however long the file. Each frame goes
+    // into a bucket of its own until there are max_buckets of them; then
+    // neighbours are merged pairwise, and it goes on two frames a bucket,
+    // then four, and so on. So a file ends up with between max_buckets / 2
+    // and max_buckets buckets (or one a frame, if it has fewer), every one
+    // of them the same number of frames but the last.
+    class bitrate_timeline {
+        std::vector<timeline_bucket> m_buckets;
+        size_t m_max;
+        int64_t m_per_bucket = 1;
+        int64_t m_frames = 0;
+        int64_t m_samples = 0;
+        timeline_bucket m_before; // gaps before the first frame
+
+        void halve() noexcept {
+            const size_t n = m_buckets.size() / 2;
+            for (size_t i = 0; i < n; ++i) {
+                timeline_bucket b = m_buckets[2 * i];
+                b.merge(m_buckets[2 * i + 1]);
+                m_buckets[i] = b;
+            }
+            m_buckets.resize(n);
+            m_per_bucket *= 2;
+        }
+
+        public:
+        // max_buckets is rounded down to an even number, and is at least 2
+        explicit bitrate_timeline(size_t max_buckets = 2048)
+            : m_max((std::max)(max_buckets & ~CAST(size_t, 1), CAST(size_t, 2))) {
+            m_buckets.reserve(m_max);
+        }
+
+        void add(const frame_base& f) noexcept {
+            add(f.props_const().bitrate / 1000, f.length_in_bytes(), f.samples());
+        }
+        // from a frame index (parser::frame_index(), saved_index)
+        void add(const frame_entry& e) noexcept {
+            add(e.bitrate / 1000, e.length, e.samples);
+        }
+
+        void add(int kbps, int bytes, int samples) noexcept {
+            if (m_buckets.empty() || m_buckets.back().frames == m_per_bucket) {
+                if (m_buckets.size() == m_max) {
+                    halve();
+                }
+                timeline_bucket b;
+                b.first_frame = m_frames;
+                b.start_sample = m_samples;
+                if (m_buckets.empty()) {
+                    b.gaps = m_before.gaps;
+                    b.gap_bytes = m_before.gap_bytes;
+                }
+                m_buckets.push_back(b);
+            }
+            timeline_bucket one;
+            one.frames = 1;
+            one.min_kbps = one.max_kbps = kbps;
+            one.kbps_sum = kbps;
+            one.min_bytes = one.max_bytes = bytes;
+            one.bytes = bytes;
+            m_buckets.back().merge(one);
+            ++m_frames;
+            m_samples += samples;
+        }
+
+        // bytes of junk after the last frame added (before the first, if none)
+        void gap(int64_t bytes) noexcept {
+            timeline_bucket& b = m_buckets.empty() ? m_before : m_buckets.back();
+            ++b.gaps;
+            b.gap_bytes += bytes;
+        }
+
+        void clear() noexcept {
+            m_buckets.clear();
+            m_per_bucket = 1;
+            m_frames = m_samples = 0;
+            m_before = timeline_bucket();
+        }
+
+        const std::vector<timeline_bucket>& buckets() const noexcept { return m_buckets; }
+        int64_t frames_per_bucket() const noexcept { return m_per_bucket; }
+        int64_t frames() const noexcept { return m_frames; }
+        int64_t samples() const noexcept { return m_samples; }
+        size_t max_buckets() const noexcept { return m_max; }
+    };
+
+    // Bytes the caller owns, for parser::parse(byte_span). What the parser
+    // hands back from one (frames, tags) points into them.
+    struct byte_span {
+        const unsigned char* ptr = nullptr;
+        size_t len = 0;
+
+        byte_span() = default;
+        byte_span(const void* p, size_t n) noexcept
+            : ptr(static_cast<const unsigned char*>(p)), len(n) {}
+        const unsigned char* data() const noexcept { return ptr; }
+        size_t size() const noexcept { return len; }
+        bool empty() const noexcept { return len == 0; }
+        // clamped to what there is
+        byte_span subspan(size_t off, size_t n) const noexcept {
+            off = (std::min)(off, len);
+            return byte_span(ptr + off, (std::min)(n, len - off));
+        }
+    };
+
+    namespace detail {
+        // Where in a layer 3 frame a Xing/Info tag starts: after the header
+        // and the side info.
+        constexpr int xing_offset(int version, int channelmode) noexcept {
+            const bool mono = channelmode == CHANNELS_SINGLE_CHANNEL;
+            return version == 1 ? (mono ? 21 : 36) : (mono ? 13 : 21);
+        }
+        static constexpr int VBRI_OFFSET = 36; // always
+
+        // Is f a Xing/Info (LAME) or VBRI header frame? They hold no audio.
+        inline bool is_info_frame(const frame& f) noexcept {
+            const auto& p = f.props_const();
+            int off = xing_offset(p.version, p.channelmode);
+            const auto* b = f.bytes();
+            const int have = f.bytes_size();
+            if (p.layer == 3 && off + 4 <= have
+                && (memcmp(b + off, "Xing", 4) == 0 || memcmp(b + off, "Info", 4) == 0)) {
+                return true;
+            }
+            off = VBRI_OFFSET;
+            return off + 4 <= have && memcmp(b + off, "VBRI", 4) == 0;
+        }
+
+        inline frame_entry make_entry(const frame& f) noexcept {
+            const auto& p = f.props_const();
+            frame_entry fe;
+            fe.offset = f.file_position;
+            fe.length = f.length_in_bytes();
+            fe.bitrate = p.bitrate;
+            fe.samplerate = p.samplerate;
+            fe.samples = CAST(uint16_t, f.samples());
+            fe.version = CAST(uint8_t, p.version);
+            fe.layer = CAST(uint8_t, p.layer);
+            fe.channelmode = CAST(uint8_t, p.channelmode);
+            fe.padding = p.padding ? 1 : 0;
+            return fe;
+        }
+
+        // An APEv2 tag sits between the audio and any ID3V1 tag, and ends
+        // with a footer. Its total size (header included, if it has one),
+        // from the footer that ends at tag_end; 0 if it isn't one.
+        static constexpr int APE_FOOTER_SIZE = 32;
+        inline uint32_t ape_tag_size(const char* footer, int64_t tag_end) noexcept {
+            const auto* u = reinterpret_cast<const unsigned char*>(footer);
+            if (memcmp(u, "APETAGEX", 8) != 0) {
+                return 0;
+            }
+            const auto le32 = [](const unsigned char* p) {
+                return CAST(uint32_t, p[0]) | (CAST(uint32_t, p[1]) << 8)
+                    | (CAST(uint32_t, p[2]) << 16) | (CAST(uint32_t, p[3]) << 24);
+            };
+            const uint32_t size = le32(u + 12); // includes the footer
+            const uint32_t flags = le32(u + 20);
+            const uint64_t total
+                = CAST(uint64_t, size) + ((flags & 0x80000000u) ? APE_FOOTER_SIZE : 0);
+            if (size < APE_FOOTER_SIZE || total > CAST(uint64_t, tag_end)) {
+                return 0;
+            }
+            return CAST(uint32_t, total);
+        }
+
+        // Where a seek_type lands, for readers that keep their own position.
+        inline int64_t seek_target(const seek_type& sk, int64_t pos, int64_t size) noexcept {
+            switch (sk.seek) {
+                case my::io::seek_value_type::seek_from_begin: return sk.position;
+                case my::io::seek_value_type::seek_from_cur: return pos + sk.position;
+                case my::io::seek_value_type::seek_from_end:
+                    return size - (sk.position > 0 ? sk.position : -sk.position);
+                default: return pos;
+            }
+        }
+
+        // The IO parse(byte_span) walks with. Tags are small reads, and copied
+        // like from any other IO; the frame walk and the resync scan don't
+        // read from it at all, but look straight at the bytes (see the
+        // span_io overloads in parser).
+        class span_io {
+            byte_span m_data;
+            int64_t m_pos = 0;
+            const std::string& m_uri;
+
+            public:
+            span_io(const std::string& uri, byte_span data) noexcept
+                : m_data(data), m_uri(uri) {}
+            const std::string& uri() const noexcept { return m_uri; }
+            byte_span data() const noexcept { return m_data; }
+            int64_t size() const noexcept { return CAST(int64_t, m_data.size()); }
+            void clear() noexcept {}
+            void size_set(int) noexcept {} // read_io() wants one: nothing to size
+
+            error get(int& how_much, const seek_type& sk, char* const into,
+                bool /*peek*/ = false) noexcept {
+                m_pos = seek_target(sk, m_pos, size());
+                if (m_pos < 0 || m_pos > size()) {
+                    how_much = 0;
+                    return error(CAST(error::error_code, -EINVAL));
+                }
+                const int64_t got = (std::min)(CAST(int64_t, how_much), size() - m_pos);
+                memcpy(into, m_data.data() + m_pos, CAST(size_t, got));
+                m_pos += got;
+                const bool short_read = got < how_much;
+                how_much = CAST(int, got);
+                return short_read ? error::error_code::no_more_data
+                                  : error::error_code::noerror;
+            }
+        };
+
+        // No frame is longer than this (MPEG 2.5 Layer II, 8 kHz, 160 kbps,
+        // padded, is 2881 bytes): a frame view never needs to be bigger.
+        static constexpr int MAX_FRAME_VIEW = 4096;
+    } // namespace detail
+
     class parser {
 
         private:
         detail::frames_t m_frames{}; // frame[NUM_MPEG_HEADERS];
 
-        void copy_frame_overflow(
-            const frame* const pprev_frame, frame& cur_frame) noexcept {
+        // Parses the 4 header bytes at p into m_probe. Only the header is
+        // wanted here, so data_incomplete is expected, and not an error.
+        error probe_header(const unsigned char* p, int64_t file_pos) {
+            m_probe.clear();
+            m_probe.m_sbo.clear();
+            m_probe.m_sbo.append_data(reinterpret_cast<const char*>(p), MPEG_HEADER_SIZE);
+            error e = m_probe.parse_header(file_pos);
+            if (e == error::error_code::data_incomplete) {
+                e = error::error_code::noerror;
+            }
+            return e;
+        }
+
+        template <typename IO>
+        error read_at(IO&& io, int64_t file_pos, char* into, int& how_much) {
+            io.clear();
+            const seek_type sk(file_pos, seek_value_type::seek_from_begin);
+            return detail::read_io(io, how_much, into, sk);
+        }
 
-            assert(pprev_frame
-                && "cannot copy_frame_overflow if there isn't a previous frame!"
-                    != nullptr);
+        // Is there a real frame at cand? It must parse, and so must the next
+        // RESYNC_CONFIRM_FRAMES - 1 frames it chains to, all with the same
+        // stream signature. Only the 4 header bytes of each are looked at, out
+        // of the scan window if they are in it, else with a tiny read.
+        template <typename IO>
+        bool confirm_sync(IO&& io, int64_t cand, const unsigned char* hdr,
+            int64_t win_pos, const char* win, int win_size) {
 
-            const auto prev_sz = pprev_frame->size_in_bytes();
-            const auto copy_len = pprev_frame->m_sbo.size_i() - prev_sz;
+            if (probe_header(hdr, cand)) {
+                return false;
+            }
+            const uint32_t sig = detail::stream_signature(hdr);
+            int64_t pos = cand + m_probe.length_in_bytes();
 
-            if (copy_len > 0) {
-                auto copy_from = pprev_frame->m_sbo.cbegin() + prev_sz;
-                auto copy_to = cur_frame.m_sbo.begin();
-                cur_frame.m_sbo.resize(cur_frame.m_sbo.size() + CAST(size_t, copy_len));
-                memcpy(copy_to, copy_from, CAST(size_t, copy_len));
+            for (int i = 1; i < detail::RESYNC_CONFIRM_FRAMES; ++i) {
+                if (pos + MPEG_HEADER_SIZE > m_audio_end) {
+                    // ran out of audio: a short chain at the very end is
+                    // believable, a lone frame is not.
+                    return i >= 2;
+                }
+                unsigned char h[MPEG_HEADER_SIZE] = {0};
+                const int64_t off = pos - win_pos;
+                if (off >= 0 && off + MPEG_HEADER_SIZE <= win_size) {
+                    memcpy(h, win + off, MPEG_HEADER_SIZE);
+                } else {
+                    int how_much = MPEG_HEADER_SIZE;
+                    const error e = read_at(io, pos, reinterpret_cast<char*>(h), how_much);
+                    if ((e && e != error::error_code::no_more_data)
+                        || how_much < MPEG_HEADER_SIZE) {
+                        return false;
+                    }
+                }
+                if (detail::stream_signature(h) != sig || probe_header(h, pos)) {
+                    return false;
+                }
+                pos += m_probe.length_in_bytes();
             }
+            return true;
         }
 
-        error single_frame(frame& cur_frame, frame* pprev_frame,
-            my::io::seek_type sk = my::io::seek_type()) noexcept {
+        // Up to got bytes of the file from file_pos, for resync() to scan.
+        template <typename IO>
+        error scan_window(IO&& io, int64_t file_pos, const char*& win, int& got) {
+            m_scan.resize(detail::RESYNC_WINDOW);
+            got = (std::min)(got, CAST(int, m_scan.size()));
+            win = m_scan.data();
+            return read_at(io, file_pos, m_scan.data(), got);
+        }
+        error scan_window(
+            detail::span_io& io, int64_t file_pos, const char*& win, int& got) noexcept {
+            const auto v = io.data().subspan(CAST(size_t, file_pos), CAST(size_t, got));
+            win = reinterpret_cast<const char*>(v.data());
+            got = CAST(int, v.size());
+            return error::error_code::noerror;
+        }
 
-            error e;
-            (void)sk;
-            auto frame_pos = int64_t{0};
+        // Finds the first confirmed frame at or after from. found_at is -1 if
+        // there is none before the end of the audio.
+        // The scan only ever moves forward: each byte is searched for a sync
+        // once (windows overlap by at most 3 bytes), and each candidate costs
+        // a fixed number of header checks, so junk is skipped in linear time.
+        template <typename IO>
+        error resync(IO&& io, int64_t from, int64_t& found_at) {
+            found_at = -1;
+            int64_t win_pos = from;
+
+            while (win_pos + MPEG_HEADER_SIZE <= m_audio_end) {
+                int got = CAST(int,
+                    (std::min)(CAST(int64_t, detail::RESYNC_WINDOW), m_audio_end - win_pos));
+                const char* win = nullptr;
+                const error e = scan_window(io, win_pos, win, got);
+                if (e && e != error::error_code::no_more_data) {
+                    return e;
+                }
+                if (got < MPEG_HEADER_SIZE) {
+                    break;
+                }
 
-            if (pprev_frame != nullptr) {
-                copy_frame_overflow(pprev_frame, cur_frame);
-                frame_pos = pprev_frame->file_position + pprev_frame->size_in_bytes();
-            } else {
-                // finding first frame here
-                frame_pos = cur_frame.file_position;
+                const auto* const base = reinterpret_cast<const unsigned char*>(win);
+                const auto* const wend = base + got;
+                const auto* p = base;
+                while (wend - p >= MPEG_HEADER_SIZE) {
+                    const auto* sync = reinterpret_cast<const unsigned char*>(
+                        detail::find_sync(reinterpret_cast<const char*>(p), 0,
+                            CAST(int, wend - p)));
+                    if (sync == nullptr) {
+                        // the last byte may yet start a sync in the next window
+                        p = wend - 1;
+                        break;
+                    }
+                    if (wend - sync < MPEG_HEADER_SIZE) {
+                        p = sync;
+                        break;
+                    }
+                    const int64_t cand = win_pos + (sync - base);
+                    if (confirm_sync(io, cand, sync, win_pos, win, got)) {
+                        found_at = cand;
+                        return error::error_code::noerror;
+                    }
+                    p = sync + 1;
+                }
+                win_pos += p - base;
             }
+            return error::error_code::noerror;
+        }
 
-            auto& sbo = cur_frame.m_sbo;
-            if (sbo.size() == 0) {
-                return error::error_code::need_more_data;
+        // The size of the APEv2 tag that ends at tag_end, or 0 if there isn't
+        // one.
+        template <typename IO> uint32_t get_ape_size(IO&& io, int64_t tag_end) {
+            if (tag_end < detail::APE_FOOTER_SIZE) {
+                return 0;
             }
-
-            auto* sync = detail::find_sync(sbo.begin(), 0, sbo.size_i());
-            if (sync == nullptr) {
-                return error::error_code::lost_sync;
+            char footer[detail::APE_FOOTER_SIZE];
+            int how_much = detail::APE_FOOTER_SIZE;
+            const error e
+                = read_at(io, tag_end - detail::APE_FOOTER_SIZE, footer, how_much);
+            if ((e && e != error::error_code::no_more_data)
+                || how_much < detail::APE_FOOTER_SIZE) {
+                return 0;
             }
-            const auto skipped = sync - sbo.data();
-            assert(!skipped);
+            return detail::ape_tag_size(footer, tag_end);
+        }
 
-            e = cur_frame.parse_header(frame_pos);
-            if (e == error::error_code::data_incomplete
-                || e == error::error_code::need_more_data) {
-                return e;
+        // Makes sure all of f is in its buffer, fetching the end of it if it is
+        // bigger than what the walk loaded.
+        template <typename IO> error load_whole_frame(IO&& io, frame& f) {
+            if (f.is_view()) {
+                return error::error_code::noerror; // all there already
+            }
+            auto& sbo = f.m_sbo;
+            const int have = sbo.size_i();
+            const int len = f.length_in_bytes();
+            if (have < len && f.file_position + len <= m_audio_end) {
+                sbo.resize(CAST(size_t, len));
+                int how_much = len - have;
+                const error e
+                    = read_at(io, f.file_position + have, sbo.begin() + have, how_much);
+                if (e && e != error::error_code::no_more_data) {
+                    return e;
+                }
+                sbo.resize(CAST(size_t, have + how_much));
+                f.set_header_ptr();
             }
+            return error::error_code::noerror;
+        }
 
-            return e;
+        void add_gap(int64_t from, int64_t to) {
+            if (to > from) {
+                m_gaps.push_back(sync_gap{from, to - from});
+                if (m_timeline != nullptr) {
+                    m_timeline->gap(to - from);
+                }
+                if (detail::loglevel >= detail::loglevel_t::all) {
+                    printf("Skipped %lld bytes of junk @ file position %lld\n",
+                        static_cast<long long>(to - from), static_cast<long long>(from));
+                }
+            }
         }
 
         template <typename IO> error get_id3v1(IO&& io, detail::ID3V1& v1tag) {
@@ -1105,25 +1870,6 @@ namespace mpeg {
             return memcmp(&tag, "TAG", 3) == 0;
         }
 
-        template <typename IO>
-        error find_next_frame(
-            IO&& buf, int& buf_pos, frame& prev_frame, frame& next_frame) {
-
-            (void)buf;
-            (void)buf_pos;
-            error e;
-            e = single_frame(next_frame, &prev_frame);
-
-            return e;
-        }
-
-        template <typename IO>
-        error find_first_frame(IO&& io, int buf_pos, int64_t file_pos, frame& f) {
-            const auto sk = my::io::seek_type(file_pos, seek_value_type::seek_from_begin);
-            error e = single_frame(io, buf_pos, f, file_pos, sk);
-            return e;
-        }
-
         inline void init_frames() noexcept {
             // constexpr auto N = detail::NUM_MPEG_HEADERS;
             for (auto& m_frame : m_frames) {
@@ -1148,12 +1894,13 @@ namespace mpeg {
 
             int got = how_much;
             auto& sbo = f.m_sbo;
-            sbo.resize(sbo.size() + CAST(size_t, how_much));
-            auto e = detail::read_io(io, got, f.m_sbo.begin() + f.size_in_bytes(), sk);
-            if (e) {
-                assert(0);
+            sbo.resize(CAST(size_t, how_much));
+            auto e = detail::read_io(io, got, sbo.begin(), sk);
+            if (e && e != error::error_code::no_more_data) {
+                sbo.clear();
                 return e;
             }
+            sbo.resize(CAST(size_t, got));
             if (got > 0) {
                 if (got < how_much) {
                     e = error::error_code::no_more_data;
@@ -1165,23 +1912,45 @@ namespace mpeg {
             return e;
         }
 
-        // does all the things possible to find the next frame
-        template <typename IO> error buf2frame(IO&& io, frame* pprev, frame& fcur) {
-            if (pprev) {
-                copy_frame_overflow(pprev, fcur);
-            }
-
-            auto e = error::error_code::noerror;
-            while (e != error::error_code::need_more_data) {
-                int how_much = fcur.m_sbo.capacity_i();
-                e = frame_load_data(io, fcur, how_much);
+        // parse(byte_span): the frame is a view into the caller's bytes.
+        error frame_load_data(detail::span_io& io, frame& f, int /*how_much*/,
+            seek_type sk = seek_type{}) noexcept {
+            const auto v = io.data().subspan(
+                CAST(size_t, sk.position), CAST(size_t, detail::MAX_FRAME_VIEW));
+            if (v.empty()) {
+                return error::error_code::need_more_data;
             }
+            f.set_view(v.data(), CAST(int, v.size()));
+            return error::error_code::noerror;
         }
 
+        static byte_span data_of(const detail::span_io& io) noexcept { return io.data(); }
+        template <typename IO> static byte_span data_of(const IO&) noexcept { return {}; }
+
         template <typename IO> error find_first_frames(IO&& io) {
 
             init_frames();
+            m_gaps.clear();
+            m_vbr = false;
+            m_first_frame = -1;
+            m_total_samples = 0;
+            m_duration_ms = 0;
+            m_ape_size = 0;
+            m_info_frame = -1;
+            m_hash.reset();
+            m_stats = frame_stats();
+            if (m_timeline != nullptr) {
+                m_timeline->clear();
+            }
+            m_index.clear();
+            m_data = data_of(io);
             error e;
+            if (this->file_size <= mpeg::detail::MIN_MPEG_PAYLOAD) {
+                // too small for audio, whatever its tags: and too small to
+                // look 128 bytes back from the end for an ID3v1 tag
+                e = error::error_code::tiny_file;
+                return e.at(0, MPEG_WHERE);
+            }
             e = get_id3(io, m_id3v2Header, m_id3v1Tag);
 
             if (e == error::error_code::no_id3v2_tag) {
@@ -1198,186 +1967,188 @@ namespace mpeg {
             this->m_payload_size = this->file_size - headers_size;
             if (m_payload_size <= mpeg::detail::MIN_MPEG_PAYLOAD) {
                 e = error::error_code::tiny_file;
-                return e;
+                return e.at(m_id3v2Header.tagsize_inc_header, MPEG_WHERE);
             }
+            m_audio_end = this->file_size - (id3v1_valid(m_id3v1Tag) ? 128 : 0);
+            m_ape_size = get_ape_size(io, m_audio_end);
+            m_audio_end -= m_ape_size;
 
-            io.clear();
             int64_t file_pos
                 = m_id3v2Header.tagsize_inc_header ? m_id3v2Header.tagsize_inc_header : 0;
 
             size_t cur_frame_idx = 0;
-            size_t next_frame_idx = 1;
-            int buf_pos = 0;
-
-            int n_confirmed_frames = 0;
-            auto sk = my::io::seek_type(file_pos, seek_value_type::seek_from_begin);
+            const frame* pprev = nullptr;
+            bool in_sync = false;
+            uint32_t signature = 0;
             nframes = 0;
             using namespace std;
-            int io_pos = 0;
-
-            int prev_frame_index = -1;
 
             while (true) {
 
-                auto& cur_frame = m_frames[0];
-                assert(io_pos == 0);
-                cur_frame.set_file_position(file_pos);
-                e = frame_load_data(io, cur_frame, cur_frame.m_sbo.capacity_i(), sk);
-                if (e) {
-                    assert(0);
-                    return e;
+                if (!in_sync) {
+                    int64_t found_at = -1;
+                    e = resync(io, file_pos, found_at);
+                    if (e) {
+                        return e.at(file_pos, MPEG_WHERE);
+                    }
+                    if (found_at < 0) {
+                        add_gap(file_pos, m_audio_end);
+                        return error::error_code::no_more_data;
+                    }
+                    add_gap(file_pos, found_at);
+                    file_pos = found_at;
+                    in_sync = true;
+                    pprev = nullptr;
                 }
-                e = single_frame(cur_frame, nullptr, sk);
 
-                if (e) {
-                    if (e == error::error_code::no_more_data) {
-                        return e;
-                    }
-                    assert(0);
-                } else {
+                if (file_pos + MPEG_HEADER_SIZE > m_audio_end) {
+                    return error::error_code::no_more_data;
+                }
 
-                    n_confirmed_frames++;
-                    nframes++;
-
-                    if (nframes == 1) {
-                        const auto& fm = cur_frame;
-                        const auto& props = fm.props_const();
-                        cout << "reckon first frame is @ " << fm.file_position << endl
-                             << props.bitrate << " kbps" << endl
-                             << "version:    " << CAST(int, props.version) << endl
-                             << "layer:      " << CAST(int, props.layer) << endl
-                             << "samplerate: " << props.samplerate << endl
-                             << "padding:    " << props.padding << endl
-                             << "total size: " << fm.size_in_bytes() << endl
-                             << "[next frame expected @ file position: "
-                             << fm.file_position + fm.size_in_bytes() << "]" << endl;
-                        cout << "file size is: " << this->file_size << endl;
+                auto& cur_frame = m_frames[cur_frame_idx];
+                cur_frame.clear();
+                const auto sk = my::io::seek_type(file_pos, seek_value_type::seek_from_begin);
+                io.clear();
+                e = frame_load_data(io, cur_frame, cur_frame.m_sbo.capacity_i(), sk);
+                if (e && e != error::error_code::no_more_data) {
+                    return e.at(file_pos, MPEG_WHERE);
+                }
+                if (pprev != nullptr && m_known != nullptr
+                    && m_known(cur_frame, file_pos)) {
+                    e = error::error_code::noerror;
+                } else {
+                    e = cur_frame.parse_header(file_pos);
+                    // a frame bigger than what we loaded is fine: we only need
+                    // its header to walk to the next one.
+                    if (e == error::error_code::data_incomplete) {
+                        e = error::error_code::noerror;
                     }
+                }
 
-                    buf_pos += cur_frame.length_in_bytes();
-                    const auto capa = cur_frame.m_sbo.capacity_i();
-                    const auto fsz = cur_frame.size_in_bytes();
-                    const auto remain_in_buffer = capa - fsz;
-                    if (remain_in_buffer < 0) {
-                        assert(0);
-                    }
+                if (e) {
+                    // lost it: damage. Go find the next real frame, starting
+                    // right here.
+                    cur_frame.clear();
+                    in_sync = false;
+                    continue;
+                }
+                const auto this_sig = detail::stream_signature(cur_frame.header_bytes);
+                if (pprev != nullptr && this_sig != signature) {
+                    // a splice, which may well start here
+                    cur_frame.clear();
+                    in_sync = false;
+                    continue;
+                }
+                signature = this_sig;
+                if (pprev == nullptr) {
+                    m_known = m_fast_path ? detail::known_signature_for(signature) : nullptr;
+                }
 
-                // ---------------------------------
-                the_next_frame:
-                    io.clear();
-                    m_frames[next_frame_idx].clear();
-                    frame* pcur_frame = &m_frames[cur_frame_idx];
-                    e = find_next_frame(
-                        io, buf_pos, *pcur_frame, m_frames[next_frame_idx]);
-
-                    if (e == error::error_code::need_more_data
-                        || e == error::error_code::data_incomplete) {
-                        const auto stray_size
-                            = m_frames[next_frame_idx].m_sbo.size_i() - buf_pos;
-                        assert(stray_size > 0
-                            && "stray size must be positive, or zero!" == nullptr);
-                        const auto fp = m_frames[next_frame_idx].file_position;
-                        assert(stray_size);
-                        int my_io_pos = buf_pos; //
-                        //
-                        if (prev_frame_index >= 0) {
-                            e = find_next_frame(io, my_io_pos, m_frames[prev_frame_index],
-                                m_frames[next_frame_idx]);
-                        } else {
-                            e = single_frame(*pcur_frame,
-                                &m_frames[CAST(size_t, prev_frame_index)], fp);
-                        }
+                if (pprev != nullptr
+                    && compare_frames(*pprev, cur_frame) == frame_mismatch::bitrate) {
+                    m_vbr = true;
+                }
+                cur_frame.vbr_set(m_vbr);
+                nframes++;
+                m_stats.add(cur_frame);
+                if (m_timeline != nullptr) {
+                    m_timeline->add(cur_frame);
+                }
+                m_total_samples += cur_frame.samples();
+                m_duration_ms += 1000.0 * cur_frame.samples()
+                    / cur_frame.props_const().samplerate;
 
-                        if (e != error::error_code::no_more_data) {
-                            assert(e == error::error_code::data_incomplete);
-                        }
-                    }
-                    if (e != error::error_code::no_more_data) {
-                        assert(
-                            e.to_int() == 0 || e == error::error_code::data_incomplete);
+                if (nframes == 1 && detail::is_info_frame(cur_frame)) {
+                    m_info_frame = file_pos;
+                } else {
+                    if (m_index_frames) {
+                        m_index.push_back(detail::make_entry(cur_frame));
                     }
-                    if (e == error::error_code::noerror) {
-
-                        const auto baddun = compare_frames(
-                            m_frames[cur_frame_idx], m_frames[next_frame_idx]);
-                        if (baddun != frame_mismatch::none) {
-                            if (baddun == frame_mismatch::bitrate) {
-                                m_frames[cur_frame_idx].vbr_set(true);
-                                m_frames[0].vbr_set(true);
-                            }
-
-                            fprintf(
-                                stderr, "%s\n", frame_mismatch_string(baddun).c_str());
-                            return error(baddun);
+                    if (m_fingerprint || m_on_frame) {
+                        e = load_whole_frame(io, cur_frame);
+                        if (e) {
+                            return e.at(file_pos, MPEG_WHERE);
                         }
-
-                        const auto prev_start_where = file_pos;
-                        const auto& this_frame = m_frames[next_frame_idx];
-                        file_pos = this_frame.file_position;
-                        const auto fl = this_frame.length_in_bytes();
-                        file_pos += fl;
-                        if (this_frame.m_sbo.size_i() > fl) {
-                            io_pos = fl;
-                        } else {
-                            io_pos = 0;
+                        if (m_fingerprint) {
+                            m_hash.update(cur_frame.bytes(),
+                                CAST(size_t,
+                                    (std::min)(cur_frame.bytes_size(),
+                                        cur_frame.length_in_bytes())));
                         }
-
-                        if (detail::loglevel >= detail::loglevel_t::all) {
-                            printf("MPEG header %lu @ file position %lu has "
-                                   "size of: %lu\n",
-                                static_cast<unsigned long>(nframes),
-                                static_cast<unsigned long>(this_frame.file_position),
-                                static_cast<unsigned long>(this_frame.length_in_bytes()));
+                        if (m_on_frame) {
+                            m_on_frame(cur_frame);
                         }
-                        assert(file_pos > prev_start_where);
-
-                        cur_frame_idx++;
+                    }
+                }
 
-                        if (cur_frame_idx >= detail::NUM_MPEG_HEADERS) {
-                            cur_frame_idx = 0;
-                        }
-                        prev_frame_index = CAST(int, cur_frame_idx);
+                if (nframes == 1) {
+                    m_first_frame = file_pos;
+                }
+                if (nframes == 1 && detail::loglevel >= detail::loglevel_t::all) {
+                    const auto& fm = cur_frame;
+                    const auto& props = fm.props_const();
+                    cout << "reckon first frame is @ " << fm.file_position << endl
+                         << props.bitrate << " kbps" << endl
+                         << "version:    " << CAST(int, props.version) << endl
+                         << "layer:      " << CAST(int, props.layer) << endl
+                         << "samplerate: " << props.samplerate << endl
+                         << "padding:    " << props.padding << endl
+                         << "total size: " << fm.size_in_bytes() << endl
+                         << "[next frame expected @ file position: "
+                         << fm.file_position + fm.size_in_bytes() << "]" << endl;
+                    cout << "file size is: " << this->file_size << endl;
+                } else if (detail::loglevel >= detail::loglevel_t::all) {
+                    printf("MPEG header %lld @ file position %lld has "
+                           "size of: %d\n",
+                        static_cast<long long>(nframes),
+                        static_cast<long long>(cur_frame.file_position),
+                        cur_frame.length_in_bytes());
+                }
 
-                        next_frame_idx = cur_frame_idx + 1;
-                        if (next_frame_idx >= detail::NUM_MPEG_HEADERS) {
-                            next_frame_idx = 0;
-                        }
-                        assert(next_frame_idx != cur_frame_idx);
-                        n_confirmed_frames++;
-                        nframes++;
-                        buf_pos = this_frame.size_in_bytes();
-                        goto the_next_frame;
-                    } else {
-                        if (e != error::error_code::no_more_data) {
-                            if (e == error::error_code::data_incomplete) {
-                                // might be a truncated frame, if there is no
-                                // more data:
-                                int x = 0;
-                                (void)x;
-                                std::cout << x;
-
-                            } else {
-
-                                assert("frame parser error that is NOT "
-                                       "no_more_data!"
-                                    == nullptr);
-                            }
-                        }
-                        return e;
-                    }
+                file_pos += cur_frame.length_in_bytes();
+                pprev = &cur_frame;
+                cur_frame_idx++;
+                if (cur_frame_idx >= detail::NUM_MPEG_HEADERS) {
+                    cur_frame_idx = 0;
+                }
+                if (m_stop_after > 0 && nframes >= m_stop_after) {
+                    return error::error_code::noerror;
                 }
             }
 
             return e;
         }
+
         // using buffer_t = buffer_type<IO>;
-        uint32_t nframes{0};
+        int64_t nframes{0};
         int64_t file_size{-1};
         std::string filepath;
         my::mpeg::error err;
         detail::id3v2Header m_id3v2Header;
         detail::ID3V1 m_id3v1Tag;
         int64_t m_payload_size = 0;
+        // where the audio stops (before any ID3V1 tag)
+        int64_t m_audio_end = 0;
+        bool m_vbr = false;
+        int64_t m_first_frame = -1;
+        int64_t m_total_samples = 0;
+        double m_duration_ms = 0;
+        uint32_t m_ape_size = 0;
+        int64_t m_info_frame = -1; // Xing, Info or VBRI frame, if any
+        bool m_fingerprint = false;
+        my::hash::xxh64 m_hash;
+        std::function<void(const frame&)> m_on_frame;
+        frame_stats m_stats;
+        bitrate_timeline* m_timeline = nullptr;
+        bool m_index_frames = false;
+        std::vector<frame_entry> m_index;
+        std::vector<sync_gap> m_gaps;
+        std::vector<char> m_scan; // resync window: reused, not reallocated
+        frame m_probe; // scratch for checking sync candidates
+        byte_span m_data; // what parse(byte_span) was given, if that's how
+        bool m_fast_path = true;
+        detail::known_signature_fn m_known = nullptr; // for this run of frames
+        int64_t m_stop_after = 0;
 
         // IO& m_buf;
 
@@ -1395,18 +2166,135 @@ namespace mpeg {
         parser(string_view file_path, uintmax_t file_size)
             : parser(0, file_path, file_size) {}
 
+        // Every run of junk skipped while finding (or re-finding) sync, in file
+        // order.
+        const std::vector<sync_gap>& gaps() const noexcept { return m_gaps; }
+        bool vbr() const noexcept { return m_vbr; }
+        // what the last parse() returned
+        const error& last_error() const noexcept { return err; }
+
+        // Hash the audio frames as they are found (parse_summary::audio_hash).
+        // Costs no extra reads, except for frames too big for one frame load.
+        void fingerprint(bool on) noexcept { m_fingerprint = on; }
+        // file offset of the Xing/Info/VBRI frame, or -1
+        int64_t info_frame() const noexcept { return m_info_frame; }
+        // bitrate histogram and friends, from the same walk
+        const frame_stats& stats() const noexcept { return m_stats; }
+        // Build t as the walk goes: every frame, and every gap. t is the
+        // caller's, and is cleared when a parse starts; nullptr to stop.
+        void timeline(bitrate_timeline* t) noexcept { m_timeline = t; }
+        // Record where every audio frame is (not the Xing/Info/VBRI one), in
+        // file order. Costs 24 bytes a frame, and no extra reads.
+        void index_frames(bool on) noexcept { m_index_frames = on; }
+        const std::vector<frame_entry>& frame_index() const noexcept { return m_index; }
+        // Check the headers after the first in each run of frames against that
+        // run's signature (detail::known_signature), rather than decoding each
+        // one in full. On by default: off is only for checking it.
+        void fast_path(bool on) noexcept { m_fast_path = on; }
+        // End the walk, quite happily, once n frames (the Xing/Info/VBRI one
+        // counts) have been found. 0, the default, walks them all.
+        void stop_after(int64_t n) noexcept { m_stop_after = n; }
+
+        // What a parse stopped after a few frames reads, as far as it can be
+        // known before any of the file is seen: the start (the ID3v2 header,
+        // and the first frames of an untagged file) and the end (ID3v1, and
+        // the APE footer before it). Where an ID3v2 tag ends, and so where the
+        // first frames are, only the start can say.
+        static std::vector<byte_range> wanted_ranges(int64_t file_size) {
+            static constexpr int64_t TAIL = 128 + 32; // ID3v1, APE footer
+            std::vector<byte_range> v;
+            if (file_size <= 0) {
+                return v;
+            }
+            const int64_t head = (std::min)(
+                file_size, CAST(int64_t, detail::RESYNC_WINDOW));
+            v.push_back(byte_range{0, head});
+            if (file_size > head) {
+                const int64_t from = (std::max)(head, file_size - TAIL);
+                v.push_back(byte_range{from, file_size - from});
+            }
+            return v;
+        }
+
+        // Called with each audio frame (not the Xing/Info/VBRI one) as the walk
+        // reaches it, with the whole frame in its buffer: a decoder (see
+        // my_layer3.hpp) can run off the parser's own reads.
+        using frame_callback = std::function<void(const frame&)>;
+        void on_frame(frame_callback cb) { m_on_frame = std::move(cb); }
+
+        parse_summary summary() const noexcept {
+            parse_summary s;
+            s.file_size = file_size;
+            s.first_frame = m_first_frame;
+            s.nframes = nframes;
+            s.total_samples = m_total_samples;
+            s.duration_ms = m_duration_ms;
+            for (const auto& g : m_gaps) {
+                s.gap_bytes += g.length;
+            }
+            s.ngaps = CAST(uint32_t, m_gaps.size());
+            s.error = err.to_int();
+            s.error_offset = err.offset;
+            s.id3v2_size = m_id3v2Header.tagsize_inc_header;
+            s.id3v1 = id3v1_valid(m_id3v1Tag) ? 1 : 0;
+            s.vbr = m_vbr ? 1 : 0;
+            s.ape_size = m_ape_size;
+            s.audio_hash = m_fingerprint ? m_hash.digest() : 0;
+            if (nframes) {
+                const auto& p = any_valid_frame().props_const();
+                s.samplerate = p.samplerate;
+                s.bitrate = p.bitrate;
+                s.version = p.version;
+                s.layer = p.layer;
+                s.channelmode = p.channelmode;
+                s.emphasis = p.emphasis;
+            }
+            return s;
+        }
+
+        // Parses bytes already in memory, which must stay put for as long as
+        // anything taken from the parse (frames passed to on_frame(), the tag
+        // views below) is in use. Nothing is copied: frames are views into
+        // data. The file size given to the constructor is not used.
+        mpeg::error parse(byte_span data) {
+            file_size = CAST(int64_t, data.size());
+            detail::span_io io(filepath, data);
+            return parse(io);
+        }
+
+        // After parse(byte_span), the tags found, as views into what it was
+        // given. Empty if there is no such tag, or after any other parse().
+        byte_span id3v2_tag() const noexcept {
+            return m_data.subspan(0, m_id3v2Header.tagsize_inc_header);
+        }
+        byte_span ape_tag() const noexcept {
+            return m_data.subspan(CAST(size_t, m_audio_end), m_ape_size);
+        }
+        byte_span id3v1_tag() const noexcept {
+            return id3v1_valid(m_id3v1Tag) ? m_data.subspan(m_data.size() - 128, 128)
+                                           : byte_span();
+        }
+        // ... and any indexed frame, likewise
+        byte_span frame_bytes(const frame_entry& fe) const noexcept {
+            return m_data.subspan(CAST(size_t, fe.offset), CAST(size_t, fe.length));
+        }
+
         template <typename IO> mpeg::error parse(IO&& myio) {
             using namespace std;
-            static auto ctr = 0;
+            // shared by every parser, maybe in other threads
+            static std::atomic<int> ctr{0};
 
-            std::cout << endl;
-            std::cout << "-----------------------------------------" << endl;
+            if (detail::loglevel >= detail::loglevel_t::all) {
+                std::cout << endl;
+                std::cout << "-----------------------------------------" << endl;
 
-            std::cout << "Parsing: " << this->filepath << endl;
-            cout << "Files parsed so far: " << ctr++ << endl;
+                std::cout << "Parsing: " << this->filepath << endl;
+                cout << "Files parsed so far: " << ctr << endl;
+            }
+            ++ctr;
             mpeg::error e;
 
-            const auto myctr = ctr;
+            const int myctr = ctr;
             (void)myctr;
             CAST(void, ctr);
             e = find_first_frames(myio);
@@ -1416,31 +2304,276 @@ namespace mpeg {
                     e = error::error_code::noerror;
 
                 } else {
-                    assert("unexpected find_first_frames error" == nullptr);
+                    fprintf(stderr, "%s: %s\n", this->filepath.c_str(),
+                        e.describe().c_str());
+                    // a file too small to hold audio is no surprise
+                    MPEG_ASSERT(e == error::error_code::tiny_file
+                        || "unexpected find_first_frames error" == nullptr);
                 }
             }
+            err = e;
 
             if (nframes) {
-                const auto ll = detail::loglevel;
+                const auto ll = detail::loglevel.load();
                 if (ll >= detail::loglevel_t::all) {
                     puts(myio.uri().c_str());
-                    printf("nFrames = %lu\n", CAST(unsigned long, nframes));
+                    printf("nFrames = %lld\n", CAST(long long, nframes));
                     const auto& f = any_valid_frame();
                     printf("single frame dur in ms = %d\n", f.frame_dur_in_ms());
-                    auto dur_ms = nframes * CAST(unsigned long, f.frame_dur_in_ms());
-                    const int chans = detail::nchannels(
-                        CAST(my::mpeg::detail::ChannelEnum, f.props_const().channelmode));
-                    assert(
-                        chans > 0 && chans <= 2 && "bad/weird num channels" != nullptr);
-                    dur_ms *= CAST(unsigned int, chans);
-                    printf("Dur: %f seconds.\n", CAST(double, dur_ms) / 1000.0);
-                    assert(dur_ms > 10);
+                    // NOTE: duration does not depend on the number of channels:
+                    // a stereo frame holds the same time as a mono one.
+                    printf("Dur: %f seconds.\n", m_duration_ms / 1000.0);
+                    printf("Bitrate: %d - %d kbps, %.1f kbps average, %.1f%% of "
+                           "frames padded\n",
+                        m_stats.min_kbps, m_stats.max_kbps, m_stats.average_kbps(),
+                        m_stats.padding_ratio() * 100.0);
+                    MPEG_ASSERT(m_duration_ms > 10);
                 }
             }
-            assert(e == error::error_code::noerror);
             return e;
         }
     };
 
+    namespace detail {
+#ifndef _WIN32
+        static_assert(sizeof(off_t) >= sizeof(int64_t),
+            "a 32 bit off_t wraps past 2 GB: build with -D_FILE_OFFSET_BITS=64");
+#endif
+        // A READER_CALLBACK (see buffer<>) over a FILE*.
+        // Returns 0, my::io::NO_MORE_DATA at end of file, or -errno.
+        inline int read_stdio(
+            FILE* f, char* const into, int& how_much, const seek_type& sk) noexcept {
+            if (sk.seek != my::io::seek_value_type::seek_invalid) {
+                int whence = SEEK_SET;
+                int64_t pos = sk.position;
+                if (sk.seek == my::io::seek_value_type::seek_from_cur) {
+                    whence = SEEK_CUR;
+                } else if (sk.seek == my::io::seek_value_type::seek_from_end) {
+                    whence = SEEK_END;
+                    pos = pos > 0 ? -pos : pos;
+                }
+#ifdef _WIN32
+                const int sr = _fseeki64(f, pos, whence);
+#else
+                const int sr = fseeko(f, CAST(off_t, pos), whence);
+#endif
+                if (sr != 0) {
+                    how_much = 0;
+                    return errno > 0 ? -errno : -1;
+                }
+            }
+            const size_t wanted = CAST(size_t, how_much);
+            const size_t got = fread(into, 1, wanted, f);
+            how_much = CAST(int, got);
+            if (got < wanted) {
+                const bool bad = ferror(f) != 0;
+                clearerr(f);
+                return bad ? -EIO : my::io::NO_MORE_DATA;
+            }
+            return 0;
+        }
+
+        // A READER_CALLBACK over bytes somebody else owns (a mapped file, a
+        // download): nothing is copied but what the parser asks for.
+        struct memory_reader {
+            const char* data = nullptr;
+            int64_t size = 0;
+            int64_t pos = 0;
+
+            int operator()(char* const into, int& how_much, const seek_type& sk) noexcept {
+                pos = seek_target(sk, pos, size);
+                if (pos < 0 || pos > size) {
+                    how_much = 0;
+                    return -EINVAL;
+                }
+                const int64_t got = (std::min)(CAST(int64_t, how_much), size - pos);
+                memcpy(into, data + pos, CAST(size_t, got));
+                pos += got;
+                const bool short_read = got < how_much;
+                how_much = CAST(int, got);
+                return short_read ? my::io::NO_MORE_DATA : 0;
+            }
+        };
+
+        // A READER_CALLBACK over a file descriptor the caller opened (and
+        // closes). It keeps its own position, so the descriptor's is left
+        // alone (except on Windows).
+        struct fd_reader {
+            int fd = -1;
+            int64_t size = 0;
+            int64_t pos = 0;
+
+            int operator()(char* const into, int& how_much, const seek_type& sk) noexcept {
+                pos = seek_target(sk, pos, size);
+                if (pos < 0) {
+                    how_much = 0;
+                    return -EINVAL;
+                }
+                int got = 0;
+                while (got < how_much) {
+#ifdef _WIN32
+                    const int r = _lseeki64(fd, pos + got, SEEK_SET) < 0
+                        ? -1
+                        : _read(fd, into + got, CAST(unsigned, how_much - got));
+#else
+                    const ssize_t r = ::pread(
+                        fd, into + got, CAST(size_t, how_much - got), CAST(off_t, pos + got));
+#endif
+                    if (r < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        how_much = got;
+                        pos += got;
+                        return errno > 0 ? -errno : -EIO;
+                    }
+                    if (r == 0) {
+                        break;
+                    }
+                    got += CAST(int, r);
+                }
+                pos += got;
+                const bool short_read = got < how_much;
+                how_much = got;
+                return short_read ? my::io::NO_MORE_DATA : 0;
+            }
+        };
+
+        static constexpr int MIN_READ_BLOCK = 64 * 1024;
+        static constexpr int MAX_READ_BLOCK = 4 * 1024 * 1024;
+        static constexpr int DEFAULT_READ_BLOCK = 256 * 1024;
+
+        // A READER_CALLBACK in front of another one. The parser asks for a
+        // frame's worth (about 1 KB) at a time, each at its own seek: this
+        // turns those into whole reads of the block_size-aligned block they
+        // fall in, and serves the rest of the walk through that block out of
+        // memory. The read of each block is the read-ahead for the frames in
+        // it, so a file costs about size / block_size reads, plus a couple for
+        // the tags at either end. size is the file's (seek_from_end needs it).
+        // Two blocks are kept: a frame load that runs over the end of one
+        // block is followed by one that starts back inside it.
+        template <typename READER> class block_reader {
+            struct block {
+                std::vector<char> data;
+                int64_t pos = -1; // file offset of data[0]
+                int len = 0;
+                bool holds(int64_t at) const noexcept { return at >= pos && at < pos + len; }
+            };
+            READER m_reader;
+            block m_blocks[2];
+            int m_last = 0; // the one used last: the other goes first
+            int64_t m_size = 0;
+            int64_t m_pos = 0;
+            int64_t m_reads = 0;
+
+            // Reads the block holding file offset at into b. Returns as m_reader
+            // does.
+            int fill(block& b, int64_t at) {
+                const int64_t bs = CAST(int64_t, b.data.size());
+                b.pos = at - at % bs;
+                int how_much = CAST(int, (std::min)(bs, m_size - b.pos));
+                ++m_reads;
+                const int rv = m_reader(b.data.data(), how_much,
+                    seek_type(b.pos, my::io::seek_value_type::seek_from_begin));
+                b.len = rv < 0 && rv != my::io::NO_MORE_DATA ? 0 : how_much;
+                return rv;
+            }
+
+            public:
+            block_reader(READER reader, int64_t size, int block_size = DEFAULT_READ_BLOCK)
+                : m_reader(std::move(reader))
+                , m_size(size < 0 ? (std::numeric_limits<int64_t>::max)() : size) {
+                block_size = (std::max)(MIN_READ_BLOCK, (std::min)(block_size, MAX_READ_BLOCK));
+                for (auto& b : m_blocks) {
+                    b.data.resize(CAST(size_t, block_size));
+                }
+            }
+
+            int operator()(char* const into, int& how_much, const seek_type& sk) {
+                m_pos = seek_target(sk, m_pos, m_size);
+                if (m_pos < 0) {
+                    how_much = 0;
+                    return -EINVAL;
+                }
+                int got = 0;
+                while (got < how_much && m_pos < m_size) {
+                    if (!m_blocks[m_last].holds(m_pos)) {
+                        m_last = 1 - m_last;
+                    }
+                    block& b = m_blocks[m_last];
+                    if (!b.holds(m_pos)) {
+                        const int rv = fill(b, m_pos);
+                        if (rv < 0 && rv != my::io::NO_MORE_DATA) {
+                            how_much = got;
+                            return rv;
+                        }
+                        if (!b.holds(m_pos)) {
+                            break; // the file is shorter than it said
+                        }
+                    }
+                    const int off = CAST(int, m_pos - b.pos);
+                    const int n = (std::min)(how_much - got, b.len - off);
+                    memcpy(into + got, b.data.data() + off, CAST(size_t, n));
+                    got += n;
+                    m_pos += n;
+                }
+                const bool short_read = got < how_much;
+                how_much = got;
+                return short_read ? my::io::NO_MORE_DATA : 0;
+            }
+
+            // how many reads went to the reader underneath
+            int64_t reads() const noexcept { return m_reads; }
+            int block_size() const noexcept { return CAST(int, m_blocks[0].data.size()); }
+        };
+    } // namespace detail
+
+    // Opens and parses the file at path in one go. summary is filled in even
+    // when the parse fails, so the failure can be recorded. on_frame, if
+    // given, sees every audio frame (parser::on_frame()); stats, if given,
+    // gets parser::stats(). The file is read read_block bytes at a time
+    // (detail::block_reader).
+    inline error parse_file(const std::string& path, parse_summary& summary,
+        bool fingerprint = false, parser::frame_callback on_frame = nullptr,
+        frame_stats* stats = nullptr, int read_block = detail::DEFAULT_READ_BLOCK) {
+        summary = parse_summary();
+        FILE* f = ::fopen(path.c_str(), "rb");
+        if (f == nullptr) {
+            error e(CAST(error::error_code, -errno));
+            summary.error = e.to_int();
+            return e.at(-1, MPEG_WHERE);
+        }
+        // block_reader does the buffering: stdio's would only copy it twice
+        setvbuf(f, nullptr, _IONBF, 0);
+        int64_t file_size = -1;
+#ifdef _WIN32
+        if (_fseeki64(f, 0, SEEK_END) == 0) {
+            file_size = _ftelli64(f);
+        }
+#else
+        if (fseeko(f, 0, SEEK_END) == 0) {
+            file_size = CAST(int64_t, ftello(f));
+        }
+#endif
+#if !defined(_WIN32) && defined(POSIX_FADV_SEQUENTIAL)
+        posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        auto stdio = [f](char* const p, int& how_much, const seek_type& sk) {
+            return detail::read_stdio(f, p, how_much, sk);
+        };
+        detail::block_reader<decltype(stdio)> reader(stdio, file_size, read_block);
+        buffer buf(path, std::move(reader));
+        parser p(path, CAST(uintmax_t, file_size));
+        p.fingerprint(fingerprint);
+        p.on_frame(std::move(on_frame));
+        const error e = p.parse(buf);
+        summary = p.summary();
+        if (stats != nullptr) {
+            *stats = p.stats();
+        }
+        fclose(f);
+        return e;
+    }
+
 } // namespace mpeg
 } // namespace my
@@ -0,0 +1,503 @@
+#pragma once
+// my_mpeg_async.hpp
+// parse_async(): a parse as a C++20 coroutine that awaits its reads, so one
+// thread can have thousands of files in flight on an event loop, with no
+// thread and no stack per file: each costs its coroutine frame and one read
+// block.
+//
+// The tags are read first (the tail, then the head), then the audio, a block
+// at a time in file order, goes through a stream_framer (my_icy.hpp): a push
+// walk, which never has to go back for bytes. The summary is parser::parse()'s,
+// bar the odd resync in damaged audio, where a sync candidate here is believed
+// once the header after it agrees (the file walk looks further).
+//
+// Reads go through a callable read(offset, into, n) that returns an awaitable
+// giving the bytes read, 0 at the end of the file, or -errno. Two loops to get
+// them from: uring_loop (Linux io_uring, by raw syscalls: no liburing) and
+// pread_loop (anywhere with pread: run() makes the reads, one after another).
+//
+// Only with C++20 coroutines: MY_MPEG_ASYNC says whether you have them.
+#include "my_icy.hpp"
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define MY_MPEG_ASYNC 1
+#include <coroutine>
+#include <cerrno>
+#include <deque>
+#include <exception>
+#include <utility>
+#include <vector>
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define MY_MPEG_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace my {
+namespace mpeg {
+    namespace async {
+
+        // A coroutine that gives back a T. Nothing runs until it is co_awaited
+        // (it then resumes its awaiter when it is done) or start()ed.
+        template <typename T> class task {
+            public:
+            struct promise_type;
+            using handle = std::coroutine_handle<promise_type>;
+
+            struct promise_type {
+                T value{};
+                std::exception_ptr ex;
+                std::coroutine_handle<> next; // whoever co_awaits this
+
+                task get_return_object() noexcept {
+                    return task(handle::from_promise(*this));
+                }
+                std::suspend_always initial_suspend() noexcept { return {}; }
+                auto final_suspend() noexcept {
+                    struct to_next {
+                        bool await_ready() noexcept { return false; }
+                        std::coroutine_handle<> await_suspend(handle h) noexcept {
+                            const auto n = h.promise().next;
+                            return n ? n : std::noop_coroutine();
+                        }
+                        void await_resume() noexcept {}
+                    };
+                    return to_next{};
+                }
+                void return_value(T v) { value = std::move(v); }
+                void unhandled_exception() noexcept { ex = std::current_exception(); }
+            };
+
+            private:
+            handle m_h;
+            explicit task(handle h) noexcept : m_h(h) {}
+
+            public:
+            task(task&& rhs) noexcept : m_h(std::exchange(rhs.m_h, nullptr)) {}
+            task& operator=(task&& rhs) noexcept {
+                if (this != &rhs) {
+                    if (m_h) {
+                        m_h.destroy();
+                    }
+                    m_h = std::exchange(rhs.m_h, nullptr);
+                }
+                return *this;
+            }
+            task(const task&) = delete;
+            task& operator=(const task&) = delete;
+            ~task() {
+                if (m_h) {
+                    m_h.destroy();
+                }
+            }
+
+            bool await_ready() const noexcept { return !m_h || m_h.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+                m_h.promise().next = h;
+                return m_h; // symmetric transfer: no stack growth
+            }
+            T await_resume() { return result(); }
+
+            // From the top: runs it up to its first read.
+            void start() { m_h.resume(); }
+            bool done() const noexcept { return !m_h || m_h.done(); }
+            T result() {
+                auto& p = m_h.promise();
+                if (p.ex) {
+                    std::rethrow_exception(p.ex);
+                }
+                return std::move(p.value);
+            }
+        };
+
+        namespace detail {
+            // a read waiting on a loop
+            struct pending_read {
+                int fd = -1;
+                int64_t offset = 0;
+                char* into = nullptr;
+                int n = 0;
+                int result = 0;
+                std::coroutine_handle<> h;
+#ifndef _WIN32
+                iovec iov{};
+#endif
+            };
+
+            template <typename LOOP> struct read_awaiter {
+                LOOP* loop;
+                pending_read r;
+                bool await_ready() const noexcept { return r.n <= 0; }
+                void await_suspend(std::coroutine_handle<> h) {
+                    r.h = h;
+                    loop->submit(&r);
+                }
+                int await_resume() const noexcept { return r.result; }
+            };
+
+            // As many of the n bytes from offset as there are: a read can come
+            // back short.
+            template <typename READ>
+            task<int> read_fully(READ& read, int64_t offset, char* into, int n) {
+                int got = 0;
+                while (got < n) {
+                    const int r = co_await read(offset + got, into + got, n - got);
+                    if (r < 0) {
+                        co_return r;
+                    }
+                    if (r == 0) {
+                        break;
+                    }
+                    got += r;
+                }
+                co_return got;
+            }
+        } // namespace detail
+
+#ifndef _WIN32
+        // Makes the reads asked of it with pread, one after another, resuming
+        // each reader as its read is done. Nothing waits in parallel: for a
+        // loop anywhere, and for checking the others against.
+        class pread_loop {
+            std::deque<detail::pending_read*> m_q;
+            int64_t m_reads = 0;
+
+            public:
+            detail::read_awaiter<pread_loop> read(
+                int fd, int64_t offset, char* into, int n) {
+                return {this, detail::pending_read{fd, offset, into, n, 0, {}, {}}};
+            }
+            void submit(detail::pending_read* r) { m_q.push_back(r); }
+
+            // until nothing is waiting
+            int run() {
+                while (!m_q.empty()) {
+                    auto* r = m_q.front();
+                    m_q.pop_front();
+                    ssize_t got = 0;
+                    do {
+                        got = ::pread(
+                            r->fd, r->into, CAST(size_t, r->n), CAST(off_t, r->offset));
+                    } while (got < 0 && errno == EINTR);
+                    r->result = got < 0 ? -errno : CAST(int, got);
+                    ++m_reads;
+                    r->h.resume(); // may well submit another
+                }
+                return 0;
+            }
+            int64_t reads() const noexcept { return m_reads; }
+        };
+#endif
+
+#ifdef MY_MPEG_URING
+        // Reads through an io_uring: up to entries of them in flight at
+        // once, from however many files. io_uring_setup can be refused (a
+        // kernel before 5.1, or a seccomp policy): check ok(), and fall back
+        // to a pread_loop.
+        class uring_loop {
+            int m_fd = -1;
+            unsigned m_entries = 0;
+            void* m_sq = nullptr;
+            size_t m_sq_len = 0;
+            void* m_cq = nullptr;
+            size_t m_cq_len = 0;
+            io_uring_sqe* m_sqes = nullptr;
+            size_t m_sqes_len = 0;
+            unsigned* m_sq_head = nullptr;
+            unsigned* m_sq_tail = nullptr;
+            unsigned* m_sq_mask = nullptr;
+            unsigned* m_sq_array = nullptr;
+            unsigned* m_cq_head = nullptr;
+            unsigned* m_cq_tail = nullptr;
+            unsigned* m_cq_mask = nullptr;
+            io_uring_cqe* m_cqes = nullptr;
+            std::deque<detail::pending_read*> m_q; // not yet in the ring
+            std::vector<detail::pending_read*> m_done;
+            unsigned m_in_flight = 0; // the kernel has them
+            unsigned m_unsubmitted = 0; // in the ring, the kernel yet to take them
+            int64_t m_reads = 0;
+
+            template <typename T> static T* at(void* base, unsigned off) noexcept {
+                return reinterpret_cast<T*>(static_cast<char*>(base) + off);
+            }
+
+            void close_ring() noexcept {
+                if (m_sqes != nullptr) {
+                    ::munmap(m_sqes, m_sqes_len);
+                }
+                if (m_cq != nullptr && m_cq != m_sq) {
+                    ::munmap(m_cq, m_cq_len);
+                }
+                if (m_sq != nullptr) {
+                    ::munmap(m_sq, m_sq_len);
+                }
+                if (m_fd >= 0) {
+                    ::close(m_fd);
+                }
+                m_sqes = nullptr;
+                m_cq = m_sq = nullptr;
+                m_fd = -1;
+            }
+
+            long enter(unsigned to_submit) noexcept {
+                return ::syscall(__NR_io_uring_enter, m_fd, to_submit, 1u,
+                    IORING_ENTER_GETEVENTS, nullptr, 0);
+            }
+
+            // Takes what is done off the ring, then resumes those readers.
+            // Returns how many.
+            size_t reap() {
+                unsigned head = *m_cq_head;
+                const unsigned ctail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+                for (; head != ctail; ++head) {
+                    const io_uring_cqe& cqe = m_cqes[head & *m_cq_mask];
+                    auto* r = reinterpret_cast<detail::pending_read*>(
+                        static_cast<uintptr_t>(cqe.user_data));
+                    r->result = cqe.res;
+                    m_done.push_back(r);
+                }
+                __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+                const size_t n = m_done.size();
+                m_in_flight -= CAST(unsigned, n);
+                m_reads += CAST(int64_t, n);
+                for (auto* r : m_done) {
+                    r->h.resume();
+                }
+                m_done.clear();
+                return n;
+            }
+
+            // The ring failed: every read the kernel doesn't have fails with
+            // err, those the failed readers go on to ask for too. Those it
+            // does have are waited for (their buffers are still being
+            // written), as long as the ring will still say when they are done.
+            void fail_all(int err) {
+                // take back what is in the ring, unsubmitted, in order
+                const unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+                for (unsigned t = *m_sq_tail; t != head;) {
+                    --t;
+                    const io_uring_sqe& sqe = m_sqes[m_sq_array[t & *m_sq_mask]];
+                    m_q.push_front(reinterpret_cast<detail::pending_read*>(
+                        static_cast<uintptr_t>(sqe.user_data)));
+                }
+                __atomic_store_n(m_sq_tail, head, __ATOMIC_RELEASE);
+                m_unsubmitted = 0;
+                for (;;) {
+                    while (!m_q.empty()) {
+                        auto* r = m_q.front();
+                        m_q.pop_front();
+                        r->result = err;
+                        r->h.resume();
+                    }
+                    if (m_in_flight == 0) {
+                        return;
+                    }
+                    if (reap() == 0 && enter(0) < 0 && errno != EINTR) {
+                        return; // no telling when they finish
+                    }
+                }
+            }
+
+            public:
+            explicit uring_loop(unsigned entries = 256) {
+                io_uring_params p{};
+                m_fd = CAST(int, ::syscall(__NR_io_uring_setup, entries, &p));
+                if (m_fd < 0) {
+                    return;
+                }
+                m_entries = p.sq_entries;
+                m_sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+                m_cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+                const bool one_map = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+                if (one_map) {
+                    m_sq_len = m_cq_len = (std::max)(m_sq_len, m_cq_len);
+                }
+                m_sq = ::mmap(nullptr, m_sq_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+                if (m_sq == MAP_FAILED) {
+                    m_sq = nullptr;
+                    close_ring();
+                    return;
+                }
+                m_cq = one_map ? m_sq
+                               : ::mmap(nullptr, m_cq_len, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+                m_sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+                void* sqes = ::mmap(nullptr, m_sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+                if (m_cq == MAP_FAILED || sqes == MAP_FAILED) {
+                    m_cq = m_cq == MAP_FAILED ? nullptr : m_cq;
+                    close_ring();
+                    return;
+                }
+                m_sqes = static_cast<io_uring_sqe*>(sqes);
+                m_sq_head = at<unsigned>(m_sq, p.sq_off.head);
+                m_sq_tail = at<unsigned>(m_sq, p.sq_off.tail);
+                m_sq_mask = at<unsigned>(m_sq, p.sq_off.ring_mask);
+                m_sq_array = at<unsigned>(m_sq, p.sq_off.array);
+                m_cq_head = at<unsigned>(m_cq, p.cq_off.head);
+                m_cq_tail = at<unsigned>(m_cq, p.cq_off.tail);
+                m_cq_mask = at<unsigned>(m_cq, p.cq_off.ring_mask);
+                m_cqes = at<io_uring_cqe>(m_cq, p.cq_off.cqes);
+            }
+            ~uring_loop() { close_ring(); }
+            uring_loop(const uring_loop&) = delete;
+            uring_loop& operator=(const uring_loop&) = delete;
+
+            bool ok() const noexcept { return m_fd >= 0; }
+
+            detail::read_awaiter<uring_loop> read(
+                int fd, int64_t offset, char* into, int n) {
+                return {this, detail::pending_read{fd, offset, into, n, 0, {}, {}}};
+            }
+            void submit(detail::pending_read* r) { m_q.push_back(r); }
+
+            // Until nothing is waiting, or the ring fails (-errno: every read
+            // still waiting then fails with it).
+            int run() {
+                while (!m_q.empty() || m_in_flight != 0 || m_unsubmitted != 0) {
+                    // what there is room for goes into the ring (READV is
+                    // the oldest read it has)
+                    unsigned tail = *m_sq_tail;
+                    while (!m_q.empty() && m_in_flight + m_unsubmitted < m_entries) {
+                        auto* r = m_q.front();
+                        m_q.pop_front();
+                        r->iov.iov_base = r->into;
+                        r->iov.iov_len = CAST(size_t, r->n);
+                        const unsigned idx = tail & *m_sq_mask;
+                        io_uring_sqe& sqe = m_sqes[idx];
+                        memset(&sqe, 0, sizeof(sqe));
+                        sqe.opcode = IORING_OP_READV;
+                        sqe.fd = r->fd;
+                        sqe.off = CAST(uint64_t, r->offset);
+                        sqe.addr = reinterpret_cast<uintptr_t>(&r->iov);
+                        sqe.len = 1;
+                        sqe.user_data = reinterpret_cast<uintptr_t>(r);
+                        m_sq_array[idx] = idx;
+                        ++tail;
+                        ++m_unsubmitted;
+                    }
+                    __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+
+                    // It may take fewer than all of them (or none: EAGAIN,
+                    // EBUSY); the rest stay in the ring for next time.
+                    const long rc = enter(m_unsubmitted);
+                    if (rc >= 0) {
+                        m_in_flight += CAST(unsigned, rc);
+                        m_unsubmitted -= CAST(unsigned, rc);
+                    } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                        const int e = -errno;
+                        fail_all(e);
+                        return e;
+                    }
+                    reap();
+                }
+                return 0;
+            }
+            int64_t reads() const noexcept { return m_reads; }
+        };
+#endif // MY_MPEG_URING
+
+        // What parser::parse() gives parse_file(), with the file's bytes
+        // coming from read(offset, into, n) (see the top of this file), a
+        // read_block at a time: that is all the memory it has for them. Frames
+        // go to on_frame(const frame&) as they are found, the Xing/Info/VBRI
+        // one too (detail::is_info_frame() tells). read is kept for as long as
+        // the task is.
+        template <typename READ, typename CB>
+        task<error> parse_async(int64_t size, READ read, parse_summary& out, CB on_frame,
+            bool fingerprint = false, int read_block = mpeg::detail::MIN_READ_BLOCK) {
+            out = parse_summary();
+            out.file_size = size;
+
+            // the tail: ID3v1, and an APE footer before it
+            char tail[128 + mpeg::detail::APE_FOOTER_SIZE];
+            const int tn = CAST(int, (std::min)(size, CAST(int64_t, sizeof(tail))));
+            int got = co_await detail::read_fully(read, size - tn, tail, tn);
+            if (got < 0) {
+                co_return error(CAST(error::error_code, got));
+            }
+            out.id3v1 = got == tn && tn >= 128 && memcmp(tail + tn - 128, "TAG", 3) == 0;
+            int64_t audio_end = size - (out.id3v1 ? 128 : 0);
+            const int foot = got - (out.id3v1 ? 128 : 0) - mpeg::detail::APE_FOOTER_SIZE;
+            if (got == tn && foot >= 0) {
+                out.ape_size = mpeg::detail::ape_tag_size(tail + foot, audio_end);
+            }
+
+            // the head: ID3v2
+            std::vector<char> block(CAST(size_t, (std::max)(read_block, 4096)));
+            const int hn = CAST(int, (std::min)(size, CAST(int64_t, block.size())));
+            got = co_await detail::read_fully(read, 0, block.data(), hn);
+            if (got < 0) {
+                co_return error(CAST(error::error_code, got));
+            }
+            if (got >= mpeg::detail::ID3V2_HEADER_SIZE
+                && memcmp(block.data(), "ID3", 3) == 0) {
+                mpeg::detail::id3v2Header h;
+                memcpy(static_cast<void*>(&h), block.data(),
+                    mpeg::detail::ID3V2_HEADER_SIZE);
+                out.id3v2_size = mpeg::detail::id3v2_tag_size(h);
+            }
+            const int64_t payload = size - (out.id3v1 ? 128 : 0) - out.id3v2_size;
+            if (payload <= mpeg::detail::MIN_MPEG_PAYLOAD) {
+                error e = error::error_code::tiny_file;
+                e.at(out.id3v2_size, MPEG_WHERE);
+                out.error = e.to_int();
+                out.error_offset = e.offset;
+                co_return e;
+            }
+            audio_end -= out.ape_size;
+            const int64_t audio_from = out.id3v2_size;
+
+            // the audio
+            my::hash::xxh64 hash;
+            frame_tally tally(audio_from);
+            auto count = [&](const frame& f) {
+                const bool info = out.nframes == 0 && mpeg::detail::is_info_frame(f);
+                tally.add(f, out);
+                if (fingerprint && !info) {
+                    hash.update(f.bytes(),
+                        CAST(size_t, (std::min)(f.bytes_size(), f.length_in_bytes())));
+                }
+                on_frame(f);
+            };
+
+            stream_framer framer(audio_from);
+            int64_t pos = 0; // of what is in block
+            int have = got;
+            while (true) {
+                const int64_t from = (std::max)(pos, audio_from);
+                const int64_t to = (std::min)(pos + have, audio_end);
+                if (to > from) {
+                    const auto* p = block.data() + (from - pos);
+                    framer.feed(byte_span(p, CAST(size_t, to - from)), count);
+                }
+                pos = (std::max)(pos + have, audio_from);
+                if (pos >= audio_end || have == 0) {
+                    break;
+                }
+                const int n
+                    = CAST(int, (std::min)(CAST(int64_t, block.size()), audio_end - pos));
+                have = co_await detail::read_fully(read, pos, block.data(), n);
+                if (have < 0) {
+                    error e(CAST(error::error_code, have));
+                    e.at(pos, MPEG_WHERE);
+                    out.error = e.to_int();
+                    out.error_offset = pos;
+                    co_return e;
+                }
+            }
+            framer.finish(count);
+            tally.end(audio_end, out);
+            out.audio_hash = fingerprint ? hash.digest() : 0;
+            co_return error(error::error_code::noerror);
+        }
+
+    } // namespace async
+} // namespace mpeg
+} // namespace my
+#endif // __cpp_impl_coroutine
@@ -0,0 +1,116 @@
+#pragma once
+/* my_mpeg_c.h
+ * A C ABI over my_mpeg.hpp, for code that can't use the templates (Go via
+ * cgo, Python via ctypes/cffi, ...). Build my_mpeg_c.cpp into a shared
+ * library (MPEGAudioParseLib.pro).
+ *
+ * Every call that can fail returns 0 or an error: a negative errno, or one of
+ * my::mpeg::error::error_code (positive). my_mpeg_strerror() describes them.
+ * Nothing here throws, aborts or holds global state: different handles can
+ * be used from different threads at once, one handle from one at a time.
+ *
+ * The structs only ever grow at the end, and MY_MPEG_ABI_VERSION goes up
+ * when they do: check my_mpeg_abi_version() at load time.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* MY_MPEG_C_BUILD: building the DLL. MY_MPEG_C_DLL: linking against it.
+ * Neither: my_mpeg_c.cpp is compiled in (as the test program does). */
+#if defined(_WIN32) && defined(MY_MPEG_C_BUILD)
+#define MY_MPEG_API __declspec(dllexport)
+#elif defined(_WIN32) && defined(MY_MPEG_C_DLL)
+#define MY_MPEG_API __declspec(dllimport)
+#elif defined(__GNUC__)
+#define MY_MPEG_API __attribute__((visibility("default")))
+#else
+#define MY_MPEG_API
+#endif
+
+#define MY_MPEG_ABI_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* my_mpeg_parse() flags */
+#define MY_MPEG_FINGERPRINT 1u /* fill in audio_hash */
+#define MY_MPEG_INDEX_FRAMES 2u /* keep a frame index (my_mpeg_frames()) */
+
+typedef struct my_mpeg_file my_mpeg_file; /* opaque */
+
+/* see my::mpeg::parse_summary */
+typedef struct my_mpeg_summary {
+    int64_t file_size;
+    int64_t first_frame;
+    int64_t nframes;
+    int64_t total_samples;
+    double duration_ms;
+    int64_t gap_bytes;
+    int64_t error_offset;
+    uint64_t audio_hash;
+    int32_t error;
+    int32_t samplerate;
+    int32_t bitrate; /* of the first frame, bits per second */
+    uint32_t ngaps;
+    uint32_t id3v2_size;
+    uint32_t ape_size;
+    uint8_t version; /* 1, 2, or 3 for MPEG 2.5 */
+    uint8_t layer;
+    uint8_t channelmode;
+    uint8_t emphasis;
+    uint8_t vbr;
+    uint8_t id3v1;
+    uint8_t spare[2];
+} my_mpeg_summary;
+
+/* see my::mpeg::frame_entry */
+typedef struct my_mpeg_frame {
+    int64_t offset;
+    int32_t length;
+    int32_t bitrate;
+    int32_t samplerate;
+    uint16_t samples;
+    uint8_t version;
+    uint8_t layer;
+    uint8_t channelmode;
+    uint8_t padding;
+    uint8_t spare[2];
+} my_mpeg_frame;
+
+MY_MPEG_API int my_mpeg_abi_version(void);
+MY_MPEG_API const char* my_mpeg_strerror(int err);
+/* The parser narrates each parse on stdout unless told not to. The shared
+ * library starts quiet; 1 turns the narration on. Process wide. */
+MY_MPEG_API void my_mpeg_set_verbose(int on);
+
+/* The handle reads the file itself (path), reads through fd (which the
+ * caller keeps open, and closes, after my_mpeg_close()), or reads size bytes
+ * at data (which must stay there until my_mpeg_close()). */
+MY_MPEG_API int my_mpeg_open_path(const char* path, my_mpeg_file** out);
+MY_MPEG_API int my_mpeg_open_fd(int fd, my_mpeg_file** out);
+MY_MPEG_API int my_mpeg_open_memory(const void* data, size_t size, my_mpeg_file** out);
+MY_MPEG_API void my_mpeg_close(my_mpeg_file* f);
+
+/* Parses the whole file. Returns the parse error, which is also in the
+ * summary: a file with junk or damage in it may still have frames. */
+MY_MPEG_API int my_mpeg_parse(my_mpeg_file* f, unsigned flags);
+MY_MPEG_API int my_mpeg_get_summary(const my_mpeg_file* f, my_mpeg_summary* out);
+
+/* The frame index (MY_MPEG_INDEX_FRAMES): my_mpeg_frames() copies up to max
+ * entries, starting at frame first, and returns how many it copied. Call it
+ * in a loop with a fixed buffer to walk the lot. */
+MY_MPEG_API int64_t my_mpeg_frame_count(const my_mpeg_file* f);
+MY_MPEG_API int64_t my_mpeg_frames(
+    const my_mpeg_file* f, int64_t first, my_mpeg_frame* out, int64_t max);
+
+/* Parses n files on nthreads threads (0: one per core), filling out[i] for
+ * paths[i]: a file that can't be opened gets its errno in out[i].error, and
+ * one with no frames in it no_frames (16). Returns how many files parsed
+ * without error. */
+MY_MPEG_API int64_t my_mpeg_parse_paths(const char* const* paths, size_t n,
+    my_mpeg_summary* out, unsigned flags, int nthreads);
+
+#ifdef __cplusplus
+}
+#endif
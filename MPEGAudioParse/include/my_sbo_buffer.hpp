@@ -6,13 +6,16 @@
 #include <cstddef> // required
 #include <cstdlib> // malloc
 #include <cstdio> // stderr
+#include <cerrno> // errno
+#include <atomic>
 #include "my_macros.hpp"
 
 namespace my {
 namespace io {
 
     namespace detail {
-        static inline int sbo_count = 0;
+        // atomic: buffers get made on every parsing thread
+        static inline std::atomic<int> sbo_count{0};
         using byte_type = char;
         static inline constexpr size_t BUFFER_GUARD = 8;
 
@@ -179,7 +182,9 @@ namespace io {
 
                         if (m_dyn_size == 0) {
                             assert(new_size >= old_size);
+#ifdef MY_SBO_TRACE
                             printf("call to alloc() : %zu\n", new_size);
+#endif
                             m_dyn_buf = static_cast<byte_type*>(
                                 malloc(new_size + BUFFER_GUARD));
                             if (m_dyn_buf == nullptr) {
@@ -197,7 +202,9 @@ namespace io {
 
                         if (new_actual > m_dyn_size) {
                             const size_t mysize = new_actual;
+#ifdef MY_SBO_TRACE
                             printf("call to realloc() : %zu\n", new_size);
+#endif
                             auto ptr = realloc(m_dyn_buf, mysize);
                             pnew = CAST(byte_type*, ptr);
                             if (pnew == nullptr) {
@@ -262,8 +269,6 @@ namespace io {
 
                 size_t new_size = m_size + cb;
                 const size_t old_size = m_size;
-                const auto cap = capacity();
-
                 resize(new_size);
                 assert(old_size + cb <= capacity());
                 bool dyn = m_dyn_buf != nullptr;
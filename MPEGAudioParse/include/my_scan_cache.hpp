@@ -0,0 +1,380 @@
+#pragma once
+// my_scan_cache.hpp
+// A persistent cache of parse results (parse_summary), keyed by path and
+// checked against inode, size, mtime and (optionally) a hash of the head and
+// tail of the file. A warm rescan of an unchanged library then costs one
+// stat() per file, and no parsing at all.
+//
+// On disk it is an append-only log: a file header, then records of
+//      scan_cache_record_header | parse_summary | path, zero padded to 8
+// Everything is 8 byte aligned. A later record for a path replaces an earlier
+// one; open() reads the whole log into memory in one pass and rebuilds the
+// index (path -> entry) from it, and the log is compacted when it is mostly
+// dead records.
+#include "my_mpeg.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace my {
+namespace mpeg {
+
+    // Identity of a file on disk: if any of it differs from what's cached,
+    // the cached summary is stale.
+    struct file_key {
+        uint64_t inode = {0}; // always 0 on Windows
+        int64_t size = {-1};
+        int64_t mtime_ns = {0};
+        uint64_t content_hash = {0}; // 0 unless the cache hashes content
+
+        bool operator==(const file_key& rhs) const noexcept {
+            return inode == rhs.inode && size == rhs.size && mtime_ns == rhs.mtime_ns
+                && content_hash == rhs.content_hash;
+        }
+        bool operator!=(const file_key& rhs) const noexcept { return !(*this == rhs); }
+    };
+
+    namespace detail {
+        static constexpr char SCAN_CACHE_MAGIC[8] = {'M', 'P', 'S', 'C', 'A', 'C', 'H', 'E'};
+        static constexpr uint32_t SCAN_CACHE_VERSION = 1;
+        static constexpr uint32_t SCAN_CACHE_RECORD_MAGIC = 0x52435350; // "PSCR"
+        // how much of each end of the file goes into file_key::content_hash
+        static constexpr int CONTENT_HASH_BYTES = 4096;
+        // don't bother compacting tiny logs
+        static constexpr size_t SCAN_CACHE_MIN_COMPACT = 1024;
+
+        struct scan_cache_file_header {
+            char magic[8];
+            uint32_t version;
+            uint32_t summary_size; // a changed parse_summary invalidates the lot
+        };
+
+        struct scan_cache_record_header {
+            uint32_t magic;
+            uint32_t path_len;
+            file_key key;
+        };
+        static_assert(sizeof(scan_cache_file_header) % 8 == 0, "keep records aligned");
+        static_assert(sizeof(scan_cache_record_header) % 8 == 0, "keep records aligned");
+        static_assert(sizeof(parse_summary) % 8 == 0, "keep records aligned");
+
+        inline size_t pad8(size_t n) noexcept { return (n + 7) & ~CAST(size_t, 7); }
+
+        // FNV-1a: only used to notice that a file changed under the same
+        // size and mtime, so it need not be strong.
+        inline uint64_t fnv1a(const char* p, size_t n,
+            uint64_t h = 14695981039346656037ULL) noexcept {
+            for (size_t i = 0; i < n; ++i) {
+                h ^= CAST(unsigned char, p[i]);
+                h *= 1099511628211ULL;
+            }
+            return h;
+        }
+
+        // returns 0, or an errno
+        inline int stat_file(const std::string& path, file_key& key) noexcept {
+#ifdef _WIN32
+            struct _stat64 st;
+            if (::_stat64(path.c_str(), &st) != 0) {
+                return errno;
+            }
+            key.inode = 0;
+            key.mtime_ns = CAST(int64_t, st.st_mtime) * 1000000000LL;
+#else
+            struct stat st;
+            if (::stat(path.c_str(), &st) != 0) {
+                return errno;
+            }
+            key.inode = CAST(uint64_t, st.st_ino);
+#if defined(__APPLE__)
+            key.mtime_ns = CAST(int64_t, st.st_mtimespec.tv_sec) * 1000000000LL
+                + st.st_mtimespec.tv_nsec;
+#else
+            key.mtime_ns = CAST(int64_t, st.st_mtim.tv_sec) * 1000000000LL
+                + st.st_mtim.tv_nsec;
+#endif
+#endif
+            key.size = CAST(int64_t, st.st_size);
+            key.content_hash = 0;
+            return 0;
+        }
+
+        // hash of the first and last CONTENT_HASH_BYTES of the file
+        inline int head_tail_hash(
+            const std::string& path, int64_t size, uint64_t& hash) noexcept {
+            FILE* f = ::fopen(path.c_str(), "rb");
+            if (f == nullptr) {
+                return errno;
+            }
+            char buf[CONTENT_HASH_BYTES];
+            size_t got = fread(buf, 1, sizeof(buf), f);
+            hash = fnv1a(buf, got);
+            if (size > CONTENT_HASH_BYTES * 2) {
+                if (fseek(f, -CONTENT_HASH_BYTES, SEEK_END) == 0) {
+                    got = fread(buf, 1, sizeof(buf), f);
+                    hash = fnv1a(buf, got, hash);
+                }
+            }
+            fclose(f);
+            if (hash == 0) {
+                hash = 1; // 0 means "not hashed"
+            }
+            return 0;
+        }
+    } // namespace detail
+
+    class scan_cache {
+        public:
+        struct entry {
+            file_key key;
+            parse_summary summary;
+        };
+
+        // hash_content: also hash the head and tail of each file. Catches a
+        // file rewritten in place within the mtime granularity, at the cost
+        // of 2 small reads per lookup.
+        scan_cache(std::string log_path, bool hash_content = false)
+            : m_path(std::move(log_path)), m_hash_content(hash_content) {}
+        scan_cache(const scan_cache&) = delete;
+        scan_cache& operator=(const scan_cache&) = delete;
+        ~scan_cache() { close(); }
+
+        // Loads the log, if there is one. A missing log is not an error; an
+        // unreadable or foreign one is thrown away and rewritten. Returns 0,
+        // or an errno.
+        int open() {
+            m_entries.clear();
+            m_records = 0;
+            m_needs_rewrite = false;
+
+            FILE* f = ::fopen(m_path.c_str(), "rb");
+            if (f == nullptr) {
+                return errno == ENOENT ? 0 : errno;
+            }
+            std::vector<char> data;
+            char chunk[65536];
+            size_t got = 0;
+            while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+                data.insert(data.end(), chunk, chunk + got);
+            }
+            fclose(f);
+            load(data);
+            return 0;
+        }
+
+        // Looks up path. key is filled in with what's on disk now, ready to
+        // hand to put() on a miss. Returns nullptr if there is no entry, or
+        // it is stale.
+        const parse_summary* find(const std::string& path, file_key& key) {
+            if (detail::stat_file(path, key) != 0) {
+                ++m_misses;
+                return nullptr;
+            }
+            return find_stated(path, key);
+        }
+
+        // find(), for a key already filled in by detail::stat_file(): the
+        // stat can then be done outside whatever lock guards the cache.
+        const parse_summary* find_stated(const std::string& path, file_key& key) {
+            const auto it = m_entries.find(path);
+            if (it == m_entries.end() || !same_file(path, it->second.key, key)) {
+                ++m_misses;
+                return nullptr;
+            }
+            ++m_hits;
+            return &it->second.summary;
+        }
+
+        // Adds (or replaces) path's entry, and appends it to the log.
+        // Returns 0, or an errno.
+        int put(const std::string& path, file_key key, const parse_summary& s) {
+            if (m_hash_content && key.content_hash == 0) {
+                detail::head_tail_hash(path, key.size, key.content_hash);
+            }
+            m_entries[path] = entry{key, s};
+            if (m_needs_rewrite) {
+                return compact();
+            }
+            if (m_log == nullptr) {
+                const int e = open_log(false);
+                if (e != 0) {
+                    return e;
+                }
+            }
+            ++m_records;
+            return write_record(m_log, path, m_entries[path]);
+        }
+
+        // Rewrites the log with only the live entries. Returns 0, or an errno.
+        int compact() {
+            close_log();
+            const std::string tmp = m_path + ".tmp";
+            FILE* f = ::fopen(tmp.c_str(), "wb");
+            if (f == nullptr) {
+                return errno;
+            }
+            int e = write_file_header(f);
+            for (const auto& kv : m_entries) {
+                if (e != 0) {
+                    break;
+                }
+                e = write_record(f, kv.first, kv.second);
+            }
+            if (fclose(f) != 0 && e == 0) {
+                e = errno;
+            }
+            if (e != 0) {
+                ::remove(tmp.c_str());
+                return e;
+            }
+#ifdef _WIN32
+            ::remove(m_path.c_str());
+#endif
+            if (::rename(tmp.c_str(), m_path.c_str()) != 0) {
+                return errno;
+            }
+            m_records = m_entries.size();
+            m_needs_rewrite = false;
+            return 0;
+        }
+
+        // Flushes the log, compacting it first if it is mostly dead records.
+        void close() noexcept {
+            if (m_records > detail::SCAN_CACHE_MIN_COMPACT
+                && m_records > m_entries.size() * 2) {
+                m_needs_rewrite = true;
+            }
+            if (m_needs_rewrite && !m_entries.empty()) {
+                compact();
+            }
+            close_log();
+        }
+
+        size_t size() const noexcept { return m_entries.size(); }
+        unsigned long hits() const noexcept { return m_hits; }
+        unsigned long misses() const noexcept { return m_misses; }
+        const std::string& path() const noexcept { return m_path; }
+
+        private:
+        std::string m_path;
+        bool m_hash_content = false;
+        bool m_needs_rewrite = false;
+        FILE* m_log = nullptr;
+        size_t m_records = 0; // on disk, dead or alive
+        unsigned long m_hits = 0;
+        unsigned long m_misses = 0;
+        std::unordered_map<std::string, entry> m_entries;
+
+        bool same_file(
+            const std::string& path, const file_key& cached, file_key& now) const {
+            if (cached.inode != now.inode || cached.size != now.size
+                || cached.mtime_ns != now.mtime_ns) {
+                return false;
+            }
+            if (m_hash_content) {
+                if (detail::head_tail_hash(path, now.size, now.content_hash) != 0) {
+                    return false;
+                }
+                return cached.content_hash == now.content_hash;
+            }
+            now.content_hash = cached.content_hash;
+            return true;
+        }
+
+        void load(const std::vector<char>& data) {
+            using namespace detail;
+            scan_cache_file_header fh;
+            if (data.size() < sizeof(fh)) {
+                m_needs_rewrite = !data.empty();
+                return;
+            }
+            memcpy(&fh, data.data(), sizeof(fh));
+            if (memcmp(fh.magic, SCAN_CACHE_MAGIC, sizeof(fh.magic)) != 0
+                || fh.version != SCAN_CACHE_VERSION
+                || fh.summary_size != sizeof(parse_summary)) {
+                m_needs_rewrite = true;
+                return;
+            }
+
+            size_t pos = sizeof(fh);
+            while (pos < data.size()) {
+                scan_cache_record_header rh;
+                if (data.size() - pos < sizeof(rh) + sizeof(parse_summary)) {
+                    break;
+                }
+                memcpy(&rh, data.data() + pos, sizeof(rh));
+                const size_t len
+                    = sizeof(rh) + sizeof(parse_summary) + pad8(rh.path_len);
+                if (rh.magic != SCAN_CACHE_RECORD_MAGIC || data.size() - pos < len) {
+                    break;
+                }
+                entry en;
+                en.key = rh.key;
+                memcpy(&en.summary, data.data() + pos + sizeof(rh), sizeof(parse_summary));
+                m_entries[std::string(data.data() + pos + sizeof(rh)
+                                          + sizeof(parse_summary),
+                    rh.path_len)]
+                    = en;
+                ++m_records;
+                pos += len;
+            }
+            // a torn append (we died mid-write): drop it, or we'd append
+            // after it and never read past it again.
+            if (pos != data.size()) {
+                m_needs_rewrite = true;
+            }
+        }
+
+        int open_log(bool truncate) {
+            const bool exists = !truncate && myio::exists(std::string(m_path));
+            m_log = ::fopen(m_path.c_str(), exists ? "ab" : "wb");
+            if (m_log == nullptr) {
+                return errno;
+            }
+            if (!exists) {
+                return write_file_header(m_log);
+            }
+            return 0;
+        }
+
+        void close_log() noexcept {
+            if (m_log != nullptr) {
+                fclose(m_log);
+                m_log = nullptr;
+            }
+        }
+
+        static int write_file_header(FILE* f) noexcept {
+            detail::scan_cache_file_header fh;
+            memcpy(fh.magic, detail::SCAN_CACHE_MAGIC, sizeof(fh.magic));
+            fh.version = detail::SCAN_CACHE_VERSION;
+            fh.summary_size = sizeof(parse_summary);
+            if (fwrite(&fh, sizeof(fh), 1, f) != 1) {
+                return errno ? errno : EIO;
+            }
+            return 0;
+        }
+
+        static int write_record(FILE* f, const std::string& path, const entry& en) {
+            detail::scan_cache_record_header rh;
+            rh.magic = detail::SCAN_CACHE_RECORD_MAGIC;
+            rh.path_len = CAST(uint32_t, path.size());
+            rh.key = en.key;
+            static const char zeros[8] = {0};
+            const size_t padding = detail::pad8(path.size()) - path.size();
+            if (fwrite(&rh, sizeof(rh), 1, f) != 1
+                || fwrite(&en.summary, sizeof(en.summary), 1, f) != 1
+                || fwrite(path.data(), 1, path.size(), f) != path.size()
+                || fwrite(zeros, 1, padding, f) != padding) {
+                return errno ? errno : EIO;
+            }
+            return 0;
+        }
+    };
+
+} // namespace mpeg
+} // namespace my
@@ -0,0 +1,619 @@
+#pragma once
+// my_sparse.hpp
+// Parsing a file on slow or far away storage (an HTTP server, a NAS across a
+// WAN) by fetching as little of it as will do. Each request costs a round
+// trip, so the parser says up front what it will want
+// (parser::wanted_ranges(): the head and the tail), the ranges are merged into
+// as few requests as make sense, and the parse runs over what came back. A
+// read of bytes that aren't there yet is noted, and looks like the end of the
+// file; the misses go out as the next round of requests, and the parse runs
+// again, until it misses nothing. An ID3v2 tagged file takes two rounds: the
+// second fetches the first frames, from where the tag says it ends.
+//
+// The walk stops after a few frames. How many frames there are, and how long
+// they last, comes from the Xing/Info or VBRI header if there is one, and is
+// worked out from the bitrate and the size of the audio if not.
+//
+// A source of ranges is anything with
+//     int64_t size(); // or -errno
+//     int fetch(const byte_range& r, std::string& into); // 0 or -errno
+// file_ranges (a local file) and http_ranges (HTTP/1.1 Range requests) are two.
+#include "my_mpeg.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace my {
+namespace mpeg {
+
+    namespace detail {
+        // frames a sparse parse walks before it stops: the Xing frame, and
+        // enough after it to be sure of sync
+        static constexpr uint32_t SPARSE_WALK_FRAMES = 4;
+        // Bytes between two ranges that are fetched rather than split into
+        // two requests: over a WAN, a round trip is worth a lot of bytes.
+        static constexpr int64_t SPARSE_MAX_GAP = 16 * 1024;
+        // the least a miss fetches, so a run of small reads is one request
+        static constexpr int64_t SPARSE_MIN_FETCH = 4 * 1024;
+        static constexpr int SPARSE_MAX_ROUNDS = 8;
+    } // namespace detail
+
+    // Sorts ranges, and merges the ones that overlap or are no more than
+    // max_gap apart.
+    inline std::vector<byte_range> coalesce(std::vector<byte_range> v, int64_t max_gap) {
+        std::sort(v.begin(), v.end(),
+            [](const byte_range& a, const byte_range& b) { return a.offset < b.offset; });
+        std::vector<byte_range> out;
+        for (const auto& r : v) {
+            if (r.length <= 0) {
+                continue;
+            }
+            if (!out.empty() && r.offset <= out.back().end() + max_gap) {
+                out.back().length = (std::max)(out.back().end(), r.end()) - out.back().offset;
+            } else {
+                out.push_back(r);
+            }
+        }
+        return out;
+    }
+
+    // The bytes of a file fetched so far: runs that touch are kept as one.
+    class sparse_store {
+        std::map<int64_t, std::string> m_runs; // by offset
+
+        public:
+        void clear() { m_runs.clear(); }
+
+        // the run pos is in, or end()
+        std::map<int64_t, std::string>::const_iterator find(int64_t pos) const {
+            auto it = m_runs.upper_bound(pos);
+            if (it == m_runs.begin()) {
+                return m_runs.end();
+            }
+            --it;
+            return pos < it->first + CAST(int64_t, it->second.size()) ? it : m_runs.end();
+        }
+
+        // The bytes from pos that are here, one after another: nullptr if
+        // pos isn't.
+        const char* at(int64_t pos, int64_t& avail) const {
+            const auto it = find(pos);
+            if (it == m_runs.end()) {
+                avail = 0;
+                return nullptr;
+            }
+            const auto off = CAST(size_t, pos - it->first);
+            avail = CAST(int64_t, it->second.size() - off);
+            return it->second.data() + off;
+        }
+
+        void add(int64_t offset, const std::string& bytes) {
+            if (bytes.empty()) {
+                return;
+            }
+            int64_t lo = offset;
+            int64_t hi = offset + CAST(int64_t, bytes.size());
+            auto first = m_runs.upper_bound(lo);
+            if (first != m_runs.begin()) {
+                auto prev = std::prev(first);
+                if (prev->first + CAST(int64_t, prev->second.size()) >= lo) {
+                    first = prev;
+                }
+            }
+            auto last = first;
+            while (last != m_runs.end() && last->first <= hi) {
+                lo = (std::min)(lo, last->first);
+                hi = (std::max)(hi, last->first + CAST(int64_t, last->second.size()));
+                ++last;
+            }
+            std::string run(CAST(size_t, hi - lo), '\0');
+            for (auto it = first; it != last; ++it) {
+                run.replace(CAST(size_t, it->first - lo), it->second.size(), it->second);
+            }
+            run.replace(CAST(size_t, offset - lo), bytes.size(), bytes);
+            m_runs.erase(first, last);
+            m_runs.emplace(lo, std::move(run));
+        }
+
+        // the parts of want that aren't here yet
+        std::vector<byte_range> missing(const std::vector<byte_range>& want) const {
+            std::vector<byte_range> out;
+            for (const auto& r : want) {
+                int64_t pos = r.offset;
+                while (pos < r.end()) {
+                    const auto it = find(pos);
+                    if (it != m_runs.end()) {
+                        pos = it->first + CAST(int64_t, it->second.size());
+                        continue;
+                    }
+                    const auto next = m_runs.upper_bound(pos);
+                    const int64_t to
+                        = next == m_runs.end() ? r.end() : (std::min)(r.end(), next->first);
+                    out.push_back(byte_range{pos, to - pos});
+                    pos = to;
+                }
+            }
+            return out;
+        }
+    };
+
+    namespace detail {
+        // A READER_CALLBACK (see buffer<>) over a sparse_store. A read of
+        // bytes it hasn't got gives what it has up to them, and the end of
+        // the file; the rest of what was asked for goes into misses.
+        struct sparse_reader {
+            const sparse_store* store = nullptr;
+            int64_t size = 0;
+            int64_t pos = 0;
+            std::vector<byte_range>* misses = nullptr;
+
+            int operator()(char* const into, int& how_much, const seek_type& sk) {
+                pos = seek_target(sk, pos, size);
+                if (pos < 0) {
+                    how_much = 0;
+                    return -EINVAL;
+                }
+                const int64_t asked = how_much;
+                const int64_t wanted
+                    = (std::max)(CAST(int64_t, 0), (std::min)(asked, size - pos));
+                int64_t avail = 0;
+                const char* p = store->at(pos, avail);
+                const int64_t got = (std::min)(wanted, avail);
+                if (got > 0) {
+                    memcpy(into, p, CAST(size_t, got));
+                }
+                if (got < wanted) {
+                    const int64_t from = pos + got;
+                    const int64_t len = (std::min)(
+                        (std::max)(wanted - got, SPARSE_MIN_FETCH), size - from);
+                    misses->push_back(byte_range{from, len});
+                }
+                pos += got;
+                how_much = CAST(int, got);
+                return got < asked ? my::io::NO_MORE_DATA : 0;
+            }
+        };
+
+        inline uint32_t be32(const char* p) noexcept {
+            const auto* u = reinterpret_cast<const unsigned char*>(p);
+            return (CAST(uint32_t, u[0]) << 24) | (CAST(uint32_t, u[1]) << 16)
+                | (CAST(uint32_t, u[2]) << 8) | CAST(uint32_t, u[3]);
+        }
+
+        // The frame count in a Xing/Info or VBRI header, from the frame's
+        // first have bytes: -1 if there isn't one. vbr is set for a Xing or
+        // VBRI header, not for a LAME Info (CBR) one.
+        inline int64_t info_frame_count(const char* b, int64_t have, int version,
+            int layer, int channelmode, bool& vbr) noexcept {
+            const int off = xing_offset(version, channelmode);
+            if (layer == 3 && off + 12 <= have
+                && (memcmp(b + off, "Xing", 4) == 0 || memcmp(b + off, "Info", 4) == 0)) {
+                vbr = b[off] == 'X';
+                const uint32_t flags = be32(b + off + 4);
+                return (flags & 1) ? CAST(int64_t, be32(b + off + 8)) : -1;
+            }
+            // VBRI: version, delay and quality (2 bytes each), then bytes and
+            // frames (4 each)
+            if (VBRI_OFFSET + 18 <= have && memcmp(b + VBRI_OFFSET, "VBRI", 4) == 0) {
+                vbr = true;
+                return CAST(int64_t, be32(b + VBRI_OFFSET + 14));
+            }
+            return -1;
+        }
+    } // namespace detail
+
+    struct sparse_result {
+        // Tags, the first frame and its format as a whole parse would have
+        // them. nframes, total_samples and duration_ms are for the whole
+        // file, from wherever counted says.
+        parse_summary summary;
+        enum class count_from : uint8_t {
+            walk, // the file ran out before the walk stopped: exact
+            info_header, // the Xing/Info/VBRI frame count
+            bitrate // the audio's size over the first frame's bitrate
+        };
+        count_from counted = count_from::walk;
+        int64_t frames_walked = 0;
+        int64_t bytes_fetched = 0;
+        int requests = 0;
+        int rounds = 0; // of requests, one after the other
+    };
+
+    // Parses what it fetches from src (see the top of this file), fetching
+    // as little as it can. uri is only for messages.
+    template <typename RANGES>
+    error parse_sparse(const std::string& uri, RANGES& src, sparse_result& out,
+        int64_t max_gap = detail::SPARSE_MAX_GAP) {
+        out = sparse_result();
+        const int64_t size = src.size();
+        if (size < 0) {
+            return error(CAST(error::error_code, CAST(int, size)));
+        }
+        sparse_store store;
+        parser p(uri, CAST(uintmax_t, size));
+        p.stop_after(detail::SPARSE_WALK_FRAMES);
+        std::vector<byte_range> want = parser::wanted_ranges(size);
+        error e;
+        while (true) {
+            for (const auto& r : coalesce(store.missing(want), max_gap)) {
+                std::string got;
+                ++out.requests;
+                const int fe = src.fetch(r, got);
+                if (fe < 0) {
+                    return error(CAST(error::error_code, fe)).at(r.offset, MPEG_WHERE);
+                }
+                out.bytes_fetched += CAST(int64_t, got.size());
+                store.add(r.offset, got);
+            }
+            ++out.rounds;
+            want.clear();
+            detail::sparse_reader reader{&store, size, 0, &want};
+            buffer buf(uri, std::move(reader));
+            e = p.parse(buf);
+            if (want.empty()) {
+                break;
+            }
+            if (out.rounds >= detail::SPARSE_MAX_ROUNDS) {
+                // the source keeps giving back less than it is asked for
+                e = error::error_code::data_incomplete;
+                return e.at(want.front().offset, MPEG_WHERE);
+            }
+        }
+
+        auto& s = out.summary;
+        s = p.summary();
+        out.frames_walked = s.nframes;
+        if (s.nframes < detail::SPARSE_WALK_FRAMES || s.samplerate <= 0) {
+            return e; // all of it, or none
+        }
+        const int64_t spf = s.total_samples / s.nframes;
+        int64_t count = -1;
+        if (p.info_frame() >= 0) {
+            int64_t have = 0;
+            const char* b = store.at(p.info_frame(), have);
+            bool vbr = false;
+            count = detail::info_frame_count(b, have, s.version, s.layer, s.channelmode, vbr);
+            if (count >= 0) {
+                count += 1; // the info frame: the walk counts it too
+                s.vbr = vbr ? 1 : s.vbr;
+                out.counted = sparse_result::count_from::info_header;
+            }
+        }
+        if (count < 0 && s.bitrate > 0) {
+            const int64_t audio_end = size - (s.id3v1 ? 128 : 0) - s.ape_size;
+            const double audio = CAST(double, audio_end - s.first_frame);
+            // bytes per frame, padding and all, on average
+            const double per_frame = CAST(double, spf) / 8.0 * s.bitrate / s.samplerate;
+            count = CAST(int64_t, audio / per_frame + 0.5);
+            out.counted = sparse_result::count_from::bitrate;
+        }
+        if (count >= 0) {
+            s.nframes = count;
+            s.total_samples = count * spf;
+            s.duration_ms = 1000.0 * CAST(double, s.total_samples) / s.samplerate;
+        }
+        return e;
+    }
+
+    // Ranges of a local file. Mostly for comparing with the other sources;
+    // but a file on a network mount is "local" too.
+    class file_ranges {
+        FILE* m_fp = nullptr;
+        int64_t m_size = -1;
+
+        public:
+        explicit file_ranges(const std::string& path) {
+            m_fp = ::fopen(path.c_str(), "rb");
+            if (m_fp == nullptr) {
+                return;
+            }
+            setvbuf(m_fp, nullptr, _IONBF, 0); // every fetch is one read
+#ifdef _WIN32
+            if (_fseeki64(m_fp, 0, SEEK_END) == 0) {
+                m_size = _ftelli64(m_fp);
+            }
+#else
+            if (fseeko(m_fp, 0, SEEK_END) == 0) {
+                m_size = CAST(int64_t, ftello(m_fp));
+            }
+#endif
+        }
+        ~file_ranges() {
+            if (m_fp != nullptr) {
+                fclose(m_fp);
+            }
+        }
+        file_ranges(const file_ranges&) = delete;
+        file_ranges& operator=(const file_ranges&) = delete;
+
+        int64_t size() const noexcept { return m_fp == nullptr ? -ENOENT : m_size; }
+
+        int fetch(const byte_range& r, std::string& into) {
+            into.resize(CAST(size_t, r.length));
+            int how_much = CAST(int, r.length);
+            const seek_type sk(r.offset, my::io::seek_value_type::seek_from_begin);
+            const int e = detail::read_stdio(m_fp, &into[0], how_much, sk);
+            into.resize(CAST(size_t, how_much));
+            return e < 0 ? e : 0;
+        }
+    };
+
+#ifndef _WIN32
+    namespace detail {
+        // name: value, name matched without regard to case
+        inline bool http_header_is(const std::string& line, const char* name) noexcept {
+            const size_t n = strlen(name);
+            if (line.size() <= n || line[n] != ':') {
+                return false;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                char c = line[i];
+                if (c >= 'A' && c <= 'Z') {
+                    c = CAST(char, c - 'A' + 'a');
+                }
+                if (c != name[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    } // namespace detail
+
+    // Ranges of a file on an HTTP/1.1 server (plain http://), a Range request
+    // each, over one kept-alive connection. The server has to answer a HEAD
+    // with a Content-Length, and a range with 206 Partial Content.
+    class http_ranges {
+        std::string m_host;
+        std::string m_port = "80";
+        std::string m_path = "/";
+        bool m_url_ok = false;
+        int m_fd = -1;
+        int64_t m_size = -1;
+        int m_timeout_ms = 30000;
+        std::string m_rx; // read, and not yet used
+
+        void disconnect() noexcept {
+            if (m_fd >= 0) {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+            m_rx.clear();
+        }
+
+        int connect_now() {
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* res = nullptr;
+            // an IPv6 literal is bracketed in the URL (and the Host header) only
+            std::string name = m_host;
+            if (name.size() > 2 && name.front() == '[' && name.back() == ']') {
+                name = name.substr(1, name.size() - 2);
+            }
+            if (::getaddrinfo(name.c_str(), m_port.c_str(), &hints, &res) != 0) {
+                return -EHOSTUNREACH;
+            }
+            int e = -ECONNREFUSED;
+            for (const addrinfo* a = res; a != nullptr; a = a->ai_next) {
+                const int fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (fd < 0) {
+                    e = -errno;
+                    continue;
+                }
+                timeval tv{};
+                tv.tv_sec = m_timeout_ms / 1000;
+                tv.tv_usec = (m_timeout_ms % 1000) * 1000;
+                ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+                if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+                    m_fd = fd;
+                    e = 0;
+                    break;
+                }
+                e = -errno;
+                ::close(fd);
+            }
+            ::freeaddrinfo(res);
+            return e;
+        }
+
+        int send_all(const std::string& s) noexcept {
+#ifdef MSG_NOSIGNAL
+            static constexpr int FLAGS = MSG_NOSIGNAL;
+#else
+            static constexpr int FLAGS = 0;
+#endif
+            for (size_t at = 0; at < s.size();) {
+                const ssize_t w = ::send(m_fd, s.data() + at, s.size() - at, FLAGS);
+                if (w < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (w <= 0) {
+                    return w < 0 ? -errno : -EPIPE;
+                }
+                at += CAST(size_t, w);
+            }
+            return 0;
+        }
+
+        // more of the response into m_rx: how much, 0 if the server hung up
+        int64_t receive() {
+            char buf[16 * 1024];
+            ssize_t got = 0;
+            do {
+                got = ::recv(m_fd, buf, sizeof(buf), 0);
+            } while (got < 0 && errno == EINTR);
+            if (got < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK ? -ETIMEDOUT : -errno;
+            }
+            m_rx.append(buf, CAST(size_t, got));
+            return got;
+        }
+
+        // One request, one response. The body (if not a HEAD) goes in body;
+        // from is where the server says it starts (Content-Range), else -1.
+        int exchange(const std::string& req, bool head, int& status, int64_t& length,
+            int64_t& from, std::string& body) {
+            body.clear();
+            status = 0;
+            length = -1;
+            from = -1;
+            const bool fresh = m_fd < 0;
+            if (fresh) {
+                const int ce = connect_now();
+                if (ce < 0) {
+                    return ce;
+                }
+            }
+            int e = send_all(req);
+            size_t hdr_end = std::string::npos;
+            while (e == 0 && (hdr_end = m_rx.find("\r\n\r\n")) == std::string::npos) {
+                const int64_t got = receive();
+                e = got < 0 ? CAST(int, got) : got == 0 ? -ECONNRESET : 0;
+            }
+            if (e < 0) {
+                disconnect();
+                // a kept-alive connection the server has since closed: once more
+                return fresh ? e : exchange(req, head, status, length, from, body);
+            }
+
+            bool close_after = false;
+            size_t at = 0;
+            while (at < hdr_end) {
+                const size_t eol = m_rx.find("\r\n", at);
+                const std::string line = m_rx.substr(at, eol - at);
+                at = eol + 2;
+                if (status == 0) {
+                    const size_t sp = line.find(' ');
+                    if (line.compare(0, 5, "HTTP/") != 0 || sp == std::string::npos) {
+                        disconnect();
+                        return -EPROTO;
+                    }
+                    status = atoi(line.c_str() + sp + 1);
+                } else if (detail::http_header_is(line, "content-length")) {
+                    length = CAST(int64_t, strtoll(line.c_str() + 15, nullptr, 10));
+                } else if (detail::http_header_is(line, "content-range")) {
+                    // bytes first-last/size
+                    const size_t b = line.find("bytes ");
+                    if (b != std::string::npos) {
+                        from = CAST(int64_t, strtoll(line.c_str() + b + 6, nullptr, 10));
+                    }
+                } else if (detail::http_header_is(line, "connection")) {
+                    close_after = line.find("close") != std::string::npos;
+                } else if (detail::http_header_is(line, "transfer-encoding")) {
+                    disconnect();
+                    return -EPROTO; // chunked: not for a range
+                }
+            }
+            m_rx.erase(0, hdr_end + 4);
+            if (!head) {
+                if (length < 0) {
+                    disconnect();
+                    return -EPROTO;
+                }
+                while (CAST(int64_t, m_rx.size()) < length) {
+                    const int64_t got = receive();
+                    if (got <= 0) {
+                        disconnect();
+                        return got < 0 ? CAST(int, got) : -ECONNRESET;
+                    }
+                }
+                body.assign(m_rx, 0, CAST(size_t, length));
+                m_rx.erase(0, CAST(size_t, length));
+            }
+            if (close_after) {
+                disconnect();
+            }
+            return 0;
+        }
+
+        std::string request(const char* method) const {
+            return std::string(method) + " " + m_path + " HTTP/1.1\r\nHost: " + m_host
+                + (m_port == "80" ? "" : ":" + m_port) + "\r\n";
+        }
+
+        public:
+        // http://host[:port][/path]
+        explicit http_ranges(const std::string& url) {
+            static const std::string SCHEME = "http://";
+            if (url.compare(0, SCHEME.size(), SCHEME) != 0) {
+                return;
+            }
+            const size_t slash = url.find('/', SCHEME.size());
+            std::string host = url.substr(SCHEME.size(), slash - SCHEME.size());
+            if (slash != std::string::npos) {
+                m_path = url.substr(slash);
+            }
+            const size_t colon = host.rfind(':');
+            if (colon != std::string::npos && host.find(']', colon) == std::string::npos) {
+                m_port = host.substr(colon + 1);
+                host.resize(colon);
+            }
+            m_host = host;
+            m_url_ok = !m_host.empty() && !m_port.empty();
+        }
+        ~http_ranges() { disconnect(); }
+        http_ranges(const http_ranges&) = delete;
+        http_ranges& operator=(const http_ranges&) = delete;
+
+        bool url_ok() const noexcept { return m_url_ok; }
+        void timeout_ms(int ms) noexcept { m_timeout_ms = ms; }
+
+        int64_t size() {
+            if (!m_url_ok) {
+                return -EINVAL;
+            }
+            if (m_size < 0) {
+                int status = 0;
+                int64_t from = -1;
+                std::string body;
+                const int e
+                    = exchange(request("HEAD") + "\r\n", true, status, m_size, from, body);
+                if (e < 0) {
+                    return e;
+                }
+                if (status != 200 || m_size < 0) {
+                    m_size = -1;
+                    return status == 404 ? -ENOENT : -EPROTO;
+                }
+            }
+            return m_size;
+        }
+
+        int fetch(const byte_range& r, std::string& into) {
+            into.clear();
+            if (r.length <= 0) {
+                return 0;
+            }
+            const std::string req = request("GET") + "Range: bytes="
+                + std::to_string(r.offset) + "-" + std::to_string(r.end() - 1) + "\r\n\r\n";
+            int status = 0;
+            int64_t length = -1;
+            int64_t from = -1;
+            const int e = exchange(req, false, status, length, from, into);
+            if (e < 0) {
+                return e;
+            }
+            // a 200 would be the whole file: just what this is here to avoid;
+            // and bytes from anywhere else would be taken for the ones asked for
+            if (status != 206 || from != r.offset || CAST(int64_t, into.size()) > r.length) {
+                into.clear();
+                return -EPROTO;
+            }
+            return 0;
+        }
+    };
+#endif // _WIN32
+
+} // namespace mpeg
+} // namespace my
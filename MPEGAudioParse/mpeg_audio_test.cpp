@@ -15,21 +15,52 @@
 #include <fstream>
 #include <cstring>
 #include <cerrno>
+#include <iterator>
+#include <chrono>
+#include <atomic>
+#include <cmath>
 #include "./include/my_files_enum.hpp"
 #include "./include/my_mpeg.hpp"
+#include "./include/my_scan_cache.hpp"
+#include "./include/my_dedupe.hpp"
+#include "./include/my_layer3.hpp"
+#include "./include/my_mpeg_c.h"
+#include "./include/my_frame_columns.hpp"
+#include "./include/my_dir_walker.hpp"
+#include "./include/my_library_watcher.hpp"
+#include "./include/my_memory_budget.hpp"
+#include "./include/my_icy.hpp"
+#include "./include/my_follow.hpp"
+#include "./include/my_frame_index.hpp"
+#include "./include/my_level.hpp"
+#include "./include/my_id3v2.hpp"
+#include "./include/my_sparse.hpp"
+#include "./include/my_mpeg_async.hpp"
+#include <fcntl.h>
+#ifndef _WIN32
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
 
 using namespace std;
 using seek_t = my::io::seek_type;
 int read_file(char* pdata, int& how_much, const seek_t& seek, std::fstream& f);
 
-my::mpeg::error parse_mp3(
-    string_view path, fstream& file, const uintmax_t file_size) {
+my::mpeg::error parse_mp3(string_view path, fstream& file,
+    const uintmax_t file_size, my::mpeg::parse_summary* summary = nullptr,
+    my::mpeg::frame_stats* stats = nullptr) {
 
 #if 1 // __cplusplus >= 201703L
-    my::mpeg::buffer buf(
-        path, [&](char* const ptr, int& how_much, const seek_t& seek) {
-            return read_file(ptr, how_much, seek, file);
-        });
+    // buffer keeps a reference to its reader: it must outlive the buffer, so
+    // no temporaries.
+    auto reader = [&](char* const ptr, int& how_much, const seek_t& seek) {
+        return read_file(ptr, how_much, seek, file);
+    };
+    my::mpeg::buffer buf(path, std::move(reader));
 #else
     const auto lam = [&](char* const ptr, int& how_much, const seek_t& seek) {
         return read_file(ptr, how_much, seek, file);
@@ -40,6 +71,12 @@ my::mpeg::error parse_mp3(
 
     my::mpeg::parser p(path, file_size);
     const auto e = p.parse(buf);
+    if (summary != nullptr) {
+        *summary = p.summary();
+    }
+    if (stats != nullptr) {
+        *stats = p.stats();
+    }
 
     if (e) {
         assert(e == my::mpeg::error::error_code::no_more_data);
@@ -47,7 +84,8 @@ my::mpeg::error parse_mp3(
     return e;
 }
 
-[[maybe_unused]] void test_all_mp3() {
+// parses every mp3 under searchdir (see mpegscan for doing it in earnest)
+[[maybe_unused]] void test_all_mp3(const std::string& searchdir) {
     const std::string my_extn = ".mp3";
 
     [[maybe_unused]] const auto files_found_callback = [&](const auto& item) {
@@ -62,23 +100,35 @@ my::mpeg::error parse_mp3(
         return 0;
     };
 
-    const std::string searchdir = "H:/audio-root-2018/";
     const bool recursive = true;
 
     my::files_finder finder(searchdir, recursive);
     int my_count = 0;
+    // unchanged files are not parsed again
+    my::mpeg::scan_cache cache(searchdir + ".mpeg_scan_cache");
+    cache.open();
+    my::mpeg::frame_stats library; // of the files parsed this time
 
     finder.start([&](const auto& /*item*/, const auto& u8path,
                      const auto& extn) {
         if (extn == ".mp3") {
             ++my_count;
+            my::mpeg::file_key key;
+            if (cache.find(u8path, key) != nullptr) {
+                return 0;
+            }
             std::fstream f;
             const std::string mypath
                 = "C:\\users\\coolie\\source\\MPEGAudioParser\\MPEGParser\\MPE"
                   "GAudioParse\\ztest_files\\shortkayfm-steve.mp3";
             f.open(u8path.c_str(), std::ios::binary | std::ios::in);
             assert(f);
-            const auto e = parse_mp3(u8path, f, my::fs::file_size(u8path));
+            my::mpeg::parse_summary summary;
+            my::mpeg::frame_stats stats;
+            const auto e
+                = parse_mp3(u8path, f, my::fs::file_size(u8path), &summary, &stats);
+            cache.put(u8path, key, summary);
+            library.merge(stats);
 
             // const auto e = parse_mp3(mypath, f, my::fs::file_size(mypath));
 
@@ -90,6 +140,10 @@ my::mpeg::error parse_mp3(
 
     cout << "Total real files: " << finder.count() << endl;
     cout << "Total mp3 files:  " << my_count << endl;
+    cout << "Cached results:   " << cache.hits() << endl;
+    cout << "Parsed: " << library.files << " files, " << library.nframes << " frames, "
+         << library.min_kbps << " - " << library.max_kbps << " kbps, "
+         << library.average_kbps() << " kbps average" << endl;
 }
 
 // using buf_t = my::mpeg::buffer_t;
@@ -233,11 +287,2084 @@ void test_file_read(const std::string& path) {
     cout << "test_file_read: grand tot: " << grand_tot << endl;
 }
 
+// the whole of the file at path
+std::string slurp_file(const std::string& path) {
+    fstream in(path.c_str(), std::ios_base::binary | std::ios_base::in);
+    assert(in);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// data (a whole file, that parsed as one) with its audio times times over,
+// between the same tags
+std::string repeat_audio(
+    const std::string& data, const my::mpeg::parse_summary& one, int times) {
+    const size_t audio_from = CAST(size_t, one.first_frame);
+    const size_t audio_to = data.size() - (one.id3v1 ? 128 : 0) - one.ape_size;
+    std::string big = data.substr(0, audio_from);
+    for (int i = 0; i < times; ++i) {
+        big.append(data, audio_from, audio_to - audio_from);
+    }
+    big.append(data, audio_to, std::string::npos);
+    return big;
+}
+
+#ifndef _WIN32
+// A TCP server on an ephemeral loopback port. Its thread hands each
+// connection to serve(fd), one at a time, and closes it after; stop() (or
+// the destructor) waits for the one being served.
+class loopback_server {
+    int m_lfd = -1;
+    sockaddr_in m_addr{};
+    std::atomic<bool> m_done{false};
+    std::thread m_thread;
+
+    public:
+    template <typename SERVE> explicit loopback_server(SERVE serve, int backlog = 4) {
+        m_lfd = ::socket(AF_INET, SOCK_STREAM, 0);
+        m_addr.sin_family = AF_INET;
+        m_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t alen = sizeof(m_addr);
+        int rc = ::bind(m_lfd, reinterpret_cast<sockaddr*>(&m_addr), sizeof(m_addr));
+        rc |= ::listen(m_lfd, backlog);
+        rc |= ::getsockname(m_lfd, reinterpret_cast<sockaddr*>(&m_addr), &alen);
+        assert(rc == 0);
+        CAST(void, rc);
+        m_thread = std::thread([this, serve]() mutable {
+            while (!m_done) {
+                pollfd pfd{m_lfd, POLLIN, 0};
+                if (::poll(&pfd, 1, 50) <= 0) {
+                    continue;
+                }
+                const int cfd = ::accept(m_lfd, nullptr, nullptr);
+                if (cfd >= 0) {
+                    serve(cfd);
+                    ::close(cfd);
+                }
+            }
+        });
+    }
+    loopback_server(const loopback_server&) = delete;
+    loopback_server& operator=(const loopback_server&) = delete;
+    ~loopback_server() { stop(); }
+
+    void stop() {
+        m_done = true;
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+        if (m_lfd >= 0) {
+            ::close(m_lfd);
+            m_lfd = -1;
+        }
+    }
+    std::string url() const {
+        return "http://127.0.0.1:" + std::to_string(ntohs(m_addr.sin_port));
+    }
+    // a connected socket, or -1
+    int connect() const {
+        const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (::connect(fd, reinterpret_cast<const sockaddr*>(&m_addr), sizeof(m_addr))
+            != 0) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+};
+#endif
+
+// data with 3000 bytes of junk full of sync candidates spliced in at 5000,
+// and 100 bytes cut out at 12000
+std::string damaged_audio(const std::string& data) {
+    std::string junk(3000, '\0');
+    for (size_t i = 0; i < junk.size(); ++i) {
+        static const unsigned char nasty[] = {0xFF, 0xFB, 0x90, 0x00, 0x12, 0xE0};
+        junk[i] = CAST(char, nasty[(i * 7 + i / 3) % sizeof(nasty)]);
+    }
+    return data.substr(0, 5000) + junk + data.substr(5000, 7000) + data.substr(12100);
+}
+
+// splice junk into (and cut a bit out of) a copy of path: the parser must
+// step over both and tell us where they were.
+void test_resync(const std::string& path) {
+    const std::string bad = damaged_audio(slurp_file(path));
+
+    const std::string bad_path = path + ".resync-test.mp3";
+    {
+        fstream out(bad_path.c_str(),
+            std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+        out.write(bad.data(), CAST(std::streamsize, bad.size()));
+    }
+
+    fstream file(bad_path.c_str(), std::ios_base::binary | std::ios_base::in);
+    auto reader = [&](char* const ptr, int& how_much, const seek_t& seek) {
+        return read_file(ptr, how_much, seek, file);
+    };
+    my::mpeg::buffer buf(bad_path, std::move(reader));
+    my::mpeg::parser p(bad_path, bad.size());
+    const auto e = p.parse(buf);
+    assert(e == my::mpeg::error::error_code::noerror);
+    CAST(void, e);
+    const auto& gaps = p.gaps();
+    assert(gaps.size() == 2);
+    assert(gaps[0].offset <= 5000 + 3000 && gaps[0].offset + gaps[0].length >= 5000 + 3000);
+    {
+        // scanning the caller's bytes in place must land in the same places
+        my::mpeg::parser ps(bad_path, 0);
+        ps.parse(my::mpeg::byte_span(bad.data(), bad.size()));
+        assert(ps.gaps().size() == gaps.size());
+        for (size_t i = 0; i < gaps.size(); ++i) {
+            assert(ps.gaps()[i].offset == gaps[i].offset
+                && ps.gaps()[i].length == gaps[i].length);
+        }
+        assert(ps.summary().nframes == p.summary().nframes);
+    }
+    cout << "test_resync: " << gaps.size() << " gaps:" << endl;
+    for (const auto& g : gaps) {
+        cout << "    " << g.length << " bytes @ " << g.offset << endl;
+    }
+    file.close();
+    std::remove(bad_path.c_str());
+}
+
+// parse and decode path in one pass, a few times over, and say how many times
+// faster than real time that is on one core.
+void bench_decode(const std::string& path) {
+    static constexpr int RUNS = 10;
+    double audio_secs = 0;
+    int64_t samples = 0;
+    float peak = 0;
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int run = 0; run < RUNS; ++run) {
+        my::mpeg::parse_summary summary;
+        const auto e = my::mpeg::decode_file(path,
+            [&](const my::mpeg::layer3_decoder::pcm_type& pcm, int n, int nch, int rate) {
+                for (int ch = 0; ch < nch; ++ch) {
+                    for (int i = 0; i < n; ++i) {
+                        peak = (std::max)(peak, std::abs(pcm[ch][i]));
+                    }
+                }
+                samples += n;
+                audio_secs += double(n) / rate;
+            },
+            summary);
+        assert(!e || e == my::mpeg::error::error_code::no_more_data);
+        CAST(void, e);
+    }
+    const double secs
+        = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    assert(samples > 0 && peak > 0.01f && peak < 2.0f);
+#if defined(MY_L3_AVX)
+    const char* kernels = "AVX";
+#elif defined(MY_L3_SSE)
+    const char* kernels = "SSE";
+#else
+    const char* kernels = "scalar";
+#endif
+    cout << "bench_decode: " << samples / RUNS << " samples per channel, peak " << peak
+         << ", " << audio_secs / secs << "x real time on one core (" << kernels
+         << " kernels)" << endl;
+}
+
+// An MPEG 1 intensity stereo frame whose right channel scalefactors are
+// past the last position (10, where 0 to 6 are positions and 7 is illegal)
+// must decode as illegal positions: no intensity, the right channel silent.
+void test_layer3_intensity() {
+    using namespace my::mpeg;
+    // 128 kbps, 44.1 kHz, joint stereo with intensity on: 417 bytes
+    std::vector<unsigned char> f(417, 0);
+    f[0] = 0xFF;
+    f[1] = 0xFB;
+    f[2] = 0x90;
+    f[3] = 0x50;
+    size_t bit = 32;
+    auto put = [&](uint32_t v, int n) {
+        for (int i = n - 1; i >= 0; --i, ++bit) {
+            if ((v >> i) & 1) {
+                f[bit / 8] = CAST(unsigned char, f[bit / 8] | (0x80 >> (bit % 8)));
+            }
+        }
+    };
+    // the side info: main data right after it. Left: no scalefactors, one
+    // count1 quadruple (table B) with a 1 in its first line. Right:
+    // scalefac_compress 15 (4 and 3 bits), all of it scalefactors.
+    static constexpr int LEFT_BITS = 5, RIGHT_BITS = 11 * 4 + 10 * 3;
+    put(0, 9); // main_data_begin
+    put(0, 3 + 8); // private bits, scfsi
+    for (int gr = 0; gr < 2; ++gr) {
+        for (int ch = 0; ch < 2; ++ch) {
+            put(ch == 0 ? LEFT_BITS : RIGHT_BITS, 12); // part2_3_length
+            put(0, 9); // big_values
+            put(210, 8); // global_gain
+            put(ch == 0 ? 0 : 15, 4); // scalefac_compress
+            put(0, 1 + 15 + 4 + 3); // long blocks, tables, regions
+            put(0, 2); // preflag, scalefac_scale
+            put(1, 1); // count1table_select: B
+        }
+    }
+    for (int gr = 0; gr < 2; ++gr) {
+        put(0x7, 4); // 0111: the quadruple 1000
+        put(0, 1); // and its sign
+        for (int sfb = 0; sfb < 21; ++sfb) {
+            put(sfb < 11 ? 10 : 5, sfb < 11 ? 4 : 3);
+        }
+    }
+
+    layer3_decoder dec;
+    std::unique_ptr<layer3_decoder::pcm_type[]> pcm(new layer3_decoder::pcm_type[1]);
+    float left = 0, right = 0;
+    for (int i = 0; i < 3; ++i) {
+        const int n = dec.decode(f.data(), CAST(int, f.size()), i * 417, pcm[0]);
+        assert(n == 1152 && dec.channels() == 2);
+        for (int k = 0; k < n; ++k) {
+            assert(std::isfinite(pcm[0][0][k]) && std::isfinite(pcm[0][1][k]));
+            left = (std::max)(left, std::fabs(pcm[0][0][k]));
+            right = (std::max)(right, std::fabs(pcm[0][1][k]));
+        }
+    }
+    assert(left > 0 && right == 0);
+    cout << "test_layer3_intensity: position 10 taken as illegal, left peak " << left
+         << endl;
+}
+
+// the C ABI (my_mpeg_c.h) must agree with the templates it wraps, whichever
+// way the file is opened.
+void test_c_api(const std::string& path, const my::mpeg::parse_summary& expected) {
+    assert(my_mpeg_abi_version() == MY_MPEG_ABI_VERSION);
+    const std::string data = slurp_file(path);
+#ifdef _WIN32
+    const int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+#endif
+    assert(fd >= 0);
+
+    my_mpeg_file* files[3] = {nullptr, nullptr, nullptr};
+    int e = my_mpeg_open_path(path.c_str(), &files[0]);
+    e |= my_mpeg_open_fd(fd, &files[1]);
+    e |= my_mpeg_open_memory(data.data(), data.size(), &files[2]);
+    assert(e == 0);
+    for (auto* f : files) {
+        e = my_mpeg_parse(f, MY_MPEG_INDEX_FRAMES);
+        assert(e == 0);
+        my_mpeg_summary s;
+        my_mpeg_get_summary(f, &s);
+        assert(s.nframes == expected.nframes && s.total_samples == expected.total_samples
+            && s.first_frame == expected.first_frame && s.bitrate == expected.bitrate);
+        // the index chains from one frame to the next, a few at a time
+        my_mpeg_frame chunk[5];
+        int64_t n = 0, got = 0, next = -1;
+        while ((got = my_mpeg_frames(f, n, chunk, 5)) > 0) {
+            for (int64_t i = 0; i < got; ++i) {
+                assert(next < 0 || chunk[i].offset == next);
+                next = chunk[i].offset + chunk[i].length;
+            }
+            n += got;
+        }
+        assert(n == my_mpeg_frame_count(f) && n > 0 && n <= s.nframes);
+        my_mpeg_close(f);
+    }
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+
+    const std::string missing = path + ".not-there.mp3";
+    const std::string text = path + ".not-audio.txt";
+    fstream(text, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+        << std::string(4096, 'x');
+    const char* const paths[]
+        = {path.c_str(), missing.c_str(), path.c_str(), path.c_str(), text.c_str()};
+    my_mpeg_summary out[5];
+    const int64_t good = my_mpeg_parse_paths(paths, 5, out, MY_MPEG_FINGERPRINT, 2);
+    ::remove(text.c_str());
+    assert(good == 3 && out[1].error < 0);
+    assert(out[4].nframes == 0
+        && out[4].error == CAST(int, my::mpeg::error::error_code::no_frames));
+    assert(out[0].audio_hash != 0 && out[0].audio_hash == out[3].audio_hash);
+    CAST(void, e);
+    CAST(void, good);
+    cout << "test_c_api: " << good << " of 5 parsed, " << my_mpeg_strerror(out[1].error)
+         << " for the missing one, " << my_mpeg_strerror(out[4].error)
+         << " for the text" << endl;
+}
+
+// Frame columns must give back what the frame index says, and the CRC check
+// must tell a good protection word from a bad one. The test file's encoder
+// wrote one on every frame: a copy gets frame 5's broken.
+void test_frame_columns(const std::string& path) {
+    std::vector<my::mpeg::frame_entry> index;
+    const std::string data = slurp_file(path);
+    {
+        fstream in(path.c_str(), std::ios_base::binary | std::ios_base::in);
+        auto reader = [&](char* const ptr, int& how_much, const seek_t& seek) {
+            in.clear();
+            return read_file(ptr, how_much, seek, in);
+        };
+        my::mpeg::buffer buf(path, std::move(reader));
+        my::mpeg::parser p(path, data.size());
+        p.index_frames(true);
+        p.parse(buf);
+        index = p.frame_index();
+    }
+    assert(index.size() > 5 && (data[CAST(size_t, index[5].offset) + 1] & 1) == 0);
+    std::string prot = data;
+    prot[CAST(size_t, index[5].offset) + 5] ^= 1;
+    const std::string prot_path = path + ".crc-test.mp3";
+    {
+        fstream out(prot_path.c_str(),
+            std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+        out.write(prot.data(), CAST(std::streamsize, prot.size()));
+    }
+
+    my::mpeg::frame_columns_writer w;
+    std::string cols = my::mpeg::frame_columns_writer::file_header();
+    for (const auto* p : {&path, &prot_path}) {
+        my::mpeg::parse_summary summary;
+        my::mpeg::export_frame_columns(*p, w, summary);
+        cols += w.take();
+    }
+    std::remove(prot_path.c_str());
+
+    my::mpeg::frame_columns_reader r(cols.data(), cols.size());
+    my::mpeg::frame_columns_reader::block_view b;
+    assert(r.ok());
+    int nblocks = 0;
+    int crc_count[4] = {0};
+    while (r.next(b)) {
+        assert(b.nframes() == index.size());
+        std::vector<int64_t> offsets(b.nframes());
+        b.offsets(offsets.data());
+        for (uint32_t i = 0; i < b.nframes(); ++i) {
+            assert(offsets[i] == index[i].offset && b.size[i] == index[i].length);
+            assert(b.kbps(i) * 1000 == index[i].bitrate && b.padded(i) == index[i].padding);
+            crc_count[CAST(int, b.crc(i))]++;
+        }
+        ++nblocks;
+    }
+    const int n = CAST(int, index.size());
+    assert(nblocks == 2 && crc_count[1] == 2 * n - 1 && crc_count[2] == 1);
+    CAST(void, nblocks);
+    CAST(void, n);
+    cout << "test_frame_columns: " << 2 * index.size() << " frames in " << cols.size()
+         << " bytes, " << crc_count[1] << " good and " << crc_count[2] << " bad CRCs" << endl;
+}
+
+// The known-signature fast path must agree with frame::parse_header() on
+// every header there is, and give the same walk over a real file.
+void test_known_signature(const std::string& path) {
+    using namespace my::mpeg;
+    const auto ll = detail::loglevel.load();
+    set_loglevel(loglevel_t::quiet); // parse_header() narrates every call
+    frame general;
+    frame fast;
+    int nfast = 0;
+    for (uint32_t x = 0; x < (1u << 21); ++x) {
+        const uint32_t w = 0xFFE00000u | x;
+        const char h[4] = {CAST(char, w >> 24), CAST(char, w >> 16), CAST(char, w >> 8),
+            CAST(char, w)};
+        for (auto* f : {&general, &fast}) {
+            f->clear();
+            f->m_sbo.clear();
+            f->m_sbo.append_data(h, 4);
+        }
+        const error e = general.parse_header(0);
+        const bool ok = !e || e == error::error_code::data_incomplete;
+        const uint32_t sig = w & detail::STREAM_SIGNATURE_MASK;
+        const auto fn = detail::known_signature_for(sig);
+        const bool fast_ok = fn != nullptr && fn(fast, 0);
+        assert(ok == fast_ok);
+        if (fast_ok) {
+            const auto& a = general.props_const();
+            const auto& b = fast.props_const();
+            assert(compare_frames(general, fast) == frame_mismatch::none);
+            assert(a.padding == b.padding && a.crc == b.crc && a.copyright == b.copyright);
+            assert(general.length_in_bytes() == fast.length_in_bytes());
+            assert(general.samples() == fast.samples());
+            // and one built for another samplerate wants nothing to do with it
+            const auto other = detail::known_signature_for(sig ^ 0x400);
+            assert(other == nullptr || !other(fast, 0));
+            CAST(void, a);
+            CAST(void, b);
+            CAST(void, other);
+            ++nfast;
+        }
+    }
+    set_loglevel(ll);
+
+    const std::string data = slurp_file(path);
+    std::vector<frame_entry> index[2];
+    parse_summary summary[2];
+    for (int on = 0; on < 2; ++on) {
+        detail::memory_reader reader{data.data(), CAST(int64_t, data.size()), 0};
+        buffer buf(path, std::move(reader));
+        parser p(path, data.size());
+        p.fast_path(on != 0);
+        p.index_frames(true);
+        p.parse(buf);
+        index[on] = p.frame_index();
+        summary[on] = p.summary();
+    }
+    assert(!index[0].empty() && index[0].size() == index[1].size());
+    for (size_t i = 0; i < index[0].size(); ++i) {
+        const auto& a = index[0][i];
+        const auto& b = index[1][i];
+        assert(a.offset == b.offset && a.length == b.length && a.bitrate == b.bitrate);
+        assert(a.padding == b.padding && a.channelmode == b.channelmode);
+        CAST(void, a);
+        CAST(void, b);
+    }
+    assert(summary[0].nframes == summary[1].nframes
+        && summary[0].total_samples == summary[1].total_samples);
+    cout << "test_known_signature: " << nfast << " headers agree, " << index[1].size()
+         << " frames walked the same" << endl;
+}
+
+// parse(byte_span) must find what parsing through a reader finds, with the
+// frames and tags it hands back pointing into the caller's bytes.
+void test_span_parse(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = slurp_file(path);
+    parse_summary want;
+    const error e = parse_file(path, want, true);
+    assert(!e || e == error::error_code::no_more_data);
+
+    const auto* const lo = reinterpret_cast<const unsigned char*>(data.data());
+    const auto* const hi = lo + data.size();
+    int nviews = 0;
+    parser p(path, 0);
+    p.fingerprint(true);
+    p.index_frames(true);
+    p.on_frame([&](const frame& f) {
+        assert(f.is_view() && f.bytes() >= lo && f.bytes() + f.length_in_bytes() <= hi);
+        ++nviews;
+    });
+    p.parse(byte_span(data.data(), data.size()));
+    const auto got = p.summary();
+    assert(got.nframes == want.nframes && got.audio_hash == want.audio_hash);
+    assert(got.first_frame == want.first_frame && got.total_samples == want.total_samples);
+    assert(nviews == CAST(int, p.frame_index().size()));
+
+    const auto v2 = p.id3v2_tag();
+    const auto v1 = p.id3v1_tag();
+    assert(v2.size() == want.id3v2_size && v2.data() == lo && memcmp(lo, "ID3", 3) == 0);
+    assert(want.id3v1 && v1.size() == 128 && memcmp(v1.data(), "TAG", 3) == 0);
+    const auto& first = p.frame_index().front();
+    assert(p.frame_bytes(first).data() == lo + first.offset
+        && p.frame_bytes(first).data()[0] == 0xFF);
+    CAST(void, e);
+    CAST(void, got);
+    CAST(void, v1);
+    CAST(void, first);
+    cout << "test_span_parse: " << nviews << " frames viewed in place, " << v2.size()
+         << " byte ID3v2 tag" << endl;
+}
+
+// Input that isn't audio comes back as an error or as no frames, never as an
+// abort: a buffer or a file of a few bytes is tiny_file, not a failed seek
+// for the ID3v1 tag. Built with MY_MPEG_NO_ABORT, input that would trip an
+// assert must come back too.
+void test_bad_input(const std::string& path) {
+    using namespace my::mpeg;
+    const auto ll = detail::loglevel.load();
+    set_loglevel(loglevel_t::quiet);
+    const std::string tiny("\xFF\xFB\x90", 3);
+    parser p("tiny.mp3", 0);
+    assert(p.parse(byte_span(tiny.data(), tiny.size())) == error::error_code::tiny_file);
+    assert(p.summary().nframes == 0);
+
+    const std::string tiny_path = path + ".tiny-test";
+    fstream(tiny_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+        << tiny;
+    parse_summary s;
+    assert(parse_file(tiny_path, s) == error::error_code::tiny_file && s.nframes == 0);
+    ::remove(tiny_path.c_str());
+
+    const std::string junk(4096, 'x');
+    parser q("junk.mp3", 0);
+    assert(!q.parse(byte_span(junk.data(), junk.size())) && q.summary().nframes == 0);
+    assert(q.summary().ngaps == 1 && q.summary().gap_bytes == 4096);
+    int nbad = 3;
+#ifdef MY_MPEG_NO_ABORT
+    // an ID3v2 tag that says it is bigger than any the parser reads
+    const std::string huge
+        = std::string("ID3\x03\x00\x00\x7F\x7F\x7F\x7F", 10) + std::string(4096, 'x');
+    parser r("huge-tag.mp3", 0);
+    r.parse(byte_span(huge.data(), huge.size()));
+    assert(r.summary().nframes == 0);
+    ++nbad;
+#endif
+    set_loglevel(ll);
+    CAST(void, s);
+    cout << "test_bad_input: " << nbad << " bad inputs came back as errors" << endl;
+}
+
+// A block_reader must give the parser the same file, in far fewer reads.
+// The file is padded out to several blocks by repeating its audio.
+void test_block_reader(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = slurp_file(path);
+    parse_summary one;
+    parse_file(path, one);
+    const std::string big = repeat_audio(data, one, 30);
+    const auto size = CAST(int64_t, big.size());
+
+    parse_summary got[2];
+    std::vector<sync_gap> gaps[2];
+    int64_t reads[2] = {0, 0};
+    for (int blocked = 0; blocked < 2; ++blocked) {
+        detail::memory_reader mem{big.data(), size, 0};
+        int64_t& n = reads[blocked];
+        auto counted = [&mem, &n](char* const p, int& how_much, const seek_t& sk) {
+            ++n;
+            return mem(p, how_much, sk);
+        };
+        parser p(path, big.size());
+        p.fingerprint(true);
+        if (blocked) {
+            detail::block_reader<decltype(counted)> reader(
+                counted, size, detail::MIN_READ_BLOCK);
+            buffer buf(path, std::move(reader));
+            p.parse(buf);
+        } else {
+            buffer buf(path, std::move(counted));
+            p.parse(buf);
+        }
+        got[blocked] = p.summary();
+        gaps[blocked] = p.gaps();
+    }
+    assert(got[1].nframes == got[0].nframes && got[0].nframes > 30 * 40);
+    assert(got[1].audio_hash == got[0].audio_hash && gaps[1].size() == gaps[0].size());
+    // one per block, plus the tags at the ends
+    assert(reads[1] <= size / detail::MIN_READ_BLOCK + 4);
+    cout << "test_block_reader: " << got[1].nframes << " frames in " << reads[1]
+         << " reads, not " << reads[0] << endl;
+}
+
+// A logger's file, and then some: 6 million frames, 8.6 GB, made up as they
+// are read, with a stretch of junk past 4 GB. Every offset and count must
+// come through whole, where 32 bits would have wrapped.
+void test_huge_stream() {
+    using namespace my::mpeg;
+    // MPEG 1 layer III, 320 kbps, 32 kHz, joint stereo: 1440 bytes a frame
+    static constexpr int64_t FRAME = 1440;
+    std::string frame(CAST(size_t, FRAME), '\0');
+    frame[0] = CAST(char, 0xFF);
+    frame[1] = CAST(char, 0xFB);
+    frame[2] = CAST(char, 0xE8);
+    frame[3] = CAST(char, 0x40);
+    const int64_t before = 3500000, after = 2500000, junk = 1000;
+    const int64_t gap_at = before * FRAME;
+    const int64_t size = gap_at + junk + after * FRAME;
+    assert(gap_at > (int64_t(1) << 32) && size > (int64_t(8) << 30));
+
+    int64_t pos = 0;
+    auto reader = [&](char* const into, int& how_much, const seek_t& sk) {
+        pos = detail::seek_target(sk, pos, size);
+        const int want = how_much;
+        int got = 0;
+        while (got < want && pos < size) {
+            int64_t off = pos; // into the frame at pos
+            int64_t left = 0; // what's left of that frame, or the junk
+            if (pos < gap_at) {
+                off = pos % FRAME;
+                left = FRAME - off;
+            } else if (pos < gap_at + junk) {
+                left = gap_at + junk - pos;
+                off = -1;
+            } else {
+                off = (pos - gap_at - junk) % FRAME;
+                left = FRAME - off;
+            }
+            const int n = CAST(int, (std::min)(left, CAST(int64_t, want - got)));
+            if (off < 0) {
+                memset(into + got, 0x55, CAST(size_t, n));
+            } else {
+                memcpy(into + got, frame.data() + off, CAST(size_t, n));
+            }
+            got += n;
+            pos += n;
+        }
+        how_much = got;
+        return got < want ? my::io::NO_MORE_DATA : 0;
+    };
+
+    // quiet, or it is printf that gets timed
+    const auto ll = detail::loglevel.load();
+    set_loglevel(loglevel_t::quiet);
+    parser p("huge.mp3", size);
+    const auto t0 = std::chrono::steady_clock::now();
+    buffer buf("huge.mp3", std::move(reader));
+    p.parse(buf);
+    const double secs
+        = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    set_loglevel(ll);
+    const parse_summary s = p.summary();
+    assert(s.file_size == size && s.nframes == before + after);
+    assert(s.total_samples == (before + after) * 1152
+        && s.total_samples > CAST(int64_t, UINT32_MAX));
+    assert(std::fabs(s.duration_ms - 1000.0 * double(s.total_samples) / 32000) < 1);
+    assert(s.ngaps == 1 && s.gap_bytes == junk && p.gaps()[0].offset == gap_at);
+    assert(p.stats().audio_bytes == (before + after) * FRAME);
+    assert(p.stats().bitrate_hist[320 / frame_stats::BITRATE_STEP_KBPS] == s.nframes);
+    cout << "test_huge_stream: " << s.nframes << " frames, " << size << " bytes, gap at "
+         << gap_at << ", " << double(size) / (1 << 30) / secs << " GB/s" << endl;
+}
+
+// A bitrate_timeline of a long VBR stream stays within its buckets, and
+// every bucket says what the frames it covers say, gap and all.
+void test_timeline() {
+    using namespace my::mpeg;
+    // MPEG 1 layer III, 44.1 kHz, joint stereo, no padding: 144 * bitrate /
+    // 44100 bytes a frame; the bitrate goes round all 14 of them
+    static constexpr int KBPS[15] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192,
+        224, 256, 320};
+    static constexpr int NFRAMES = 1000, GAP_AFTER = 700, JUNK = 300, NBUCKETS = 16;
+    std::string data;
+    for (int i = 0; i < NFRAMES; ++i) {
+        const int idx = 1 + (i * 7 + i / 50) % 14;
+        std::string frame(CAST(size_t, 144 * KBPS[idx] * 1000 / 44100), '\0');
+        frame[0] = CAST(char, 0xFF);
+        frame[1] = CAST(char, 0xFB);
+        frame[2] = CAST(char, idx << 4);
+        frame[3] = CAST(char, 0x40);
+        data += frame;
+        if (i == GAP_AFTER) {
+            data.append(JUNK, CAST(char, 0x55));
+        }
+    }
+
+    bitrate_timeline t(NBUCKETS);
+    parser p("vbr.mp3", 0);
+    p.index_frames(true);
+    p.timeline(&t);
+    p.parse(byte_span(data.data(), data.size()));
+    const auto& index = p.frame_index();
+    const auto& buckets = t.buckets();
+    assert(p.summary().nframes == NFRAMES && index.size() == CAST(size_t, NFRAMES));
+    assert(t.frames() == NFRAMES && t.samples() == p.summary().total_samples);
+    assert(buckets.size() > NBUCKETS / 2 && buckets.size() <= NBUCKETS);
+    assert(buckets.capacity() == NBUCKETS && t.frames_per_bucket() == 64);
+
+    int64_t frames = 0, samples = 0, gaps = 0;
+    for (const auto& b : buckets) {
+        assert(b.first_frame == frames && b.start_sample == samples);
+        assert(b.frames == t.frames_per_bucket() || &b == &buckets.back());
+        int lo = INT32_MAX, hi = 0, lo_kbps = INT32_MAX, hi_kbps = 0;
+        int64_t bytes = 0;
+        double kbps = 0;
+        for (int64_t i = frames; i < frames + b.frames; ++i) {
+            const auto& e = index[CAST(size_t, i)];
+            lo = (std::min)(lo, e.length);
+            hi = (std::max)(hi, e.length);
+            lo_kbps = (std::min)(lo_kbps, e.bitrate / 1000);
+            hi_kbps = (std::max)(hi_kbps, e.bitrate / 1000);
+            bytes += e.length;
+            kbps += e.bitrate / 1000;
+            samples += e.samples;
+        }
+        assert(b.min_bytes == lo && b.max_bytes == hi && b.bytes == bytes);
+        assert(b.min_kbps == lo_kbps && b.max_kbps == hi_kbps && hi_kbps > lo_kbps);
+        assert(std::fabs(b.mean_kbps() - kbps / b.frames) < 1e-9);
+        const bool has_gap = GAP_AFTER >= frames && GAP_AFTER < frames + b.frames;
+        assert(b.gaps == (has_gap ? 1 : 0) && b.gap_bytes == (has_gap ? JUNK : 0));
+        frames += b.frames;
+        gaps += b.gaps;
+        CAST(void, lo);
+        CAST(void, hi);
+        CAST(void, lo_kbps);
+        CAST(void, hi_kbps);
+    }
+    assert(frames == NFRAMES && gaps == 1 && p.summary().ngaps == 1);
+
+    // the same again from the index, and after a clear()
+    bitrate_timeline again(NBUCKETS);
+    for (const auto& e : index) {
+        again.add(e);
+    }
+    assert(again.buckets().size() == buckets.size());
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        assert(again.buckets()[i].kbps_sum == buckets[i].kbps_sum
+            && again.buckets()[i].bytes == buckets[i].bytes);
+    }
+    p.parse(byte_span(data.data(), data.size()));
+    assert(t.frames() == NFRAMES && t.buckets().size() == again.buckets().size());
+    CAST(void, gaps);
+    cout << "test_timeline: " << NFRAMES << " frames in " << buckets.size() << " buckets of "
+         << t.frames_per_bucket() << endl;
+}
+
+#ifndef _WIN32
+// A file written a piece at a time, as a logger writes, followed as it grows:
+// every frame turns up once, in order, nothing is read twice, and at the end
+// the summary and the index are what parsing the whole file says. The file
+// has junk in it, so the follower has to lose sync and find it as the walk
+// does.
+void test_follow(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = damaged_audio(slurp_file(path));
+    parser whole(path, data.size());
+    whole.index_frames(true);
+    whole.parse(byte_span(data.data(), data.size()));
+    const parse_summary want = whole.summary();
+
+    const std::string live = path + ".follow-test";
+    fstream(live, std::ios_base::out | std::ios_base::trunc);
+    file_follower follower(live, detail::MIN_READ_BLOCK);
+    assert(follower.open() == 0);
+
+    std::atomic<bool> written{false};
+    std::thread writer([&] {
+        const int fd = ::open(live.c_str(), O_WRONLY | O_APPEND);
+        assert(fd >= 0);
+        static const size_t sizes[] = {3, 9, 777, 1, 418, 2000, 417, 1500};
+        size_t at = 0;
+        for (int i = 0; at < data.size(); ++i) {
+            const size_t n = (std::min)(sizes[i % 8], data.size() - at);
+            const ssize_t w = ::write(fd, data.data() + at, n);
+            assert(w == CAST(ssize_t, n));
+            CAST(void, w);
+            at += n;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ::close(fd);
+        written = true;
+    });
+
+    int updates = 0;
+    int64_t seen = 0;
+    auto on_update = [&](const file_follower& f, size_t first_new) {
+        // the new frames follow on from the ones already published
+        assert(first_new == CAST(size_t, seen) && f.index().size() > first_new);
+        seen = CAST(int64_t, f.index().size());
+        ++updates;
+    };
+    while (!written || follower.bytes_read() < CAST(int64_t, data.size())) {
+        const int64_t n = follower.poll(100, on_update);
+        assert(n >= 0);
+        CAST(void, n);
+    }
+    writer.join();
+    follower.poll(50, on_update); // the writer's close
+    assert(follower.finish(on_update) >= 0);
+
+    const parse_summary& got = follower.summary();
+    assert(got.file_size == want.file_size && got.nframes == want.nframes);
+    assert(got.total_samples == want.total_samples && got.first_frame == want.first_frame);
+    assert(std::fabs(got.duration_ms - want.duration_ms) < 0.001);
+    assert(got.ngaps == want.ngaps && got.gap_bytes == want.gap_bytes && got.vbr == want.vbr);
+    assert(got.id3v2_size == want.id3v2_size && got.id3v1 == want.id3v1
+        && got.ape_size == want.ape_size);
+    const auto& index = follower.index();
+    assert(index.size() == whole.frame_index().size());
+    for (size_t i = 0; i < index.size(); ++i) {
+        assert(index[i].offset == whole.frame_index()[i].offset
+            && index[i].length == whole.frame_index()[i].length);
+    }
+    assert(follower.bytes_read() == CAST(int64_t, data.size()) && updates > 3);
+    assert(got.ngaps >= 2);
+#ifdef __linux__
+    assert(follower.writer_closed());
+#endif
+    // a file that gets shorter is not the one being followed any more
+    assert(::truncate(live.c_str(), 100) == 0);
+    assert(follower.poll(0, on_update) == -ESTALE);
+    follower.close();
+    ::unlink(live.c_str());
+    cout << "test_follow: " << got.nframes << " frames in " << updates << " updates, "
+         << follower.reads() << " reads of " << follower.bytes_read() << " bytes" << endl;
+}
+
+// Retagging a copy of the clip: an edit that fits goes over the old tag and
+// leaves the audio where it was; one that doesn't moves the audio up whole.
+// Either way the file parses as it did, bar where the audio starts.
+void test_id3v2_write(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = slurp_file(path);
+    parse_summary want;
+    parse_file(path, want);
+    const std::string audio = data.substr(want.id3v2_size);
+
+    const std::string copy = path + ".tag-test";
+    fstream(copy, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+        << data;
+    std::vector<id3v2_frame> frames;
+    assert(read_id3v2_frames(copy, frames) == 0 && frames.size() == 31);
+    assert(frames.back().id == "TIT2" && frames.back().data.size() == 11);
+    frames.back() = id3v2_text_frame("TIT2", "Kay FM");
+    frames.push_back(id3v2_text_frame("TRCK", "7"));
+
+    id3v2_write_result r;
+    assert(write_id3v2_tag(copy, frames, &r) == 0);
+    assert(r.done == id3v2_write_result::how::in_place && r.old_size == want.id3v2_size
+        && r.new_size == r.old_size);
+    std::string now = slurp_file(copy);
+    assert(now.size() == data.size() && now.compare(r.new_size, now.npos, audio) == 0);
+    assert(memcmp(now.data(), "ID3\x04", 4) == 0);
+    std::vector<id3v2_frame> back;
+    assert(read_id3v2_frames(copy, back) == 0 && back.size() == frames.size());
+    for (size_t i = 0; i < back.size(); ++i) {
+        assert(back[i].id == frames[i].id && back[i].data == frames[i].data);
+    }
+
+    // too big for the padding: the audio moves up
+    frames.push_back(id3v2_frame{"PRIV", std::string(5000, '\xFF'), 0});
+    assert(write_id3v2_tag(copy, frames, &r) == 0);
+    assert(r.done != id3v2_write_result::how::in_place && r.old_size == want.id3v2_size);
+    assert(r.new_size >= r.old_size + 5000 + detail::ID3V2_GROW_PADDING);
+    now = slurp_file(copy);
+    assert(now.size() == data.size() + (r.new_size - r.old_size));
+    assert(now.compare(r.new_size, now.npos, audio) == 0);
+    assert(read_id3v2_frames(copy, back) == 0 && back.size() == frames.size()
+        && back.back().data == frames.back().data);
+    parse_summary got;
+    parse_file(copy, got);
+    assert(got.id3v2_size == r.new_size && got.nframes == want.nframes
+        && got.total_samples == want.total_samples && got.id3v1 == want.id3v1);
+    const auto how = r.done;
+
+    // moving by copying, which the filesystem may not have needed
+    const int fd = ::open(copy.c_str(), O_RDWR);
+    assert(fd >= 0 && detail::shift_up(fd, 100, 777, CAST(int64_t, now.size())) == 0);
+    ::close(fd);
+    const std::string shifted = slurp_file(copy);
+    assert(shifted.size() == now.size() + 777
+        && shifted.compare(0, 100, now, 0, 100) == 0
+        && shifted.compare(877, shifted.npos, now, 100, now.npos) == 0);
+
+    // a v2.3 tag, unsynchronised: what comes back is what went in
+    const std::string body("\x00\xFF\xE0 sync? \xFF\x00\xFF", 12);
+    std::string frame = "TXXX" + std::string("\x00\x00\x00\x0C\x00\x00", 6) + body;
+    std::string stored;
+    for (const char c : frame) {
+        stored += c;
+        if (c == '\xFF') {
+            stored += '\0';
+        }
+    }
+    stored.resize(stored.size() + 20, '\0');
+    unsigned char h[10] = {'I', 'D', '3', 3, 0, 0x80, 0, 0, 0, 0};
+    detail::encode_syncsafe(CAST(uint32_t, stored.size()), h + 6);
+    fstream(copy, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+        << std::string(reinterpret_cast<const char*>(h), 10) << stored << audio;
+    assert(read_id3v2_frames(copy, back) == 0 && back.size() == 1);
+    assert(back[0].id == "TXXX" && back[0].data == body);
+    ::unlink(copy.c_str());
+    CAST(void, how);
+    cout << "test_id3v2_write: " << frames.size() - 1 << " frames written in place, "
+         << frames.size() << " "
+         << (how == id3v2_write_result::how::inserted ? "inserted" : "shifted") << " as a "
+         << r.new_size << " byte tag" << endl;
+}
+
+// XXH64 must give the reference values, however it is fed; the audio hash
+// must not move when the tags do, and duplicate_index must put the same audio
+// under different tags together, and nothing else.
+void test_dedupe(const std::string& path) {
+    using namespace my::mpeg;
+    using my::hash::xxh64;
+    struct reference {
+        const char* text;
+        uint64_t seed;
+        uint64_t want;
+    };
+    // from the reference implementation
+    static const reference vectors[] = {
+        {"", 0, 0xEF46DB3751D8E999ULL},
+        {"", 20141025, 0x493D554C526625BAULL},
+        {"a", 0, 0xD24EC4F1A98C6E5BULL},
+        {"abc", 0, 0x44BC2CF5AD770999ULL},
+        {"xxhash", 0, 0x32DD38952C4BC720ULL},
+        {"xxhash", 20141025, 0xB559B98D844E0635ULL},
+        {"Nobody inspects the spammish repetition", 0, 0xFBCEA83C8A378BF1ULL},
+        {"Nobody inspects the spammish repetition", 20141025, 0xCE06936136852706ULL},
+        {"The quick brown fox jumps over the lazy dog", 0, 0x0B242D361FDA71BCULL},
+    };
+    for (const auto& v : vectors) {
+        const size_t n = strlen(v.text);
+        assert(xxh64::of(v.text, n, v.seed) == v.want);
+        xxh64 bytewise(v.seed);
+        for (size_t i = 0; i < n; ++i) {
+            bytewise.update(v.text + i, 1);
+        }
+        assert(bytewise.digest() == v.want && bytewise.bytes_hashed() == n);
+        CAST(void, n);
+    }
+
+    const std::string data = slurp_file(path);
+    parse_summary orig;
+    parse_file(path, orig, true);
+    assert(orig.audio_hash != 0);
+
+    // retagged, the audio moving up to make room
+    const std::string retagged = path + ".dedupe-test";
+    fstream(retagged, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+        << data;
+    std::vector<id3v2_frame> frames;
+    assert(read_id3v2_frames(retagged, frames) == 0);
+    frames.push_back(id3v2_text_frame("TIT2", "Another title"));
+    frames.push_back(id3v2_frame{"PRIV", std::string(3000, 'p'), 0});
+    assert(write_id3v2_tag(retagged, frames) == 0);
+    parse_summary again;
+    parse_file(retagged, again, true);
+    assert(again.id3v2_size > orig.id3v2_size && again.nframes == orig.nframes);
+    assert(again.audio_hash == orig.audio_hash);
+
+    // the same tags, but a byte of audio changed
+    parser p(path, data.size());
+    p.index_frames(true);
+    p.parse(byte_span(data.data(), data.size()));
+    std::string changed = data;
+    changed[CAST(size_t, p.frame_index().back().offset) + 20] ^= 1;
+    const std::string other = path + ".dedupe-test2";
+    fstream(other, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+        << changed;
+    parse_summary different;
+    parse_file(other, different, true);
+    assert(different.nframes == orig.nframes && different.audio_hash != orig.audio_hash);
+
+    // with and without the bloom filter
+    for (const size_t expected : {size_t(0), size_t(100)}) {
+        duplicate_index dups(expected);
+        assert(!dups.add(path, orig));
+        assert(!dups.add(other, different));
+        assert(dups.add(retagged, again));
+        parse_summary unparsed;
+        assert(!dups.add(path + ".never-parsed", unparsed));
+        std::vector<std::vector<std::string>> found;
+        const size_t n = dups.groups([&](const std::vector<std::string>& paths) {
+            found.push_back(paths);
+        });
+        assert(n == 1 && found.size() == 1);
+        std::sort(found[0].begin(), found[0].end());
+        assert(found[0] == (std::vector<std::string>{path, retagged}));
+        assert(dups.size() == 3);
+        CAST(void, n);
+    }
+    ::unlink(retagged.c_str());
+    ::unlink(other.c_str());
+    cout << "test_dedupe: " << sizeof(vectors) / sizeof(vectors[0])
+         << " XXH64 vectors; audio hash kept through a retag to a " << again.id3v2_size
+         << " byte tag" << endl;
+}
+
+// Pictures found in place must be the images that went in, byte for byte:
+// straight off the disk when stored as they are, through
+// read_id3v2_picture() when unsynchronised (a frame at a time, in v2.4, or
+// the whole tag, in v2.3), and in a v2.2 PIC frame.
+void test_id3v2_pictures(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = slurp_file(path);
+    parse_summary want;
+    parse_file(path, want);
+    const std::string audio = data.substr(want.id3v2_size);
+    std::string image("\x89PNG\r\n\x1A\n", 8);
+    for (int i = 0; i < 3000; ++i) {
+        image += CAST(char, i % 5 == 0 ? 0xFF : i % 5 == 1 ? (i / 5) % 2 * 0xE0 : i * 37);
+    }
+    image += '\xFF';
+    auto unsync = [](const std::string& in) {
+        std::string out;
+        for (const char c : in) {
+            out += c;
+            if (c == '\xFF') {
+                out += '\0';
+            }
+        }
+        return out;
+    };
+    const std::string apic = std::string("\x00image/png\x00\x03" "cover\x00", 18) + image;
+    const std::string copy = path + ".picture-test";
+    auto write = [&](const std::string& tag) {
+        fstream(copy, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+            << tag << audio;
+    };
+    std::vector<id3v2_picture> pics;
+    std::string got;
+    int found = 0;
+
+    // v2.4, as it is on disk: one in UTF-16 after one in Latin-1
+    std::vector<id3v2_frame> frames;
+    assert(read_id3v2_frames(path, frames) == 0);
+    frames.push_back(id3v2_frame{"APIC", apic, 0});
+    frames.push_back(id3v2_frame{"APIC",
+        std::string("\x01image/jpeg\x00\x04\xFF\xFE" "b\x00\x00\x00", 19) + image, 0});
+    write(build_id3v2_tag(frames));
+    assert(find_id3v2_pictures(copy, pics) == 0 && pics.size() == 2);
+    std::string file = slurp_file(copy);
+    assert(pics[0].mime == "image/png" && pics[0].type == 3 && !pics[0].unsynchronised);
+    assert(pics[1].mime == "image/jpeg" && pics[1].type == 4 && !pics[1].unsynchronised);
+    for (const auto& pic : pics) {
+        assert(file.substr(CAST(size_t, pic.offset), CAST(size_t, pic.length)) == image);
+        ++found;
+    }
+
+    // v2.4, the frame unsynchronised and with its data length
+    unsigned char length[4];
+    detail::encode_syncsafe(CAST(uint32_t, apic.size()), length);
+    const std::vector<id3v2_frame> v24 = {id3v2_text_frame("TIT2", "\xFF\xFF"),
+        id3v2_frame{"APIC", std::string(reinterpret_cast<char*>(length), 4) + unsync(apic),
+            0x03}};
+    write(build_id3v2_tag(v24, 20000));
+    assert(find_id3v2_pictures(copy, pics) == 0 && pics.size() == 1);
+    assert(pics[0].unsynchronised && pics[0].length > CAST(int64_t, image.size()));
+    assert(read_id3v2_picture(copy, pics[0], got) == 0 && got == image);
+    assert(read_id3v2_frames(copy, frames) == 0 && frames.size() == 2
+        && frames[1].data == apic && frames[1].flags == 0);
+    found += CAST(int, pics.size());
+
+    // v2.3, the whole tag unsynchronised, the frame headers with it
+    auto v23_frame = [](const std::string& id, const std::string& body) {
+        const uint32_t n = CAST(uint32_t, body.size());
+        const char h[6] = {CAST(char, n >> 24), CAST(char, n >> 16), CAST(char, n >> 8),
+            CAST(char, n), 0, 0};
+        return id + std::string(h, 6) + body;
+    };
+    std::string body = unsync(v23_frame("TXXX", std::string("\x00\xFF\xFF\x00\xFF", 5))
+        + v23_frame("APIC", apic));
+    body.resize(body.size() + 100, '\0');
+    unsigned char h[10] = {'I', 'D', '3', 3, 0, 0x80, 0, 0, 0, 0};
+    detail::encode_syncsafe(CAST(uint32_t, body.size()), h + 6);
+    write(std::string(reinterpret_cast<char*>(h), 10) + body);
+    assert(find_id3v2_pictures(copy, pics) == 0 && pics.size() == 1);
+    assert(pics[0].unsynchronised && pics[0].mime == "image/png" && pics[0].type == 3);
+    assert(read_id3v2_picture(copy, pics[0], got) == 0 && got == image);
+    found += CAST(int, pics.size());
+
+    // v2.2: PIC, with a 3 letter format
+    const std::string pic = std::string("\x00JPG\x00\x00", 6) + image;
+    const uint32_t n = CAST(uint32_t, pic.size());
+    body = "PIC" + std::string{CAST(char, n >> 16), CAST(char, n >> 8), CAST(char, n)};
+    body += pic;
+    const unsigned char h22[10] = {'I', 'D', '3', 2, 0, 0, 0, 0, 0, 0};
+    std::string tag(reinterpret_cast<const char*>(h22), 10);
+    detail::encode_syncsafe(
+        CAST(uint32_t, body.size()), reinterpret_cast<unsigned char*>(&tag[6]));
+    write(tag + body);
+    assert(find_id3v2_pictures(copy, pics) == 0 && pics.size() == 1);
+    assert(pics[0].mime == "image/jpeg" && pics[0].type == 0 && !pics[0].unsynchronised);
+    assert(read_id3v2_picture(copy, pics[0], got) == 0 && got == image);
+    assert(pics[0].offset == 10 + 6 + 6 && pics[0].length == CAST(int64_t, image.size()));
+    found += CAST(int, pics.size());
+
+    // and a file with no pictures, or no tag
+    assert(find_id3v2_pictures(path, pics) == 0 && pics.empty());
+    write(std::string());
+    assert(find_id3v2_pictures(copy, pics) == 0 && pics.empty());
+    ::unlink(copy.c_str());
+    CAST(void, length);
+    cout << "test_id3v2_pictures: " << found << " pictures of " << image.size()
+         << " bytes found in 4 kinds of tag" << endl;
+}
+#endif
+
+// A saved index brought up to date after the file was added to must say what
+// a full parse says, having walked only what was added; if the part that was
+// indexed changed, it must notice and walk it all.
+void test_frame_index(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = slurp_file(path);
+    const std::string file = path + ".index-test";
+    const std::string saved = file + ".idx";
+    auto write = [&](const std::string& bytes, std::ios_base::openmode mode) {
+        fstream out(file, std::ios_base::binary | std::ios_base::out | mode);
+        out.write(bytes.data(), CAST(std::streamsize, bytes.size()));
+    };
+    auto check = [&](const saved_index& idx, const std::string& bytes) {
+        parser whole(file, bytes.size());
+        whole.index_frames(true);
+        whole.parse(byte_span(bytes.data(), bytes.size()));
+        const parse_summary want = whole.summary();
+        const parse_summary& got = idx.summary;
+        assert(got.file_size == want.file_size && got.nframes == want.nframes);
+        assert(got.total_samples == want.total_samples
+            && got.first_frame == want.first_frame);
+        assert(std::fabs(got.duration_ms - want.duration_ms) < 0.001);
+        assert(got.ngaps == want.ngaps && got.gap_bytes == want.gap_bytes
+            && got.vbr == want.vbr);
+        assert(got.id3v2_size == want.id3v2_size && got.id3v1 == want.id3v1
+            && got.ape_size == want.ape_size);
+        assert(idx.frames.size() == whole.frame_index().size());
+        for (size_t i = 0; i < idx.frames.size(); ++i) {
+            assert(idx.frames[i].offset == whole.frame_index()[i].offset
+                && idx.frames[i].length == whole.frame_index()[i].length);
+        }
+    };
+
+    write(data, std::ios_base::trunc);
+    saved_index idx;
+    int64_t from = -1;
+    assert(!index_file(file, idx, &from));
+    assert(from == idx.summary.id3v2_size && !idx.frames.empty());
+    check(idx, data);
+    assert(save_index(saved, idx) == 0);
+    const saved_index first = idx;
+    idx = saved_index();
+    assert(load_index(saved, idx) == 0);
+    assert(idx.frames.size() == first.frames.size() && idx.tail_hash == first.tail_hash
+        && idx.summary.nframes == first.summary.nframes);
+    // a byte too many, fewer than a frame_entry, is not the index that was saved
+    fstream(saved, std::ios_base::out | std::ios_base::binary | std::ios_base::app) << 'x';
+    assert(load_index(saved, idx) == EINVAL && idx.frames.empty());
+    idx = first;
+
+    // another take appended: its tags and all
+    write(data, std::ios_base::app);
+    const std::string twice = data + data;
+    assert(!index_file(file, idx, &from));
+    assert(from == first.end());
+    check(idx, twice);
+    // what was added, and the old tags now before it
+    const int64_t walked = CAST(int64_t, twice.size()) - from;
+    assert(walked == CAST(int64_t, data.size()) + first.summary.file_size - first.end());
+    const int64_t after = idx.summary.nframes;
+
+    // the indexed part changed: walk it all again
+    idx = first;
+    std::string changed = twice;
+    changed[CAST(size_t, first.frames.back().offset + 10)] ^= 0x5A;
+    write(changed, std::ios_base::trunc);
+    assert(!index_file(file, idx, &from));
+    assert(from == idx.summary.id3v2_size);
+    check(idx, changed);
+
+    // and so if it got shorter
+    idx = first;
+    const std::string shorter = data.substr(0, data.size() / 2);
+    write(shorter, std::ios_base::trunc);
+    assert(!index_file(file, idx, &from));
+    assert(from == idx.summary.id3v2_size);
+    check(idx, shorter);
+
+    // damaged audio: the index must step over the junk just where the walk does
+    idx = first;
+    const std::string damaged = damaged_audio(data);
+    write(damaged, std::ios_base::trunc);
+    assert(!index_file(file, idx, &from));
+    assert(from == idx.summary.id3v2_size && idx.summary.ngaps >= 2);
+    check(idx, damaged);
+    // and junk three frames from the end, where the chain runs into the tags
+    const size_t late = CAST(size_t, first.frames[first.frames.size() - 3].offset);
+    const std::string late_junk
+        = data.substr(0, late) + std::string("\xFF\xFB\x90\x00junk", 8) + data.substr(late);
+    write(late_junk, std::ios_base::trunc);
+    assert(!index_file(file, idx, &from));
+    check(idx, late_junk);
+
+    // not a saved index
+    write(data, std::ios_base::trunc);
+    assert(load_index(file, idx) == EINVAL && idx.frames.empty());
+    ::remove(file.c_str());
+    ::remove(saved.c_str());
+    CAST(void, walked);
+    cout << "test_frame_index: " << first.summary.nframes << " frames kept, " << after
+         << " after an append of " << data.size()
+         << " bytes, walking " << walked << endl;
+}
+
+// Entries must survive a reopen, go stale when the file's size or mtime
+// changes, and a log cut short mid-record must lose only that record.
+void test_scan_cache(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = slurp_file(path);
+    const std::string file = path + ".cache-test";
+    const std::string log = file + ".log";
+    fstream(file, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+        .write(data.data(), CAST(std::streamsize, data.size()));
+    ::remove(log.c_str());
+
+    parser p(file, data.size());
+    p.parse(byte_span(data.data(), data.size()));
+    const parse_summary want = p.summary();
+    auto same = [&](const parse_summary* got) {
+        return got != nullptr && memcmp(got, &want, sizeof(want)) == 0;
+    };
+    file_key key;
+    {
+        scan_cache cache(log);
+        assert(cache.open() == 0 && cache.size() == 0);
+        assert(cache.find(file, key) == nullptr && key.size == CAST(int64_t, data.size()));
+        assert(cache.put(file, key, want) == 0);
+        assert(cache.find(path, key) == nullptr);
+        assert(cache.put(path, key, want) == 0);
+    }
+
+    // round trip
+    {
+        scan_cache cache(log);
+        assert(cache.open() == 0 && cache.size() == 2);
+        assert(same(cache.find(file, key)) && same(cache.find(path, key)));
+        assert(cache.hits() == 2 && cache.misses() == 0);
+    }
+
+    // stale: an older mtime, then a byte more
+    {
+        scan_cache cache(log);
+        assert(cache.open() == 0);
+        struct timespec times[2];
+        times[0].tv_sec = times[1].tv_sec = key.mtime_ns / 1000000000LL - 60;
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        assert(::utimensat(AT_FDCWD, file.c_str(), times, 0) == 0);
+        assert(cache.find(file, key) == nullptr);
+        assert(cache.put(file, key, want) == 0);
+        assert(same(cache.find(file, key)));
+        fstream(file, std::ios_base::out | std::ios_base::binary | std::ios_base::app)
+            << 'x';
+        assert(cache.find(file, key) == nullptr);
+        assert(key.size == CAST(int64_t, data.size()) + 1);
+        assert(cache.put(file, key, want) == 0);
+    }
+
+    // a torn append: the last record (file's) cut short
+    const uintmax_t whole = my::fs::file_size(log);
+    assert(::truncate(log.c_str(), CAST(off_t, whole - 10)) == 0);
+    {
+        scan_cache cache(log);
+        assert(cache.open() == 0 && cache.size() == 2);
+        assert(same(cache.find(path, key)));
+        // what the record before it said: stale
+        assert(cache.find(file, key) == nullptr);
+        assert(cache.put(file, key, want) == 0);
+    }
+    // rewritten, not appended after the torn record
+    {
+        scan_cache cache(log);
+        assert(cache.open() == 0 && cache.size() == 2);
+        assert(same(cache.find(file, key)) && same(cache.find(path, key)));
+    }
+    cout << "test_scan_cache: " << whole << " byte log, cut short by 10 bytes, "
+         << my::fs::file_size(log) << " after the rewrite" << endl;
+    ::remove(log.c_str());
+    ::remove(file.c_str());
+}
+
+// The level read from the bitstream must follow the decoder's, and find a
+// stretch of silence to the sample; Layer I and II levels must be what their
+// scale factors say.
+void test_level(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = slurp_file(path);
+    parser first(path, data.size());
+    first.index_frames(true);
+    first.parse(byte_span(data.data(), data.size()));
+    const frame_entry& f0 = first.frame_index()[0];
+    const parse_summary s = first.summary();
+    const std::string audio = data.substr(CAST(size_t, s.first_frame),
+        CAST(size_t, s.file_size - (s.id3v1 ? 128 : 0) - s.first_frame));
+
+    // a second and a half of silent frames, then the audio
+    const int nsilent = 60;
+    std::string silent(CAST(size_t, f0.length - f0.padding), '\0');
+    memcpy(&silent[0], audio.data(), 4);
+    silent[2] = CAST(char, silent[2] & ~0x02); // no padding
+    silent[1] = CAST(char, silent[1] | 0x01); // no CRC
+    std::string stream;
+    for (int i = 0; i < nsilent; ++i) {
+        stream += silent;
+    }
+    stream += audio;
+
+    // the clip starts at -77 dB, and its last two frames are silent too (too
+    // short to count)
+    level_meter meter(-80.0f, 500);
+    const int spf = f0.samples;
+    layer3_decoder dec;
+    std::unique_ptr<layer3_decoder::pcm_type[]> pcm(new layer3_decoder::pcm_type[1]);
+    double err = 0;
+    int compared = 0;
+    int zero_frames = 0; // that the decoder made nothing but zeros of
+    parser p(path, stream.size());
+    p.on_frame([&](const frame& f) {
+        const int64_t at = meter.samples();
+        const float est = meter.add(f);
+        const int n = dec.decode(f, pcm[0]);
+        double loudest = 0;
+        for (int ch = 0; ch < dec.channels(); ++ch) {
+            double e = 0;
+            for (int i = 0; i < n; ++i) {
+                e += pcm[0][ch][i] * pcm[0][ch][i];
+            }
+            loudest = (std::max)(loudest, e / n);
+        }
+        zero_frames += loudest == 0 ? 1 : 0;
+        // not the clip's first two frames: the decoder has yet to fill its
+        // bit reservoir and overlap
+        if (est > LEVEL_SILENT && loudest > 0 && at >= (nsilent + 2) * spf) {
+            err += std::fabs(est - 10 * std::log10(loudest));
+            ++compared;
+        }
+    });
+    p.parse(byte_span(stream.data(), stream.size()));
+    meter.finish();
+    assert(meter.samples() == p.summary().total_samples);
+    assert(meter.runs().size() == 1);
+    const level_run& run = meter.runs()[0];
+    assert(run.silent() && run.start_sample == 0 && run.end_sample == nsilent * spf);
+    CAST(void, run);
+    // the decoder agrees: silence, and about the same level elsewhere
+    assert(zero_frames >= nsilent);
+    assert(compared > 30 && err / compared < 8.0);
+
+    // Layer II, mono, 44.1 kHz, 192 kbps: subband 0 only, one scale factor
+    // for all three parts; then nothing allocated. And the same in Layer I
+    // (384 kbps).
+    auto put_bits = [](std::string& f, int& bit, int n, unsigned v) {
+        for (int i = n - 1; i >= 0; --i, ++bit) {
+            if ((v >> i) & 1) {
+                char& c = f[CAST(size_t, bit >> 3)];
+                c = CAST(char, c | (0x80 >> (bit & 7)));
+            }
+        }
+    };
+    for (const int layer : {2, 1}) {
+        const int sf = 9; // 2 * 2^-3: -12 dB peak, -15 dB as a sine's power
+        const size_t len = layer == 2 ? 626 : 416;
+        const unsigned char head[4] = {0xFF, CAST(unsigned char, layer == 2 ? 0xFD : 0xFF),
+            CAST(unsigned char, layer == 2 ? 0xA0 : 0xC0), 0xC0};
+        std::string loud(len, '\0'), quiet(len, '\0');
+        memcpy(&loud[0], head, 4);
+        memcpy(&quiet[0], head, 4);
+        int bit = 32;
+        put_bits(loud, bit, 4, 1); // subband 0
+        if (layer == 2) {
+            bit += 10 * 4 + 12 * 3 + 7 * 2; // the rest of table B.2b
+            put_bits(loud, bit, 2, 2); // scfsi: one for all
+        } else {
+            bit += 31 * 4;
+        }
+        put_bits(loud, bit, 6, sf);
+        std::string frames;
+        for (int i = 0; i < 40; ++i) {
+            frames += i < 25 ? loud : quiet;
+        }
+        level_meter m12(-60.0f, 100);
+        float loud_db = 0; // of the first frame
+        parser p12(path, frames.size());
+        p12.on_frame([&](const frame& f) {
+            const bool first_frame = m12.samples() == 0;
+            const float db = m12.add(f);
+            loud_db = first_frame ? db : loud_db;
+        });
+        p12.parse(byte_span(frames.data(), frames.size()));
+        m12.finish();
+        const int n = layer == 2 ? 1152 : 384;
+        assert(std::fabs(loud_db - (6.0206f - 2.0069f * sf - 3.0103f)) < 0.01f);
+        assert(m12.runs().size() == 1 && m12.runs()[0].silent());
+        assert(m12.runs()[0].start_sample == 25 * n && m12.runs()[0].end_sample == 40 * n);
+        CAST(void, n);
+    }
+    cout << "test_level: " << run.end_sample << " silent samples found, "
+         << err / compared << " dB from the decoder on average" << endl;
+}
+
+#ifdef __linux__
+// The parallel walker must find what files_finder finds, whichever thread
+// gets which directory.
+void test_dir_walker(const std::string& path) {
+    const std::string root = path + ".walk-test";
+    my::fs::remove_all(root);
+    int want = 0;
+    for (int i = 0; i < 6; ++i) {
+        for (int j = 0; j < 5; ++j) {
+            const std::string dir
+                = root + "/d" + std::to_string(i) + "/e" + std::to_string(j) + "/f";
+            my::fs::create_directories(dir);
+            for (const char* name : {"/a.mp3", "/B.MP3", "/c.txt", "/mp3"}) {
+                fstream(dir + name, std::ios_base::out);
+            }
+            want += 2;
+        }
+    }
+    my::fs::create_symlink(my::fs::absolute(root + "/d0/e0/f/a.mp3"), root + "/link.mp3");
+    my::fs::create_directory_symlink(my::fs::absolute(root + "/d0"), root + "/linkdir");
+    ++want; // the link to a file, not the files behind the link to a directory
+
+    int found = 0;
+    my::files_finder finder(root, true);
+    finder.start([&](const auto&, const std::string&, const std::string& extn) {
+        found += (extn == ".mp3" || extn == ".MP3") ? 1 : 0;
+        return 0;
+    });
+    assert(found == want);
+
+    std::vector<std::string> paths;
+    my::dir_walker walker(root, ".mp3", 4, 7);
+    const int64_t n = walker.start([&](const my::dir_walker::batch_type& batch) {
+        assert(!batch.empty() && batch.size() <= 7);
+        paths.insert(paths.end(), batch.begin(), batch.end());
+        return 0;
+    });
+    assert(n == want && CAST(int, paths.size()) == want && walker.errors() == 0);
+    const int64_t ndirs = walker.dirs();
+    assert(ndirs == 1 + 6 + 6 * 5 * 2);
+    for (const auto& p : paths) {
+        assert(my::fs::is_regular_file(p));
+    }
+    // and stops when told to
+    int64_t seen = 0;
+    walker.start([&](const my::dir_walker::batch_type& batch) {
+        seen += CAST(int64_t, batch.size());
+        return 1;
+    });
+    assert(seen == walker.count() && seen <= 7);
+    my::fs::remove_all(root);
+    CAST(void, n);
+    cout << "test_dir_walker: " << paths.size() << " files in " << ndirs << " directories"
+         << endl;
+}
+
+// Files created, moved and deleted under a watched tree must come back as
+// deltas: a directory moved out takes its files with it, and after a queue
+// overflow, a file deleted while events were being lost is still reported.
+void test_library_watcher(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = slurp_file(path);
+    const std::string root = path + ".watch-test";
+    const std::string outside = path + ".watch-out";
+    my::fs::remove_all(root);
+    my::fs::remove_all(outside);
+    my::fs::create_directories(root + "/old");
+    auto put = [&](const std::string& p) {
+        fstream(p, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+            .write(data.data(), CAST(std::streamsize, data.size()));
+    };
+    put(root + "/old/there.mp3");
+
+    library_watcher watcher(root, ".mp3", 100);
+    assert(watcher.start() == 0);
+    assert(watcher.directories() == 2 && watcher.files() == 1);
+    std::vector<std::string> updated, removed;
+    // polls until there have been n deltas, or ms have gone by
+    auto wait_for = [&](size_t n, int ms = 10000) {
+        const auto until
+            = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        while (updated.size() + removed.size() < n
+            && std::chrono::steady_clock::now() < until) {
+            const int r = watcher.poll(50, [&](const library_delta& d) {
+                if (d.what == library_delta::kind::updated) {
+                    assert((!d.err || d.err == error::error_code::no_more_data)
+                        && d.summary.nframes > 0);
+                    updated.push_back(d.path.substr(root.size()));
+                } else {
+                    removed.push_back(d.path.substr(root.size()));
+                }
+            });
+            assert(r >= 0);
+            CAST(void, r);
+        }
+        return updated.size() + removed.size() == n;
+    };
+
+    put(root + "/a.mp3");
+    fstream(root + "/a.txt", std::ios_base::out) << "not wanted";
+    my::fs::create_directories(root + "/sub/deeper");
+    put(root + "/sub/deeper/b.mp3");
+    assert(wait_for(2));
+    std::sort(updated.begin(), updated.end());
+    assert(updated == (std::vector<std::string>{"/a.mp3", "/sub/deeper/b.mp3"}));
+    assert(watcher.directories() == 4 && watcher.files() == 3);
+
+    // renamed within the tree: gone from the old place, parsed in the new
+    updated.clear();
+    my::fs::rename(root + "/a.mp3", root + "/sub/a2.mp3");
+    assert(wait_for(2));
+    assert(removed == std::vector<std::string>{"/a.mp3"});
+    assert(updated == std::vector<std::string>{"/sub/a2.mp3"});
+
+    // out of the tree, with everything under it
+    updated.clear();
+    removed.clear();
+    my::fs::rename(root + "/sub", outside);
+    assert(wait_for(2));
+    std::sort(removed.begin(), removed.end());
+    assert(removed == (std::vector<std::string>{"/sub/a2.mp3", "/sub/deeper/b.mp3"}));
+    assert(watcher.directories() == 2 && watcher.files() == 1);
+    // and no longer watched: nothing is said of what happens there now
+    removed.clear();
+    put(outside + "/c.mp3");
+    assert(!wait_for(1, 300));
+
+    // deleted: but more events than the queue holds first, and only then the
+    // delete, so its event is lost; the rescan must notice
+    long queue_max = 16384;
+    fstream("/proc/sys/fs/inotify/max_queued_events", std::ios_base::in) >> queue_max;
+    {
+        // alternating names, or inotify merges them into one
+        fstream x(root + "/x.txt", std::ios_base::out);
+        fstream y(root + "/y.txt", std::ios_base::out);
+        for (long i = 0; i <= queue_max; ++i) {
+            (i & 1 ? x : y) << 'z' << std::flush;
+        }
+    }
+    my::fs::remove(root + "/old/there.mp3");
+    assert(wait_for(1));
+    assert(removed == std::vector<std::string>{"/old/there.mp3"});
+    assert(updated.empty() && watcher.files() == 0);
+
+    cout << "test_library_watcher: " << watcher.directories()
+         << " directories watched after a move out and a queue overflow of "
+         << queue_max << " events" << endl;
+    watcher.stop();
+    my::fs::remove_all(root);
+    my::fs::remove_all(outside);
+}
+
+// A walk feeding a slow consumer through a queue charged to a small budget
+// must pause, not pile the paths up, and give every byte back.
+void test_memory_budget(const std::string& path) {
+    const std::string root = path + ".budget-test";
+    my::fs::remove_all(root);
+    const int nsub = 8;
+    int want = 0;
+    for (int i = 0; i < nsub; ++i) {
+        for (int j = 0; j < nsub; ++j) {
+            const std::string dir
+                = root + "/d" + std::to_string(i) + "/e" + std::to_string(j);
+            my::fs::create_directories(dir);
+            for (int k = 0; k < 10; ++k) {
+                fstream(dir + "/track" + std::to_string(k) + ".mp3", std::ios_base::out);
+                ++want;
+            }
+        }
+    }
+
+    const int64_t limit = 4096;
+    my::memory_budget budget(limit);
+    std::mutex mx;
+    std::condition_variable cv;
+    std::deque<std::pair<std::string, int64_t>> queue; // and what it was charged
+    bool done = false;
+    int got = 0;
+    int64_t max_cost = 0;
+    std::thread consumer([&] {
+        std::unique_lock<std::mutex> lk(mx);
+        for (;;) {
+            cv.wait(lk, [&] { return done || !queue.empty(); });
+            if (queue.empty()) {
+                break;
+            }
+            const int64_t charged = queue.front().second;
+            queue.pop_front();
+            lk.unlock();
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            budget.release(charged);
+            lk.lock();
+            ++got;
+        }
+    });
+
+    my::dir_walker walker(root, ".mp3", 4, 3);
+    walker.budget(&budget);
+    const int64_t n = walker.start([&](const my::dir_walker::batch_type& batch) {
+        for (const auto& p : batch) {
+            const int64_t c = my::memory_budget::cost(p);
+            budget.acquire(c);
+            std::lock_guard<std::mutex> lk(mx);
+            max_cost = std::max(max_cost, c);
+            queue.emplace_back(p, c);
+            cv.notify_one();
+        }
+        return 0;
+    });
+    {
+        std::lock_guard<std::mutex> lk(mx);
+        done = true;
+    }
+    cv.notify_one();
+    consumer.join();
+
+    assert(n == want && got == want && walker.errors() == 0);
+    assert(budget.used() == 0 && budget.waits() > 0);
+    // over only by what the walk's threads charged at once for the
+    // subdirectories they found
+    assert(budget.peak() <= limit + 4 * (nsub + 1) * max_cost);
+    my::fs::remove_all(root);
+    CAST(void, n);
+    cout << "test_memory_budget: " << got << " files through a " << limit
+         << " byte budget, " << budget.peak() << " bytes held at most, "
+         << budget.waits() << " waits" << endl;
+}
+#endif
+
+#ifndef _WIN32
+// A stand-in Shoutcast server on loopback sends the test file's audio, four
+// times over, with a metadata block every 4000 bytes (a new title every third
+// one), in odd sized writes. Read without blocking, the demux must give back
+// exactly the audio and the title changes, and the framer every frame.
+void test_icy_stream(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = slurp_file(path);
+    parse_summary s;
+    parse_file(path, s);
+    const size_t from = CAST(size_t, s.first_frame);
+    const std::string once = data.substr(from, data.size() - (s.id3v1 ? 128 : 0) - from);
+    const std::string audio = once + once + once + once;
+
+    static constexpr int METAINT = 4000;
+    std::string stream = "ICY 200 OK\r\nicy-name: loopback\r\nicy-metaint: 4000\r\n\r\n";
+    std::vector<std::string> titles;
+    for (size_t at = 0, block = 0; at < audio.size(); at += METAINT, ++block) {
+        stream += audio.substr(at, METAINT);
+        if (at + METAINT >= audio.size()) {
+            break; // metadata only ever comes after a whole metaint of audio
+        }
+        if (block % 2 == 1) {
+            stream += '\0'; // no change
+            continue;
+        }
+        const std::string title = "Song " + std::to_string(block / 3);
+        if (titles.empty() || titles.back() != title) {
+            titles.push_back(title);
+        }
+        std::string meta = "StreamTitle='" + title + "';StreamUrl='';";
+        meta.resize((meta.size() + 15) / 16 * 16, '\0');
+        stream += CAST(char, meta.size() / 16);
+        stream += meta;
+    }
+
+    loopback_server server([&](int cfd) {
+        for (size_t at = 0, i = 0; at < stream.size(); ++i) {
+            const size_t n = (std::min)(stream.size() - at, 1 + (i * 397) % 1500);
+            const ssize_t w = ::write(cfd, stream.data() + at, n);
+            if (w <= 0) {
+                break;
+            }
+            at += CAST(size_t, w);
+        }
+    });
+    const int fd = server.connect();
+    assert(fd >= 0);
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    icy_demux demux;
+    stream_framer framer;
+    std::string got_audio;
+    std::vector<std::string> got_titles;
+    int64_t nframes = 0;
+    auto on_frame = [&](const frame& f) {
+        assert(f.is_view() && f.bytes()[0] == 0xFF);
+        CAST(void, f);
+        ++nframes;
+    };
+    auto on_audio = [&](byte_span a) {
+        got_audio.append(reinterpret_cast<const char*>(a.data()), a.size());
+        framer.feed(a, on_frame);
+    };
+    auto on_meta = [&](const icy_metadata& md) { got_titles.push_back(md.title); };
+    char buf[2048];
+    int eagains = 0;
+    while (true) {
+        const int64_t got = demux.read_some(fd, buf, sizeof(buf), on_audio, on_meta);
+        if (got == -EAGAIN) {
+            ++eagains;
+            pollfd pfd{fd, POLLIN, 0};
+            ::poll(&pfd, 1, 5000);
+            continue;
+        }
+        assert(got >= 0);
+        if (got <= 0) {
+            break;
+        }
+    }
+    server.stop();
+    ::close(fd);
+
+    parser p(path, 0);
+    p.parse(byte_span(audio.data(), audio.size()));
+    assert(demux.headers().metaint == METAINT && demux.headers().name == "loopback");
+    assert(got_audio == audio && got_titles == titles);
+    assert(nframes == framer.frames() && nframes == p.summary().nframes);
+    assert(framer.junk_bytes() == 0);
+    cout << "test_icy_stream: " << nframes << " frames, " << got_titles.size()
+         << " titles, " << demux.meta_bytes() << " metadata bytes dropped, "
+         << framer.copied_bytes() << " bytes copied at read edges" << endl;
+}
+
+// A stand-in HTTP server on loopback serves the test file's audio thirty times
+// over, as is and with a Xing header written into its first frame. Parsed a
+// range at a time, the tags and the format must come out as a whole parse has
+// them, the frame count from the bitrate (or the Xing header), and only the
+// head, the first frames and the tail may be fetched.
+void test_sparse_parse(const std::string& path) {
+    using namespace my::mpeg;
+    {
+        const auto v = coalesce({{100, 10}, {0, 10}, {20, 5}, {5, 10}}, 16);
+        assert(v.size() == 2 && v[0].offset == 0 && v[0].length == 25);
+        assert(v[1].offset == 100 && v[1].length == 10);
+        sparse_store st;
+        st.add(10, "0123456789");
+        st.add(30, "abc");
+        st.add(18, "xyz12345678901");
+        const auto m = st.missing({{0, 40}});
+        assert(m.size() == 2 && m[0].offset == 0 && m[0].length == 10);
+        assert(m[1].offset == 33 && m[1].length == 7);
+        int64_t avail = 0;
+        const char* b = st.at(17, avail);
+        assert(avail == 16 && memcmp(b, "7xyz", 4) == 0 && st.at(33, avail) == nullptr);
+        CAST(void, v);
+        CAST(void, b);
+    }
+
+    const std::string data = slurp_file(path);
+    parse_summary one;
+    parse_file(path, one);
+    const size_t audio_from = CAST(size_t, one.first_frame);
+    std::string files[2];
+    files[0] = repeat_audio(data, one, 30);
+    files[1] = files[0];
+    const char xing[12] = {'X', 'i', 'n', 'g', 0, 0, 0, 1, 0, 0, 3, CAST(char, 0xE8)};
+    files[1].replace(audio_from + detail::xing_offset(one.version, one.channelmode),
+        sizeof(xing), xing, sizeof(xing));
+
+    std::atomic<int64_t> served{0};
+    loopback_server server([&](int cfd) {
+        std::string rx;
+        char buf[4096];
+        while (true) {
+            const size_t end = rx.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                const ssize_t got = ::read(cfd, buf, sizeof(buf));
+                if (got <= 0) {
+                    break;
+                }
+                rx.append(buf, CAST(size_t, got));
+                continue;
+            }
+            const std::string req = rx.substr(0, end);
+            rx.erase(0, end + 4);
+            const bool head = req.compare(0, 5, "HEAD ") == 0;
+            const size_t sp = req.find(' ');
+            const std::string target = req.substr(sp + 1, req.find(' ', sp + 1) - sp - 1);
+            // skewed.mp3: long.mp3, but each range said to start a byte on
+            const int skew = target == "/skewed.mp3" ? 1 : 0;
+            const std::string* file = target == "/long.mp3" || skew ? &files[0]
+                : target == "/xing.mp3"                             ? &files[1]
+                                                                    : nullptr;
+            std::string reply;
+            if (file == nullptr) {
+                reply = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+            } else if (head) {
+                reply = "HTTP/1.1 200 OK\r\nContent-Length: "
+                    + std::to_string(file->size()) + "\r\n\r\n";
+            } else {
+                const size_t r = req.find("Range: bytes=");
+                assert(r != std::string::npos);
+                char* dash = nullptr;
+                const auto from = strtoull(req.c_str() + r + 13, &dash, 10);
+                const auto to = (std::min)(CAST(unsigned long long, file->size() - 1),
+                    strtoull(dash + 1, nullptr, 10));
+                const std::string body = file->substr(from, to - from + 1);
+                served += CAST(int64_t, body.size());
+                reply = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes "
+                    + std::to_string(from + skew) + "-" + std::to_string(to + skew) + "/"
+                    + std::to_string(file->size()) + "\r\nContent-Length: "
+                    + std::to_string(body.size()) + "\r\n\r\n" + body;
+            }
+            const ssize_t w = ::write(cfd, reply.data(), reply.size());
+            if (w != CAST(ssize_t, reply.size())) {
+                break;
+            }
+        }
+    });
+
+    const std::string url = server.url();
+    parse_summary whole;
+    {
+        parser p(path, files[0].size());
+        p.parse(byte_span(files[0].data(), files[0].size()));
+        whole = p.summary();
+    }
+    sparse_result got[2];
+    for (int i = 0; i < 2; ++i) {
+        http_ranges src(url + (i ? "/xing.mp3" : "/long.mp3"));
+        const auto e = parse_sparse(path, src, got[i]);
+        assert(!e);
+        const auto& s = got[i].summary;
+        assert(s.first_frame == whole.first_frame && s.id3v2_size == whole.id3v2_size);
+        assert(s.id3v1 == whole.id3v1 && s.ape_size == whole.ape_size);
+        assert(s.version == whole.version && s.layer == whole.layer);
+        assert(s.samplerate == whole.samplerate && s.bitrate == whole.bitrate);
+        assert(got[i].frames_walked == detail::SPARSE_WALK_FRAMES);
+        CAST(void, e);
+        CAST(void, s);
+    }
+    // no Xing header: from the bitrate, near enough
+    assert(got[0].counted == sparse_result::count_from::bitrate);
+    assert(std::abs(got[0].summary.nframes - whole.nframes) <= 1);
+    assert(std::abs(got[0].summary.duration_ms - whole.duration_ms) < 30);
+    // the tag says 1000 audio frames, and there is the Xing frame itself
+    assert(got[1].counted == sparse_result::count_from::info_header);
+    assert(got[1].summary.nframes == 1001 && got[1].summary.vbr == 1);
+    // the head, the tail, then the first frames where the ID3v2 tag ends
+    assert(got[0].rounds == 2 && got[0].requests == 3);
+    assert(got[0].bytes_fetched + got[1].bytes_fetched == served);
+    assert(got[0].bytes_fetched < 16 * 1024);
+    {
+        http_ranges src(url + "/none.mp3");
+        sparse_result r;
+        const auto e = parse_sparse(path, src, r);
+        assert(e.to_int() == -ENOENT);
+        CAST(void, e);
+    }
+    {
+        http_ranges src(url + "/skewed.mp3");
+        sparse_result r;
+        const auto e = parse_sparse(path, src, r);
+        assert(e.to_int() == -EPROTO && r.requests == 1);
+        CAST(void, e);
+    }
+    {
+        // the brackets are the URL's, not the name's: ::1 is looked up (and
+        // refused: the server is IPv4 only)
+        http_ranges src("http://[::1]:" + url.substr(url.rfind(':') + 1) + "/long.mp3");
+        assert(src.url_ok());
+        const int64_t e = src.size();
+        assert(e < 0 && e != -EHOSTUNREACH);
+        CAST(void, e);
+    }
+    server.stop();
+
+    // and a local file fetches just the same
+    const std::string local = path + ".sparse-test";
+    {
+        fstream out(local.c_str(), std::ios_base::binary | std::ios_base::out);
+        out.write(files[0].data(), CAST(std::streamsize, files[0].size()));
+    }
+    sparse_result lr;
+    {
+        file_ranges src(local);
+        parse_sparse(local, src, lr);
+    }
+    my::fs::remove(local);
+    assert(lr.bytes_fetched == got[0].bytes_fetched
+        && lr.summary.nframes == got[0].summary.nframes);
+    cout << "test_sparse_parse: " << got[0].summary.nframes << " frames ("
+         << whole.nframes << " walked in full), " << got[0].bytes_fetched << " of "
+         << files[0].size() << " bytes in " << got[0].requests << " requests, "
+         << got[0].rounds << " rounds" << endl;
+}
+
+// Runs the mpegscan binary (MPEGSCAN, else ./mpegscan; skipped when there is
+// none) on the test files: a line per mp3 with every column, in JSON and in
+// CSV, however little memory it is given; exit status 1 for a missing path,
+// 2 for bad usage.
+void test_mpegscan(const std::string& path) {
+    const char* const env = getenv("MPEGSCAN");
+    const std::string exe = env != nullptr ? env : "./mpegscan";
+    if (!my::fs::exists(exe)) {
+        cout << "test_mpegscan: skipped, no " << exe << " (set MPEGSCAN)" << endl;
+        return;
+    }
+    const std::string dir = my::fs::path(path).parent_path().string();
+    size_t nmp3 = 0;
+    for (const auto& de : my::fs::directory_iterator(dir)) {
+        nmp3 += de.path().extension() == ".mp3" ? 1 : 0;
+    }
+    // what it wrote, one string a line; status: its exit status
+    auto run = [&](const std::string& args, int& status) {
+        std::vector<std::string> lines;
+        FILE* p = ::popen(("'" + exe + "' -j 2 " + args + " 2>/dev/null").c_str(), "r");
+        assert(p != nullptr);
+        std::string line;
+        char buf[4096];
+        while (fgets(buf, sizeof(buf), p) != nullptr) {
+            line += buf;
+            if (line.back() == '\n') {
+                line.pop_back();
+                lines.push_back(line);
+                line.clear();
+            }
+        }
+        const int st = ::pclose(p);
+        status = WIFEXITED(st) ? WEXITSTATUS(st) : -1;
+        return lines;
+    };
+    static const char* const columns[] = {"path", "size", "ok", "error", "error_text",
+        "error_offset", "duration_ms", "version", "layer", "samplerate", "bitrate_kbps",
+        "channel_mode", "vbr", "frames", "samples", "first_frame", "id3v2_size", "id3v1",
+        "ape_size", "gaps", "gap_bytes", "audio_hash", "parse_us"};
+    const size_t ncolumns = sizeof(columns) / sizeof(columns[0]);
+    auto json_ok = [&](const std::string& line) {
+        if (line.front() != '{' || line.back() != '}'
+            || line.find("\"ok\":true") == std::string::npos) {
+            return false;
+        }
+        // every column, in order
+        size_t at = 0;
+        for (const char* c : columns) {
+            at = line.find(std::string(at == 0 ? "{\"" : ",\"") + c + "\":", at);
+            if (at == std::string::npos) {
+                return false;
+            }
+            ++at;
+        }
+        return true;
+    };
+    // fields, outside quotes
+    auto csv_fields = [](const std::string& line) {
+        size_t n = 1;
+        bool quoted = false;
+        for (const char c : line) {
+            if (c == '"') {
+                quoted = !quoted;
+            } else if (c == ',' && !quoted) {
+                ++n;
+            }
+        }
+        return n;
+    };
+
+    const std::string quoted_dir = "'" + dir + "'";
+    int status = -1;
+    auto lines = run(quoted_dir, status);
+    assert(status == 0 && lines.size() == nmp3);
+    for (const auto& l : lines) {
+        assert(json_ok(l));
+    }
+    lines = run("--fingerprint --mem 1 " + quoted_dir, status);
+    assert(status == 0 && lines.size() == nmp3);
+    for (const auto& l : lines) {
+        assert(json_ok(l) && l.find("\"audio_hash\":\"\"") == std::string::npos);
+    }
+    lines = run("--csv " + quoted_dir, status);
+    assert(status == 0 && lines.size() == nmp3 + 1);
+    std::string header;
+    for (const char* c : columns) {
+        header += (header.empty() ? "" : ",") + std::string(c);
+    }
+    assert(lines[0] == header);
+    for (size_t i = 1; i < lines.size(); ++i) {
+        assert(csv_fields(lines[i]) == ncolumns && lines[i].find(",1,0,") != std::string::npos);
+    }
+
+    // a path that isn't there still gets its line, and fails the run
+    lines = run("'" + path + ".not-there' '" + path + "'", status);
+    assert(status == 1 && lines.size() == 2);
+    // a second run with a cache parses nothing (parse_us is 0), and says the same
+    const std::string cache = path + ".scan-cache-test";
+    ::remove(cache.c_str());
+    const std::string cached_run = "--cache '" + cache + "' " + quoted_dir;
+    auto first = run(cached_run, status);
+    assert(status == 0 && first.size() == nmp3);
+    auto again = run(cached_run, status);
+    assert(status == 0 && again.size() == nmp3);
+    for (auto* v : {&first, &again}) {
+        for (auto& l : *v) {
+            const size_t us = l.rfind(",\"parse_us\":");
+            assert(v == &first || l.compare(us, l.npos, ",\"parse_us\":0}") == 0);
+            l.resize(us);
+        }
+        std::sort(v->begin(), v->end());
+    }
+    assert(first == again);
+    ::remove(cache.c_str());
+
+    // no frames at all: not a good mp3, whatever it is called
+    const std::string junk = path + ".junk-test";
+    {
+        fstream out(junk, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        for (int i = 0; i < 2700; ++i) {
+            out << "not audio ";
+        }
+    }
+    lines = run("'" + junk + "'", status);
+    assert(status == 1 && lines.size() == 1);
+    assert(lines[0].find("\"ok\":false,\"error\":16,") != std::string::npos);
+    lines = run("--csv '" + junk + "'", status);
+    assert(status == 1 && lines.size() == 2 && lines[1].find(",0,16,") != std::string::npos);
+    ::remove(junk.c_str());
+    lines = run("--block 1 " + quoted_dir, status);
+    assert(status == 2 && lines.empty());
+    CAST(void, ncolumns);
+    cout << "test_mpegscan: " << nmp3
+         << " files, as JSON and CSV, with a 1 MB cap, and from a cache" << endl;
+}
+#endif
+
+#if defined(MY_MPEG_ASYNC) && !defined(_WIN32)
+// Hundreds of parses in flight on this one thread, half of them on a file with
+// junk (tags) between its runs of frames: each must come out as parse_file()
+// has it, through io_uring (where the kernel lets us) and through pread.
+void test_async_parse(const std::string& path) {
+    using namespace my::mpeg;
+    const std::string data = slurp_file(path);
+    const std::string big_path = path + ".async-test";
+    {
+        fstream out(big_path.c_str(), std::ios_base::binary | std::ios_base::out);
+        for (int i = 0; i < 10; ++i) {
+            out.write(data.data(), CAST(std::streamsize, data.size()));
+        }
+    }
+    const std::string paths[2] = {path, big_path};
+    parse_summary want[2];
+    int fds[2];
+    int64_t sizes[2];
+    for (int i = 0; i < 2; ++i) {
+        parse_file(paths[i], want[i], true);
+        fds[i] = ::open(paths[i].c_str(), O_RDONLY);
+        sizes[i] = want[i].file_size;
+        assert(fds[i] >= 0);
+    }
+    assert(want[1].ngaps == 9);
+
+    static constexpr int IN_FLIGHT = 400;
+    auto check = [&](auto& loop, const char* name) {
+        std::vector<parse_summary> got(IN_FLIGHT);
+        std::vector<int64_t> frames(IN_FLIGHT, 0);
+        std::vector<async::task<error>> tasks;
+        tasks.reserve(IN_FLIGHT);
+        for (int i = 0; i < IN_FLIGHT; ++i) {
+            const int which = i % 2;
+            const int fd = fds[which];
+            auto read = [&loop, fd](int64_t off, char* into, int n) {
+                return loop.read(fd, off, into, n);
+            };
+            int64_t& nf = frames[CAST(size_t, i)];
+            tasks.push_back(async::parse_async(sizes[which], read, got[CAST(size_t, i)],
+                [&nf](const frame&) { ++nf; }, true, 4096 << which));
+            tasks.back().start();
+        }
+        const int rc = loop.run();
+        assert(rc == 0);
+        for (int i = 0; i < IN_FLIGHT; ++i) {
+            const auto& w = want[i % 2];
+            const auto& g = got[CAST(size_t, i)];
+            assert(tasks[CAST(size_t, i)].done() && !tasks[CAST(size_t, i)].result());
+            assert(g.nframes == w.nframes && frames[CAST(size_t, i)] == w.nframes);
+            assert(g.total_samples == w.total_samples && g.first_frame == w.first_frame);
+            assert(g.id3v2_size == w.id3v2_size && g.id3v1 == w.id3v1);
+            assert(g.ape_size == w.ape_size && g.vbr == w.vbr);
+            assert(g.ngaps == w.ngaps && g.gap_bytes == w.gap_bytes);
+            assert(g.audio_hash == w.audio_hash && g.bitrate == w.bitrate);
+            assert(std::abs(g.duration_ms - w.duration_ms) < 0.001);
+            CAST(void, w);
+            CAST(void, g);
+        }
+        CAST(void, rc);
+        cout << "test_async_parse: " << IN_FLIGHT << " files in flight on one thread, "
+             << loop.reads() << " reads through " << name << endl;
+    };
+#ifdef MY_MPEG_URING
+    async::uring_loop ring;
+    if (ring.ok()) {
+        check(ring, "io_uring");
+    }
+#endif
+    async::pread_loop plain;
+    check(plain, "pread");
+    for (const int fd : fds) {
+        ::close(fd);
+    }
+    my::fs::remove(big_path);
+}
+#endif
+
 #ifdef _MSC_VER
 #pragma warning(disable : 26485) // no decaying arrays
 #endif
 
-int main(int /*unused*/, const char* const argv[]) {
+int main(int argc, const char* const argv[]) {
 
     assert(argv);
 #ifdef _WIN32
@@ -272,12 +2399,69 @@ int main(int /*unused*/, const char* const argv[]) {
         assert("File open error." == nullptr);
         return -1;
     }
-    const auto e = parse_mp3(path, file, file_size);
+    my::mpeg::parse_summary summary;
+    my::mpeg::frame_stats stats;
+    const auto e = parse_mp3(path, file, file_size, &summary, &stats);
     assert(e == my::mpeg::error::error_code::no_more_data
         || e == my::mpeg::error::error_code::noerror);
+    {
+        // the histograms must account for every frame
+        int64_t hist = 0;
+        for (const auto n : stats.bitrate_hist) {
+            hist += n;
+        }
+        assert(stats.nframes == summary.nframes && hist == stats.nframes);
+        assert(stats.min_kbps <= summary.bitrate / 1000
+            && stats.max_kbps >= summary.bitrate / 1000);
+        assert(stats.by_version_layer[summary.version - 1][summary.layer - 1]
+            == stats.nframes);
+        my::mpeg::frame_stats twice = stats;
+        twice.merge(stats);
+        assert(twice.nframes == 2 * stats.nframes && twice.files == 2);
+        CAST(void, hist);
+        cout << "frame stats: " << stats.nframes << " frames, " << stats.min_kbps << " - "
+             << stats.max_kbps << " kbps, " << stats.padding_ratio() * 100.0
+             << "% padded, " << stats.mode_changes << " channel mode changes" << endl;
+    }
 
     // test_file_read(path);
+    test_resync(path);
+    bench_decode(path);
+    test_layer3_intensity();
+    test_c_api(path, summary);
+    test_frame_columns(path);
+    test_known_signature(path);
+    test_span_parse(path);
+    test_bad_input(path);
+    test_block_reader(path);
+    test_huge_stream();
+    test_timeline();
+    test_frame_index(path);
+    test_level(path);
+#ifndef _WIN32
+    test_follow(path);
+    test_scan_cache(path);
+    test_id3v2_write(path);
+    test_id3v2_pictures(path);
+    test_dedupe(path);
+#endif
+#ifdef __linux__
+    test_dir_walker(path);
+    test_library_watcher(path);
+    test_memory_budget(path);
+#endif
+#ifndef _WIN32
+    test_icy_stream(path);
+    test_sparse_parse(path);
+    test_mpegscan(path);
+#endif
+#if defined(MY_MPEG_ASYNC) && !defined(_WIN32)
+    test_async_parse(path);
+#endif
 
-    test_all_mp3();
+    // a library to chew on, if we were given one
+    if (argc > 1) {
+        test_all_mp3(argv[1]);
+    }
     return 0;
 }
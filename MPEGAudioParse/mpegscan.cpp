@@ -0,0 +1,591 @@
+// mpegscan.cpp
+// Parses mp3 files on N threads and writes one line per file, as JSON Lines
+// or CSV, as each one finishes:
+//
+//     mpegscan [-j N] [--csv] [--fingerprint] [--ext .mp3] [--frames out]
+//              [--block KB] [--mem MB] [--cache file] [path ...]
+//     mpegscan --follow file [--csv]
+//
+// A path that is a directory is walked (recursively) for files ending in ext;
+// a file is scanned whatever it is called. With no paths, or "-", the paths
+// come one a line from stdin, so a find(1) or a database dump can be piped
+// in. Memory stays flat however many files there are: paths queue up to a
+// fixed depth, and each line goes out as soon as its file is done, in
+// whatever order the workers finish (every line carries its path).
+//
+// --frames also writes every frame of every file to out, column-wise (see
+// my_frame_columns.hpp), a file's blocks at a time.
+//
+// --block sets how much of a file each read fetches (64 KB to 4 MB): bigger
+// blocks mean fewer reads, which is what counts on network storage.
+//
+// --mem caps what the scan holds (see my_memory_budget.hpp): the queued paths,
+// the directories still to walk, and the files being parsed. When it is
+// spent, the walk (or stdin) waits for the workers to catch up. The default is
+// 256 MB; 0 is no cap.
+//
+// --cache keeps every file's result in file (see my_scan_cache.hpp), under its
+// path, inode, size and mtime: a rescan then parses only what has changed,
+// and costs one stat() for the rest. With --frames every file is parsed (the
+// cache still learns from it).
+//
+// --follow watches one file that is still being written (see my_follow.hpp),
+// and writes its line again each time it has more frames: only the new bytes
+// are read. It stops once the writer has closed the file and a second has
+// gone by without more (where there is no inotify, it goes on until killed).
+//
+// Exit status: 0 if every file parsed, 1 if any did not (a file with no MPEG
+// frames in it is no_frames, as with my_mpeg_parse_paths()), 2 for bad usage.
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#include "./include/my_files_enum.hpp"
+#include "./include/my_dir_walker.hpp"
+#include "./include/my_mpeg.hpp"
+#include "./include/my_frame_columns.hpp"
+#include "./include/my_memory_budget.hpp"
+#include "./include/my_scan_cache.hpp"
+#ifndef _WIN32
+#include "./include/my_follow.hpp"
+#endif
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct options {
+    int workers = 0; // 0: one per core
+    bool csv = false;
+    bool fingerprint = false;
+    std::string extn = ".mp3";
+    std::string frames_path; // --frames
+    int read_block = my::mpeg::detail::DEFAULT_READ_BLOCK; // --block, in bytes
+    int64_t mem_limit = int64_t(256) << 20; // --mem, in bytes
+    std::string follow_path; // --follow
+    std::string cache_path; // --cache
+    std::vector<std::string> paths;
+};
+
+// Paths from the producer to the workers. push() blocks while it is full, or
+// the memory budget is spent: that is what keeps a million-line stdin (or a
+// ten million file tree) from ending up in memory. Each path is charged to the
+// budget until the worker that pops it is done with it.
+class path_queue {
+    std::mutex m_mx;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+    std::deque<std::pair<std::string, int64_t>> m_q; // and what it was charged
+    size_t m_cap;
+    my::memory_budget& m_budget;
+    bool m_closed = false;
+
+    public:
+    path_queue(size_t cap, my::memory_budget& budget) : m_cap(cap), m_budget(budget) {}
+
+    void push(std::string path) {
+        const int64_t cost = my::memory_budget::cost(path);
+        m_budget.acquire(cost); // not holding m_mx: the workers need it to pop
+        std::unique_lock<std::mutex> lk(m_mx);
+        m_not_full.wait(lk, [&] { return m_q.size() < m_cap; });
+        m_q.emplace_back(std::move(path), cost);
+        m_not_empty.notify_one();
+    }
+    // no more pushes: pop() drains what's left, then returns false
+    void close() {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_closed = true;
+        m_not_empty.notify_all();
+    }
+    // charged: what to give back to the budget when done with path
+    bool pop(std::string& path, int64_t& charged) {
+        std::unique_lock<std::mutex> lk(m_mx);
+        m_not_empty.wait(lk, [&] { return !m_q.empty() || m_closed; });
+        if (m_q.empty()) {
+            return false;
+        }
+        path = std::move(m_q.front().first);
+        charged = m_q.front().second;
+        m_q.pop_front();
+        m_not_full.notify_one();
+        return true;
+    }
+    my::memory_budget& budget() noexcept { return m_budget; }
+};
+
+struct result {
+    std::string path;
+    my::mpeg::parse_summary s;
+    std::string error_text;
+    int64_t parse_us = 0;
+};
+
+#ifndef __linux__
+bool ends_with_nocase(const std::string& s, const std::string& extn) {
+    if (s.size() < extn.size()) {
+        return false;
+    }
+    const char* p = s.c_str() + s.size() - extn.size();
+    for (size_t i = 0; i < extn.size(); ++i) {
+        char c = p[i];
+        if (c >= 'A' && c <= 'Z') {
+            c = CAST(char, c - 'A' + 'a');
+        }
+        if (c != extn[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+const char* version_string(int v) {
+    switch (v) {
+        case 1: return "1";
+        case 2: return "2";
+        case 3: return "2.5";
+        default: return "";
+    }
+}
+
+const char* mode_string(int m) {
+    static const char* const modes[] = {"stereo", "joint_stereo", "dual_channel", "mono"};
+    return m >= 0 && m < 4 ? modes[m] : "";
+}
+
+void json_string(std::string& out, const std::string& s) {
+    out += '"';
+    for (const char ch : s) {
+        const auto c = CAST(unsigned char, ch);
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char esc[8];
+                    snprintf(esc, sizeof(esc), "\\u%04x", c);
+                    out += esc;
+                } else {
+                    out += ch;
+                }
+        }
+    }
+    out += '"';
+}
+
+void csv_string(std::string& out, const std::string& s) {
+    out += '"';
+    for (const char ch : s) {
+        if (ch == '"') {
+            out += '"';
+        }
+        out += ch;
+    }
+    out += '"';
+}
+
+// the columns, in order, for both formats
+const char* const CSV_HEADER = "path,size,ok,error,error_text,error_offset,duration_ms,"
+                               "version,layer,samplerate,bitrate_kbps,channel_mode,vbr,"
+                               "frames,samples,first_frame,id3v2_size,id3v1,ape_size,gaps,"
+                               "gap_bytes,audio_hash,parse_us\n";
+
+void format_line(std::string& out, const result& r, bool csv) {
+    const auto& s = r.s;
+    char hash[24] = {0};
+    if (s.audio_hash != 0) {
+        snprintf(hash, sizeof(hash), "%016llx", CAST(unsigned long long, s.audio_hash));
+    }
+    char num[512];
+    out.clear();
+    if (csv) {
+        csv_string(out, r.path);
+        snprintf(num, sizeof(num), ",%lld,%d,%d,", CAST(long long, s.file_size),
+            s.error == 0 ? 1 : 0, s.error);
+        out += num;
+        csv_string(out, r.error_text);
+        snprintf(num, sizeof(num),
+            ",%lld,%.3f,%s,%d,%d,%d,%s,%d,%lld,%lld,%lld,%u,%d,%u,%u,%lld,%s,%lld\n",
+            CAST(long long, s.error_offset), s.duration_ms, version_string(s.version),
+            s.layer, s.samplerate, s.bitrate / 1000,
+            mode_string(s.nframes ? s.channelmode : -1), s.vbr,
+            CAST(long long, s.nframes), CAST(long long, s.total_samples),
+            CAST(long long, s.first_frame), s.id3v2_size, s.id3v1, s.ape_size, s.ngaps,
+            CAST(long long, s.gap_bytes), hash, CAST(long long, r.parse_us));
+        out += num;
+        return;
+    }
+    out += "{\"path\":";
+    json_string(out, r.path);
+    snprintf(num, sizeof(num), ",\"size\":%lld,\"ok\":%s,\"error\":%d,\"error_text\":",
+        CAST(long long, s.file_size), s.error == 0 ? "true" : "false", s.error);
+    out += num;
+    json_string(out, r.error_text);
+    snprintf(num, sizeof(num),
+        ",\"error_offset\":%lld,\"duration_ms\":%.3f,\"version\":\"%s\",\"layer\":%d,"
+        "\"samplerate\":%d,\"bitrate_kbps\":%d,\"channel_mode\":\"%s\",\"vbr\":%s,"
+        "\"frames\":%lld,\"samples\":%lld,\"first_frame\":%lld,\"id3v2_size\":%u,"
+        "\"id3v1\":%s,\"ape_size\":%u,\"gaps\":%u,\"gap_bytes\":%lld,\"audio_hash\":\"%s\","
+        "\"parse_us\":%lld}\n",
+        CAST(long long, s.error_offset), s.duration_ms, version_string(s.version), s.layer,
+        s.samplerate, s.bitrate / 1000, mode_string(s.nframes ? s.channelmode : -1),
+        s.vbr ? "true" : "false", CAST(long long, s.nframes),
+        CAST(long long, s.total_samples), CAST(long long, s.first_frame), s.id3v2_size,
+        s.id3v1 ? "true" : "false", s.ape_size, s.ngaps, CAST(long long, s.gap_bytes), hash,
+        CAST(long long, r.parse_us));
+    out += num;
+}
+
+// Feeds path to the queue: as is if it is a file, else every file under it
+// ending in extn. Returns false if it isn't there.
+bool produce(const std::string& path, const options& opt, path_queue& q) {
+    std::error_code ec;
+    if (!my::fs::is_directory(path, ec)) {
+        q.push(path);
+        return true;
+    }
+#ifdef __linux__
+    // the walk can take longer than the parse (network storage): walk on as
+    // many threads as we parse on
+    my::dir_walker walker(path, opt.extn, opt.workers);
+    walker.budget(&q.budget());
+    walker.start([&](const my::dir_walker::batch_type& batch) {
+        for (const auto& p : batch) {
+            q.push(p);
+        }
+        return 0;
+    });
+    if (walker.errors() != 0) {
+        fprintf(stderr, "mpegscan: %s: %lld directories could not be read\n",
+            path.c_str(), CAST(long long, walker.errors()));
+    }
+#else
+    try {
+        my::files_finder finder(path, true);
+        finder.start([&](const auto&, const std::string& u8path, const std::string&) {
+            if (ends_with_nocase(u8path, opt.extn)) {
+                q.push(u8path);
+            }
+            return 0;
+        });
+    } catch (const my::fs::filesystem_error& e) {
+        fprintf(stderr, "mpegscan: %s\n", e.what());
+        return false;
+    }
+#endif
+    return true;
+}
+
+#ifndef _WIN32
+int follow(const options& opt) {
+    my::mpeg::file_follower f(opt.follow_path, opt.read_block);
+    f.index_frames(false);
+    int e = f.open();
+    result r;
+    r.path = opt.follow_path;
+    std::string line;
+    const auto emit = [&](const my::mpeg::file_follower& ff, size_t) {
+        r.s = ff.summary();
+        format_line(line, r, opt.csv);
+        fwrite(line.data(), 1, line.size(), stdout);
+        fflush(stdout);
+    };
+    using clock = std::chrono::steady_clock;
+    auto grew = clock::now();
+    while (e == 0) {
+        const int64_t had = f.bytes_read();
+        const int64_t n = f.poll(1000, emit);
+        if (n < 0) {
+            e = CAST(int, -n);
+        } else if (f.bytes_read() != had) {
+            grew = clock::now();
+        } else if (f.writer_closed() && clock::now() - grew >= std::chrono::seconds(1)) {
+            break;
+        }
+    }
+    if (e == 0) {
+        const int64_t n = f.finish([](const my::mpeg::file_follower&, size_t) {});
+        e = n < 0 ? CAST(int, -n) : 0;
+    }
+    if (e != 0) {
+        fprintf(stderr, "mpegscan: %s: %s\n", opt.follow_path.c_str(), strerror(e));
+        return 1;
+    }
+    emit(f, 0); // the last word: with the tags at the end, if any
+    return 0;
+}
+#endif
+
+int usage() {
+    fputs("usage: mpegscan [-j N] [--csv] [--fingerprint] [--ext .mp3] [--frames out]\n"
+          "                [--block KB] [--mem MB] [--cache file] [path ...]\n"
+          "       mpegscan --follow file [--csv]\n"
+          "  Scans files (or directories, recursively) and writes a line per file to\n"
+          "  stdout: JSON Lines, or CSV with --csv. With no paths, or -, reads paths\n"
+          "  one per line from stdin. --frames writes per frame columns to out.\n"
+          "  --block is the read size, 64 to 4096 KB. --mem caps what the scan holds\n"
+          "  (default 256 MB, 0 for no cap). --cache keeps results in file, and only\n"
+          "  parses files changed since. --follow writes a file's line again each\n"
+          "  time it grows, until its writer closes it.\n",
+        stderr);
+    return 2;
+}
+
+bool parse_args(int argc, const char* const argv[], options& opt) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        if ((a == "-j" || a == "--jobs") && i + 1 < argc) {
+            opt.workers = atoi(argv[++i]);
+        } else if (a.compare(0, 2, "-j") == 0 && a.size() > 2) {
+            opt.workers = atoi(a.c_str() + 2);
+        } else if (a == "--csv") {
+            opt.csv = true;
+        } else if (a == "--json") {
+            opt.csv = false;
+        } else if (a == "--fingerprint") {
+            opt.fingerprint = true;
+        } else if (a == "--ext" && i + 1 < argc) {
+            opt.extn = argv[++i];
+            for (auto& c : opt.extn) {
+                if (c >= 'A' && c <= 'Z') {
+                    c = CAST(char, c - 'A' + 'a');
+                }
+            }
+        } else if (a == "--frames" && i + 1 < argc) {
+            opt.frames_path = argv[++i];
+        } else if (a == "--block" && i + 1 < argc) {
+            opt.read_block = atoi(argv[++i]) * 1024;
+            if (opt.read_block < my::mpeg::detail::MIN_READ_BLOCK
+                || opt.read_block > my::mpeg::detail::MAX_READ_BLOCK) {
+                fprintf(stderr, "mpegscan: --block wants 64 to 4096 (KB)\n");
+                return false;
+            }
+        } else if (a == "--mem" && i + 1 < argc) {
+            opt.mem_limit = CAST(int64_t, atoll(argv[++i])) << 20;
+            if (opt.mem_limit < 0) {
+                fprintf(stderr, "mpegscan: --mem wants MB, 0 for no cap\n");
+                return false;
+            }
+        } else if (a == "--cache" && i + 1 < argc) {
+            opt.cache_path = argv[++i];
+        } else if (a == "--follow" && i + 1 < argc) {
+            opt.follow_path = argv[++i];
+        } else if (a == "-h" || a == "--help") {
+            return false;
+        } else if (a.size() > 1 && a[0] == '-' && a != "-") {
+            fprintf(stderr, "mpegscan: unknown option %s\n", a.c_str());
+            return false;
+        } else {
+            opt.paths.push_back(a);
+        }
+    }
+    return opt.workers >= 0;
+}
+
+} // namespace
+
+int main(int argc, const char* const argv[]) {
+    options opt;
+    if (!parse_args(argc, argv, opt)) {
+        return usage();
+    }
+    if (opt.workers == 0) {
+        opt.workers = CAST(int, std::thread::hardware_concurrency());
+        if (opt.workers <= 0) {
+            opt.workers = 1;
+        }
+    }
+    if (opt.paths.empty()) {
+        opt.paths.push_back("-");
+    }
+
+    // stdout is ours: the parser's narration would corrupt it
+    my::mpeg::set_loglevel(my::mpeg::loglevel_t::quiet);
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+    if (opt.csv) {
+        fputs(CSV_HEADER, stdout);
+    }
+#ifndef _WIN32
+    if (!opt.follow_path.empty()) {
+        return follow(opt);
+    }
+#endif
+
+    FILE* frames_out = nullptr;
+    if (!opt.frames_path.empty()) {
+        frames_out = ::fopen(opt.frames_path.c_str(), "wb");
+        if (frames_out == nullptr) {
+            fprintf(stderr, "mpegscan: %s: %s\n", opt.frames_path.c_str(), strerror(errno));
+            return 2;
+        }
+        const std::string fh = my::mpeg::frame_columns_writer::file_header();
+        fwrite(fh.data(), 1, fh.size(), frames_out);
+    }
+
+    my::memory_budget budget(opt.mem_limit);
+    path_queue q(CAST(size_t, opt.workers) * 64, budget);
+    // a file being parsed holds its read blocks (block_reader keeps two)
+    const int64_t per_file = 2 * CAST(int64_t, opt.read_block);
+    std::mutex out_mx;
+    std::mutex frames_mx;
+    std::atomic<int64_t> nfiles{0};
+    std::atomic<int64_t> nbad{0};
+    std::atomic<int64_t> nhits{0};
+
+    std::unique_ptr<my::mpeg::scan_cache> cache;
+    std::mutex cache_mx;
+    if (!opt.cache_path.empty()) {
+        cache.reset(new my::mpeg::scan_cache(opt.cache_path));
+        const int ce = cache->open();
+        if (ce != 0) {
+            fprintf(stderr, "mpegscan: %s: %s\n", opt.cache_path.c_str(), strerror(ce));
+            return 2;
+        }
+    }
+    // what the cache has for path, if the file is as it was then
+    auto from_cache = [&](const std::string& path, my::mpeg::file_key& key,
+                          my::mpeg::parse_summary& s) {
+        std::lock_guard<std::mutex> lk(cache_mx);
+        const my::mpeg::parse_summary* hit = cache->find_stated(path, key);
+        // cached without --fingerprint: no audio_hash to give
+        if (hit == nullptr
+            || (opt.fingerprint && hit->audio_hash == 0 && hit->nframes != 0)) {
+            return false;
+        }
+        s = *hit;
+        return true;
+    };
+    const auto t0 = std::chrono::steady_clock::now();
+
+    auto work = [&]() {
+        std::string path;
+        std::string line;
+        result r;
+        my::mpeg::frame_columns_writer columns;
+        int64_t charged = 0;
+        while (q.pop(path, charged)) {
+            budget.charge(per_file);
+            r.path = std::move(path);
+            my::mpeg::file_key key;
+            const bool stated
+                = cache != nullptr && my::mpeg::detail::stat_file(r.path, key) == 0;
+            if (stated && frames_out == nullptr && from_cache(r.path, key, r.s)) {
+                ++nhits;
+                r.parse_us = 0;
+                r.error_text.clear();
+                if (r.s.error != 0) {
+                    my::mpeg::error e(CAST(my::mpeg::error::error_code, r.s.error));
+                    r.error_text = e.to_string();
+                }
+            } else {
+                const auto p0 = std::chrono::steady_clock::now();
+                my::mpeg::error e = frames_out != nullptr
+                    ? my::mpeg::export_frame_columns(
+                        r.path, columns, r.s, opt.fingerprint, opt.read_block)
+                    : my::mpeg::parse_file(
+                        r.path, r.s, opt.fingerprint, nullptr, nullptr, opt.read_block);
+                r.parse_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - p0)
+                                 .count();
+                if (e == my::mpeg::error::error_code::no_more_data) {
+                    e = my::mpeg::error::error_code::noerror;
+                }
+                if (r.s.error == CAST(int, my::mpeg::error::error_code::no_more_data)) {
+                    r.s.error = 0;
+                }
+                if (!e && r.s.error == 0 && r.s.nframes == 0) {
+                    // not an MPEG file at all: not a good one (as my_mpeg_parse_paths)
+                    e = my::mpeg::error::error_code::no_frames;
+                }
+                r.error_text = e ? e.to_string() : std::string();
+                if (e && r.s.error == 0) {
+                    r.s.error = e.to_int();
+                }
+                if (stated) {
+                    std::lock_guard<std::mutex> lk(cache_mx);
+                    cache->put(r.path, key, r.s);
+                }
+            }
+            if (frames_out != nullptr && columns.pending_bytes() != 0) {
+                const std::string blocks = columns.take();
+                budget.charge(CAST(int64_t, blocks.size()));
+                {
+                    std::lock_guard<std::mutex> lk(frames_mx);
+                    fwrite(blocks.data(), 1, blocks.size(), frames_out);
+                }
+                budget.refund(CAST(int64_t, blocks.size()));
+            }
+            format_line(line, r, opt.csv);
+            ++nfiles;
+            if (r.s.error != 0) {
+                ++nbad;
+            }
+            {
+                std::lock_guard<std::mutex> lk(out_mx);
+                fwrite(line.data(), 1, line.size(), stdout);
+            }
+            budget.refund(per_file);
+            budget.release(charged);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opt.workers; ++i) {
+        threads.emplace_back(work);
+    }
+
+    bool missing = false;
+    for (const auto& p : opt.paths) {
+        if (p == "-") {
+            std::string line;
+            while (std::getline(std::cin, line)) {
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (!line.empty()) {
+                    q.push(line);
+                }
+            }
+        } else if (!produce(p, opt, q)) {
+            missing = true;
+        }
+    }
+    q.close();
+    for (auto& t : threads) {
+        t.join();
+    }
+    fflush(stdout);
+    bool frames_failed = false;
+    if (frames_out != nullptr) {
+        frames_failed = ferror(frames_out) != 0;
+        frames_failed = fclose(frames_out) != 0 || frames_failed;
+        if (frames_failed) {
+            fprintf(stderr, "mpegscan: error writing %s\n", opt.frames_path.c_str());
+        }
+    }
+
+    const double secs
+        = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    fprintf(stderr,
+        "mpegscan: %lld files (%lld from the cache), %lld failed, %.2f s, %.0f files/s on "
+        "%d workers, %.1f MB held at most (%lld waits)\n",
+        CAST(long long, nfiles.load()), CAST(long long, nhits.load()),
+        CAST(long long, nbad.load()), secs,
+        secs > 0 ? double(nfiles.load()) / secs : 0.0, opt.workers,
+        double(budget.peak()) / (1 << 20), CAST(long long, budget.waits()));
+    return (nbad.load() != 0 || missing || frames_failed) ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+TEMPLATE = app
+TARGET = mpegscan
+CONFIG += console c++17
+CONFIG -= app_bundle
+CONFIG -= qt
+
+QMAKE_CXXFLAGS += -std=c++17
+DEFINES += MY_MPEG_NO_ABORT
+SOURCES += \
+    mpegscan.cpp
+
+HEADERS += \
+    include/my_files_enum.hpp \
+    include/my_dir_walker.hpp \
+    include/my_memory_budget.hpp \
+    include/my_icy.hpp \
+    include/my_follow.hpp \
+    include/my_mpeg.hpp \
+    include/my_frame_columns.hpp \
+    include/my_scan_cache.hpp
+
+LIBS += -lstdc++fs -lpthread
@@ -0,0 +1,329 @@
+// my_mpeg_c.cpp
+// The C ABI in include/my_mpeg_c.h. Build it with MY_MPEG_NO_ABORT defined
+// (MPEGAudioParseLib.pro does): a library must not take its host down over a
+// bad file.
+#include "include/my_mpeg_c.h"
+#include "include/my_mpeg.hpp"
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+using my::mpeg::error;
+
+struct my_mpeg_file {
+    enum class source { path, fd, memory };
+    source from = source::path;
+    std::string uri;
+    FILE* fp = nullptr; // owned, when from a path
+    int fd = -1;
+    const char* data = nullptr;
+    int64_t size = -1;
+    my::mpeg::parse_summary summary;
+    std::vector<my::mpeg::frame_entry> index;
+
+    ~my_mpeg_file() {
+        if (fp != nullptr) {
+            fclose(fp);
+        }
+    }
+};
+
+namespace {
+
+// Hitting the end of the data is how every parse finishes: not an error to
+// anyone on the far side of the ABI.
+int c_error(int e) noexcept {
+    return e == CAST(int, error::error_code::no_more_data) ? 0 : e;
+}
+
+int errno_or(int fallback) noexcept { return errno > 0 ? -errno : fallback; }
+
+void set_flags(my::mpeg::parser& p, unsigned flags) noexcept {
+    p.fingerprint((flags & MY_MPEG_FINGERPRINT) != 0);
+    p.index_frames((flags & MY_MPEG_INDEX_FRAMES) != 0);
+}
+
+int parse_done(my_mpeg_file* f, const my::mpeg::parser& p, my::mpeg::error e) {
+    f->summary = p.summary();
+    f->summary.error = c_error(f->summary.error);
+    f->index = p.frame_index();
+    return c_error(e.to_int());
+}
+
+template <typename READER>
+int parse_with(my_mpeg_file* f, READER& reader, unsigned flags) {
+    my::mpeg::buffer buf(f->uri, std::move(reader));
+    my::mpeg::parser p(f->uri, CAST(uintmax_t, f->size));
+    set_flags(p, flags);
+    return parse_done(f, p, p.parse(buf));
+}
+
+void to_c(const my::mpeg::parse_summary& s, my_mpeg_summary& out) noexcept {
+    out = my_mpeg_summary();
+    out.file_size = s.file_size;
+    out.first_frame = s.first_frame;
+    out.nframes = s.nframes;
+    out.total_samples = s.total_samples;
+    out.duration_ms = s.duration_ms;
+    out.gap_bytes = s.gap_bytes;
+    out.error_offset = s.error_offset;
+    out.audio_hash = s.audio_hash;
+    out.error = s.error;
+    out.samplerate = s.samplerate;
+    out.bitrate = s.bitrate;
+    out.ngaps = s.ngaps;
+    out.id3v2_size = s.id3v2_size;
+    out.ape_size = s.ape_size;
+    out.version = s.version;
+    out.layer = s.layer;
+    out.channelmode = s.channelmode;
+    out.emphasis = s.emphasis;
+    out.vbr = s.vbr;
+    out.id3v1 = s.id3v1;
+}
+
+int open_file(const char* path, std::unique_ptr<my_mpeg_file>& f) {
+    f.reset(new my_mpeg_file);
+    f->from = my_mpeg_file::source::path;
+    f->uri = path;
+    f->fp = ::fopen(path, "rb");
+    if (f->fp == nullptr) {
+        return errno_or(-ENOENT);
+    }
+    setvbuf(f->fp, nullptr, _IONBF, 0); // the parse reads in big blocks
+#ifdef _WIN32
+    if (_fseeki64(f->fp, 0, SEEK_END) == 0) {
+        f->size = _ftelli64(f->fp);
+    }
+#else
+    if (fseeko(f->fp, 0, SEEK_END) == 0) {
+        f->size = CAST(int64_t, ftello(f->fp));
+    }
+#endif
+    return 0;
+}
+
+#ifdef MY_MPEG_C_BUILD
+// a library has no business writing on its host's stdout
+const bool g_quiet = (my::mpeg::set_loglevel(my::mpeg::loglevel_t::quiet), true);
+#endif
+
+} // namespace
+
+extern "C" {
+
+int my_mpeg_abi_version(void) { return MY_MPEG_ABI_VERSION; }
+
+const char* my_mpeg_strerror(int err) {
+    // error::to_string() makes a std::string: keep it somewhere that lasts
+    thread_local std::string s;
+    try {
+        error e(CAST(error::error_code, err));
+        s = e.to_string();
+    } catch (...) {
+        return "out of memory";
+    }
+    return s.c_str();
+}
+
+void my_mpeg_set_verbose(int on) {
+    my::mpeg::set_loglevel(on ? my::mpeg::loglevel_t::all : my::mpeg::loglevel_t::quiet);
+}
+
+int my_mpeg_open_path(const char* path, my_mpeg_file** out) {
+    if (path == nullptr || out == nullptr) {
+        return -EINVAL;
+    }
+    *out = nullptr;
+    try {
+        std::unique_ptr<my_mpeg_file> f;
+        const int e = open_file(path, f);
+        if (e != 0) {
+            return e;
+        }
+        *out = f.release();
+        return 0;
+    } catch (const std::bad_alloc&) {
+        return -ENOMEM;
+    }
+}
+
+int my_mpeg_open_fd(int fd, my_mpeg_file** out) {
+    if (fd < 0 || out == nullptr) {
+        return -EINVAL;
+    }
+    *out = nullptr;
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        return errno_or(-EBADF);
+    }
+    try {
+        std::unique_ptr<my_mpeg_file> f(new my_mpeg_file);
+        f->from = my_mpeg_file::source::fd;
+        f->uri = "fd:" + std::to_string(fd);
+        f->fd = fd;
+        f->size = CAST(int64_t, st.st_size);
+        *out = f.release();
+        return 0;
+    } catch (const std::bad_alloc&) {
+        return -ENOMEM;
+    }
+}
+
+int my_mpeg_open_memory(const void* data, size_t size, my_mpeg_file** out) {
+    if ((data == nullptr && size != 0) || out == nullptr) {
+        return -EINVAL;
+    }
+    *out = nullptr;
+    try {
+        std::unique_ptr<my_mpeg_file> f(new my_mpeg_file);
+        f->from = my_mpeg_file::source::memory;
+        f->uri = "memory";
+        f->data = static_cast<const char*>(data);
+        f->size = CAST(int64_t, size);
+        *out = f.release();
+        return 0;
+    } catch (const std::bad_alloc&) {
+        return -ENOMEM;
+    }
+}
+
+void my_mpeg_close(my_mpeg_file* f) { delete f; }
+
+int my_mpeg_parse(my_mpeg_file* f, unsigned flags) {
+    if (f == nullptr) {
+        return -EINVAL;
+    }
+    try {
+        f->summary = my::mpeg::parse_summary();
+        f->index.clear();
+        switch (f->from) {
+            case my_mpeg_file::source::path: {
+                FILE* fp = f->fp;
+                auto stdio = [fp](char* const p, int& how_much,
+                                 const my::mpeg::seek_type& sk) {
+                    return my::mpeg::detail::read_stdio(fp, p, how_much, sk);
+                };
+                my::mpeg::detail::block_reader<decltype(stdio)> reader(stdio, f->size);
+                return parse_with(f, reader, flags);
+            }
+            case my_mpeg_file::source::fd: {
+                my::mpeg::detail::block_reader<my::mpeg::detail::fd_reader> reader(
+                    my::mpeg::detail::fd_reader{f->fd, f->size, 0}, f->size);
+                return parse_with(f, reader, flags);
+            }
+            case my_mpeg_file::source::memory: {
+                // straight off the caller's bytes: no reader, no copies
+                my::mpeg::parser p(f->uri, CAST(uintmax_t, f->size));
+                set_flags(p, flags);
+                return parse_done(
+                    f, p, p.parse(my::mpeg::byte_span(f->data, CAST(size_t, f->size))));
+            }
+        }
+        return -EINVAL;
+    } catch (const std::bad_alloc&) {
+        f->summary.error = -ENOMEM;
+        return -ENOMEM;
+    } catch (...) {
+        const int e = CAST(int, error::error_code::unknown);
+        f->summary.error = e;
+        return e;
+    }
+}
+
+int my_mpeg_get_summary(const my_mpeg_file* f, my_mpeg_summary* out) {
+    if (f == nullptr || out == nullptr) {
+        return -EINVAL;
+    }
+    to_c(f->summary, *out);
+    return 0;
+}
+
+int64_t my_mpeg_frame_count(const my_mpeg_file* f) {
+    return f == nullptr ? 0 : CAST(int64_t, f->index.size());
+}
+
+int64_t my_mpeg_frames(
+    const my_mpeg_file* f, int64_t first, my_mpeg_frame* out, int64_t max) {
+    if (f == nullptr || out == nullptr || first < 0 || max <= 0) {
+        return 0;
+    }
+    const int64_t have = CAST(int64_t, f->index.size());
+    int64_t n = 0;
+    for (int64_t i = first; i < have && n < max; ++i, ++n) {
+        const auto& fe = f->index[CAST(size_t, i)];
+        my_mpeg_frame& o = out[n];
+        o = my_mpeg_frame();
+        o.offset = fe.offset;
+        o.length = fe.length;
+        o.bitrate = fe.bitrate;
+        o.samplerate = fe.samplerate;
+        o.samples = fe.samples;
+        o.version = fe.version;
+        o.layer = fe.layer;
+        o.channelmode = fe.channelmode;
+        o.padding = fe.padding;
+    }
+    return n;
+}
+
+int64_t my_mpeg_parse_paths(const char* const* paths, size_t n, my_mpeg_summary* out,
+    unsigned flags, int nthreads) {
+    if (n == 0 || paths == nullptr || out == nullptr) {
+        return 0;
+    }
+    // one summary out per file: the index has nowhere to go
+    flags &= ~MY_MPEG_INDEX_FRAMES;
+    if (nthreads <= 0) {
+        nthreads = CAST(int, std::thread::hardware_concurrency());
+    }
+    nthreads = CAST(int, (std::min)(CAST(size_t, (std::max)(nthreads, 1)), n));
+
+    std::atomic<size_t> next{0};
+    std::atomic<int64_t> good{0};
+    auto work = [&]() {
+        for (size_t i = next++; i < n; i = next++) {
+            my_mpeg_summary& s = out[i];
+            my_mpeg_file* f = nullptr;
+            int e = my_mpeg_open_path(paths[i], &f);
+            if (e == 0) {
+                e = my_mpeg_parse(f, flags);
+                my_mpeg_get_summary(f, &s);
+                my_mpeg_close(f);
+                if (e == 0 && s.nframes == 0) {
+                    // not an MPEG file at all: not a good one
+                    e = s.error = CAST(int, my::mpeg::error::error_code::no_frames);
+                }
+            } else {
+                s = my_mpeg_summary();
+                s.file_size = -1;
+                s.first_frame = -1;
+                s.error_offset = -1;
+                s.error = e;
+            }
+            if (e == 0) {
+                ++good;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    try {
+        for (int t = 1; t < nthreads; ++t) {
+            threads.emplace_back(work);
+        }
+    } catch (...) {
+        // fewer threads than asked for is still a parse
+    }
+    work();
+    for (auto& t : threads) {
+        t.join();
+    }
+    return good;
+}
+
+} // extern "C"